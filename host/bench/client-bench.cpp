@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "mount-client.hpp"
+
+/**
+ * @brief End to end protocol benchmark, through the C++ client. By default it starts `mount-sim --tcp` (next to this
+ * executable) and measures against the simulated mount, which runs the comm task every COMM_TASK_PERIOD in real time
+ * like the firmware. `--connect` measures an already running device instead.
+ *
+ * Results are printed to stdout as JSON:
+ *  - `syncCmdsPerSecond` - `+gp` round trips, one command at a time
+ *  - `pipelinedCmdsPerSecond` - `+gp` with the default pipelining window
+ *  - `uploadPointsPerSecond` - track points uploaded by MountClient::uploadTrack into the cleared track buffer
+ *  - `streamPointsPerSecond` - the same by MountClient::streamTrack, in the credit based streaming mode
+ */
+
+#define BENCH_DEFAULT_PORT 15025
+#define BENCH_SYNC_CMDS 200
+#define BENCH_PIPELINED_CMDS 5000
+#define BENCH_CONNECT_TIMEOUT 3000 // ms
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+pid_t startSim(const char *benchPath, int port) {
+    std::string simPath = benchPath;
+    size_t slash = simPath.rfind('/');
+    simPath = (slash == std::string::npos ? std::string(".") : simPath.substr(0, slash)) + "/mount-sim";
+    std::string portStr = std::to_string(port);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDOUT_FILENO);
+        dup2(devNull, STDERR_FILENO);
+        execl(simPath.c_str(), simPath.c_str(), "--tcp", portStr.c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    return pid;
+}
+
+std::unique_ptr<mount::Connection> connectRetrying(const std::string &host, int port) {
+    Clock::time_point start = Clock::now();
+    for (;;) {
+        try {
+            return mount::Connection::openTcp(host, port);
+        }
+        catch (const std::runtime_error &) {
+            if (secondsSince(start) * 1000 > BENCH_CONNECT_TIMEOUT)
+                throw;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    }
+}
+
+double measureCmds(mount::MountClient &client, int count) {
+    Clock::time_point start = Clock::now();
+    std::vector<std::future<mount::Response>> responses;
+    responses.reserve(count);
+    for (int i = 0; i < count; i++)
+        responses.push_back(client.request("gp"));
+    for (auto &response : responses) {
+        if (!response.get().ok())
+            throw std::runtime_error("Position request failed");
+    }
+    return count / secondsSince(start);
+}
+
+double measureUpload(mount::MountClient &client, size_t &pointCount, bool stream) {
+    if (!client.call("tbc").ok())
+        throw std::runtime_error("Couldn't clear the track buffer");
+    pointCount = client.getTrackBufferFreeSpace().get();
+    std::vector<mount::TrackPoint> points(pointCount);
+    for (size_t i = 0; i < pointCount; i++)
+        points[i] = { (int64_t)i * 100, -(int64_t)i * 100, 2000000000000ULL + i * 100 };
+
+    Clock::time_point start = Clock::now();
+    if (stream) {
+        client.startStream();
+        pointCount = client.streamTrack(points, false);
+    }
+    else {
+        pointCount = client.uploadTrack(points);
+    }
+    double rate = pointCount / secondsSince(start);
+    if (stream)
+        client.stopStream();
+    if (pointCount != points.size())
+        throw std::runtime_error("Only " + std::to_string(pointCount) + " of " + std::to_string(points.size())
+            + " track points uploaded");
+    client.call("tbc");
+    return rate;
+}
+
+void printUsage(const char *name) {
+    fprintf(stderr, "Usage: %s [--connect <host:port | serial port>] [--port <port>] [--address <n>]\n", name);
+    fprintf(stderr, "  --connect <target>  Benchmark a running device instead of starting mount-sim\n");
+    fprintf(stderr, "  --port <port>       TCP port for the started mount-sim (default %i)\n", BENCH_DEFAULT_PORT);
+    fprintf(stderr, "  --address <n>       Bus address of the device\n");
+}
+
+int main(int argc, char **argv) {
+    const char *target = nullptr;
+    int port = BENCH_DEFAULT_PORT;
+    int address = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+            target = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--address") == 0 && i + 1 < argc)
+            address = atoi(argv[++i]);
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    pid_t sim = -1;
+    int result = 0;
+    try {
+        std::unique_ptr<mount::Connection> connection;
+        if (target != nullptr) {
+            connection = mount::Connection::open(target);
+        }
+        else {
+            sim = startSim(argv[0], port);
+            connection = connectRetrying("127.0.0.1", port);
+        }
+        mount::MountClient client(std::move(connection), address);
+        client.setTimeout(std::chrono::seconds(5));
+
+        client.setWindow(mount::DEVICE_RX_BUFFER, 1);
+        double syncRate = measureCmds(client, BENCH_SYNC_CMDS);
+        client.setWindow(mount::DEVICE_RX_BUFFER / 2, 64);
+        double pipelinedRate = measureCmds(client, BENCH_PIPELINED_CMDS);
+        size_t points;
+        double uploadRate = measureUpload(client, points, false);
+        double streamRate = measureUpload(client, points, true);
+
+        printf("{\"target\":\"%s\",\"syncCmdsPerSecond\":%.0f,\"pipelinedCmdsPerSecond\":%.0f,"
+            "\"uploadPoints\":%zu,\"uploadPointsPerSecond\":%.0f,\"streamPointsPerSecond\":%.0f}\n",
+            target != nullptr ? target : "mount-sim", syncRate, pipelinedRate, points, uploadRate, streamRate);
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        result = 1;
+    }
+
+    if (sim > 0) {
+        kill(sim, SIGTERM);
+        waitpid(sim, nullptr, 0);
+    }
+    return result;
+}
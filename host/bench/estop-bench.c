@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include "sim.h"
+#include "settings.h"
+#include "motors/motor-task.h"
+#include "motors/motor-driver.h"
+#include "log/dlog.h"
+
+/**
+ * @brief Emergency stop benchmark. Runs both motors at full speed through the motor task on the simulation HAL,
+ * triggers the emergency stop or limit switch input and measures how fast the step output freezes. The input is
+ * triggered between the motor loop passes at varied phases, and in the middle of a step pulse (from the GPIO listener,
+ * on the rising edge of a step pin), which is the worst case.
+ *
+ * Latency is the time from the input edge to the later of the last step edge and the motor loop pass that stops
+ * the motors. The virtual clock doesn't move inside a pass, so the loop period `--step` stands for the duration of
+ * one pass - use the pass time measured on the hardware (MEASURE_CYCLE_T) to check the target.
+ *
+ * Results are printed to stdout as JSON, one object per trial, with the summary at the end. Exits with 1 if any trial
+ * exceeds MOTOR_FAULT_MAX_LATENCY, makes more than one step per axis after the input edge, doesn't stop the motors
+ * or can't clear the fault.
+ */
+
+#define TAG "estop-bench"
+#define BENCH_DEFAULT_STEP 10 // us
+#define BENCH_DEFAULT_TRIALS 12
+#define BENCH_START_TIME 1000000000ULL // Mount time at the start of the simulation (ms)
+#define BENCH_SPIN_UP 3000000 // Time to reach the full speed before each trial (us)
+#define BENCH_SETTLE 100000 // Time the output must stay frozen after the fault (us)
+#define BENCH_CLEAR_TIMEOUT 1000000 // us
+
+typedef enum TriggerMode {
+    TRIGGER_BETWEEN,
+    TRIGGER_PULSE_AX1,
+    TRIGGER_PULSE_AX2
+} TriggerMode;
+
+const char *TRIGGER_NAMES[] = { "between", "pulse-ax1", "pulse-ax2" };
+
+typedef struct Trial {
+    TriggerMode mode;
+    int pin;
+    /**
+     * @brief Step pin whose rising edge triggers the input, -1 if triggered between the passes
+     */
+    int triggerPin;
+    bool triggered;
+    int64_t faultTime;
+    int64_t lastEdgeTime;
+    uint32_t extraSteps[2];
+} Trial;
+
+void onGpioEdge(const sim_gpio_edge_t *edge, void *ctx) {
+    Trial *trial = ctx;
+    if (edge->level != 1)
+        return;
+
+    for (uint8_t axis = 1; axis <= 2; axis++) {
+        if (edge->pin != motor_getAxis(axis)->cfg.stepPin)
+            continue;
+        if (trial->triggered) {
+            trial->extraSteps[axis - 1]++;
+            trial->lastEdgeTime = edge->time;
+        }
+        else if (edge->pin == trial->triggerPin) {
+            // The step pulse is being issued right now, the interrupt comes in the middle of it
+            trial->triggered = true;
+            trial->faultTime = edge->time;
+            trial->lastEdgeTime = edge->time;
+            sim_setGpioInput(trial->pin, BOARD_FAULT_ACTIVE_LEVEL);
+        }
+    }
+}
+
+void runFor(int64_t duration, int64_t step) {
+    int64_t end = hal_getTime() + duration;
+    while (hal_getTime() < end) {
+        motor_taskRun();
+        sim_advance(step);
+    }
+}
+
+void sendCmd(MotorQueues *queues, MotorCmd cmd) {
+    hal_queueSend(queues->cmdQueue, &cmd);
+}
+
+/**
+ * @brief Starts gotos of both axes to the far side, so the motors run at full speed during the trial
+ */
+void spinUp(MotorQueues *queues, int64_t step) {
+    motor_t m1 = motor_getAxis(1);
+    motor_t m2 = motor_getAxis(2);
+    MotorCmd cmd = { .type = CMD_GOTO, .data.pos = {
+        .ax1 = m1->pos + (m1->v >= 0 ? CPR_AX1 : -CPR_AX1),
+        .ax2 = m2->pos + (m2->v >= 0 ? CPR_AX2 : -CPR_AX2)
+    } };
+    sendCmd(queues, cmd);
+    runFor(BENCH_SPIN_UP, step);
+}
+
+/**
+ * @brief Runs one trial
+ *
+ * @return int64_t Latency (us), -1 if the motors weren't stopped
+ */
+int64_t runTrial(MotorQueues *queues, Trial *trial, int64_t step, int64_t phase) {
+    sim_setGpioListener(onGpioEdge, trial);
+    if (trial->mode == TRIGGER_BETWEEN) {
+        motor_taskRun();
+        sim_advance(phase);
+        trial->triggered = true;
+        trial->faultTime = hal_getTime();
+        trial->lastEdgeTime = trial->faultTime;
+        sim_setGpioInput(trial->pin, BOARD_FAULT_ACTIVE_LEVEL);
+        sim_advance(step - phase);
+    }
+    else {
+        int64_t timeout = hal_getTime() + BENCH_SPIN_UP;
+        while (!trial->triggered && hal_getTime() < timeout) {
+            motor_taskRun();
+            sim_advance(step);
+        }
+    }
+
+    // The pass that handles the fault
+    int64_t stopTime = -1;
+    int64_t end = hal_getTime() + BENCH_SETTLE;
+    while (hal_getTime() < end) {
+        motor_taskRun();
+        if (stopTime < 0 && mount_getStatus() == MOUNT_STATUS_FAULT && motor_getAxis(1)->v == 0
+            && motor_getAxis(2)->v == 0)
+            stopTime = hal_getTime();
+        sim_advance(step);
+    }
+    sim_setGpioListener(NULL, NULL);
+    if (!trial->triggered || stopTime < 0)
+        return -1;
+    return (stopTime > trial->lastEdgeTime ? stopTime : trial->lastEdgeTime) - trial->faultTime;
+}
+
+/**
+ * @brief Releases the input and clears the fault
+ *
+ * @return true The fault was cleared
+ */
+bool clearTrial(MotorQueues *queues, Trial *trial, int64_t step) {
+    sim_setGpioInput(trial->pin, !BOARD_FAULT_ACTIVE_LEVEL);
+    MotorCmd cmd = { .type = CMD_FAULT_CLEAR };
+    sendCmd(queues, cmd);
+    int64_t end = hal_getTime() + BENCH_CLEAR_TIMEOUT;
+    while (hal_getTime() < end && motor_getFault() != 0) {
+        motor_taskRun();
+        sim_advance(step);
+    }
+    runFor(2 * MOTOR_TSK_UPADTE_P, step);
+    dlog_drain();
+    return motor_getFault() == 0 && mount_getStatus() != MOUNT_STATUS_FAULT;
+}
+
+void printUsage(const char *name) {
+    fprintf(stderr, "Usage: %s [--step <us>] [--trials <n>]\n", name);
+    fprintf(stderr, "  --step <us>    Virtual time per motor loop iteration (default %i)\n", BENCH_DEFAULT_STEP);
+    fprintf(stderr, "  --trials <n>   Number of trials (default %i)\n", BENCH_DEFAULT_TRIALS);
+}
+
+int main(int argc, char **argv) {
+    int64_t step = BENCH_DEFAULT_STEP;
+    int trials = BENCH_DEFAULT_TRIALS;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+            step = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--trials") == 0 && i + 1 < argc)
+            trials = atoi(argv[++i]);
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (step <= 0 || trials <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (BOARD_ESTOP_PIN < 0 && BOARD_LIMIT_PIN < 0) {
+        ESP_LOGE(TAG, "The board has no fault inputs");
+        return 1;
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+    dlog_setLevel(ESP_LOG_ERROR); // Each trial logs the fault
+
+    MotorQueues queues = {
+        .cmdQueue = hal_queueCreate(10, sizeof(MotorCmd)),
+        .jogQueue = hal_queueCreate(1, sizeof(JogCmd))
+    };
+    sim_setTime(0);
+    dlog_init();
+    mount_initSettings();
+    mount_setTime(BENCH_START_TIME);
+    motor_taskInit(&queues);
+
+    int64_t maxLatency = 0;
+    uint32_t maxExtraSteps = 0;
+    bool failed = false;
+    printf("[");
+    for (int i = 0; i < trials; i++) {
+        Trial trial;
+        memset(&trial, 0, sizeof(trial));
+        trial.mode = i % 3;
+        trial.pin = (i / 3) % 2 == 1 && BOARD_LIMIT_PIN >= 0 ? BOARD_LIMIT_PIN : BOARD_ESTOP_PIN;
+        if (trial.pin < 0)
+            trial.pin = BOARD_LIMIT_PIN;
+        trial.triggerPin = trial.mode == TRIGGER_PULSE_AX1 ? motor_getAxis(1)->cfg.stepPin
+            : trial.mode == TRIGGER_PULSE_AX2 ? motor_getAxis(2)->cfg.stepPin : -1;
+        // Spreads the trigger over the whole pass period
+        int64_t phase = (i * 7 + 1) % step;
+
+        spinUp(&queues, step);
+        float v1 = motor_getAxis(1)->v, v2 = motor_getAxis(2)->v;
+        int64_t latency = runTrial(&queues, &trial, step, phase);
+        dlog_drain();
+        bool cleared = clearTrial(&queues, &trial, step);
+        bool ok = latency >= 0 && latency <= MOTOR_FAULT_MAX_LATENCY && trial.extraSteps[0] <= 1
+            && trial.extraSteps[1] <= 1 && cleared;
+
+        printf("%s\n{\"trial\":%i,\"trigger\":\"%s\",\"input\":\"%s\",\"v1\":%.0f,\"v2\":%.0f,\"latencyUs\":%lli,"
+            "\"extraSteps\":[%u,%u],\"cleared\":%s,\"ok\":%s}",
+            i == 0 ? "" : ",", i, TRIGGER_NAMES[trial.mode], trial.pin == BOARD_ESTOP_PIN ? "estop" : "limit", v1, v2,
+            (long long)latency, trial.extraSteps[0], trial.extraSteps[1], cleared ? "true" : "false", ok ? "true" : "false");
+        if (latency > maxLatency)
+            maxLatency = latency;
+        for (int axis = 0; axis < 2; axis++) {
+            if (trial.extraSteps[axis] > maxExtraSteps)
+                maxExtraSteps = trial.extraSteps[axis];
+        }
+        failed |= !ok;
+    }
+    printf(",\n{\"summary\":true,\"stepUs\":%lli,\"maxLatencyUs\":%lli,\"specUs\":%i,\"maxExtraSteps\":%u,\"ok\":%s}\n]\n",
+        (long long)step, (long long)maxLatency, MOTOR_FAULT_MAX_LATENCY, maxExtraSteps, failed ? "false" : "true");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <esp_log.h>
+#include "comm/uart-ctrl.h"
+#include "comm/transport.h"
+#include "log/dlog.h"
+
+/**
+ * @brief Control protocol parser benchmark. Feeds batches of one command through the loopback transport to
+ * comm_getNext and measures the CPU time of parsing, for each command type. The parser is the only consumer of the
+ * comm task's time between the replies, so this is the number to beat when optimizing it.
+ *
+ * Results are printed to stdout as JSON, one object per command. Exits with 1 if a command doesn't parse to the
+ * expected message.
+ */
+
+#define TAG "parser-bench"
+#define BENCH_DEFAULT_COUNT 200000
+#define BENCH_ADDRESS 3
+
+typedef struct BenchCmd {
+    const char *name;
+    const char *line;
+    cmd_t cmd;
+    /**
+     * @brief Address of the device, COMM_ADDRESS_NONE for point-to-point
+     */
+    uint8_t address;
+} BenchCmd;
+
+const BenchCmd BENCH_CMDS[] = {
+    { "gp", "+gp\n", MOUNT_MSG_CMD_GET_POS, COMM_ADDRESS_NONE },
+    { "gs", "+gs\n", MOUNT_MSG_CMD_GET_STATUS, COMM_ADDRESS_NONE },
+    { "gtbf", "+gtbf\n", MOUNT_MSG_CMD_GET_TRACK_BUF_FREE_SPACE, COMM_ADDRESS_NONE },
+    { "t", "+t 1700000000000\n", MOUNT_MSG_CMD_TIME_SYNC, COMM_ADDRESS_NONE },
+    { "p", "+p -9223372036854775808 9223372036854775807\n", MOUNT_MSG_CMD_SET_POS, COMM_ADDRESS_NONE },
+    { "g", "+g 123456789 -987654321\n", MOUNT_MSG_CMD_GOTO, COMM_ADDRESS_NONE },
+    { "s", "+s 1\n", MOUNT_MSG_CMD_STOP, COMM_ADDRESS_NONE },
+    { "tp", "+tp 123456789 -987654321 1700000000000\n", MOUNT_MSG_CMD_TRACK_ADD_POINT, COMM_ADDRESS_NONE },
+    { "j", "+j 1.25 -0.5\n", MOUNT_MSG_CMD_JOG, COMM_ADDRESS_NONE },
+    { "tr", "+tr 0.001 -0.002\n", MOUNT_MSG_CMD_TRACK_RATE_OFFSET, COMM_ADDRESS_NONE },
+    { "gtr", "+gtr 0 16\n", MOUNT_MSG_CMD_GET_TRACE, COMM_ADDRESS_NONE },
+    { "tlb", "+tlb pass-1\n", MOUNT_MSG_CMD_TRAJLIB_BEGIN, COMM_ADDRESS_NONE },
+    { "scfg", "+scfg 1 maxV 2.5\n", MOUNT_MSG_CMD_SET_CONFIG, COMM_ADDRESS_NONE },
+    { "unknown", "+zz 1 2\n", MOUNT_MSG_CMD_ERR_UNKNOWN_CMD, COMM_ADDRESS_NONE },
+    { "addressed-tp", "@3 +tp 123456789 -987654321 1700000000000\n", MOUNT_MSG_CMD_TRACK_ADD_POINT, BENCH_ADDRESS },
+    { "broadcast-t", "@* +t 1700000000000\n", MOUNT_MSG_CMD_TIME_SYNC, BENCH_ADDRESS }
+};
+
+comm_transport_t loopbackTransport;
+comm_loopback_t loopback;
+
+bool runCmd(const BenchCmd *benchCmd, uint32_t count) {
+    size_t lineLen = strlen(benchCmd->line);
+    uint32_t batch = COMM_TRANSPORT_BUFFER_SIZE / lineLen;
+    uint32_t parsed = 0;
+    comm_setAddress(benchCmd->address);
+    loopbackTransport.flushInput(&loopbackTransport);
+
+    struct timespec cpuStart, cpuEnd;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+    while (parsed < count) {
+        for (uint32_t i = 0; i < batch; i++)
+            transport_loopbackSend(&loopback, benchCmd->line, lineLen);
+        for (uint32_t i = 0; i < batch; i++) {
+            MountMsg msg = comm_getNext();
+            if (msg.cmd != benchCmd->cmd) {
+                ESP_LOGE(TAG, "%s parsed to %i instead of %i", benchCmd->name, msg.cmd, benchCmd->cmd);
+                return false;
+            }
+        }
+        parsed += batch;
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+
+    double cpuNs = (cpuEnd.tv_sec - cpuStart.tv_sec) * 1e9 + (cpuEnd.tv_nsec - cpuStart.tv_nsec);
+    printf("{\"cmd\":\"%s\",\"bytes\":%zu,\"count\":%u,\"cmdsPerSecond\":%.0f,\"nsPerCmd\":%.1f,\"nsPerByte\":%.2f}",
+        benchCmd->name, lineLen, parsed, parsed / (cpuNs / 1e9), cpuNs / parsed, cpuNs / parsed / lineLen);
+    fflush(stdout);
+    return true;
+}
+
+void printUsage(const char *name) {
+    fprintf(stderr, "Usage: %s [--cmd <name>] [--count <n>]\n", name);
+    fprintf(stderr, "  --cmd <name>   Run only this command (gp, tp, addressed-tp...)\n");
+    fprintf(stderr, "  --count <n>    Commands parsed per type (default %i)\n", BENCH_DEFAULT_COUNT);
+}
+
+int main(int argc, char **argv) {
+    const char *selected = NULL;
+    uint32_t count = BENCH_DEFAULT_COUNT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cmd") == 0 && i + 1 < argc)
+            selected = argv[++i];
+        else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc)
+            count = atoi(argv[++i]);
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (count == 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+    dlog_init();
+    // The unknown command is logged on each parse, the log must not take part in the measurement
+    dlog_setLevel(ESP_LOG_ERROR);
+    transport_initLoopback(&loopbackTransport, &loopback);
+    comm_initTransport(&loopbackTransport);
+
+    bool ok = true;
+    bool first = true;
+    printf("[\n");
+    for (size_t i = 0; i < sizeof(BENCH_CMDS) / sizeof(BENCH_CMDS[0]); i++) {
+        if (selected != NULL && strcmp(selected, BENCH_CMDS[i].name) != 0)
+            continue;
+        if (!first)
+            printf(",\n");
+        first = false;
+        ok &= runCmd(&BENCH_CMDS[i], count);
+    }
+    printf("\n]\n");
+    return ok ? 0 : 1;
+}
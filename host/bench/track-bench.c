@@ -0,0 +1,488 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <esp_log.h>
+#include "sim.h"
+#include "settings.h"
+#include "motors/motor-task.h"
+#include "motors/motor-driver.h"
+#include "log/dlog.h"
+#include "comm/comm-task.h"
+
+/**
+ * @brief Tracking benchmark. Replays satellite passes (synthetic, or recorded in a CSV file) through the motor task
+ * on the simulation HAL and measures how well the motors follow them. The virtual clock makes the results deterministic,
+ * except for the CPU time.
+ * 
+ * Results are printed to stdout as JSON, one object per scenario:
+ *  - `rmsError`, `maxError` - difference between the motor position and the reference trajectory, sampled each millisecond (steps)
+ *  - `stepJitterRms`, `stepJitterMax` - difference between the actual step interval and the interval given by the motor velocity (us)
+ *  - `peakAccel` - maximum acceleration of the motor, from velocity sampled each 10 ms (steps/s^2)
+ *  - `cpuUsPerSimSecond` - CPU time spent per simulated second
+ *  - `maxUpdateUs` - longest motor loop pass with the update (wall time, us), the step output waits for it. With 
+ *    `--intercept` it includes the intercept search.
+ *  - `windowMisses` - track points pulled while the prefetch window was empty
+ */
+
+#define TAG "track-bench"
+#define BENCH_DEFAULT_STEP 10 // us
+#define BENCH_DEFAULT_POINT_INTERVAL 500 // ms
+#define BENCH_START_TIME 1000000000ULL // Mount time at the start of the simulation (ms)
+#define BENCH_LEAD_TIME 3000 // Time between the simulation start and the trajectory start (ms)
+#define BENCH_ERROR_SAMPLE_P 1000 // us
+#define BENCH_ACCEL_SAMPLE_P 10000 // us
+#define BENCH_REFILL_P 100000 // us
+#define BENCH_PREFETCH_P (COMM_TASK_PERIOD * 1000) // us, the communication task prefetches the track points
+
+#define EARTH_R 6371.0
+#define EARTH_GM 398600.4418
+#define ORBIT_ALTITUDE 550.0
+
+typedef enum TrajectoryType {
+    TRAJ_PASS,
+    TRAJ_CSV
+} TrajectoryType;
+
+/**
+ * @brief Benchmark trajectory. Synthetic passes are circular orbits over a non-rotating Earth, seen from an alt-az mount
+ * (axis 1 elevation, axis 2 azimuth).
+ */
+typedef struct Trajectory {
+    const char *name;
+    TrajectoryType type;
+    /**
+     * @brief Maximum elevation of the pass (degrees)
+     */
+    double maxEl;
+    /**
+     * @brief Angle between the observer and the orbital plane, seen from the Earth centre
+     */
+    double beta;
+    /**
+     * @brief Orbit angle of the horizon crossings (-thetaH, thetaH)
+     */
+    double thetaH;
+    /**
+     * @brief Orbital angular velocity (rad/s)
+     */
+    double omega;
+    /**
+     * @brief Recorded points (time relative to the trajectory start), for TRAJ_CSV
+     */
+    TrackPoint *points;
+    size_t pointCount;
+    /**
+     * @brief Trajectory duration (ms)
+     */
+    uint64_t duration;
+} Trajectory;
+
+typedef struct AxisStats {
+    double errSqSum;
+    double maxError;
+    uint64_t errSamples;
+    double jitterSqSum;
+    double maxJitter;
+    uint64_t steps;
+    double peakAccel;
+    float lastV;
+} AxisStats;
+
+AxisStats axisStats[2];
+int64_t measureStart, measureEnd;
+
+void passAzEl(const Trajectory *traj, double theta, double *az, double *el) {
+    double r = EARTH_R + ORBIT_ALTITUDE;
+    double dx = r * sin(theta);
+    double dy = r * cos(theta) * sin(traj->beta);
+    double dz = r * cos(theta) * cos(traj->beta) - EARTH_R;
+    *el = asin(dz / sqrt(dx * dx + dy * dy + dz * dz));
+    *az = atan2(dx, dy);
+}
+
+void initPass(Trajectory *traj) {
+    double r = EARTH_R + ORBIT_ALTITUDE;
+    double az, el;
+    traj->omega = sqrt(EARTH_GM / (r * r * r));
+
+    // Elevation at the culmination decreases with beta
+    double lo = 0.0, hi = acos(EARTH_R / r);
+    traj->thetaH = 0.0;
+    for (int i = 0; i < 60; i++) {
+        traj->beta = (lo + hi) / 2;
+        passAzEl(traj, 0.0, &az, &el);
+        if (el * 180.0 / M_PI > traj->maxEl)
+            lo = traj->beta;
+        else
+            hi = traj->beta;
+    }
+
+    lo = 0.0, hi = M_PI / 2;
+    for (int i = 0; i < 60; i++) {
+        traj->thetaH = (lo + hi) / 2;
+        passAzEl(traj, traj->thetaH, &az, &el);
+        if (el > 0.0)
+            lo = traj->thetaH;
+        else
+            hi = traj->thetaH;
+    }
+    traj->duration = 2 * traj->thetaH / traj->omega * 1000;
+}
+
+bool loadCsv(Trajectory *traj, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
+
+    size_t capacity = 1024;
+    traj->points = malloc(capacity * sizeof(TrackPoint));
+    traj->pointCount = 0;
+    char line[256];
+    unsigned long long time;
+    long long ax1, ax2;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "%llu,%lli,%lli", &time, &ax1, &ax2) != 3)
+            continue; // Header or comment
+        if (traj->pointCount == capacity) {
+            capacity *= 2;
+            traj->points = realloc(traj->points, capacity * sizeof(TrackPoint));
+        }
+        TrackPoint tp = { .ax1 = ax1, .ax2 = ax2, .time = time };
+        traj->points[traj->pointCount++] = tp;
+    }
+    fclose(file);
+
+    if (traj->pointCount < 2)
+        return false;
+    uint64_t t0 = traj->points[0].time;
+    for (size_t i = 0; i < traj->pointCount; i++)
+        traj->points[i].time -= t0;
+    traj->duration = traj->points[traj->pointCount - 1].time;
+    return true;
+}
+
+/**
+ * @brief Reference position of the trajectory
+ * 
+ * @param t Time since the trajectory start (ms)
+ */
+void trajectoryAt(const Trajectory *traj, double t, double *ax1, double *ax2) {
+    if (traj->type == TRAJ_PASS) {
+        double az, el;
+        passAzEl(traj, -traj->thetaH + traj->omega * t / 1000, &az, &el);
+        *ax1 = el / (2 * M_PI) * CPR_AX1;
+        *ax2 = az / (2 * M_PI) * CPR_AX2;
+        return;
+    }
+
+    size_t lo = 0, hi = traj->pointCount - 1;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (traj->points[mid].time <= t)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const TrackPoint *a = &traj->points[lo];
+    const TrackPoint *b = &traj->points[hi];
+    double k = (t - a->time) / (b->time - a->time);
+    if (k < 0.0)
+        k = 0.0;
+    if (k > 1.0)
+        k = 1.0;
+    *ax1 = a->ax1 + (b->ax1 - a->ax1) * k;
+    *ax2 = a->ax2 + (b->ax2 - a->ax2) * k;
+}
+
+/**
+ * @brief Decodes the step multiplier from the TMC2130 CFG pins, the way the driver sees them (in the SPI mode, 
+ * the resolution set over SPI)
+ */
+int decodeMultiplier(motor_t m) {
+    if (m->cfg.driver != NULL)
+        return m->mults[m->multIdx];
+    int cfg1 = sim_getGpioLevel(m->cfg.cfg1Pin);
+    int cfg2 = sim_getGpioLevel(m->cfg.cfg2Pin);
+    if (cfg1 < 0 && cfg2 < 0)
+        return 1;
+    if (cfg1 == 1 && cfg2 < 0)
+        return 4;
+    if (cfg1 < 0 && cfg2 == 0)
+        return 8;
+    return 16;
+}
+
+void onGpioEdge(const sim_gpio_edge_t *edge, void *ctx) {
+    if (edge->level != 1 || edge->time < measureStart || edge->time > measureEnd)
+        return;
+
+    for (uint8_t axis = 1; axis <= 2; axis++) {
+        motor_t m = motor_getAxis(axis);
+        if (edge->pin != m->cfg.stepPin)
+            continue;
+
+        AxisStats *stats = &axisStats[axis - 1];
+        stats->steps++;
+        // The step is being made, so lastStepTime and v still describe the interval that has just elapsed
+        if (m->lastStepTime < measureStart || fabsf(m->v) < 1.0f)
+            return;
+        double idealI = 1e6 * decodeMultiplier(m) / fabsf(m->v);
+        double jitter = (edge->time - m->lastStepTime) - idealI;
+        stats->jitterSqSum += jitter * jitter;
+        if (fabs(jitter) > stats->maxJitter)
+            stats->maxJitter = fabs(jitter);
+        return;
+    }
+}
+
+void sampleError(const Trajectory *traj, int64_t time, uint64_t trajStart) {
+    double ref[2];
+    trajectoryAt(traj, BENCH_START_TIME + time / 1000.0 - trajStart, &ref[0], &ref[1]);
+    for (uint8_t axis = 1; axis <= 2; axis++) {
+        AxisStats *stats = &axisStats[axis - 1];
+        double err = motor_getAxis(axis)->pos - ref[axis - 1];
+        stats->errSqSum += err * err;
+        stats->errSamples++;
+        if (fabs(err) > stats->maxError)
+            stats->maxError = fabs(err);
+    }
+}
+
+void sampleAccel(int64_t dt) {
+    for (uint8_t axis = 1; axis <= 2; axis++) {
+        AxisStats *stats = &axisStats[axis - 1];
+        float v = motor_getAxis(axis)->v;
+        double a = fabs(v - stats->lastV) * 1e6 / dt;
+        if (a > stats->peakAccel)
+            stats->peakAccel = a;
+        stats->lastV = v;
+    }
+}
+
+TrackPoint trajectoryPoint(const Trajectory *traj, size_t idx, uint32_t pointInterval, uint64_t trajStart) {
+    TrackPoint tp;
+    if (traj->type == TRAJ_CSV) {
+        tp = traj->points[idx];
+    }
+    else {
+        double ax1, ax2;
+        tp.time = idx * pointInterval;
+        if (tp.time > traj->duration)
+            tp.time = traj->duration;
+        trajectoryAt(traj, tp.time, &ax1, &ax2);
+        tp.ax1 = llround(ax1);
+        tp.ax2 = llround(ax2);
+    }
+    tp.time += trajStart;
+    return tp;
+}
+
+/**
+ * @brief Pushes trajectory points to the track buffer until it is full, like a client would
+ */
+void refillBuffer(const Trajectory *traj, size_t *nextPoint, size_t pointCount, uint32_t pointInterval, uint64_t trajStart) {
+    while (*nextPoint < pointCount) {
+        if (mount_pushTrackPoint(trajectoryPoint(traj, *nextPoint, pointInterval, trajStart)) != MOUNT_BUFFER_OK)
+            return;
+        (*nextPoint)++;
+    }
+}
+
+/**
+ * @brief Replays the trajectory and prints the results
+ * 
+ * @param interceptDelay 0 to start the tracking by CMD_TRACK_BEGIN_AT at the trajectory start, otherwise the time 
+ * (in milliseconds) after the start when the tracking is started by CMD_TRACK_BEGIN, intercepting the trajectory
+ */
+void runTrajectory(const Trajectory *traj, int64_t step, uint32_t pointInterval, uint32_t interceptDelay) {
+    MotorQueues queues = {
+        .cmdQueue = hal_queueCreate(10, sizeof(MotorCmd)),
+        .jogQueue = hal_queueCreate(1, sizeof(JogCmd))
+    };
+    sim_setTime(0);
+    dlog_init();
+    mount_initSettings();
+    mount_setTime(BENCH_START_TIME);
+    motor_taskInit(&queues);
+
+    uint64_t trajStart = BENCH_START_TIME + BENCH_LEAD_TIME;
+    size_t pointCount = traj->type == TRAJ_CSV ? traj->pointCount : (traj->duration + pointInterval - 1) / pointInterval + 1;
+    size_t nextPoint = 0;
+    TrackPoint first = trajectoryPoint(traj, 0, pointInterval, trajStart);
+    MotorCmd cmd = { .type = CMD_POSITION_UPDATE, .data.pos = { .ax1 = first.ax1, .ax2 = first.ax2 } };
+    hal_queueSend(queues.cmdQueue, &cmd);
+    refillBuffer(traj, &nextPoint, pointCount, pointInterval, trajStart);
+    if (interceptDelay == 0) {
+        cmd.type = CMD_TRACK_BEGIN_AT;
+        cmd.data.time = trajStart;
+        hal_queueSend(queues.cmdQueue, &cmd);
+    }
+
+    memset(axisStats, 0, sizeof(axisStats));
+    // The intercepted trajectory is measured from the tracking start, including the catch-up
+    measureStart = ((int64_t)BENCH_LEAD_TIME + interceptDelay) * 1000;
+    measureEnd = ((int64_t)BENCH_LEAD_TIME + traj->duration) * 1000;
+    sim_setGpioListener(onGpioEdge, NULL);
+
+    struct timespec cpuStart, cpuEnd, passStart, passEnd;
+    int64_t maxUpdateNs = 0;
+    // Follows the update period of motor_taskRun, only the passes with the update are timed
+    int64_t lastUpdate = 0;
+    bool trackBeginSent = interceptDelay == 0;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+    int64_t nextErrorSample = measureStart;
+    int64_t nextAccelSample = measureStart;
+    int64_t nextRefill = 0;
+    int64_t nextPrefetch = 0;
+    int64_t end = measureEnd + 1000000;
+    while (hal_getTime() < end) {
+        if (hal_getTime() > lastUpdate + MOTOR_TSK_UPADTE_P) {
+            lastUpdate = hal_getTime();
+            clock_gettime(CLOCK_MONOTONIC, &passStart);
+            motor_taskRun();
+            clock_gettime(CLOCK_MONOTONIC, &passEnd);
+            int64_t passNs = (passEnd.tv_sec - passStart.tv_sec) * 1000000000LL + (passEnd.tv_nsec - passStart.tv_nsec);
+            if (passNs > maxUpdateNs)
+                maxUpdateNs = passNs;
+        }
+        else {
+            motor_taskRun();
+        }
+        sim_advance(step);
+
+        int64_t time = hal_getTime();
+        if (!trackBeginSent && time >= measureStart) {
+            cmd.type = CMD_TRACK_BEGIN;
+            hal_queueSend(queues.cmdQueue, &cmd);
+            trackBeginSent = true;
+        }
+        if (time >= nextPrefetch) {
+            mount_prefetchTrackPoints();
+            nextPrefetch += BENCH_PREFETCH_P;
+        }
+        if (time >= nextRefill) {
+            refillBuffer(traj, &nextPoint, pointCount, pointInterval, trajStart);
+            dlog_drain();
+            nextRefill += BENCH_REFILL_P;
+        }
+        if (time >= nextErrorSample && time <= measureEnd) {
+            sampleError(traj, time, trajStart);
+            nextErrorSample += BENCH_ERROR_SAMPLE_P;
+        }
+        if (time >= nextAccelSample && time <= measureEnd) {
+            if (time > measureStart)
+                sampleAccel(BENCH_ACCEL_SAMPLE_P);
+            else
+                sampleAccel(INT64_MAX); // Just the initial velocity
+            nextAccelSample += BENCH_ACCEL_SAMPLE_P;
+        }
+    }
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+    sim_setGpioListener(NULL, NULL);
+
+    double cpuUs = (cpuEnd.tv_sec - cpuStart.tv_sec) * 1e6 + (cpuEnd.tv_nsec - cpuStart.tv_nsec) / 1e3;
+    double simSeconds = end / 1e6;
+    printf("{\"scenario\":\"%s\",\"duration\":%.3f,\"points\":%zu,\"stepUs\":%lli,\"cpuUsPerSimSecond\":%.1f,"
+        "\"maxUpdateUs\":%.1f,\"windowMisses\":%u,\"axes\":[",
+        traj->name, traj->duration / 1000.0, pointCount, (long long)step, cpuUs / simSeconds, maxUpdateNs / 1000.0,
+        mount_getTrackWindowMisses());
+    for (uint8_t axis = 1; axis <= 2; axis++) {
+        AxisStats *stats = &axisStats[axis - 1];
+        double rmsError = stats->errSamples > 0 ? sqrt(stats->errSqSum / stats->errSamples) : 0.0;
+        double rmsJitter = stats->steps > 0 ? sqrt(stats->jitterSqSum / stats->steps) : 0.0;
+        printf("%s{\"axis\":%i,\"rmsError\":%.2f,\"maxError\":%.0f,\"rmsErrorArcsec\":%.2f,\"steps\":%llu,"
+            "\"stepJitterRms\":%.2f,\"stepJitterMax\":%.1f,\"peakAccel\":%.0f}",
+            axis == 1 ? "" : ",", axis, rmsError, stats->maxError, rmsError * 1296000.0 / (axis == 1 ? CPR_AX1 : CPR_AX2),
+            (unsigned long long)stats->steps, rmsJitter, stats->maxJitter, stats->peakAccel);
+    }
+    printf("]}");
+    fflush(stdout);
+}
+
+void printUsage(const char *name) {
+    fprintf(stderr, "Usage: %s [--scenario <name>] [--csv <file>] [--step <us>] [--point-interval <ms>]\n", name);
+    fprintf(stderr, "  --scenario <name>      Run only this synthetic pass (leo-overhead, low-elevation, meridian)\n");
+    fprintf(stderr, "  --csv <file>           Run a recorded trajectory instead (lines time_ms,ax1,ax2 in steps)\n");
+    fprintf(stderr, "  --step <us>            Virtual time per motor loop iteration (default %i)\n", BENCH_DEFAULT_STEP);
+    fprintf(stderr, "  --point-interval <ms>  Track point spacing of the synthetic passes (default %i)\n", BENCH_DEFAULT_POINT_INTERVAL);
+    fprintf(stderr, "  --intercept <s>        Start the tracking by +tb this long after the trajectory start (intercept)\n");
+}
+
+int main(int argc, char **argv) {
+    Trajectory scenarios[] = {
+        { .name = "leo-overhead", .type = TRAJ_PASS, .maxEl = 60.0 },
+        { .name = "low-elevation", .type = TRAJ_PASS, .maxEl = 15.0 },
+        { .name = "meridian", .type = TRAJ_PASS, .maxEl = 80.0 }
+    };
+    size_t scenarioCount = sizeof(scenarios) / sizeof(scenarios[0]);
+    const char *selected = NULL;
+    const char *csvPath = NULL;
+    int64_t step = BENCH_DEFAULT_STEP;
+    uint32_t pointInterval = BENCH_DEFAULT_POINT_INTERVAL;
+    uint32_t interceptDelay = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--scenario") == 0 && i + 1 < argc)
+            selected = argv[++i];
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+            csvPath = argv[++i];
+        else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+            step = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--point-interval") == 0 && i + 1 < argc)
+            pointInterval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--intercept") == 0 && i + 1 < argc)
+            interceptDelay = atof(argv[++i]) * 1000;
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (step <= 0 || pointInterval == 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+    dlog_setLevel(ESP_LOG_WARN);
+
+    if (csvPath != NULL) {
+        Trajectory traj = { .name = csvPath, .type = TRAJ_CSV };
+        if (!loadCsv(&traj, csvPath)) {
+            ESP_LOGE(TAG, "Couldn't load trajectory from %s", csvPath);
+            return 1;
+        }
+        scenarios[0] = traj;
+        scenarioCount = 1;
+    }
+
+    // Each scenario runs in its own process, so it starts from a clean firmware state
+    bool first = true;
+    printf("[");
+    for (size_t i = 0; i < scenarioCount; i++) {
+        if (selected != NULL && strcmp(selected, scenarios[i].name) != 0)
+            continue;
+        if (scenarios[i].type == TRAJ_PASS)
+            initPass(&scenarios[i]);
+
+        printf(first ? "\n" : ",\n");
+        fflush(stdout);
+        first = false;
+        pid_t pid = fork();
+        if (pid == 0) {
+            runTrajectory(&scenarios[i], step, pointInterval, interceptDelay);
+            exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            ESP_LOGE(TAG, "Scenario %s failed", scenarios[i].name);
+            return 1;
+        }
+    }
+    printf("\n]\n");
+    return first ? 1 : 0;
+}
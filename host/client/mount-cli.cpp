@@ -0,0 +1,104 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include "mount-client.hpp"
+
+/**
+ * @brief Command line client. Sends one command given on the command line, or the commands read from stdin (one per
+ * line, pipelined), and prints the responses in order. Unsolicited lines (`*...`) are printed as they come.
+ *
+ * Commands are written as in the protocol, without the `+` (`gp`, `g 1000 -2000`, `tba 1700000000000`...).
+ */
+
+void printUsage(const char *name) {
+    fprintf(stderr, "Usage: %s [--address <n>] <host:port | serial port> [command [args...]]\n", name);
+    fprintf(stderr, "  --address <n>  Bus address of the mount (@<n> framing)\n");
+    fprintf(stderr, "Without a command, reads the commands from stdin, one per line.\n");
+}
+
+void printResponse(const mount::Response &response) {
+    for (const std::string &line : response.lines)
+        printf("+%s\n", line.c_str());
+    if (!response.ok()) {
+        printf("! %i %s\n", response.errorCode, response.error.c_str());
+        return;
+    }
+    printf("+%s", response.cmd.c_str());
+    for (const std::string &arg : response.args)
+        printf(" %s", arg.c_str());
+    printf("\n");
+}
+
+/**
+ * @brief Splits `+cmd args` (the `+` optional) into the command and the arguments
+ */
+bool splitCommand(std::string line, std::string &cmd, std::string &args) {
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+        line.pop_back();
+    if (!line.empty() && line[0] == '+')
+        line.erase(0, 1);
+    if (line.empty())
+        return false;
+    size_t space = line.find(' ');
+    cmd = line.substr(0, space);
+    args = space == std::string::npos ? "" : line.substr(space + 1);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int address = 0;
+    int argIdx = 1;
+    if (argc > 2 && strcmp(argv[1], "--address") == 0) {
+        address = atoi(argv[2]);
+        argIdx = 3;
+    }
+    if (argIdx >= argc || address < 0 || address > 254) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    try {
+        mount::MountClient client(mount::Connection::open(argv[argIdx]), address);
+        client.setUnsolicitedHandler([](const std::string &line) { printf("*%s\n", line.c_str()); });
+        if (argIdx + 1 < argc) {
+            std::string line;
+            for (int i = argIdx + 1; i < argc; i++)
+                line += std::string(i > argIdx + 1 ? " " : "") + argv[i];
+            std::string cmd, args;
+            splitCommand(line, cmd, args);
+            mount::Response response = client.call(cmd, args);
+            printResponse(response);
+            return response.ok() ? 0 : 1;
+        }
+
+        // Responses are printed as they come, while the next commands are already sent
+        std::deque<std::future<mount::Response>> responses;
+        std::string line;
+        bool failed = false;
+        while (std::getline(std::cin, line)) {
+            std::string cmd, args;
+            if (!splitCommand(line, cmd, args))
+                continue;
+            responses.push_back(client.request(cmd, args));
+            while (!responses.empty() && responses.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+                mount::Response response = responses.front().get();
+                failed |= !response.ok();
+                printResponse(response);
+                responses.pop_front();
+            }
+        }
+        for (auto &future : responses) {
+            mount::Response response = future.get();
+            failed |= !response.ok();
+            printResponse(response);
+        }
+        return failed ? 1 : 0;
+    }
+    catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
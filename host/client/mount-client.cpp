@@ -0,0 +1,481 @@
+#include "mount-client.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define READ_POLL_MS 50
+#define READ_CHUNK 4096
+
+namespace mount {
+
+int64_t Response::intArg(size_t idx) const {
+    return idx < args.size() ? std::strtoll(args[idx].c_str(), nullptr, 10) : 0;
+}
+
+uint64_t Response::uintArg(size_t idx) const {
+    return idx < args.size() ? std::strtoull(args[idx].c_str(), nullptr, 10) : 0;
+}
+
+double Response::floatArg(size_t idx) const {
+    return idx < args.size() ? std::strtod(args[idx].c_str(), nullptr) : 0.0;
+}
+
+std::unique_ptr<Connection> Connection::openTcp(const std::string &host, uint16_t port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addrs;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addrs) != 0)
+        throw std::runtime_error("Couldn't resolve " + host);
+
+    int fd = -1;
+    for (addrinfo *addr = addrs; addr != nullptr && fd < 0; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0)
+        throw std::runtime_error("Couldn't connect to " + host + ":" + std::to_string(port));
+
+    // Commands are short lines, they shouldn't wait for more data
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    return std::make_unique<Connection>(fd);
+}
+
+speed_t baudConstant(int baudRate) {
+    switch (baudRate) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B115200;
+    }
+}
+
+std::unique_ptr<Connection> Connection::openSerial(const std::string &path, int baudRate) {
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0)
+        throw std::runtime_error("Couldn't open " + path + ": " + std::strerror(errno));
+
+    termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetspeed(&tio, baudConstant(baudRate));
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return std::make_unique<Connection>(fd);
+}
+
+std::unique_ptr<Connection> Connection::open(const std::string &target) {
+    size_t colon = target.rfind(':');
+    if (target.find('/') == std::string::npos && colon != std::string::npos)
+        return openTcp(target.substr(0, colon), std::atoi(target.c_str() + colon + 1));
+    return openSerial(target);
+}
+
+Connection::~Connection() {
+    close(fd);
+}
+
+bool Connection::write(const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == ENOTSOCK)
+            n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        written += n;
+    }
+    return true;
+}
+
+ssize_t Connection::read(char *buffer, size_t len, int timeoutMs) {
+    pollfd pfd = { fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeoutMs);
+    if (ready < 0)
+        return errno == EINTR ? 0 : -1;
+    if (ready == 0)
+        return 0;
+    ssize_t n = ::read(fd, buffer, len);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return 0;
+    return n > 0 ? n : -1;
+}
+
+MountClient::MountClient(std::unique_ptr<Connection> connection, uint8_t address)
+    : connection(std::move(connection)), address(address) {
+    reader = std::thread(&MountClient::readerLoop, this);
+}
+
+MountClient::~MountClient() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    reader.join();
+    failAll(ERR_CODE_DISCONNECTED, "Client closed");
+}
+
+void MountClient::setWindow(size_t maxBytes, size_t maxRequests) {
+    std::lock_guard<std::mutex> lock(mtx);
+    this->maxBytes = maxBytes;
+    this->maxRequests = std::max<size_t>(maxRequests, 1);
+    windowCv.notify_all();
+}
+
+void MountClient::setTimeout(std::chrono::milliseconds timeout) {
+    std::lock_guard<std::mutex> lock(mtx);
+    this->timeout = timeout;
+}
+
+void MountClient::setUnsolicitedHandler(std::function<void(const std::string &line)> handler) {
+    std::lock_guard<std::mutex> lock(mtx);
+    unsolicitedHandler = std::move(handler);
+}
+
+std::future<Response> MountClient::request(const std::string &cmd, const std::string &args) {
+    std::string frame;
+    if (address != 0)
+        frame = "@" + std::to_string(address) + " ";
+    frame += "+" + cmd;
+    if (!args.empty())
+        frame += " " + args;
+    frame += "\n";
+
+    // The send lock keeps the frames in the order of the pending requests
+    std::lock_guard<std::mutex> sendLock(sendMtx);
+    std::future<Response> future;
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        windowCv.wait(lock, [&] {
+            return !connected || (!resyncing && (pending.empty()
+                || (pending.size() < maxRequests && bytesInFlight + frame.size() <= maxBytes)));
+        });
+        Pending req;
+        req.cmd = cmd;
+        req.bytes = frame.size();
+        req.sent = std::chrono::steady_clock::now();
+        future = req.promise.get_future();
+        if (!connected) {
+            req.response.cmd = cmd;
+            req.response.errorCode = ERR_CODE_DISCONNECTED;
+            req.response.error = "Not connected";
+            req.promise.set_value(req.response);
+            return future;
+        }
+        bytesInFlight += req.bytes;
+        pending.push_back(std::move(req));
+    }
+    if (!connection->write(frame))
+        failAll(ERR_CODE_DISCONNECTED, "Write failed");
+    return future;
+}
+
+Response MountClient::call(const std::string &cmd, const std::string &args) {
+    return request(cmd, args).get();
+}
+
+void MountClient::drain() {
+    std::unique_lock<std::mutex> lock(mtx);
+    windowCv.wait(lock, [&] { return pending.empty(); });
+}
+
+/**
+ * @brief Returns the value of the future response, converted by `convert`, throws MountError on error responses
+ */
+template<typename T, typename F>
+std::future<T> typedRequest(std::future<Response> response, F convert) {
+    return std::async(std::launch::deferred, [response = std::move(response), convert]() mutable {
+        Response r = response.get();
+        if (!r.ok())
+            throw MountError(r.errorCode, r.error);
+        return convert(r);
+    });
+}
+
+std::future<std::pair<int64_t, int64_t>> MountClient::getPosition() {
+    return typedRequest<std::pair<int64_t, int64_t>>(request("gp"), [](const Response &r) {
+        return std::make_pair(r.intArg(0), r.intArg(1));
+    });
+}
+
+std::future<uint64_t> MountClient::getTime() {
+    return typedRequest<uint64_t>(request("gt"), [](const Response &r) { return r.uintArg(0); });
+}
+
+std::future<int> MountClient::getStatus() {
+    return typedRequest<int>(request("gs"), [](const Response &r) { return (int)r.intArg(0); });
+}
+
+std::future<uint32_t> MountClient::getTrackBufferFreeSpace() {
+    return typedRequest<uint32_t>(request("gtbf"), [](const Response &r) { return (uint32_t)r.uintArg(0); });
+}
+
+std::future<uint32_t> MountClient::getTrackBufferSize() {
+    return typedRequest<uint32_t>(request("gtbs"), [](const Response &r) { return (uint32_t)r.uintArg(0); });
+}
+
+std::future<Response> MountClient::requestTrackPoint(const TrackPoint &point) {
+    return request("tp", std::to_string(point.ax1) + " " + std::to_string(point.ax2) + " " + std::to_string(point.time));
+}
+
+/**
+ * @brief Returns the number of track points accepted, throws MountError on error responses and points out of the range
+ */
+size_t countAccepted(std::vector<std::future<Response>> &responses) {
+    size_t accepted = 0;
+    bool rejected = false;
+    for (auto &response : responses) {
+        Response r = response.get();
+        if (!r.ok())
+            throw MountError(r.errorCode, r.error);
+        if (r.intArg(0) == BUFFER_RANGE)
+            throw MountError(ERR_CODE_INVALID_MSG, "Track point position out of the track buffer range");
+        if (r.intArg(0) != BUFFER_OK)
+            rejected = true;
+        else if (rejected)
+            throw MountError(ERR_CODE_INTERNAL, "Track point accepted after a rejected one, the track is out of order");
+        else
+            accepted++;
+    }
+    return accepted;
+}
+
+size_t MountClient::uploadTrack(const std::vector<TrackPoint> &points, bool waitForSpace,
+        std::chrono::milliseconds pollInterval) {
+    size_t next = 0;
+    uint32_t freeSpace = getTrackBufferFreeSpace().get();
+    while (next < points.size()) {
+        if (freeSpace == 0) {
+            if (!waitForSpace)
+                break;
+            std::this_thread::sleep_for(pollInterval);
+            freeSpace = getTrackBufferFreeSpace().get();
+            continue;
+        }
+
+        size_t batch = std::min<size_t>(freeSpace, points.size() - next);
+        std::vector<std::future<Response>> responses;
+        responses.reserve(batch);
+        for (size_t i = next; i < next + batch; i++)
+            responses.push_back(requestTrackPoint(points[i]));
+        std::future<uint32_t> nextFreeSpace = getTrackBufferFreeSpace();
+
+        size_t accepted = countAccepted(responses);
+        next += accepted;
+        freeSpace = nextFreeSpace.get();
+    }
+    return next;
+}
+
+void MountClient::startStream(uint32_t watermark) {
+    // The initial credits are taken from the response by the reader, in order with the grants
+    Response r = call("tsm", "1 " + std::to_string(watermark));
+    if (!r.ok())
+        throw MountError(r.errorCode, r.error);
+}
+
+void MountClient::stopStream() {
+    Response r = call("tsm", "0");
+    if (!r.ok())
+        throw MountError(r.errorCode, r.error);
+}
+
+size_t MountClient::streamTrack(const std::vector<TrackPoint> &points, bool waitForSpace) {
+    size_t next = 0;
+    std::vector<std::future<Response>> responses;
+    responses.reserve(points.size());
+    while (next < points.size()) {
+        uint32_t credits;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            if (waitForSpace)
+                creditsCv.wait(lock, [&] { return streamCredits > 0 || !connected; });
+            if (!connected || streamCredits == 0)
+                break;
+            credits = std::min<size_t>(streamCredits, points.size() - next);
+            streamCredits -= credits;
+        }
+        for (uint32_t i = 0; i < credits; i++)
+            responses.push_back(requestTrackPoint(points[next++]));
+    }
+    return countAccepted(responses);
+}
+
+void MountClient::complete(std::deque<Pending>::iterator it) {
+    bytesInFlight -= it->bytes;
+    it->promise.set_value(std::move(it->response));
+    pending.erase(it);
+    windowCv.notify_all();
+}
+
+void MountClient::failAll(int code, const std::string &error) {
+    std::lock_guard<std::mutex> lock(mtx);
+    connected = false;
+    creditsCv.notify_all();
+    failPending(code, error);
+}
+
+/**
+ * @brief Fails all the requests in flight, expects `mtx` to be taken
+ */
+void MountClient::failPending(int code, const std::string &error) {
+    while (!pending.empty()) {
+        pending.front().response.cmd = pending.front().cmd;
+        pending.front().response.errorCode = code;
+        pending.front().response.error = error;
+        complete(pending.begin());
+    }
+}
+
+/**
+ * @brief Command of the lines that precede the final response line of another command
+ */
+const char *partOf(const std::string &cmd) {
+    if (cmd == "gtre")
+        return "gtr";
+    if (cmd == "gdt" || cmd == "gdq")
+        return "gd";
+    if (cmd == "tlle")
+        return "tll";
+    return nullptr;
+}
+
+void MountClient::handleLine(const std::string &rawLine) {
+    std::string line = rawLine;
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    if (!line.empty() && line[0] == '@') {
+        // Replies of other devices on the bus are skipped
+        size_t space = line.find(' ');
+        if (space == std::string::npos || std::atoi(line.c_str() + 1) != address)
+            return;
+        line = line.substr(space + 1);
+    }
+    if (line.empty())
+        return;
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (resyncing && line[0] != '*') {
+        // Late response of a timed out request
+        resyncUntil = std::chrono::steady_clock::now() + timeout;
+        return;
+    }
+    if (line[0] == '*') {
+        std::istringstream ss(line.substr(1));
+        std::string cmd;
+        ss >> cmd;
+        if (cmd == "tc") {
+            uint32_t credits = 0;
+            ss >> credits;
+            streamCredits += credits;
+            creditsCv.notify_all();
+        }
+        auto handler = unsolicitedHandler;
+        lock.unlock();
+        if (handler)
+            handler(line.substr(1));
+        return;
+    }
+    if (line[0] == '!') {
+        // The device answers in order, so the error is for the oldest request
+        if (pending.empty())
+            return;
+        std::istringstream ss(line.substr(1));
+        Pending &req = pending.front();
+        ss >> req.response.errorCode;
+        std::getline(ss >> std::ws, req.response.error);
+        if (req.response.errorCode == 0)
+            req.response.errorCode = ERR_CODE_INTERNAL;
+        req.response.cmd = req.cmd;
+        complete(pending.begin());
+        return;
+    }
+    if (line[0] != '+')
+        return;
+
+    std::istringstream ss(line.substr(1));
+    std::string cmd;
+    ss >> cmd;
+    const char *parent = partOf(cmd);
+    const std::string &owner = parent != nullptr ? parent : cmd;
+    auto it = std::find_if(pending.begin(), pending.end(), [&](const Pending &p) { return p.cmd == owner; });
+    if (it == pending.end())
+        return;
+    if (parent != nullptr) {
+        it->response.lines.push_back(line.substr(1));
+        return;
+    }
+
+    it->response.cmd = cmd;
+    std::string arg;
+    while (ss >> arg)
+        it->response.args.push_back(arg);
+    if (cmd == "tsm") {
+        // Grants sent after the response add to these credits
+        streamCredits = it->response.uintArg(0);
+        creditsCv.notify_all();
+    }
+    complete(it);
+}
+
+void MountClient::readerLoop() {
+    char buffer[READ_CHUNK];
+    std::string line;
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (stopping)
+                return;
+            auto now = std::chrono::steady_clock::now();
+            if (!pending.empty() && now - pending.front().sent > timeout) {
+                // The responses of the later requests can't be matched any more
+                failPending(ERR_CODE_TIMEOUT, "No response");
+                resyncing = true;
+                resyncUntil = now + timeout;
+            }
+            else if (resyncing && now >= resyncUntil) {
+                resyncing = false;
+                windowCv.notify_all();
+            }
+        }
+
+        ssize_t n = connection->read(buffer, sizeof(buffer), READ_POLL_MS);
+        if (n < 0) {
+            failAll(ERR_CODE_DISCONNECTED, "Connection closed");
+            return;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            if (buffer[i] == '\n') {
+                handleLine(line);
+                line.clear();
+            }
+            else {
+                line += buffer[i];
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,254 @@
+#ifndef __MOUNT_CLIENT
+#define __MOUNT_CLIENT
+
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Host client of the mount control protocol (main/comm/uart-ctrl.h), over a serial port or a TCP socket
+ * (`mount-sim --tcp`, or the firmware TCP transport).
+ *
+ * Requests are asynchronous - MountClient::request sends the command right away and returns a future of the response,
+ * so any number of commands can be in flight (pipelined). The device answers them in order. The bytes in flight are
+ * limited to the device receive buffer (see MountClient::setWindow), a request blocks until there is space.
+ * A background thread reads the responses and completes the futures, and passes the unsolicited lines (`*...`, sent
+ * by the device in the track streaming mode) to the handler set by MountClient::setUnsolicitedHandler.
+ */
+
+namespace mount {
+
+/**
+ * @brief Protocol constants, see main/comm/uart-ctrl.h and main/settings.h
+ */
+constexpr int ERR_CODE_INTERNAL = 1;
+constexpr int ERR_CODE_INVALID_MSG = 2;
+constexpr int ERR_CODE_UNKNOWN_CMD = 3;
+/**
+ * @brief Error code of the requests that got no response in time (client side only)
+ */
+constexpr int ERR_CODE_TIMEOUT = -1;
+/**
+ * @brief Error code of the requests failed by a lost connection (client side only)
+ */
+constexpr int ERR_CODE_DISCONNECTED = -2;
+constexpr int BUFFER_OK = 0;
+constexpr int BUFFER_FULL = 1;
+/**
+ * @brief The point's position doesn't fit into the track store (32 bits per axis)
+ */
+constexpr int BUFFER_RANGE = 3;
+/**
+ * @brief Receive buffer of the device (RX_TX_BUFFER_SIZE)
+ */
+constexpr size_t DEVICE_RX_BUFFER = 1024;
+
+struct Response {
+    /**
+     * @brief Command name, without the `+`
+     */
+    std::string cmd;
+    std::vector<std::string> args;
+    /**
+     * @brief Lines sent before the final response line (trace events of `gtr`, tasks and queues of `gd`,
+     * entries of `tll`), without the `+`
+     */
+    std::vector<std::string> lines;
+    /**
+     * @brief 0 on success, otherwise the error code of the `!` response, or ERR_CODE_TIMEOUT/ERR_CODE_DISCONNECTED
+     */
+    int errorCode = 0;
+    std::string error;
+
+    bool ok() const { return errorCode == 0; }
+    int64_t intArg(size_t idx) const;
+    uint64_t uintArg(size_t idx) const;
+    double floatArg(size_t idx) const;
+};
+
+/**
+ * @brief Error response of the typed requests
+ */
+class MountError : public std::runtime_error {
+public:
+    MountError(int code, const std::string &msg) : std::runtime_error(msg), code(code) {}
+    const int code;
+};
+
+struct TrackPoint {
+    int64_t ax1;
+    int64_t ax2;
+    /**
+     * @brief Mount time (ms)
+     */
+    uint64_t time;
+};
+
+/**
+ * @brief Byte stream to the device
+ */
+class Connection {
+public:
+    /**
+     * @brief Connects to a TCP port. Throws std::runtime_error on failure.
+     */
+    static std::unique_ptr<Connection> openTcp(const std::string &host, uint16_t port);
+    /**
+     * @brief Opens a serial port (a tty, or the pty of mount-sim). Throws std::runtime_error on failure.
+     */
+    static std::unique_ptr<Connection> openSerial(const std::string &path, int baudRate = 115200);
+    /**
+     * @brief Opens `host:port` as TCP, anything else as a serial port
+     */
+    static std::unique_ptr<Connection> open(const std::string &target);
+
+    explicit Connection(int fd) : fd(fd) {}
+    ~Connection();
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    bool write(const std::string &data);
+    /**
+     * @brief Reads the data available, waits up to `timeoutMs` for some
+     *
+     * @return ssize_t Number of bytes read, 0 on timeout, negative if the connection is closed
+     */
+    ssize_t read(char *buffer, size_t len, int timeoutMs);
+
+private:
+    int fd;
+};
+
+class MountClient {
+public:
+    /**
+     * @brief Starts the client on the connection
+     *
+     * @param address Bus address of the device (`@<address>` framing), 0 for a point-to-point link
+     */
+    explicit MountClient(std::unique_ptr<Connection> connection, uint8_t address = 0);
+    ~MountClient();
+    MountClient(const MountClient &) = delete;
+    MountClient &operator=(const MountClient &) = delete;
+
+    /**
+     * @brief Sets the pipelining limits - the bytes and the requests in flight. `setWindow(..., 1)` makes the client
+     * synchronous.
+     */
+    void setWindow(size_t maxBytes, size_t maxRequests);
+    /**
+     * @brief Time after which a request fails with ERR_CODE_TIMEOUT. A late response can't be told apart from the
+     * responses of the later requests, so all the requests in flight fail with it, and the client drops the input until
+     * the device is quiet for this time before sending any more.
+     */
+    void setTimeout(std::chrono::milliseconds timeout);
+    /**
+     * @brief Sets the handler of the unsolicited lines (credit grants `tc <credits>`, low watermark alerts
+     * `tlw <count> <timeToEmpty>`), called with the line without the `*` from the reader thread
+     */
+    void setUnsolicitedHandler(std::function<void(const std::string &line)> handler);
+    /**
+     * @brief Sends a command, blocks only while the window is full
+     *
+     * @param cmd Command name, without the `+` (e.g. `gp`)
+     * @param args Space separated arguments
+     * @return std::future<Response> Response, errors are returned in it (not thrown)
+     */
+    std::future<Response> request(const std::string &cmd, const std::string &args = "");
+    /**
+     * @brief Sends a command and waits for the response
+     */
+    Response call(const std::string &cmd, const std::string &args = "");
+    /**
+     * @brief Waits until all the requests are answered
+     */
+    void drain();
+
+    std::future<std::pair<int64_t, int64_t>> getPosition();
+    std::future<uint64_t> getTime();
+    std::future<int> getStatus();
+    std::future<uint32_t> getTrackBufferFreeSpace();
+    std::future<uint32_t> getTrackBufferSize();
+    /**
+     * @brief Uploads track points to the track buffer, in batches as large as the free space. Each batch is pipelined
+     * together with the next free space query, so a batch costs a single round trip.
+     *
+     * @param points Points to upload
+     * @param waitForSpace When the buffer is full, wait for the tracking to consume points instead of returning
+     * @param pollInterval Free space polling period while the buffer is full
+     * @return size_t Number of points uploaded
+     */
+    size_t uploadTrack(const std::vector<TrackPoint> &points, bool waitForSpace = false,
+        std::chrono::milliseconds pollInterval = std::chrono::milliseconds(50));
+    /**
+     * @brief Enables the track streaming mode (`+tsm`). The device grants credits - the points that fit the track
+     * buffer - as the tracking consumes them, so streamTrack needs no free space queries.
+     *
+     * @param watermark Points left for the tracking below which the device sends the low watermark alert, 0 for none
+     */
+    void startStream(uint32_t watermark = 0);
+    void stopStream();
+    /**
+     * @brief Sends track points as fast as the credits allow, in the streaming mode
+     *
+     * @param points Points to send
+     * @param waitForSpace When out of credits, wait for the device to grant more instead of returning
+     * @return size_t Number of points uploaded
+     */
+    size_t streamTrack(const std::vector<TrackPoint> &points, bool waitForSpace = true);
+
+private:
+    struct Pending {
+        std::string cmd;
+        size_t bytes;
+        std::chrono::steady_clock::time_point sent;
+        std::promise<Response> promise;
+        Response response;
+    };
+
+    void readerLoop();
+    void handleLine(const std::string &line);
+    void complete(std::deque<Pending>::iterator it);
+    void failAll(int code, const std::string &error);
+    void failPending(int code, const std::string &error);
+    std::future<Response> requestTrackPoint(const TrackPoint &point);
+
+    std::unique_ptr<Connection> connection;
+    uint8_t address;
+    std::mutex sendMtx;
+    std::mutex mtx;
+    std::condition_variable windowCv;
+    std::deque<Pending> pending;
+    size_t bytesInFlight = 0;
+    size_t maxBytes = DEVICE_RX_BUFFER / 2;
+    size_t maxRequests = 64;
+    std::chrono::milliseconds timeout{2000};
+    std::function<void(const std::string &line)> unsolicitedHandler;
+    /**
+     * @brief Track points the client may send in the streaming mode
+     */
+    uint32_t streamCredits = 0;
+    std::condition_variable creditsCv;
+    /**
+     * @brief Responses are dropped after a timeout, until `resyncUntil`
+     */
+    bool resyncing = false;
+    std::chrono::steady_clock::time_point resyncUntil;
+    bool stopping = false;
+    bool connected = true;
+    std::thread reader;
+};
+
+}
+
+#endif
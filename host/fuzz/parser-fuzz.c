@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <esp_log.h>
+#include "comm/uart-ctrl.h"
+#include "comm/transport.h"
+#include "log/dlog.h"
+
+/**
+ * @brief Fuzz harness of the control protocol parser (main/comm/uart-ctrl.c). Feeds the input to comm_getNext through
+ * the loopback transport, once point-to-point and once as an addressed device, and aborts when the parser stops
+ * consuming the input, returns an unknown message code, a name parameter that isn't terminated or a non-finite
+ * number. Memory errors are left to the sanitizers.
+ *
+ * With MOUNT_FUZZ on and Clang, this is a libFuzzer target. Otherwise it's a standalone driver running the files given
+ * as arguments, or stdin - for AFL (`afl-fuzz -i host/fuzz/corpus -o findings -- ./parser-fuzz`) and to replay crashes.
+ */
+
+#define FUZZ_ADDRESS 3
+
+comm_transport_t loopbackTransport;
+comm_loopback_t loopback;
+
+void fuzzInit() {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    dlog_init();
+    dlog_setLevel(ESP_LOG_NONE);
+    transport_initLoopback(&loopbackTransport, &loopback);
+    comm_initTransport(&loopbackTransport);
+}
+
+void checkMsg(const MountMsg *msg) {
+    if (msg->cmd < MOUNT_MSG_CMD_ERR_UNKNOWN_CMD || msg->cmd > MOUNT_MSG_CMD_TRACK_STREAM) {
+        fprintf(stderr, "Unknown message code %i\n", msg->cmd);
+        abort();
+    }
+    if ((msg->cmd == MOUNT_MSG_CMD_TRAJLIB_BEGIN
+            && strnlen(msg->data.name, sizeof(msg->data.name)) >= sizeof(msg->data.name))
+        || (msg->cmd == MOUNT_MSG_CMD_TRAJLIB_REPLAY
+            && strnlen(msg->data.trajlibReplay.name, sizeof(msg->data.trajlibReplay.name)) >= sizeof(msg->data.trajlibReplay.name))) {
+        fprintf(stderr, "Trajectory name not terminated\n");
+        abort();
+    }
+    if (msg->cmd == MOUNT_MSG_CMD_SET_CONFIG
+        && strnlen(msg->data.setConfig.name, sizeof(msg->data.setConfig.name)) >= sizeof(msg->data.setConfig.name)) {
+        fprintf(stderr, "Config name not terminated\n");
+        abort();
+    }
+    if ((msg->cmd == MOUNT_MSG_CMD_JOG && !(isfinite(msg->data.jog.v1) && isfinite(msg->data.jog.v2)))
+        || (msg->cmd == MOUNT_MSG_CMD_TRACK_RATE_OFFSET
+            && !(isfinite(msg->data.trackRate.r1) && isfinite(msg->data.trackRate.r2)))
+        || (msg->cmd == MOUNT_MSG_CMD_SET_CONFIG && !isfinite(msg->data.setConfig.value))) {
+        fprintf(stderr, "Non-finite number\n");
+        abort();
+    }
+}
+
+/**
+ * @brief Parses the whole input, refilling the loopback as the parser consumes it
+ */
+void parseInput(const uint8_t *data, size_t size) {
+    size_t sent = 0;
+    loopbackTransport.flushInput(&loopbackTransport);
+    for (;;) {
+        sent += transport_loopbackSend(&loopback, data + sent, size - sent);
+        size_t available = loopbackTransport.available(&loopbackTransport);
+        if (available <= 2) {
+            if (sent == size)
+                break;
+            continue;
+        }
+
+        MountMsg msg = comm_getNext();
+        checkMsg(&msg);
+        if (loopbackTransport.available(&loopbackTransport) >= available) {
+            fprintf(stderr, "The parser didn't consume any input\n");
+            abort();
+        }
+        char reply[64];
+        while (transport_loopbackReceive(&loopback, reply, sizeof(reply)) > 0);
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static bool initialized = false;
+    if (!initialized) {
+        fuzzInit();
+        initialized = true;
+    }
+    comm_setAddress(COMM_ADDRESS_NONE);
+    parseInput(data, size);
+    comm_setAddress(FUZZ_ADDRESS);
+    parseInput(data, size);
+    return 0;
+}
+
+#ifndef MOUNT_LIBFUZZER
+bool runFile(FILE *file) {
+    size_t size = 0, capacity = 4096;
+    uint8_t *data = malloc(capacity);
+    size_t len;
+    while (data != NULL && (len = fread(data + size, 1, capacity - size, file)) > 0) {
+        size += len;
+        if (size == capacity)
+            data = realloc(data, capacity *= 2);
+    }
+    if (data == NULL)
+        return false;
+    LLVMFuzzerTestOneInput(data, size);
+    free(data);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2)
+        return runFile(stdin) ? 0 : 1;
+
+    for (int i = 1; i < argc; i++) {
+        FILE *file = fopen(argv[i], "rb");
+        if (file == NULL || !runFile(file)) {
+            fprintf(stderr, "Couldn't read %s\n", argv[i]);
+            return 1;
+        }
+        fclose(file);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,657 @@
+#define _GNU_SOURCE
+#include "hal/hal.h"
+#include "sim.h"
+#include <esp_log.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#define SIM_GPIO_COUNT 64
+#define SIM_UART_COUNT 3
+#define SIM_UART_BUFFER_SIZE 4096
+
+esp_log_level_t sim_logLevel = ESP_LOG_INFO;
+
+int64_t simTime = 0;
+
+/**
+ * @brief Pin level, -1 when the pin is a floating input
+ */
+int8_t gpioLevels[SIM_GPIO_COUNT];
+bool gpioOutput[SIM_GPIO_COUNT];
+/**
+ * @brief Level the simulated outside world drives an input pin to (sim_setGpioInput). Undriven inputs read low.
+ */
+uint8_t gpioInputLevels[SIM_GPIO_COUNT];
+typedef struct SimGpioInterrupt {
+    hal_gpio_isr_t handler;
+    void *arg;
+    uint32_t level;
+} SimGpioInterrupt;
+SimGpioInterrupt gpioInterrupts[SIM_GPIO_COUNT];
+sim_gpio_listener_t gpioListener = NULL;
+void *gpioListenerCtx = NULL;
+bool gpioRecording = false;
+sim_gpio_edge_t *gpioEdges = NULL;
+size_t gpioEdgeCount = 0;
+size_t gpioEdgeCapacity = 0;
+
+typedef struct SimUart {
+    int rxFd;
+    int txFd;
+    char rxBuffer[SIM_UART_BUFFER_SIZE];
+    size_t rxHead;
+    size_t rxLen;
+} SimUart;
+
+SimUart uarts[SIM_UART_COUNT] = {
+    { .rxFd = -1, .txFd = -1 },
+    { .rxFd = -1, .txFd = -1 },
+    { .rxFd = -1, .txFd = -1 }
+};
+
+typedef hal_queue_buffer_t SimQueue;
+
+/**
+ * @brief Simulated flash partition, same layout as partition_table/partitionTable.csv. The content is kept in memory,
+ * or in a file attached by sim_partitionAttachFile.
+ */
+typedef struct SimPartition {
+    const char *label;
+    uint32_t size;
+    uint8_t *data;
+} SimPartition;
+
+SimPartition partitions[] = {
+    { .label = "trajlib", .size = 0x100000, .data = NULL }
+};
+#define SIM_PARTITION_COUNT (sizeof(partitions) / sizeof(partitions[0]))
+
+#define SIM_SPI_DEVICE_COUNT 4
+#define SIM_SPI_REGISTER_COUNT 128
+#define SIM_SPI_DATAGRAM_LENGTH 5
+/**
+ * @brief Time a datagram takes (microseconds) - 40 bits at TMC_SPI_CLOCK_HZ (2 MHz) and the overhead of a polled ESP-IDF transaction.
+ * The virtual clock advances by it, so the SPI traffic shows in the step timing.
+ */
+#define SIM_SPI_TRANSFER_US 30
+
+/**
+ * @brief Mock SPI device with the TMC2130 register interface: 40-bit datagrams of an address byte (bit 7 set for writes)
+ * and 32-bit data. Each reply carries the status byte and the data of the register read by the previous datagram.
+ * Registers just hold the written values, except the ones set by sim_spiSetRegister.
+ */
+typedef struct SimSpiDevice {
+    int csPin;
+    uint32_t registers[SIM_SPI_REGISTER_COUNT];
+    uint32_t replyData;
+} SimSpiDevice;
+
+SimSpiDevice spiDevices[SIM_SPI_DEVICE_COUNT];
+uint32_t spiDeviceCount = 0;
+
+#define SIM_STORAGE_KEY_LENGTH 16
+#define SIM_STORAGE_MAX_ENTRIES 32
+
+/**
+ * @brief Entry of the simulated persistent storage. The storage is kept in memory, and saved to the file attached
+ * by sim_storageAttachFile after each write.
+ */
+typedef struct SimStorageEntry {
+    char key[SIM_STORAGE_KEY_LENGTH];
+    uint32_t size;
+    uint8_t *data;
+} SimStorageEntry;
+
+SimStorageEntry storageEntries[SIM_STORAGE_MAX_ENTRIES];
+uint32_t storageEntryCount = 0;
+char *storagePath = NULL;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    sim_logLevel = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    if (sim_logLevel < level)
+        return;
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+
+void sim_setTime(int64_t time) {
+    simTime = time;
+}
+
+void sim_advance(int64_t dt) {
+    simTime += dt;
+}
+
+bool anyUartAttached() {
+    for (int i = 0; i < SIM_UART_COUNT; i++) {
+        if (uarts[i].rxFd >= 0)
+            return true;
+    }
+    return false;
+}
+
+int64_t hal_getTime() {
+    return simTime;
+}
+
+hal_tick_t hal_getTicks() {
+    return simTime / 1000;
+}
+
+void hal_delay(uint32_t ms) {
+    // The virtual clock moves on, but a connected client works in real time, so give it a chance to send data
+    if (anyUartAttached()) {
+        struct pollfd fds[SIM_UART_COUNT];
+        nfds_t count = 0;
+        for (int i = 0; i < SIM_UART_COUNT; i++) {
+            if (uarts[i].rxFd >= 0) {
+                fds[count].fd = uarts[i].rxFd;
+                fds[count].events = POLLIN;
+                count++;
+            }
+        }
+        poll(fds, count, ms);
+    }
+    simTime += (int64_t)ms * 1000;
+}
+
+void hal_delayUntil(hal_tick_t *lastWake, uint32_t periodMs) {
+    hal_tick_t now = hal_getTicks();
+    *lastWake += periodMs;
+    if (*lastWake > now)
+        hal_delay(*lastWake - now);
+}
+
+void hal_disableIdleWatchdog(int core) {}
+
+int hal_getCoreId() {
+    return 0;
+}
+
+uint32_t hal_getTasks(hal_task_info_t *tasks, uint32_t maxCount, uint32_t *totalRunTime) {
+    // The simulation has no tasks, the loops are run by the driving code
+    *totalRunTime = simTime;
+    return 0;
+}
+
+uint32_t hal_getFreeHeap() {
+    return 0;
+}
+
+uint32_t hal_getMinFreeHeap() {
+    return 0;
+}
+
+hal_reset_reason_t hal_getResetReason() {
+    return HAL_RESET_POWER_ON;
+}
+
+hal_mutex_t hal_mutexCreate() {
+    return hal_mutexCreateStatic(malloc(sizeof(pthread_mutex_t)));
+}
+
+hal_mutex_t hal_mutexCreateStatic(hal_mutex_buffer_t *buffer) {
+    pthread_mutex_init(buffer, NULL);
+    return buffer;
+}
+
+bool hal_mutexTake(hal_mutex_t mutex, uint32_t timeoutMs) {
+    return pthread_mutex_lock(mutex) == 0;
+}
+
+void hal_mutexGive(hal_mutex_t mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+hal_queue_t hal_queueCreate(uint32_t length, uint32_t itemSize) {
+    SimQueue *queue = malloc(sizeof(SimQueue) + length * itemSize);
+    return hal_queueCreateStatic(length, itemSize, (uint8_t*)(queue + 1), queue);
+}
+
+hal_queue_t hal_queueCreateStatic(uint32_t length, uint32_t itemSize, uint8_t *storage, hal_queue_buffer_t *queue) {
+    queue->items = storage;
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->head = 0;
+    queue->count = 0;
+    pthread_mutex_init(&queue->mtx, NULL);
+    return queue;
+}
+
+bool hal_queueSend(hal_queue_t q, const void *item) {
+    SimQueue *queue = q;
+    pthread_mutex_lock(&queue->mtx);
+    bool sent = queue->count < queue->length;
+    if (sent) {
+        uint32_t idx = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + idx * queue->itemSize, item, queue->itemSize);
+        queue->count++;
+    }
+    pthread_mutex_unlock(&queue->mtx);
+    return sent;
+}
+
+uint32_t hal_queueCount(hal_queue_t q) {
+    SimQueue *queue = q;
+    pthread_mutex_lock(&queue->mtx);
+    uint32_t count = queue->count;
+    pthread_mutex_unlock(&queue->mtx);
+    return count;
+}
+
+void hal_queueOverwrite(hal_queue_t q, const void *item) {
+    SimQueue *queue = q;
+    pthread_mutex_lock(&queue->mtx);
+    memcpy(queue->items, item, queue->itemSize);
+    queue->head = 0;
+    queue->count = 1;
+    pthread_mutex_unlock(&queue->mtx);
+}
+
+bool hal_queueReceive(hal_queue_t q, void *item) {
+    SimQueue *queue = q;
+    pthread_mutex_lock(&queue->mtx);
+    bool received = queue->count > 0;
+    if (received) {
+        memcpy(item, queue->items + queue->head * queue->itemSize, queue->itemSize);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+    }
+    pthread_mutex_unlock(&queue->mtx);
+    return received;
+}
+
+void gpioChanged(int pin, int8_t level) {
+    if (gpioLevels[pin] == level)
+        return;
+    gpioLevels[pin] = level;
+    if (level < 0)
+        return;
+
+    sim_gpio_edge_t edge = {
+        .time = simTime,
+        .pin = pin,
+        .level = level
+    };
+
+    if (gpioRecording) {
+        if (gpioEdgeCount == gpioEdgeCapacity) {
+            gpioEdgeCapacity = gpioEdgeCapacity == 0 ? 4096 : gpioEdgeCapacity * 2;
+            gpioEdges = realloc(gpioEdges, gpioEdgeCapacity * sizeof(sim_gpio_edge_t));
+        }
+        gpioEdges[gpioEdgeCount++] = edge;
+    }
+    if (gpioListener != NULL)
+        gpioListener(&edge, gpioListenerCtx);
+}
+
+void hal_gpioSetOutput(int pin) {
+    gpioOutput[pin] = true;
+    gpioChanged(pin, gpioLevels[pin] < 0 ? 0 : gpioLevels[pin]);
+}
+
+void hal_gpioSetInput(int pin) {
+    gpioOutput[pin] = false;
+    gpioChanged(pin, -1);
+}
+
+void hal_gpioSetLevel(int pin, uint32_t level) {
+    if (gpioOutput[pin])
+        gpioChanged(pin, level ? 1 : 0);
+}
+
+void hal_gpioPulse(hal_gpio_mask_t mask) {
+    for (int level = 1; level >= 0; level--) {
+        for (hal_gpio_mask_t pins = mask; pins != 0; pins &= pins - 1) {
+            int pin = __builtin_ctzll(pins);
+            if (gpioOutput[pin])
+                gpioChanged(pin, level);
+        }
+    }
+}
+
+void hal_gpioClear(hal_gpio_mask_t mask) {
+    for (hal_gpio_mask_t pins = mask; pins != 0; pins &= pins - 1) {
+        int pin = __builtin_ctzll(pins);
+        if (gpioOutput[pin])
+            gpioChanged(pin, 0);
+    }
+}
+
+uint32_t hal_gpioGetLevel(int pin) {
+    if (gpioOutput[pin])
+        return gpioLevels[pin];
+    return gpioInputLevels[pin];
+}
+
+bool hal_gpioSetInterrupt(int pin, uint32_t level, hal_gpio_isr_t handler, void *arg) {
+    hal_gpioSetInput(pin);
+    gpioInterrupts[pin].handler = handler;
+    gpioInterrupts[pin].arg = arg;
+    gpioInterrupts[pin].level = level ? 1 : 0;
+    return true;
+}
+
+void sim_setGpioInput(int pin, uint32_t level) {
+    level = level ? 1 : 0;
+    if (gpioInputLevels[pin] == level)
+        return;
+    gpioInputLevels[pin] = level;
+    SimGpioInterrupt *interrupt = &gpioInterrupts[pin];
+    if (interrupt->handler != NULL && interrupt->level == level)
+        interrupt->handler(interrupt->arg);
+}
+
+void sim_setGpioListener(sim_gpio_listener_t listener, void *ctx) {
+    gpioListener = listener;
+    gpioListenerCtx = ctx;
+}
+
+void sim_recordGpio(bool enable) {
+    gpioRecording = enable;
+}
+
+const sim_gpio_edge_t *sim_getGpioEdges(size_t *count) {
+    *count = gpioEdgeCount;
+    return gpioEdges;
+}
+
+void sim_clearGpioEdges() {
+    gpioEdgeCount = 0;
+}
+
+int sim_getGpioLevel(int pin) {
+    return gpioLevels[pin];
+}
+
+void sim_uartAttach(int port, int rxFd, int txFd) {
+    uarts[port].rxFd = rxFd;
+    uarts[port].txFd = txFd;
+    uarts[port].rxHead = 0;
+    uarts[port].rxLen = 0;
+    fcntl(rxFd, F_SETFL, fcntl(rxFd, F_GETFL) | O_NONBLOCK);
+}
+
+bool sim_uartOpenPty(int port, char *name, size_t nameLen) {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0)
+        return false;
+
+    // Raw mode, so the line discipline doesn't echo or translate the protocol
+    struct termios tio;
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    if (ptsname_r(master, name, nameLen) != 0)
+        return false;
+    sim_uartAttach(port, master, master);
+    return true;
+}
+
+/**
+ * @brief Moves data waiting in the rx descriptor to the rx buffer
+ */
+void uartFill(SimUart *uart) {
+    if (uart->rxFd < 0)
+        return;
+    if (uart->rxHead > 0) {
+        memmove(uart->rxBuffer, uart->rxBuffer + uart->rxHead, uart->rxLen);
+        uart->rxHead = 0;
+    }
+
+    ssize_t received = read(uart->rxFd, uart->rxBuffer + uart->rxLen, SIM_UART_BUFFER_SIZE - uart->rxLen);
+    if (received > 0)
+        uart->rxLen += received;
+}
+
+void hal_uartInit(int port, int baudRate, int txPin, int rxPin, size_t bufferSize) {}
+
+bool hal_uartSetHalfDuplex(int port, int dePin) {
+    return true;
+}
+
+bool hal_uartSetFlowControl(int port, int rtsPin, int ctsPin) {
+    return true;
+}
+
+int hal_uartRead(int port, void *buffer, size_t len) {
+    SimUart *uart = &uarts[port];
+    if (uart->rxLen < len)
+        uartFill(uart);
+    if (len > uart->rxLen)
+        len = uart->rxLen;
+
+    memcpy(buffer, uart->rxBuffer + uart->rxHead, len);
+    uart->rxHead += len;
+    uart->rxLen -= len;
+    return len;
+}
+
+int hal_uartWrite(int port, const void *buffer, size_t len) {
+    if (uarts[port].txFd < 0)
+        return len;
+    return write(uarts[port].txFd, buffer, len);
+}
+
+size_t hal_uartAvailable(int port) {
+    uartFill(&uarts[port]);
+    return uarts[port].rxLen;
+}
+
+void hal_uartFlushInput(int port) {
+    uartFill(&uarts[port]);
+    uarts[port].rxHead = 0;
+    uarts[port].rxLen = 0;
+}
+
+bool hal_spiInit(int host, int sckPin, int mosiPin, int misoPin) {
+    return true;
+}
+
+SimSpiDevice *findSpiDevice(int csPin) {
+    for (uint32_t i = 0; i < spiDeviceCount; i++) {
+        if (spiDevices[i].csPin == csPin)
+            return &spiDevices[i];
+    }
+    return NULL;
+}
+
+hal_spi_device_t hal_spiAddDevice(int host, int csPin, uint32_t clockHz, uint8_t mode) {
+    if (spiDeviceCount == SIM_SPI_DEVICE_COUNT || findSpiDevice(csPin) != NULL)
+        return NULL;
+    SimSpiDevice *device = &spiDevices[spiDeviceCount++];
+    memset(device, 0, sizeof(SimSpiDevice));
+    device->csPin = csPin;
+    device->registers[0x04] = 0x11000000; // IOIN: TMC2130 version
+    return device;
+}
+
+bool hal_spiTransfer(hal_spi_device_t spiDevice, const uint8_t *tx, uint8_t *rx, size_t len) {
+    SimSpiDevice *device = spiDevice;
+    if (len != SIM_SPI_DATAGRAM_LENGTH)
+        return false;
+    simTime += SIM_SPI_TRANSFER_US;
+
+    uint32_t drvStatus = device->registers[0x6f];
+    uint32_t gstat = device->registers[0x01];
+    rx[0] = (gstat & 0x03) | ((drvStatus >> 22) & 0x04) | ((drvStatus >> 28) & 0x08);
+    for (int i = 0; i < 4; i++)
+        rx[1 + i] = device->replyData >> (24 - 8 * i);
+
+    uint8_t addr = tx[0] & 0x7f;
+    uint32_t data = (uint32_t)tx[1] << 24 | (uint32_t)tx[2] << 16 | (uint32_t)tx[3] << 8 | tx[4];
+    if (tx[0] & 0x80)
+        device->registers[addr] = data;
+    device->replyData = device->registers[addr];
+    return true;
+}
+
+uint32_t sim_spiGetRegister(int csPin, uint8_t addr) {
+    SimSpiDevice *device = findSpiDevice(csPin);
+    return device == NULL ? 0 : device->registers[addr & 0x7f];
+}
+
+void sim_spiSetRegister(int csPin, uint8_t addr, uint32_t value) {
+    SimSpiDevice *device = findSpiDevice(csPin);
+    if (device != NULL)
+        device->registers[addr & 0x7f] = value;
+}
+
+SimPartition *findPartition(const char *label) {
+    for (size_t i = 0; i < SIM_PARTITION_COUNT; i++) {
+        if (strcmp(partitions[i].label, label) == 0)
+            return &partitions[i];
+    }
+    return NULL;
+}
+
+bool sim_partitionAttachFile(const char *label, const char *path) {
+    SimPartition *partition = findPartition(label);
+    if (partition == NULL || partition->data != NULL)
+        return false;
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+    off_t oldSize = lseek(fd, 0, SEEK_END);
+    bool ok = oldSize >= 0 && ftruncate(fd, partition->size) == 0;
+    uint8_t *data = ok ? mmap(NULL, partition->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    // A new (or grown) file reads as erased flash
+    if (oldSize < partition->size)
+        memset(data + oldSize, 0xff, partition->size - oldSize);
+    partition->data = data;
+    return true;
+}
+
+hal_partition_t hal_partitionFind(const char *label) {
+    SimPartition *partition = findPartition(label);
+    if (partition != NULL && partition->data == NULL) {
+        partition->data = malloc(partition->size);
+        memset(partition->data, 0xff, partition->size);
+    }
+    return partition;
+}
+
+uint32_t hal_partitionSize(hal_partition_t partition) {
+    return ((const SimPartition*)partition)->size;
+}
+
+bool hal_partitionErase(hal_partition_t p, uint32_t offset, uint32_t size) {
+    const SimPartition *partition = p;
+    if (offset % HAL_FLASH_SECTOR_SIZE != 0 || size % HAL_FLASH_SECTOR_SIZE != 0 || offset + size > partition->size)
+        return false;
+    memset(partition->data + offset, 0xff, size);
+    return true;
+}
+
+bool hal_partitionWrite(hal_partition_t p, uint32_t offset, const void *data, size_t size) {
+    const SimPartition *partition = p;
+    if (offset + size > partition->size)
+        return false;
+    // Writing can only clear bits, like on a real flash
+    for (size_t i = 0; i < size; i++)
+        partition->data[offset + i] &= ((const uint8_t*)data)[i];
+    return true;
+}
+
+const void *hal_partitionMap(hal_partition_t partition) {
+    return ((const SimPartition*)partition)->data;
+}
+
+SimStorageEntry *findStorageEntry(const char *key) {
+    for (uint32_t i = 0; i < storageEntryCount; i++) {
+        if (strncmp(storageEntries[i].key, key, SIM_STORAGE_KEY_LENGTH) == 0)
+            return &storageEntries[i];
+    }
+    return NULL;
+}
+
+bool setStorageEntry(const char *key, const void *data, size_t size) {
+    SimStorageEntry *entry = findStorageEntry(key);
+    if (entry == NULL) {
+        if (storageEntryCount == SIM_STORAGE_MAX_ENTRIES || strlen(key) >= SIM_STORAGE_KEY_LENGTH)
+            return false;
+        entry = &storageEntries[storageEntryCount++];
+        memset(entry->key, 0, SIM_STORAGE_KEY_LENGTH);
+        strcpy(entry->key, key);
+        entry->data = NULL;
+    }
+    entry->data = realloc(entry->data, size);
+    memcpy(entry->data, data, size);
+    entry->size = size;
+    return true;
+}
+
+bool sim_storageAttachFile(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file != NULL) {
+        char key[SIM_STORAGE_KEY_LENGTH];
+        uint32_t size;
+        while (fread(key, SIM_STORAGE_KEY_LENGTH, 1, file) == 1 && fread(&size, sizeof(size), 1, file) == 1) {
+            uint8_t *data = malloc(size);
+            bool ok = fread(data, size, 1, file) == 1;
+            key[SIM_STORAGE_KEY_LENGTH - 1] = 0;
+            if (ok)
+                setStorageEntry(key, data, size);
+            free(data);
+            if (!ok)
+                break;
+        }
+        fclose(file);
+    }
+    else if (errno != ENOENT)
+        return false;
+    free(storagePath);
+    storagePath = strdup(path);
+    return true;
+}
+
+bool hal_storageInit() {
+    return true;
+}
+
+bool hal_storageRead(const char *key, void *data, size_t size) {
+    SimStorageEntry *entry = findStorageEntry(key);
+    if (entry == NULL || entry->size != size)
+        return false;
+    memcpy(data, entry->data, size);
+    return true;
+}
+
+bool hal_storageWrite(const char *key, const void *data, size_t size) {
+    if (!setStorageEntry(key, data, size))
+        return false;
+    if (storagePath == NULL)
+        return true;
+
+    FILE *file = fopen(storagePath, "wb");
+    if (file == NULL)
+        return false;
+    bool ok = true;
+    for (uint32_t i = 0; i < storageEntryCount; i++) {
+        SimStorageEntry *entry = &storageEntries[i];
+        ok &= fwrite(entry->key, SIM_STORAGE_KEY_LENGTH, 1, file) == 1;
+        ok &= fwrite(&entry->size, sizeof(entry->size), 1, file) == 1;
+        ok &= fwrite(entry->data, entry->size, 1, file) == 1;
+    }
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,36 @@
+#ifndef __SIM_ESP_LOG
+#define __SIM_ESP_LOG
+
+#include <stdio.h>
+#include "hal/hal.h"
+
+/**
+ * @brief Minimal replacement of ESP-IDF logging for the host build. Logs go to stderr, with virtual time in milliseconds.
+ */
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+extern esp_log_level_t sim_logLevel;
+
+#define SIM_LOG(level, letter, tag, format, ...) do { \
+        if (sim_logLevel >= level) \
+            fprintf(stderr, letter " (%lld) %s: " format "\n", (long long)(hal_getTime() / 1000), tag, ##__VA_ARGS__); \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) SIM_LOG(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) SIM_LOG(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) SIM_LOG(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) SIM_LOG(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) SIM_LOG(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...);
+
+#endif
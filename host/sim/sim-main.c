@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <esp_log.h>
+#include "sim.h"
+#include "settings.h"
+#include "comm/comm-task.h"
+#include "comm/uart-ctrl.h"
+#include "motors/motor-task.h"
+#include "log/dlog.h"
+#include "diag/diag.h"
+#include "trajlib/trajlib.h"
+#include "persist/persist.h"
+
+#define TAG "sim"
+#define SIM_DEFAULT_STEP 10 // us
+#define SIM_DIAG_SAMPLE_P 1000000 // us
+
+/**
+ * @brief Simulated mount. Runs the firmware core (settings, communication and motor tasks) on the host, 
+ * with the UART connected to a pseudo-terminal (or stdin/stdout), so the mount can be controlled by the usual clients.
+ * With `--tcp`, the protocol runs over a TCP socket instead (the TCP transport of the firmware).
+ * 
+ * The comm task is run each COMM_TASK_PERIOD, the motor loop in between with the virtual clock moved by `--step`
+ * microseconds per iteration. By default the virtual clock is paced to real time, `--fast` runs as fast as possible.
+ */
+
+MotorQueues motorQueues;
+comm_transport_t tcpTransport;
+comm_tcp_t tcp;
+
+void printUsage(const char *name) {
+    fprintf(stderr, "Usage: %s [--stdio | --tcp <port>] [--fast] [--step <us>] [--flash <file>] [--nvs <file>] [--verbose]\n", name);
+    fprintf(stderr, "  --stdio       Use stdin/stdout as the mount UART instead of a pty\n");
+    fprintf(stderr, "  --tcp <port>  Listen for the client on the TCP port instead of the UART\n");
+    fprintf(stderr, "  --fast        Don't pace the simulation to real time\n");
+    fprintf(stderr, "  --step <us>   Virtual time per motor loop iteration (default %i)\n", SIM_DEFAULT_STEP);
+    fprintf(stderr, "  --flash <file> Keep the trajectory library partition in the file (default: in memory)\n");
+    fprintf(stderr, "  --nvs <file>  Keep the persistent storage (configuration, checkpoint) in the file (default: in memory)\n");
+    fprintf(stderr, "  --verbose     Enable debug logs\n");
+}
+
+int64_t realTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char **argv) {
+    bool useStdio = false;
+    int tcpPort = -1;
+    bool fast = false;
+    int64_t step = SIM_DEFAULT_STEP;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stdio") == 0)
+            useStdio = true;
+        else if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc)
+            tcpPort = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fast") == 0)
+            fast = true;
+        else if (strcmp(argv[i], "--step") == 0 && i + 1 < argc)
+            step = atoll(argv[++i]);
+        else if (strcmp(argv[i], "--flash") == 0 && i + 1 < argc) {
+            if (!sim_partitionAttachFile(TRAJLIB_PARTITION, argv[++i])) {
+                ESP_LOGE(TAG, "Couldn't open flash file %s", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--nvs") == 0 && i + 1 < argc) {
+            if (!sim_storageAttachFile(argv[++i])) {
+                ESP_LOGE(TAG, "Couldn't open storage file %s", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--verbose") == 0) {
+            esp_log_level_set("*", ESP_LOG_DEBUG);
+            dlog_setLevel(ESP_LOG_DEBUG);
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (step <= 0 || tcpPort == 0 || tcpPort > 65535) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (useStdio) {
+        sim_uartAttach(COMM_UART_PORT, STDIN_FILENO, STDOUT_FILENO);
+    }
+    else if (tcpPort < 0) {
+        char ptyName[128];
+        if (!sim_uartOpenPty(COMM_UART_PORT, ptyName, sizeof(ptyName))) {
+            ESP_LOGE(TAG, "Couldn't create pty");
+            return 1;
+        }
+        printf("%s\n", ptyName);
+        fflush(stdout);
+    }
+
+    dlog_init();
+    motorQueues.cmdQueue = hal_queueCreate(10, sizeof(MotorCmd));
+    motorQueues.jogQueue = hal_queueCreate(1, sizeof(JogCmd));
+    mount_initSettings();
+    persist_init();
+    trajlib_init();
+    diag_init();
+    diag_addQueue("motorCmd", motorQueues.cmdQueue);
+    diag_addQueue("jog", motorQueues.jogQueue);
+    if (tcpPort > 0) {
+        if (!transport_initTcp(&tcpTransport, &tcp, tcpPort)) {
+            ESP_LOGE(TAG, "Couldn't listen on TCP port %i", tcpPort);
+            return 1;
+        }
+        comm_initTransport(&tcpTransport);
+    }
+    else {
+        comm_init();
+    }
+    motor_taskInit(&motorQueues);
+    ESP_LOGI(TAG, "Simulation running");
+
+    int64_t realStart = realTime();
+    int64_t simStart = hal_getTime();
+    int64_t nextComm = simStart;
+    int64_t nextDiag = simStart;
+    for (;;) {
+        if (hal_getTime() >= nextComm) {
+            comm_runPeriodic();
+            while (comm_processNext(&motorQueues));
+            dlog_drain();
+            nextComm += COMM_TASK_PERIOD * 1000;
+        }
+        if (hal_getTime() >= nextDiag) {
+            diag_sample();
+            nextDiag += SIM_DIAG_SAMPLE_P;
+        }
+
+        motor_taskRun();
+        sim_advance(step);
+
+        if (!fast) {
+            int64_t ahead = (hal_getTime() - simStart) - (realTime() - realStart);
+            if (ahead > 1000)
+                usleep(ahead);
+        }
+    }
+    return 0;
+}
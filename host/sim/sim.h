@@ -0,0 +1,119 @@
+#ifndef __MOUNT_SIM
+#define __MOUNT_SIM
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Controls of the simulation HAL backend (hal-sim.c). The firmware core sees the simulation only through hal.h,
+ * these functions are for the code driving the simulation (sim-main.c, benchmarks).
+ * 
+ * The clock is virtual - it only moves when sim_advance (or hal_delay) is called, so a simulation run is deterministic.
+ */
+
+/**
+ * @brief Recorded GPIO level change
+ * 
+ */
+typedef struct SimGpioEdge {
+    /**
+     * @brief Virtual time of the change (in microseconds)
+     * 
+     */
+    int64_t time;
+    int pin;
+    uint8_t level;
+} sim_gpio_edge_t;
+
+typedef void (*sim_gpio_listener_t)(const sim_gpio_edge_t *edge, void *ctx);
+
+/**
+ * @brief Sets the virtual clock
+ * 
+ * @param time Time in microseconds
+ */
+void sim_setTime(int64_t time);
+/**
+ * @brief Moves the virtual clock forward
+ * 
+ * @param dt Time in microseconds
+ */
+void sim_advance(int64_t dt);
+
+/**
+ * @brief Sets a function called on each level change of an output pin. Pass NULL to remove it.
+ * 
+ */
+void sim_setGpioListener(sim_gpio_listener_t listener, void *ctx);
+/**
+ * @brief Enables recording of output pin level changes into a buffer readable by sim_getGpioEdges
+ * 
+ */
+void sim_recordGpio(bool enable);
+const sim_gpio_edge_t *sim_getGpioEdges(size_t *count);
+void sim_clearGpioEdges();
+/**
+ * @brief Returns the current pin level, or -1 if the pin is a floating input
+ * 
+ */
+int sim_getGpioLevel(int pin);
+/**
+ * @brief Drives an input pin from the outside (a switch), calling its interrupt handler (hal_gpioSetInterrupt) 
+ * right away on the configured edge, like the interrupt would
+ * 
+ */
+void sim_setGpioInput(int pin, uint32_t level);
+
+/**
+ * @brief Reads a register of the mock SPI device (TMC2130) with the chip select pin
+ * 
+ * @return uint32_t Register value, 0 if there is no such device
+ */
+uint32_t sim_spiGetRegister(int csPin, uint8_t addr);
+/**
+ * @brief Sets a register of the mock SPI device, e.g. DRV_STATUS (0x6f) to simulate a stall or a driver error
+ * 
+ */
+void sim_spiSetRegister(int csPin, uint8_t addr, uint32_t value);
+
+/**
+ * @brief Connects the simulated UART port to file descriptors (pipes, sockets, stdin/stdout...)
+ * 
+ * @param port UART port number used by the firmware
+ * @param rxFd Descriptor the firmware reads from
+ * @param txFd Descriptor the firmware writes to
+ */
+void sim_uartAttach(int port, int rxFd, int txFd);
+
+/**
+ * @brief Connects the simulated UART port to a new pseudo-terminal
+ * 
+ * @param port UART port number used by the firmware
+ * @param name Path of the pty slave (to be opened by the client) is written here
+ * @param nameLen Length of `name`
+ * @return true Success
+ * @return false Couldn't create the pty
+ */
+bool sim_uartOpenPty(int port, char *name, size_t nameLen);
+/**
+ * @brief Backs the simulated flash partition by a file, so its content persists between runs. Must be called before
+ * the firmware looks the partition up.
+ * 
+ * @param label Partition label
+ * @param path File path, created (as an erased flash) if it doesn't exist
+ * @return true Success
+ * @return false Unknown partition, already in use or the file couldn't be mapped
+ */
+bool sim_partitionAttachFile(const char *label, const char *path);
+/**
+ * @brief Backs the simulated persistent storage (NVS) by a file, so it persists between runs. Must be called before
+ * the firmware reads the storage.
+ * 
+ * @param path File path, created on the first write if it doesn't exist
+ * @return true Success
+ * @return false The file exists, but couldn't be opened
+ */
+bool sim_storageAttachFile(const char *path);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef __MOUNT_BOARD
+#define __MOUNT_BOARD
+
+/**
+ * @brief Board profiles - pin assignment, driver wiring and axis gearing of the supported boards, in one place.
+ *
+ * The profile is selected by the `MOUNT_BOARD` choice (`idf.py menuconfig`, "ESP mount" menu, see main/Kconfig.projbuild),
+ * the host build sets the same CONFIG_MOUNT_BOARD_* define from its `MOUNT_BOARD` cache variable. A new board gets
+ * a choice entry in Kconfig.projbuild and a block below defining all the BOARD_ and pin macros.
+ *
+ * The step pins of both axes should be in the same GPIO bank (0-31 or 32-39), the steps of both axes are then
+ * pulsed by a single register write (see hal_gpioPulse).
+ *
+ * The emergency stop and limit switch inputs (BOARD_ESTOP_PIN, BOARD_LIMIT_PIN, -1 if not wired) depend on the wiring
+ * rather than the board, they are set by the MOUNT_ESTOP_PIN and MOUNT_LIMIT_PIN options and are off by default.
+ * They have the internal pull-up enabled, so they need pins with pull-ups (not 34-39), and shouldn't take the JTAG
+ * (12-15) or strapping pins. With BOARD_FAULT_ACTIVE_LEVEL 1, normally closed switches to ground are expected - an open
+ * switch or a broken wire stops the mount.
+ *
+ * COMM_PIN_DE is the driver enable pin of an RS-485 transceiver (the UART then runs half-duplex, the transmitter is 
+ * enabled only while a reply is sent), -1 for a plain UART link.
+ * COMM_PIN_RTS and COMM_PIN_CTS enable the hardware flow control of a plain UART link, -1 if not wired.
+ */
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+#if defined(CONFIG_MOUNT_BOARD_DEVKIT_SPI)
+/**
+ * @brief ESP32 devkit with the TMC2130 drivers in SPI mode - the CFG0-CFG3 pins of the drivers are SDO, SDI, SCK and CS
+ */
+#define BOARD_NAME "devkit-spi"
+#define MOTOR_DRIVER_SPI
+
+#define MOTOR_DEC_STEP_PIN 21
+#define MOTOR_DEC_DIR_PIN 19
+#define MOTOR_DEC_CS_PIN 33
+#define MOTOR_RA_STEP_PIN 2
+#define MOTOR_RA_DIR_PIN 32
+#define MOTOR_RA_CS_PIN 4
+#define MOTOR_SPI_HOST 2
+#define MOTOR_SPI_SCK_PIN 18
+#define MOTOR_SPI_MOSI_PIN 23
+#define MOTOR_SPI_MISO_PIN 22
+/**
+ * @brief Unused, the resolution is set over SPI
+ */
+#define MOTOR_DEC_CFG1_PIN -1
+#define MOTOR_DEC_CFG2_PIN -1
+#define MOTOR_RA_CFG1_PIN -1
+#define MOTOR_RA_CFG2_PIN -1
+
+#define COMM_PIN_TX 26
+#define COMM_PIN_RX 27
+#define COMM_PIN_DE -1
+#define COMM_PIN_RTS -1
+#define COMM_PIN_CTS -1
+#define BOARD_LED_PIN 25
+
+#define CPR_AX1 2304000
+#define CPR_AX2 2304000
+
+#else
+/**
+ * @brief ESP32 devkit with the TMC2130 drivers in standalone mode, the resolution is set by the CFG1 and CFG2 pins (default)
+ */
+#define BOARD_NAME "devkit"
+
+#define MOTOR_DEC_STEP_PIN 21
+#define MOTOR_DEC_DIR_PIN 19
+#define MOTOR_DEC_CFG1_PIN 23
+#define MOTOR_DEC_CFG2_PIN 22
+#define MOTOR_RA_STEP_PIN 2
+#define MOTOR_RA_DIR_PIN 32
+#define MOTOR_RA_CFG1_PIN 18
+#define MOTOR_RA_CFG2_PIN 33
+
+#define COMM_PIN_TX 26
+#define COMM_PIN_RX 27
+#define COMM_PIN_DE -1
+#define COMM_PIN_RTS -1
+#define COMM_PIN_CTS -1
+#define BOARD_LED_PIN 25
+
+/**
+ * @brief Steps per full rotation for the first axis.
+ */
+#define CPR_AX1 2304000
+/**
+ * @brief Steps per full rotation for the second axis.
+ *
+ */
+#define CPR_AX2 2304000
+#endif
+
+#ifdef CONFIG_MOUNT_ESTOP_PIN
+#define BOARD_ESTOP_PIN CONFIG_MOUNT_ESTOP_PIN
+#else
+#define BOARD_ESTOP_PIN -1
+#endif
+#ifdef CONFIG_MOUNT_LIMIT_PIN
+#define BOARD_LIMIT_PIN CONFIG_MOUNT_LIMIT_PIN
+#else
+#define BOARD_LIMIT_PIN -1
+#endif
+#define BOARD_FAULT_ACTIVE_LEVEL 1
+
+#endif
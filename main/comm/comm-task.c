@@ -1,13 +1,26 @@
 #include "comm-task.h"
 #include "uart-ctrl.h"
-#include <esp_log.h>
+#include "../log/dlog.h"
 #include "../settings.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
+#include "../hal/hal.h"
 #include "../config.h"
-#include "../motors/motor-task.h"
+#include "../persist/persist.h"
 #define TAG "comm-task"
 
+/**
+ * @brief Track streaming mode (+tsm). The client holds credits - the track points it may send - and the device grants
+ * more as the tracking frees the buffer, so the client never overruns it. The credits held by the client are
+ * `streamGranted - streamReceived`.
+ */
+bool streamEnabled = false;
+uint32_t streamWatermark = 0;
+uint32_t streamGranted = 0;
+uint32_t streamReceived = 0;
+/**
+ * @brief Set while the points left for the tracking are below the watermark, the alert is sent once per crossing
+ */
+bool streamLow = false;
+
 mount_status_t mountStatusToStatusCode(MountStatus status) {
     switch (status)
     {
@@ -22,147 +35,511 @@ mount_status_t mountStatusToStatusCode(MountStatus status) {
     
     case MOUNT_STATUS_TRACKING:
         return MOUNT_STATUS_CODE_TRACKING;
+
+    case MOUNT_STATUS_ARMED:
+        return MOUNT_STATUS_CODE_ARMED;
+
+    case MOUNT_STATUS_VELOCITY:
+        return MOUNT_STATUS_CODE_VELOCITY;
+
+    case MOUNT_STATUS_FAULT:
+        return MOUNT_STATUS_CODE_FAULT;
     }
 
     return -1;
 }
 
-void comm_task(void *args) {
-    comm_init();
+const char *trajlibErrorStr(uint8_t code) {
+    switch (code)
+    {
+    case TRAJLIB_ERR_NO_PARTITION:
+        return "No trajectory library partition";
+    case TRAJLIB_ERR_EXISTS:
+        return "Trajectory already exists";
+    case TRAJLIB_ERR_FULL:
+        return "Trajectory library full";
+    case TRAJLIB_ERR_NOT_WRITING:
+        return "No trajectory being written";
+    case TRAJLIB_ERR_EMPTY:
+        return "Trajectory has no points";
+    case TRAJLIB_ERR_FLASH:
+        return "Flash write failed";
+    }
+
+    return "Trajectory library error";
+}
+
+const char *persistErrorStr(uint8_t code) {
+    switch (code)
+    {
+    case PERSIST_ERR_AXIS:
+        return "Invalid axis";
+    case PERSIST_ERR_PARAM:
+        return "Unknown parameter";
+    case PERSIST_ERR_VALUE:
+        return "Invalid parameter value";
+    case PERSIST_ERR_STORAGE:
+        return "Configuration couldn't be stored";
+    }
+
+    return "Configuration error";
+}
+
+/**
+ * @brief Checks the trajectory library can be written - flash writes stall both cores, so the mount must be stopped. 
+ * Sends the error response if not.
+ * 
+ */
+bool checkTrajlibWritable() {
+    if (mount_getStatus() == MOUNT_STATUS_STOPPED)
+        return true;
+    comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Mount must be stopped to write the trajectory library");
+    return false;
+}
+
+/**
+ * @brief Checks there is no latched fault, which blocks the motion commands. Sends the error response if there is.
+ * 
+ */
+bool checkNoFault() {
+    if (motor_getFault() == 0)
+        return true;
+    comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Fault latched, clear it by +fc");
+    return false;
+}
+
+inline bool isMotionMsg(cmd_t cmd) {
+    return cmd == MOUNT_MSG_CMD_GOTO || cmd == MOUNT_MSG_CMD_TRACKING_BEGIN || cmd == MOUNT_MSG_CMD_TRACKING_BEGIN_AT
+        || cmd == MOUNT_MSG_CMD_JOG;
+}
 
-    TickType_t lastTicks = xTaskGetTickCount();
-    QueueHandle_t motorCmdQueue = args;
+bool comm_processNext(MotorQueues *queues) {
+    hal_queue_t motorCmdQueue = queues->cmdQueue;
+    MountMsg msg = comm_getNext();
+    if (msg.cmd == MOUNT_MSG_CMD_NONE) {
+        return false;
+    }
     
-    for(;;) {
-        MountMsg msg = comm_getNext();
-        if (msg.cmd == MOUNT_MSG_CMD_NONE) {
-            vTaskDelayUntil(&lastTicks, COMM_TASK_PERIOD / portTICK_PERIOD_MS);
-            int64_t t1 = esp_timer_get_time();
-            continue;
-        }
-        
-        if (msg.cmd == MOUNT_MSG_CMD_NONE) {}
-        else if (msg.cmd == MOUNT_MSG_CMD_TIME_SYNC) {
-            mount_setTime(msg.data.time);
-            uint64_t mountTime;
-            mount_getTime(&mountTime);
-            ESP_LOGI(TAG, "Received time %llu", mountTime);
-            comm_sendTimeResponse(mountTime);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_SET_POS) {
-            MountMsg_SetPos pos = msg.data.setPos;
-            mount_setPos(pos.ax1, pos.ax2);
-            ESP_LOGI(TAG, "Received new pos: [%lli %lli]", pos.ax1, pos.ax2);
-            MotorPosData data = {
-                .ax1 = pos.ax1,
-                .ax2 = pos.ax2
-            };
+    if (isMotionMsg(msg.cmd) && !checkNoFault()) {}
+    else if (msg.cmd == MOUNT_MSG_CMD_TIME_SYNC) {
+        mount_setTime(msg.data.time);
+        uint64_t mountTime;
+        mount_getTime(&mountTime);
+        DLOGI(TAG, "Received time %llu", mountTime);
+        comm_sendTimeResponse(mountTime);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_SET_POS) {
+        MountMsg_SetPos pos = msg.data.setPos;
+        mount_setPos(pos.ax1, pos.ax2);
+        DLOGI(TAG, "Received new pos: [%lli %lli]", pos.ax1, pos.ax2);
+        MotorPosData data = {
+            .ax1 = pos.ax1,
+            .ax2 = pos.ax2
+        };
 
-            MotorCmd cmd = {
-                .type = CMD_POSITION_UPDATE,
-                .data = {
-                    .pos = data
-                }
-            };
-            xQueueSend(motorCmdQueue, &cmd, 0);
-            comm_sendSetPosResponse(pos.ax1, pos.ax2);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_POS) {
-            step_t ax1, ax2;
-            if (mount_getPos(&ax1, &ax2))
-                comm_sendGetPosResponse(ax1, ax2);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_TIME) {
-            uint64_t time;
-            mount_getTime(&time);
-            comm_sendGetTimeResponse(time);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GOTO) {
-            MountMsg_Goto gotoData = msg.data.goTo;
-            ESP_LOGI(TAG, "Received goto msg: [%lli %lli]", gotoData.ax1, gotoData.ax2);
-            MotorPosData data = {
-                .ax1 = msg.data.goTo.ax1,
-                .ax2 = msg.data.goTo.ax2
-            };
+        MotorCmd cmd = {
+            .type = CMD_POSITION_UPDATE,
+            .data = {
+                .pos = data
+            }
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendSetPosResponse(pos.ax1, pos.ax2);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_POS) {
+        step_t ax1, ax2;
+        if (mount_getPos(&ax1, &ax2))
+            comm_sendGetPosResponse(ax1, ax2);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_TIME) {
+        uint64_t time;
+        mount_getTime(&time);
+        comm_sendGetTimeResponse(time);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GOTO) {
+        MountMsg_Goto gotoData = msg.data.goTo;
+        DLOGI(TAG, "Received goto msg: [%lli %lli]", gotoData.ax1, gotoData.ax2);
+        MotorPosData data = {
+            .ax1 = msg.data.goTo.ax1,
+            .ax2 = msg.data.goTo.ax2
+        };
 
-            MotorCmd cmd = {
-                .type = CMD_GOTO,
-                .data = {
-                    .pos = data
-                }
-            };
+        MotorCmd cmd = {
+            .type = CMD_GOTO,
+            .data = {
+                .pos = data
+            }
+        };
 
-            xQueueSend(motorCmdQueue, &cmd, 0);
-            comm_sendGotoResponse(gotoData.ax1, gotoData.ax2);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_STOP) {
-            ESP_LOGI(TAG, "Received stop msg (instant: %hhi)", msg.data.stopInstant);
-            MotorCmd cmd = {
-                .type = CMD_STOP,
-                .data = {
-                    .instantStop = msg.data.stopInstant
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendGotoResponse(gotoData.ax1, gotoData.ax2);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_STOP) {
+        DLOGI(TAG, "Received stop msg (instant: %hhi)", msg.data.stopInstant);
+        MotorCmd cmd = {
+            .type = CMD_STOP,
+            .data = {
+                .instantStop = msg.data.stopInstant
+            }
+        };
+
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendStopResponse(msg.data.stopInstant);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_CPR) {
+        DLOGI(TAG, "Received cpr request");
+        persist_axis_config_t ax1, ax2;
+        if (persist_getAxisConfig(1, &ax1) && persist_getAxisConfig(2, &ax2))
+            comm_sendCprResponse(ax1.cpr, ax2.cpr);
+        else
+            comm_sendError(MOUNT_ERR_CODE_INTERNAL, "Configuration not available");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_STATUS) {
+        MountStatus status = mount_getStatus();
+        comm_sendStatusResponse(mountStatusToStatusCode(status), motor_getFault());
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_PROTOCOL_VERSION) {
+        DLOGI(TAG, "Requested protocol version");
+        comm_sendProtocolVersionResponse();
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_TRACK_BUF_FREE_SPACE) {
+        DLOGI(TAG, "Requested track buffer free space");
+        comm_sendTrackBufferFreeSpaceResponse(mount_getTrackBufferFreeSpace());
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_TRACK_BUF_SIZE) {
+        DLOGI(TAG, "Requested track buffer size");
+        comm_sendTrackBufferSizeResponse(mount_getTrackBufferSize());
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_BUF_CLEAR) {
+        DLOGI(TAG, "Requested track buffer clear");
+        mount_clearTrackBuffer();
+        comm_sendTrackBufferClearResponse();
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_ADD_POINT) {
+        uint8_t successCode = mount_pushTrackPoint(msg.data.trackPoint);
+        if (streamEnabled)
+            streamReceived++;
+        comm_sendAddTrackPointResponse(successCode);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACKING_BEGIN) {
+        DLOGI(TAG, "Received track begin request");
+        MotorCmd cmd = {
+            .type = CMD_TRACK_BEGIN
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendTrackingBeginResponse();
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACKING_STOP) {
+        DLOGI(TAG, "Received track stop reqeust");
+        MotorCmd cmd = {
+            .type = CMD_TRACK_STOP
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendTrackingStopRespone();
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACKING_BEGIN_AT) {
+        DLOGI(TAG, "Received track begin request at %llu", msg.data.time);
+        MotorCmd cmd = {
+            .type = CMD_TRACK_BEGIN_AT,
+            .data = {
+                .time = msg.data.time
+            }
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendTrackingBeginAtResponse(msg.data.time);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_JOG) {
+        JogCmd cmd = {
+            .v1 = msg.data.jog.v1,
+            .v2 = msg.data.jog.v2
+        };
+        hal_queueOverwrite(queues->jogQueue, &cmd);
+        comm_sendJogResponse();
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_OFFSET) {
+        MotorCmd cmd = {
+            .type = CMD_TRACK_OFFSET,
+            .data = {
+                .pos = {
+                    .ax1 = msg.data.trackOffset.ax1,
+                    .ax2 = msg.data.trackOffset.ax2
                 }
-            };
+            }
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendTrackOffsetResponse(msg.data.trackOffset.ax1, msg.data.trackOffset.ax2);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_RATE_OFFSET) {
+        MotorCmd cmd = {
+            .type = CMD_TRACK_RATE_OFFSET,
+            .data = {
+                .rate = {
+                    .r1 = msg.data.trackRate.r1,
+                    .r2 = msg.data.trackRate.r2
+                }
+            }
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendTrackRateOffsetResponse(msg.data.trackRate.r1, msg.data.trackRate.r2);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_TIME_SHIFT) {
+        MotorCmd cmd = {
+            .type = CMD_TRACK_TIME_SHIFT,
+            .data = {
+                .timeShift = msg.data.timeShift
+            }
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendTrackTimeShiftResponse(msg.data.timeShift);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_BUF_NEXT) {
+        DLOGI(TAG, "Requested next track buffer");
+        comm_sendTrackBufferNextResponse(mount_prepareNextTrackBuffer());
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_BUF_SWAP) {
+        DLOGI(TAG, "Requested track buffer swap at %llu", msg.data.time);
+        if (mount_scheduleTrackBufferSwap(msg.data.time))
+            comm_sendTrackBufferSwapResponse(msg.data.time);
+        else
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "No track buffer prepared");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_STATS) {
+        motor_stats_t stats;
+        if (motor_getStats(msg.data.axis, &stats))
+            comm_sendStatsResponse(msg.data.axis, &stats);
+        else
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Statistics not available for this axis");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_RESET_STATS) {
+        DLOGI(TAG, "Requested statistics reset");
+        MotorCmd cmd = {
+            .type = CMD_RESET_STATS
+        };
+        hal_queueSend(motorCmdQueue, &cmd);
+        comm_sendResetStatsResponse();
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_TRACE) {
+        // Events older than the buffer are skipped, the client sees the gap in sequence numbers
+        uint32_t seq = msg.data.getTrace.from;
+        uint32_t oldest = trace_getOldest();
+        uint32_t next = trace_getNext();
+        if ((int32_t)(seq - oldest) < 0)
+            seq = oldest;
+        if ((int32_t)(seq - next) > 0)
+            seq = next;
+        uint32_t max = msg.data.getTrace.max < COMM_TRACE_DUMP_MAX ? msg.data.getTrace.max : COMM_TRACE_DUMP_MAX;
 
-            xQueueSend(motorCmdQueue, &cmd, 0);
-            comm_sendStopResponse(msg.data.stopInstant);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_CPR) {
-            ESP_LOGI(TAG, "Received cpr request");
-            comm_sendCprResponse(CPR_AX1, CPR_AX2);
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_STATUS) {
-            MountStatus status = mount_getStatus();
-            comm_sendStatusResponse(mountStatusToStatusCode(status));
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_PROTOCOL_VERSION) {
-            ESP_LOGI(TAG, "Requested protocol version");
-            comm_sendProtocolVersionResponse();
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_TRACK_BUF_FREE_SPACE) {
-            ESP_LOGI(TAG, "Requested track buffer free space");
-            comm_sendTrackBufferFreeSpaceResponse(mount_getTrackBufferFreeSpace());
+        uint32_t count = 0;
+        trace_event_t event;
+        while (count < max && (int32_t)(trace_getNext() - seq) > 0) {
+            if (trace_read(seq, &event)) {
+                comm_sendTraceEvent(seq, &event);
+                count++;
+            }
+            seq++;
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_GET_TRACK_BUF_SIZE) {
-            ESP_LOGI(TAG, "Requested track buffer size");
-            comm_sendTrackBufferSizeResponse(mount_getTrackBufferSize());
-        }
-        else if (msg.cmd == MOUNT_MSG_CMD_TRACK_BUF_CLEAR) {
-            ESP_LOGI(TAG, "Requested track buffer clear");
-            mount_clearTrackBuffer();
-            comm_sendTrackBufferClearResponse();
+        comm_sendTraceResponse(seq, count);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_DIAG) {
+        diag_task_t tasks[DIAG_MAX_TASKS];
+        diag_queue_t queues[DIAG_MAX_QUEUES];
+        uint32_t taskCount = diag_getTasks(tasks, DIAG_MAX_TASKS);
+        uint32_t queueCount = diag_getQueues(queues, DIAG_MAX_QUEUES);
+        for (uint32_t i = 0; i < taskCount; i++)
+            comm_sendDiagTask(&tasks[i]);
+        for (uint32_t i = 0; i < queueCount; i++)
+            comm_sendDiagQueue(&queues[i]);
+        comm_sendDiagResponse(hal_getFreeHeap(), hal_getMinFreeHeap(), dlog_getDropped(), taskCount, mount_getTrackWindowMisses());
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRAJLIB_BEGIN) {
+        DLOGI(TAG, "Requested trajectory library write");
+        if (checkTrajlibWritable()) {
+            uint8_t result = trajlib_begin(msg.data.name);
+            if (result == TRAJLIB_OK)
+                comm_sendTrajlibBeginResponse(msg.data.name);
+            else
+                comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, trajlibErrorStr(result));
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_TRACK_ADD_POINT) {
-            uint8_t successCode = mount_pushTrackPoint(msg.data.trackPoint);
-            comm_sendAddTrackPointResponse(successCode);
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRAJLIB_POINT) {
+        if (checkTrajlibWritable())
+            comm_sendTrajlibPointResponse(trajlib_append(msg.data.trackPoint));
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRAJLIB_END) {
+        uint32_t count;
+        uint8_t result = trajlib_end(&count);
+        if (result == TRAJLIB_OK)
+            comm_sendTrajlibEndResponse(count);
+        else
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, trajlibErrorStr(result));
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRAJLIB_LIST) {
+        uint32_t count = trajlib_getCount();
+        trajlib_entry_t entry;
+        for (uint32_t i = 0; i < count && trajlib_getEntry(i, &entry); i++)
+            comm_sendTrajlibEntry(i, &entry);
+        comm_sendTrajlibListResponse(count, trajlib_getFreePoints());
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRAJLIB_REPLAY) {
+        DLOGI(TAG, "Requested trajectory replay");
+        uint32_t count;
+        const TrackPoint *points = trajlib_find(msg.data.trajlibReplay.name, &count);
+        if (points == NULL)
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Trajectory not found");
+        else if (mount_mapTrackBuffer(points, count, msg.data.trajlibReplay.startTime))
+            comm_sendTrajlibReplayResponse(count);
+        else
+            comm_sendError(MOUNT_ERR_CODE_INTERNAL, "Track buffer not available");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRAJLIB_CLEAR) {
+        DLOGI(TAG, "Requested trajectory library clear");
+        if (checkTrajlibWritable()) {
+            mount_releaseMappedTrackBuffers();
+            uint8_t result = trajlib_clear();
+            if (result == TRAJLIB_OK)
+                comm_sendTrajlibClearResponse();
+            else
+                comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, trajlibErrorStr(result));
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_TRACKING_BEGIN) {
-            ESP_LOGI(TAG, "Received track begin request");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_CONFIG) {
+        persist_axis_config_t config;
+        if (persist_getAxisConfig(msg.data.axis, &config))
+            comm_sendConfigResponse(msg.data.axis, &config);
+        else
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Configuration not available for this axis");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_SET_CONFIG) {
+        DLOGI(TAG, "Requested configuration change");
+        MountMsg_SetConfig *setConfig = &msg.data.setConfig;
+        uint8_t result = persist_setAxisParam(setConfig->axis, setConfig->name, setConfig->value);
+        if (result == PERSIST_OK || result == PERSIST_ERR_STORAGE) {
+            // Even when it couldn't be stored, the value is set until reset
             MotorCmd cmd = {
-                .type = CMD_TRACK_BEGIN
+                .type = CMD_CONFIG_UPDATE
             };
-            xQueueSend(motorCmdQueue, &cmd, 0);
-            comm_sendTrackingBeginResponse();
+            hal_queueSend(motorCmdQueue, &cmd);
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_TRACKING_STOP) {
-            ESP_LOGI(TAG, "Received track stop reqeust");
+        if (result == PERSIST_OK)
+            comm_sendSetConfigResponse(setConfig->axis, setConfig->name, setConfig->value);
+        else
+            comm_sendError(result == PERSIST_ERR_STORAGE ? MOUNT_ERR_CODE_INTERNAL : MOUNT_ERR_CODE_INVALID_MSG, persistErrorStr(result));
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_GET_CHECKPOINT) {
+        persist_checkpoint_t checkpoint;
+        uint8_t source = persist_getRestored(&checkpoint);
+        comm_sendCheckpointResponse(source, &checkpoint, mountStatusToStatusCode(checkpoint.status));
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_FAULT_CLEAR) {
+        uint8_t active = motor_getFaultInputs();
+        DLOGI(TAG, "Requested fault clear (active inputs %hhu)", active);
+        if (active == 0) {
             MotorCmd cmd = {
-                .type = CMD_TRACK_STOP
+                .type = CMD_FAULT_CLEAR
             };
-            xQueueSend(motorCmdQueue, &cmd, 0);
-            comm_sendTrackingStopRespone();
+            hal_queueSend(motorCmdQueue, &cmd);
+            comm_sendFaultClearResponse();
+        }
+        else {
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Fault input still active");
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_ERR_INVALID_CMD) {
-            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Invalid command received");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_SET_ADDRESS) {
+        DLOGI(TAG, "Requested address change to %hhu", msg.data.address);
+        if (streamEnabled && msg.data.address != COMM_ADDRESS_NONE) {
+            // Same as +tsm, the unsolicited lines would collide on the bus
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Disable streaming (+tsm 0) first");
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_ERR_INVALID_PARAM) {
-            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Invalid parameter received");
+        else if (persist_setAddress(msg.data.address)) {
+            // The reply still goes out with the old address
+            comm_sendSetAddressResponse(msg.data.address);
+            comm_setAddress(msg.data.address);
         }
-        else if (msg.cmd == MOUNT_MSG_CMD_ERR_UNKNOWN_CMD) {
-            comm_sendError(MOUNT_ERR_CODE_UNKNOWN_CMD, "Unknown command received");
+        else {
+            comm_sendError(MOUNT_ERR_CODE_INTERNAL, "Couldn't store the address");
+        }
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_TRACK_STREAM) {
+        DLOGI(TAG, "Requested track streaming %hhu (watermark %u)", msg.data.trackStream.enable, msg.data.trackStream.watermark);
+        if (msg.data.trackStream.enable && comm_getAddress() != COMM_ADDRESS_NONE) {
+            // Unsolicited lines would collide with the replies of the other devices on the bus
+            comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Streaming needs a point-to-point link");
         }
         else {
-            comm_sendError(MOUNT_ERR_CODE_INTERNAL, "Unimplemented command");
+            streamEnabled = msg.data.trackStream.enable;
+            streamWatermark = msg.data.trackStream.watermark;
+            streamGranted = streamEnabled ? mount_getTrackBufferFreeSpace() : 0;
+            streamReceived = 0;
+            streamLow = false;
+            comm_sendTrackStreamResponse(streamGranted);
         }
     }
+    else if (msg.cmd == MOUNT_MSG_CMD_ERR_INVALID_CMD) {
+        comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Invalid command received");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_ERR_INVALID_PARAM) {
+        comm_sendError(MOUNT_ERR_CODE_INVALID_MSG, "Invalid parameter received");
+    }
+    else if (msg.cmd == MOUNT_MSG_CMD_ERR_UNKNOWN_CMD) {
+        comm_sendError(MOUNT_ERR_CODE_UNKNOWN_CMD, "Unknown command received");
+    }
+    else {
+        comm_sendError(MOUNT_ERR_CODE_INTERNAL, "Unimplemented command");
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sends the credit grants and the low watermark alert of the track streaming mode
+ * 
+ */
+void updateStream() {
+    if (!streamEnabled)
+        return;
+
+    // Credits the client holds are reserved, even if it doesn't use them. Points sent over the credits are already
+    // in the buffer (or rejected), the free space accounts for them.
+    if ((int32_t)(streamGranted - streamReceived) < 0)
+        streamGranted = streamReceived;
+    uint32_t held = streamGranted - streamReceived;
+    uint32_t freeSpace = mount_getTrackBufferFreeSpace();
+    if (freeSpace >= held + COMM_STREAM_GRANT_MIN) {
+        uint32_t credits = freeSpace - held;
+        comm_sendStreamCredits(credits);
+        streamGranted += credits;
+    }
+
+    uint32_t count;
+    uint64_t lastTime, time;
+    int64_t shift;
+    if (streamWatermark == 0 || mount_getStatus() != MOUNT_STATUS_TRACKING || !mount_getTrackBufferLevel(&count, &lastTime))
+        return;
+    if (count >= streamWatermark) {
+        streamLow = false;
+    }
+    else if (!streamLow && mount_getTime(&time) && mount_getTrackTimeShift(&shift)) {
+        streamLow = true;
+        // The last point is reached at its time moved by +tt
+        int64_t timeToEmpty = (int64_t)(lastTime - time) + shift;
+        comm_sendLowWatermarkAlert(count, timeToEmpty > 0 ? (uint64_t)timeToEmpty : 0);
+    }
+}
+
+void comm_runPeriodic() {
+    mount_prefetchTrackPoints();
+    persist_checkpoint();
+    updateStream();
+}
+
+void comm_task(void *args) {
+    comm_init();
+
+    hal_tick_t lastTicks = hal_getTicks();
+    
+    for(;;) {
+        comm_runPeriodic();
+        if (!comm_processNext(args))
+            hal_delayUntil(&lastTicks, COMM_TASK_PERIOD);
+    }
 }
\ No newline at end of file
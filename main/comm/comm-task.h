@@ -1,8 +1,39 @@
 #ifndef __COMM_TASK
 #define __COMM_TASK
 
+#include <stdbool.h>
+#include "../motors/motor-task.h"
+
 #define COMM_TASK_PERIOD 10
+/**
+ * @brief Maximum number of motion trace events sent in response to a single trace dump command
+ */
+#define COMM_TRACE_DUMP_MAX 64
+/**
+ * @brief Smallest credit grant of the track streaming mode. Larger grants mean fewer unsolicited lines, but the buffer
+ * is refilled later.
+ */
+#define COMM_STREAM_GRANT_MIN 16
 
+/**
+ * @brief Receives the next message (if there is any), executes it and sends the response.
+ * 
+ * @param queues Queues to the motor task
+ * @return true A message was processed
+ * @return false No message was received
+ */
+bool comm_processNext(MotorQueues *queues);
+/**
+ * @brief Work of the communication task besides the messages - track point prefetch, position checkpoint, and
+ * the credit grants and alerts of the track streaming mode. Called before each message.
+ * 
+ */
+void comm_runPeriodic();
+/**
+ * @brief Communication task. Initializes the communication and processes incoming messages.
+ * 
+ * @param args Pointer to MotorQueues
+ */
 void comm_task(void *args);
 
 #endif
\ No newline at end of file
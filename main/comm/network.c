@@ -0,0 +1,74 @@
+#include "network.h"
+#include <sdkconfig.h>
+#include "../log/dlog.h"
+
+#define TAG "network"
+
+#if defined(CONFIG_MOUNT_COMM_TCP)
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <esp_event.h>
+#include <esp_netif.h>
+#include <esp_wifi.h>
+
+#define NETWORK_CONNECTED_BIT BIT0
+
+StaticEventGroup_t networkEventsBuffer;
+EventGroupHandle_t networkEvents;
+
+void networkEventHandler(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    }
+    else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        xEventGroupClearBits(networkEvents, NETWORK_CONNECTED_BIT);
+        DLOGW(TAG, "WiFi disconnected, reconnecting");
+        esp_wifi_connect();
+    }
+    else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        const ip_event_got_ip_t *event = data;
+        DLOGI(TAG, "Got IP address " IPSTR ", listening on port %i", IP2STR(&event->ip_info.ip), CONFIG_MOUNT_COMM_TCP_PORT);
+        xEventGroupSetBits(networkEvents, NETWORK_CONNECTED_BIT);
+    }
+}
+
+bool network_init() {
+    networkEvents = xEventGroupCreateStatic(&networkEventsBuffer);
+    if (esp_netif_init() != ESP_OK || esp_event_loop_create_default() != ESP_OK) {
+        DLOGE(TAG, "Couldn't initialize the TCP/IP stack");
+        return false;
+    }
+    esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t initConfig = WIFI_INIT_CONFIG_DEFAULT();
+    wifi_config_t wifiConfig = {
+        .sta = {
+            .ssid = CONFIG_MOUNT_WIFI_SSID,
+            .password = CONFIG_MOUNT_WIFI_PASSWORD
+        }
+    };
+    if (esp_wifi_init(&initConfig) != ESP_OK
+        || esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, networkEventHandler, NULL) != ESP_OK
+        || esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, networkEventHandler, NULL) != ESP_OK
+        || esp_wifi_set_mode(WIFI_MODE_STA) != ESP_OK
+        || esp_wifi_set_config(WIFI_IF_STA, &wifiConfig) != ESP_OK
+        // Power save would delay the replies by up to the beacon interval
+        || esp_wifi_set_ps(WIFI_PS_NONE) != ESP_OK
+        || esp_wifi_start() != ESP_OK) {
+        DLOGE(TAG, "Couldn't start the WiFi station");
+        return false;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(networkEvents, NETWORK_CONNECTED_BIT, pdFALSE, pdTRUE,
+        NETWORK_CONNECT_TIMEOUT / portTICK_PERIOD_MS);
+    if ((bits & NETWORK_CONNECTED_BIT) == 0) {
+        DLOGW(TAG, "Not connected to the WiFi yet, still trying");
+        return false;
+    }
+    return true;
+}
+#else
+bool network_init() {
+    return true;
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef __MOUNT_NETWORK
+#define __MOUNT_NETWORK
+
+#include <stdbool.h>
+
+/**
+ * @brief Maximum waiting time (in milliseconds) for the IP address in network_init
+ */
+#define NETWORK_CONNECT_TIMEOUT 10000
+
+/**
+ * @brief Brings up the network for the TCP transport (CONFIG_MOUNT_COMM_TCP) - the TCP/IP stack and a WiFi station
+ * connecting to CONFIG_MOUNT_WIFI_SSID. Must be called before comm_init, after the NVS is initialized (persist_init).
+ * The station reconnects whenever the connection is lost, the listening socket keeps working through that.
+ *
+ * @return true The station got an IP address within NETWORK_CONNECT_TIMEOUT
+ * @return false Not connected yet (it keeps trying), or the network couldn't be initialized
+ */
+bool network_init();
+
+#endif
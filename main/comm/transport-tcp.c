@@ -0,0 +1,131 @@
+#include "transport.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "../log/dlog.h"
+
+/**
+ * @brief TCP transport over the BSD sockets, lwIP in the firmware and the system ones in the host build
+ */
+
+#define TAG "transport-tcp"
+#define TCP_RECV_CHUNK 256
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+void tcpCloseClient(comm_tcp_t *tcp) {
+    close(tcp->clientFd);
+    tcp->clientFd = -1;
+    tcp->rx.head = 0;
+    tcp->rx.len = 0;
+    DLOGI(TAG, "Client disconnected");
+}
+
+/**
+ * @brief Accepts a waiting client if there is none connected, and moves the received data to the buffer
+ *
+ */
+void tcpPoll(comm_tcp_t *tcp) {
+    if (tcp->clientFd < 0) {
+        tcp->clientFd = accept(tcp->listenFd, NULL, NULL);
+        if (tcp->clientFd < 0)
+            return;
+        // The replies are short lines, they shouldn't wait for more data
+        int noDelay = 1;
+        setsockopt(tcp->clientFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        DLOGI(TAG, "Client connected");
+    }
+
+    char chunk[TCP_RECV_CHUNK];
+    while (tcp->rx.len < COMM_TRANSPORT_BUFFER_SIZE) {
+        size_t free = COMM_TRANSPORT_BUFFER_SIZE - tcp->rx.len;
+        ssize_t received = recv(tcp->clientFd, chunk, free < sizeof(chunk) ? free : sizeof(chunk), MSG_DONTWAIT);
+        if (received > 0) {
+            transport_bufferPush(&tcp->rx, chunk, received);
+            continue;
+        }
+        if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            tcpCloseClient(tcp);
+        return;
+    }
+}
+
+int tcpRead(comm_transport_t *transport, void *buffer, size_t len) {
+    comm_tcp_t *tcp = transport->ctx;
+    if (tcp->rx.len < len)
+        tcpPoll(tcp);
+    return transport_bufferPop(&tcp->rx, buffer, len);
+}
+
+int tcpWrite(comm_transport_t *transport, const void *buffer, size_t len) {
+    comm_tcp_t *tcp = transport->ctx;
+    if (tcp->clientFd < 0)
+        return len;
+
+    const char *data = buffer;
+    size_t written = 0;
+    while (written < len) {
+        ssize_t sent = send(tcp->clientFd, data + written, len - written, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0) {
+            tcpCloseClient(tcp);
+            return -1;
+        }
+        written += sent;
+    }
+    return written;
+}
+
+size_t tcpAvailable(comm_transport_t *transport) {
+    comm_tcp_t *tcp = transport->ctx;
+    tcpPoll(tcp);
+    return tcp->rx.len;
+}
+
+void tcpFlushInput(comm_transport_t *transport) {
+    comm_tcp_t *tcp = transport->ctx;
+    tcpPoll(tcp);
+    tcp->rx.head = 0;
+    tcp->rx.len = 0;
+}
+
+bool transport_initTcp(comm_transport_t *transport, comm_tcp_t *tcp, uint16_t port) {
+    tcp->clientFd = -1;
+    tcp->rx.head = 0;
+    tcp->rx.len = 0;
+    tcp->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (tcp->listenFd < 0) {
+        DLOGE(TAG, "Couldn't create the socket (%i)", errno);
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(tcp->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY)
+    };
+    if (bind(tcp->listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(tcp->listenFd, 1) != 0) {
+        DLOGE(TAG, "Couldn't listen on port %hu (%i)", port, errno);
+        close(tcp->listenFd);
+        return false;
+    }
+    // Accepting is polled by the protocol engine, it must not block
+    fcntl(tcp->listenFd, F_SETFL, fcntl(tcp->listenFd, F_GETFL, 0) | O_NONBLOCK);
+
+    transport->name = "tcp";
+    transport->read = tcpRead;
+    transport->write = tcpWrite;
+    transport->available = tcpAvailable;
+    transport->flushInput = tcpFlushInput;
+    transport->ctx = tcp;
+    DLOGI(TAG, "Listening on port %hu", port);
+    return true;
+}
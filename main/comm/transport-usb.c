@@ -0,0 +1,79 @@
+#include "transport.h"
+#include <soc/soc_caps.h>
+#include "../log/dlog.h"
+
+/**
+ * @brief USB serial/JTAG transport. The driver has no way to tell how much data is waiting, so the received data
+ * is moved to the transport's own buffer.
+ */
+
+#define TAG "transport-usb"
+
+#if SOC_USB_SERIAL_JTAG_SUPPORTED
+#include <driver/usb_serial_jtag.h>
+#include <freertos/FreeRTOS.h>
+
+#define USB_RECV_CHUNK 64
+#define USB_WRITE_TIMEOUT 100 // ms
+
+void usbPoll(comm_usb_t *usb) {
+    uint8_t chunk[USB_RECV_CHUNK];
+    while (usb->rx.len < COMM_TRANSPORT_BUFFER_SIZE) {
+        size_t free = COMM_TRANSPORT_BUFFER_SIZE - usb->rx.len;
+        int received = usb_serial_jtag_read_bytes(chunk, free < sizeof(chunk) ? free : sizeof(chunk), 0);
+        if (received <= 0)
+            return;
+        transport_bufferPush(&usb->rx, chunk, received);
+    }
+}
+
+int usbRead(comm_transport_t *transport, void *buffer, size_t len) {
+    comm_usb_t *usb = transport->ctx;
+    if (usb->rx.len < len)
+        usbPoll(usb);
+    return transport_bufferPop(&usb->rx, buffer, len);
+}
+
+int usbWrite(comm_transport_t *transport, const void *buffer, size_t len) {
+    return usb_serial_jtag_write_bytes(buffer, len, pdMS_TO_TICKS(USB_WRITE_TIMEOUT));
+}
+
+size_t usbAvailable(comm_transport_t *transport) {
+    comm_usb_t *usb = transport->ctx;
+    usbPoll(usb);
+    return usb->rx.len;
+}
+
+void usbFlushInput(comm_transport_t *transport) {
+    comm_usb_t *usb = transport->ctx;
+    usbPoll(usb);
+    usb->rx.head = 0;
+    usb->rx.len = 0;
+}
+
+bool transport_initUsb(comm_transport_t *transport, comm_usb_t *usb) {
+    usb_serial_jtag_driver_config_t config = {
+        .rx_buffer_size = COMM_TRANSPORT_BUFFER_SIZE,
+        .tx_buffer_size = COMM_TRANSPORT_BUFFER_SIZE
+    };
+    if (usb_serial_jtag_driver_install(&config) != ESP_OK) {
+        DLOGE(TAG, "Couldn't install the USB serial/JTAG driver");
+        return false;
+    }
+    usb->rx.head = 0;
+    usb->rx.len = 0;
+
+    transport->name = "usb";
+    transport->read = usbRead;
+    transport->write = usbWrite;
+    transport->available = usbAvailable;
+    transport->flushInput = usbFlushInput;
+    transport->ctx = usb;
+    return true;
+}
+#else
+bool transport_initUsb(comm_transport_t *transport, comm_usb_t *usb) {
+    DLOGE(TAG, "The chip has no USB serial/JTAG controller");
+    return false;
+}
+#endif
@@ -0,0 +1,113 @@
+#include "transport.h"
+#include <string.h>
+#include "../hal/hal.h"
+#include "../log/dlog.h"
+
+#define TAG "transport"
+
+size_t transport_bufferPush(comm_byte_buffer_t *buffer, const void *data, size_t len) {
+    const uint8_t *bytes = data;
+    size_t pushed = 0;
+    while (pushed < len && buffer->len < COMM_TRANSPORT_BUFFER_SIZE) {
+        size_t tail = (buffer->head + buffer->len) % COMM_TRANSPORT_BUFFER_SIZE;
+        // Free space up to the buffer end, or up to the head if the data wraps around
+        size_t chunk = tail >= buffer->head ? COMM_TRANSPORT_BUFFER_SIZE - tail : buffer->head - tail;
+        if (chunk > len - pushed)
+            chunk = len - pushed;
+        memcpy(buffer->data + tail, bytes + pushed, chunk);
+        buffer->len += chunk;
+        pushed += chunk;
+    }
+    return pushed;
+}
+
+size_t transport_bufferPop(comm_byte_buffer_t *buffer, void *data, size_t len) {
+    uint8_t *bytes = data;
+    size_t popped = 0;
+    while (popped < len && buffer->len > 0) {
+        size_t chunk = COMM_TRANSPORT_BUFFER_SIZE - buffer->head;
+        if (chunk > buffer->len)
+            chunk = buffer->len;
+        if (chunk > len - popped)
+            chunk = len - popped;
+        memcpy(bytes + popped, buffer->data + buffer->head, chunk);
+        buffer->head = (buffer->head + chunk) % COMM_TRANSPORT_BUFFER_SIZE;
+        buffer->len -= chunk;
+        popped += chunk;
+    }
+    return popped;
+}
+
+int uartRead(comm_transport_t *transport, void *buffer, size_t len) {
+    return hal_uartRead(((comm_uart_t*)transport->ctx)->port, buffer, len);
+}
+
+int uartWrite(comm_transport_t *transport, const void *buffer, size_t len) {
+    return hal_uartWrite(((comm_uart_t*)transport->ctx)->port, buffer, len);
+}
+
+size_t uartAvailable(comm_transport_t *transport) {
+    return hal_uartAvailable(((comm_uart_t*)transport->ctx)->port);
+}
+
+void uartFlushInput(comm_transport_t *transport) {
+    hal_uartFlushInput(((comm_uart_t*)transport->ctx)->port);
+}
+
+void transport_initUart(comm_transport_t *transport, comm_uart_t *uart, int port, int baudRate, int txPin, int rxPin,
+        int dePin, int rtsPin, int ctsPin, size_t bufferSize) {
+    uart->port = port;
+    hal_uartInit(port, baudRate, txPin, rxPin, bufferSize);
+    if (dePin >= 0 && !hal_uartSetHalfDuplex(port, dePin))
+        DLOGE(TAG, "Couldn't set the RS-485 half-duplex mode");
+    if (dePin >= 0 && (rtsPin >= 0 || ctsPin >= 0))
+        DLOGE(TAG, "No hardware flow control in the RS-485 mode, the RTS output drives the transceiver");
+    else if ((rtsPin >= 0 || ctsPin >= 0) && !hal_uartSetFlowControl(port, rtsPin, ctsPin))
+        DLOGE(TAG, "Couldn't set the hardware flow control");
+
+    transport->name = "uart";
+    transport->read = uartRead;
+    transport->write = uartWrite;
+    transport->available = uartAvailable;
+    transport->flushInput = uartFlushInput;
+    transport->ctx = uart;
+}
+
+int loopbackRead(comm_transport_t *transport, void *buffer, size_t len) {
+    return transport_bufferPop(&((comm_loopback_t*)transport->ctx)->rx, buffer, len);
+}
+
+int loopbackWrite(comm_transport_t *transport, const void *buffer, size_t len) {
+    comm_loopback_t *loopback = transport->ctx;
+    size_t written = transport_bufferPush(&loopback->tx, buffer, len);
+    loopback->txDropped += len - written;
+    return len;
+}
+
+size_t loopbackAvailable(comm_transport_t *transport) {
+    return ((comm_loopback_t*)transport->ctx)->rx.len;
+}
+
+void loopbackFlushInput(comm_transport_t *transport) {
+    comm_loopback_t *loopback = transport->ctx;
+    loopback->rx.head = 0;
+    loopback->rx.len = 0;
+}
+
+void transport_initLoopback(comm_transport_t *transport, comm_loopback_t *loopback) {
+    memset(loopback, 0, sizeof(comm_loopback_t));
+    transport->name = "loopback";
+    transport->read = loopbackRead;
+    transport->write = loopbackWrite;
+    transport->available = loopbackAvailable;
+    transport->flushInput = loopbackFlushInput;
+    transport->ctx = loopback;
+}
+
+size_t transport_loopbackSend(comm_loopback_t *loopback, const void *data, size_t len) {
+    return transport_bufferPush(&loopback->rx, data, len);
+}
+
+size_t transport_loopbackReceive(comm_loopback_t *loopback, void *data, size_t len) {
+    return transport_bufferPop(&loopback->tx, data, len);
+}
@@ -0,0 +1,164 @@
+#ifndef __MOUNT_TRANSPORT
+#define __MOUNT_TRANSPORT
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Byte stream transports of the control protocol. The protocol engine (uart-ctrl.c) reads and writes bytes only
+ * through the transport it was initialized with (comm_initTransport), so the same engine runs over the UART,
+ * the USB serial/JTAG port, a TCP socket or the in-memory loopback (host tests and benchmarks).
+ *
+ * A transport is a comm_transport_t with the functions of the implementation and its state (`ctx`), both allocated
+ * by the caller. The transport_init* functions fill them in.
+ */
+
+/**
+ * @brief Size of the receive buffers of the transports that keep their own (TCP, USB, loopback)
+ */
+#define COMM_TRANSPORT_BUFFER_SIZE 1024
+
+typedef struct CommTransport comm_transport_t;
+
+struct CommTransport {
+    const char *name;
+    /**
+     * @brief Reads up to `len` bytes already received, without blocking
+     *
+     * @return int Number of bytes read
+     */
+    int (*read)(comm_transport_t *transport, void *buffer, size_t len);
+    /**
+     * @brief Writes the bytes, may block until there is space in the transmit buffer
+     *
+     * @return int Number of bytes written, negative on error
+     */
+    int (*write)(comm_transport_t *transport, const void *buffer, size_t len);
+    /**
+     * @brief Returns number of received bytes available for reading
+     *
+     */
+    size_t (*available)(comm_transport_t *transport);
+    /**
+     * @brief Drops all the received bytes
+     *
+     */
+    void (*flushInput)(comm_transport_t *transport);
+    /**
+     * @brief State of the implementation
+     *
+     */
+    void *ctx;
+};
+
+/**
+ * @brief Circular byte buffer, for the transports that buffer the received data themselves
+ *
+ */
+typedef struct CommByteBuffer {
+    uint8_t data[COMM_TRANSPORT_BUFFER_SIZE];
+    size_t head;
+    size_t len;
+} comm_byte_buffer_t;
+
+/**
+ * @brief Appends the bytes to the buffer, as many as fit
+ *
+ * @return size_t Number of bytes appended
+ */
+size_t transport_bufferPush(comm_byte_buffer_t *buffer, const void *data, size_t len);
+/**
+ * @brief Removes up to `len` bytes from the start of the buffer
+ *
+ * @return size_t Number of bytes removed
+ */
+size_t transport_bufferPop(comm_byte_buffer_t *buffer, void *data, size_t len);
+
+typedef struct CommUart {
+    int port;
+} comm_uart_t;
+
+typedef struct CommTcp {
+    int listenFd;
+    /**
+     * @brief Connected client, -1 if there is none. Only one client is served at a time.
+     */
+    int clientFd;
+    comm_byte_buffer_t rx;
+} comm_tcp_t;
+
+typedef struct CommUsb {
+    comm_byte_buffer_t rx;
+} comm_usb_t;
+
+/**
+ * @brief Both directions of the loopback. The host side (test, benchmark) feeds the commands by transport_loopbackSend
+ * and takes the replies by transport_loopbackReceive.
+ *
+ */
+typedef struct CommLoopback {
+    /**
+     * @brief Host to device
+     */
+    comm_byte_buffer_t rx;
+    /**
+     * @brief Device to host
+     */
+    comm_byte_buffer_t tx;
+    /**
+     * @brief Reply bytes dropped because the host didn't take them in time
+     */
+    uint32_t txDropped;
+} comm_loopback_t;
+
+/**
+ * @brief Initializes the UART transport. Panics if the port can't be initialized.
+ *
+ * @param port UART port number
+ * @param baudRate Baud rate
+ * @param txPin TX pin
+ * @param rxPin RX pin
+ * @param dePin Driver enable pin of an RS-485 transceiver (see hal_uartSetHalfDuplex), -1 for a plain UART
+ * @param rtsPin RTS pin of the hardware flow control (see hal_uartSetFlowControl), -1 for none
+ * @param ctsPin CTS pin of the hardware flow control, -1 for none
+ * @param bufferSize Size of RX and TX buffers
+ */
+void transport_initUart(comm_transport_t *transport, comm_uart_t *uart, int port, int baudRate, int txPin, int rxPin,
+    int dePin, int rtsPin, int ctsPin, size_t bufferSize);
+/**
+ * @brief Initializes the TCP transport, listening on all the interfaces. The network must be already up.
+ * A client is accepted whenever there is none connected, the replies are dropped while there is none.
+ *
+ * @param port TCP port
+ * @return true Listening
+ * @return false The socket couldn't be created or bound
+ */
+bool transport_initTcp(comm_transport_t *transport, comm_tcp_t *tcp, uint16_t port);
+/**
+ * @brief Initializes the USB serial/JTAG transport (ESP32-C3, ESP32-S3 and other chips with the USB serial/JTAG
+ * controller only)
+ *
+ * @return true Success
+ * @return false The driver couldn't be installed, or the chip has no USB serial/JTAG controller
+ */
+bool transport_initUsb(comm_transport_t *transport, comm_usb_t *usb);
+/**
+ * @brief Initializes the in-memory loopback transport
+ *
+ */
+void transport_initLoopback(comm_transport_t *transport, comm_loopback_t *loopback);
+/**
+ * @brief Sends bytes to the device through the loopback
+ *
+ * @return size_t Number of bytes accepted, less than `len` if the receive buffer is full
+ */
+size_t transport_loopbackSend(comm_loopback_t *loopback, const void *data, size_t len);
+/**
+ * @brief Takes up to `len` bytes the device has written to the loopback
+ *
+ * @return size_t Number of bytes taken
+ */
+size_t transport_loopbackReceive(comm_loopback_t *loopback, void *data, size_t len);
+
+#endif
@@ -1,13 +1,15 @@
 #include "uart-ctrl.h"
 #include <stdio.h>
-#include <esp_log.h>
-#include <esp_err.h>
-#include <freertos/task.h>
+#include "../log/dlog.h"
+#include "../hal/hal.h"
 #include <string.h>
+#include <stdlib.h>
+#include <math.h>
 
 #define TAG "mount-comm"
 
 #define CMD_START '+'
+#define CMD_UNSOLICITED_START '*'
 #define CMD_STR_TIME_SYNC "t"
 #define CMD_STR_SET_POS "p"
 #define CMD_STR_GET_POS "gp"
@@ -23,27 +25,85 @@
 #define CMD_STR_TRACK_BUF_ADD_POINT "tp"
 #define CMD_STR_TRACKING_BEGIN "tb"
 #define CMD_STR_TRACKING_STOP "ts"
+#define CMD_STR_TRACK_BUF_NEXT "tbn"
+#define CMD_STR_TRACK_BUF_SWAP "tbsw"
+#define CMD_STR_TRACKING_BEGIN_AT "tba"
+#define CMD_STR_JOG "j"
+#define CMD_STR_TRACK_OFFSET "to"
+#define CMD_STR_TRACK_RATE_OFFSET "tr"
+#define CMD_STR_TRACK_TIME_SHIFT "tt"
+#define CMD_STR_GET_STATS "gst"
+#define CMD_STR_RESET_STATS "rst"
+#define CMD_STR_GET_TRACE "gtr"
+#define CMD_STR_TRACE_EVENT "gtre"
+#define CMD_STR_GET_DIAG "gd"
+#define CMD_STR_DIAG_TASK "gdt"
+#define CMD_STR_DIAG_QUEUE "gdq"
+#define CMD_STR_TRAJLIB_BEGIN "tlb"
+#define CMD_STR_TRAJLIB_POINT "tlp"
+#define CMD_STR_TRAJLIB_END "tle"
+#define CMD_STR_TRAJLIB_LIST "tll"
+#define CMD_STR_TRAJLIB_ENTRY "tlle"
+#define CMD_STR_TRAJLIB_REPLAY "tlr"
+#define CMD_STR_TRAJLIB_CLEAR "tlc"
+#define CMD_STR_GET_CONFIG "gcfg"
+#define CMD_STR_SET_CONFIG "scfg"
+#define CMD_STR_GET_CHECKPOINT "gck"
+#define CMD_STR_FAULT_CLEAR "fc"
+#define CMD_STR_SET_ADDRESS "sa"
+#define CMD_STR_TRACK_STREAM "tsm"
+#define CMD_STR_STREAM_CREDITS "tc"
+#define CMD_STR_LOW_WATERMARK "tlw"
 
 #define UART_TIMEOUT_MS 10
+#define CMD_ADDR_START '@'
+#define CMD_ADDR_BROADCAST "*"
+/**
+ * @brief Reply address of frames nobody should answer (broadcasts, frames for other devices)
+ */
+#define COMM_REPLY_SILENT -1
 
 /**
- * @brief Initiates mount communication through a UART port. Other functions in this file can be then used 
- * for communication with the control pc (or some other device). For this communication, pins `COMM_PIN_TX` and `COMM_PIN_RX` are used
- * 
+ * @brief Address of this device on the bus, COMM_ADDRESS_NONE if not addressed
  */
+uint8_t commAddress = COMM_ADDRESS_NONE;
+/**
+ * @brief Address replies to the last received frame are prefixed by, COMM_ADDRESS_NONE for no prefix,
+ * COMM_REPLY_SILENT to drop them
+ */
+int16_t replyAddress = COMM_ADDRESS_NONE;
+
+/**
+ * @brief Transport the protocol runs over
+ */
+comm_transport_t *transport = NULL;
+comm_transport_t defaultTransport;
+#if defined(CONFIG_MOUNT_COMM_TCP)
+comm_tcp_t tcp;
+#elif defined(CONFIG_MOUNT_COMM_USB)
+comm_usb_t usb;
+#else
+comm_uart_t uart;
+#endif
+
 void comm_init() {
-    uart_config_t config = {
-        .baud_rate = COMM_BAUD_RATE,
-        .data_bits = UART_DATA_8_BITS,
-        .parity = UART_PARITY_DISABLE,
-        .stop_bits = UART_STOP_BITS_1,
-        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
-    };
+#if defined(CONFIG_MOUNT_COMM_TCP)
+    if (!transport_initTcp(&defaultTransport, &tcp, CONFIG_MOUNT_COMM_TCP_PORT))
+        abort();
+#elif defined(CONFIG_MOUNT_COMM_USB)
+    if (!transport_initUsb(&defaultTransport, &usb))
+        abort();
+#else
+    transport_initUart(&defaultTransport, &uart, COMM_UART_PORT, COMM_BAUD_RATE, COMM_PIN_TX, COMM_PIN_RX, COMM_PIN_DE,
+        COMM_PIN_RTS, COMM_PIN_CTS, RX_TX_BUFFER_SIZE);
+#endif
+    comm_initTransport(&defaultTransport);
+}
 
-    ESP_ERROR_CHECK(uart_param_config(COMM_UART_PORT, &config));
-    ESP_ERROR_CHECK(uart_set_pin(COMM_UART_PORT, COMM_PIN_TX, COMM_PIN_RX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-    ESP_ERROR_CHECK(uart_driver_install(COMM_UART_PORT, RX_TX_BUFFER_SIZE, RX_TX_BUFFER_SIZE, 0, NULL, 0));
-    ESP_LOGD(TAG, "Control UART initialized");
+void comm_initTransport(comm_transport_t *commTransport) {
+    transport = commTransport;
+    commAddress = persist_getAddress();
+    DLOGD(TAG, "Communication over %s initialized (address %hhu)", transport->name, commAddress);
 }
 
 MountMsg makeMountMsg(cmd_t cmd) {
@@ -53,32 +113,75 @@ MountMsg makeMountMsg(cmd_t cmd) {
     return msg;
 }
 
+uint8_t comm_getAddress() {
+    return commAddress;
+}
+
+void comm_setAddress(uint8_t address) {
+    commAddress = address;
+}
+
+/**
+ * @brief Writes a line prefixed by the address
+ * 
+ * @param address Address to prefix the line by, COMM_ADDRESS_NONE for no prefix, COMM_REPLY_SILENT to drop the line
+ * @param line Line to write
+ */
+void sendLineTo(int16_t address, const char *line) {
+    if (address == COMM_REPLY_SILENT)
+        return;
+    if (address != COMM_ADDRESS_NONE) {
+        char prefix[6];
+        snprintf(prefix, sizeof(prefix), "%c%hhu ", CMD_ADDR_START, (uint8_t)address);
+        transport->write(transport, prefix, strlen(prefix));
+    }
+    transport->write(transport, line, strlen(line));
+}
+
+/**
+ * @brief Writes a reply line. Replies to addressed frames are prefixed by the address, so the host can tell the devices
+ * apart, replies to broadcasts are dropped.
+ * 
+ */
+void sendLine(const char *line) {
+    sendLineTo(replyAddress, line);
+}
+
 char receive_char(){
     char nextByte;
-    uart_read_bytes(COMM_UART_PORT, &nextByte, sizeof(nextByte), 0);
+    transport->read(transport, &nextByte, sizeof(nextByte));
     return nextByte;
 }
 
 bool waitForAvailable(size_t availableMin, uint32_t timeout) {
-    size_t available = 0;
-    uart_get_buffered_data_len(COMM_UART_PORT, &available);
-    TickType_t startTick = xTaskGetTickCount();
-
-    while (available < availableMin) {
-        vTaskDelay(1);
-        uart_get_buffered_data_len(COMM_UART_PORT, &available);
-        if (xTaskGetTickCount() - startTick > timeout / portTICK_PERIOD_MS) {
-            ESP_LOGW(TAG, "UART command timed out");
+    int64_t startTime = hal_getTime();
+
+    while (transport->available(transport) < availableMin) {
+        if (hal_getTime() - startTime >= (int64_t)timeout * 1000) {
+            DLOGW(TAG, "UART command timed out");
             return false;
         }
+        hal_delay(1);
     }
 
     return true;
 }
 
+/**
+ * @brief Skips the rest of a frame, up to the end of line
+ * 
+ */
+void skipFrame() {
+    while (waitForAvailable(1, UART_TIMEOUT_MS)) {
+        if (receive_char() == '\n')
+            return;
+    }
+}
+
 /**
  * @brief Reads the next command parameter(something surrounded by space characters, or space and end-of-line characters in case of the last parameter).
  * For example, if the rx buffer contains: " hi how are you\n", `receive_space_block` will return "hi" and the rx buffer will than contain only "how are you\n".
+ * A parameter that doesn't fit the buffer is read whole, but returned as empty (invalid), so it doesn't spill into the next one.
  * 
  * @param buffer Return buffer. The resulting parameter will be written into this buffer
  * @param len Buffer length.
@@ -100,13 +203,16 @@ size_t receive_space_block(char* buffer, size_t len, bool *endFlag) {
             bufferCounter++;
         }
         if (firstChar == '\n') {
-            ESP_LOGD(TAG, "First char is LF");
-            *endFlag = true;
+            DLOGD(TAG, "First char is LF");
+            if (endFlag != NULL)
+                *endFlag = true;
+            buffer[0] = 0;
             return 0;
         }
     }
 
-    while (bufferCounter < len - 1 && waitForAvailable(1, UART_TIMEOUT_MS)) {
+    bool overflow = false;
+    while (waitForAvailable(1, UART_TIMEOUT_MS)) {
         char nextChar = receive_char();
         if (nextChar == ' ' || nextChar == '\n'){
             if (nextChar == '\n' && endFlag != NULL){
@@ -114,10 +220,18 @@ size_t receive_space_block(char* buffer, size_t len, bool *endFlag) {
             }
             break;
         }
+        if (bufferCounter >= len - 1) {
+            overflow = true;
+            continue;
+        }
         
         buffer[bufferCounter] = nextChar;
         bufferCounter++;
     }
+    if (overflow) {
+        DLOGW(TAG, "Parameter longer than %u characters", (unsigned)(len - 1));
+        bufferCounter = 0;
+    }
     buffer[bufferCounter] = 0;
 
     return bufferCounter;
@@ -136,7 +250,7 @@ bool receive_uint64(uint64_t *result, bool *endFlag) {
 }
 
 bool receive_int64(int64_t* result, bool *endFlag) {
-    char intStr[20];
+    char intStr[21]; // INT64_MIN with the sign
 
     size_t intStrLen = receive_space_block(intStr, sizeof(intStr), endFlag);
 
@@ -147,6 +261,30 @@ bool receive_int64(int64_t* result, bool *endFlag) {
     return true;
 }
 
+bool receive_float(float* result, bool *endFlag) {
+    char floatStr[24];
+
+    size_t floatStrLen = receive_space_block(floatStr, sizeof(floatStr), endFlag);
+
+    if (floatStrLen == 0)
+        return false;
+
+    *result = strtof(floatStr, NULL);
+    return true;
+}
+
+bool receive_double(double* result, bool *endFlag) {
+    char doubleStr[32];
+
+    size_t doubleStrLen = receive_space_block(doubleStr, sizeof(doubleStr), endFlag);
+
+    if (doubleStrLen == 0)
+        return false;
+
+    *result = strtod(doubleStr, NULL);
+    return true;
+}
+
 /**
  * @brief Receives a boolean from the communication uart port
  * 
@@ -168,18 +306,20 @@ bool receive_bool(bool* result, bool *endFlag) {
     return true;
 }
 
+/**
+ * @brief Skips the rest of the command line, after its last parameter. Only the current line is consumed, the commands
+ * that follow it stay in the buffer.
+ * 
+ * @return true The end of line was received
+ * @return false The line didn't end in time
+ */
 bool receive_end() {
-    size_t available;
-    uart_get_buffered_data_len(COMM_UART_PORT, &available);
-    if (available == 0)
-        return false;
-
-    char endChar = 0;
-    while (waitForAvailable(1, 0)){
-        endChar = receive_char();
+    while (waitForAvailable(1, UART_TIMEOUT_MS)) {
+        if (receive_char() == '\n')
+            return true;
     }
     
-    return endChar == '\n';
+    return false;
 }
 
 MountMsg parseTimeSyncCmd(bool *endFlag) {
@@ -202,12 +342,39 @@ MountMsg parseTimeSyncCmd(bool *endFlag) {
     return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_CMD);
 }
 
+/**
+ * @brief Parses a command with a single mount time parameter
+ * 
+ * @param cmd Command of the resulting message
+ * @param endFlag End flag
+ * @return MountMsg Message with `data.time` set
+ */
+MountMsg parseTimeParamCmd(cmd_t cmd, bool *endFlag) {
+    uint64_t time;
+    bool success = receive_uint64(&time, endFlag);
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    if (*endFlag || receive_end()) {
+        MountMsg msg = {
+            .cmd = cmd,
+            .data = {
+                .time = time
+            }
+        };
+        return msg;
+    }
+
+    return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_CMD);
+}
+
 MountMsg parseSetPosCmd(bool *endFlag) {
     step_t posRa, posDec;
     bool success = receive_int64(&posRa, endFlag);
     success &= receive_int64(&posDec, endFlag);
 
-    success &= endFlag || receive_end();
+    success &= *endFlag || receive_end();
 
     if (!success)
         return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
@@ -233,8 +400,7 @@ MountMsg parseGotoMsg(bool *endFlag) {
     step_t posRa, posDec;
     bool success = receive_int64(&posRa, endFlag);
     success &= receive_int64(&posDec, endFlag);
-    
-    //success &= *endFlag || receive_end();
+    success &= *endFlag || receive_end();
 
     if (!success)
         return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
@@ -276,12 +442,20 @@ MountMsg parseStopMsg(bool *endFlag) {
     return msg;
 }
 
-MountMsg parseTrackPointMsg(bool *endFlag) {
+/**
+ * @brief Parses a track point command (track buffer or trajectory library point)
+ * 
+ * @param cmd Command of the resulting message
+ * @param endFlag End flag
+ * @return MountMsg Message with `data.trackPoint` set
+ */
+MountMsg parseTrackPointMsg(cmd_t cmd, bool *endFlag) {
     step_t ax1, ax2;
     uint64_t time;
     bool success = receive_int64(&ax1, endFlag);
     success &= receive_int64(&ax2, endFlag);
     success &= receive_uint64(&time, endFlag);
+    success &= *endFlag || receive_end();
 
     if (!success)
         return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
@@ -293,7 +467,7 @@ MountMsg parseTrackPointMsg(bool *endFlag) {
     };
 
     MountMsg msg = {
-        .cmd = MOUNT_MSG_CMD_TRACK_ADD_POINT,
+        .cmd = cmd,
         .data = {
             .trackPoint = trackPoint
         }
@@ -302,6 +476,262 @@ MountMsg parseTrackPointMsg(bool *endFlag) {
     return msg;
 }
 
+MountMsg parseJogMsg(bool *endFlag) {
+    float v1, v2;
+    bool success = receive_float(&v1, endFlag);
+    success &= receive_float(&v2, endFlag);
+    success &= *endFlag || receive_end();
+    // strtof accepts "nan" and "inf", which would get past the velocity limits
+    success &= isfinite(v1) && isfinite(v2);
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg_Jog jog = {
+        .v1 = v1,
+        .v2 = v2
+    };
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_JOG,
+        .data = {
+            .jog = jog
+        }
+    };
+
+    return msg;
+}
+
+MountMsg parseTrackOffsetMsg(bool *endFlag) {
+    step_t ax1, ax2;
+    bool success = receive_int64(&ax1, endFlag);
+    success &= receive_int64(&ax2, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg_TrackOffset offset = {
+        .ax1 = ax1,
+        .ax2 = ax2
+    };
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_TRACK_OFFSET,
+        .data = {
+            .trackOffset = offset
+        }
+    };
+
+    return msg;
+}
+
+MountMsg parseTrackRateOffsetMsg(bool *endFlag) {
+    float r1, r2;
+    bool success = receive_float(&r1, endFlag);
+    success &= receive_float(&r2, endFlag);
+    success &= *endFlag || receive_end();
+    success &= isfinite(r1) && isfinite(r2);
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg_TrackRate rate = {
+        .r1 = r1,
+        .r2 = r2
+    };
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_TRACK_RATE_OFFSET,
+        .data = {
+            .trackRate = rate
+        }
+    };
+
+    return msg;
+}
+
+MountMsg parseTrackTimeShiftMsg(bool *endFlag) {
+    int64_t timeShift;
+    bool success = receive_int64(&timeShift, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_TRACK_TIME_SHIFT,
+        .data = {
+            .timeShift = timeShift
+        }
+    };
+
+    return msg;
+}
+
+/**
+ * @brief Parses a command with a single axis number parameter
+ * 
+ * @param cmd Command of the resulting message
+ * @param endFlag End flag
+ * @return MountMsg Message with `data.axis` set
+ */
+MountMsg parseAxisParamCmd(cmd_t cmd, bool *endFlag) {
+    uint64_t axis;
+    bool success = receive_uint64(&axis, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = cmd,
+        .data = {
+            .axis = axis
+        }
+    };
+
+    return msg;
+}
+
+MountMsg parseGetTraceMsg(bool *endFlag) {
+    uint64_t from, max;
+    bool success = receive_uint64(&from, endFlag);
+    success &= receive_uint64(&max, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg_GetTrace getTrace = {
+        .from = from,
+        .max = max
+    };
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_GET_TRACE,
+        .data = {
+            .getTrace = getTrace
+        }
+    };
+
+    return msg;
+}
+
+/**
+ * @brief Parses a command with a single trajectory name parameter
+ * 
+ * @param cmd Command of the resulting message
+ * @param endFlag End flag
+ * @return MountMsg Message with `data.name` set
+ */
+MountMsg parseNameParamCmd(cmd_t cmd, bool *endFlag) {
+    char name[TRAJLIB_NAME_LENGTH + 1];
+    size_t nameLen = receive_space_block(name, sizeof(name), endFlag);
+    bool success = nameLen > 0 && nameLen < TRAJLIB_NAME_LENGTH;
+    success &= *endFlag || receive_end();
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = cmd
+    };
+    strcpy(msg.data.name, name);
+    return msg;
+}
+
+MountMsg parseTrajlibReplayMsg(bool *endFlag) {
+    char name[TRAJLIB_NAME_LENGTH + 1];
+    uint64_t startTime = 0;
+    size_t nameLen = receive_space_block(name, sizeof(name), endFlag);
+    bool success = nameLen > 0 && nameLen < TRAJLIB_NAME_LENGTH;
+    if (!*endFlag)
+        success &= receive_uint64(&startTime, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_TRAJLIB_REPLAY,
+        .data = {
+            .trajlibReplay = {
+                .startTime = startTime
+            }
+        }
+    };
+    strcpy(msg.data.trajlibReplay.name, name);
+    return msg;
+}
+
+MountMsg parseSetConfigMsg(bool *endFlag) {
+    uint64_t axis;
+    char name[PERSIST_NAME_LENGTH + 1];
+    double value;
+    bool success = receive_uint64(&axis, endFlag);
+    size_t nameLen = receive_space_block(name, sizeof(name), endFlag);
+    success &= nameLen > 0 && nameLen < PERSIST_NAME_LENGTH;
+    success &= receive_double(&value, endFlag);
+    success &= *endFlag || receive_end();
+    success &= isfinite(value);
+
+    if (!success)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_SET_CONFIG,
+        .data = {
+            .setConfig = {
+                .axis = axis,
+                .value = value
+            }
+        }
+    };
+    strcpy(msg.data.setConfig.name, name);
+    return msg;
+}
+
+MountMsg parseSetAddressMsg(bool *endFlag) {
+    uint64_t address;
+    bool success = receive_uint64(&address, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success || address > COMM_ADDRESS_MAX)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_SET_ADDRESS,
+        .data = {
+            .address = address
+        }
+    };
+    return msg;
+}
+
+MountMsg parseTrackStreamMsg(bool *endFlag) {
+    bool enable;
+    uint64_t watermark = 0;
+    bool success = receive_bool(&enable, endFlag);
+    if (!*endFlag)
+        success &= receive_uint64(&watermark, endFlag);
+    success &= *endFlag || receive_end();
+
+    if (!success || watermark > UINT32_MAX)
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_PARAM);
+
+    MountMsg msg = {
+        .cmd = MOUNT_MSG_CMD_TRACK_STREAM,
+        .data = {
+            .trackStream = {
+                .enable = enable,
+                .watermark = watermark
+            }
+        }
+    };
+    return msg;
+}
+
 MountMsg returnWithEFCheck(MountMsg mainMsg, bool *endFlag) {
     if (! *endFlag) {
         receive_end();
@@ -310,15 +740,198 @@ MountMsg returnWithEFCheck(MountMsg mainMsg, bool *endFlag) {
     return mainMsg;
 }
 
+/**
+ * @brief Parses the rest of a command, after its name
+ * 
+ * @param cmdBuffer Command name (without the leading `+`)
+ * @param endFlag End flag
+ */
+MountMsg parseCmd(const char *cmdBuffer, bool *endFlag) {
+    if (strcmp(cmdBuffer, CMD_STR_TIME_SYNC) == 0) {
+        return parseTimeSyncCmd(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_SET_POS) == 0) {
+        return parseSetPosCmd(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_POS) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_POS), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_TIME) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_TIME), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_CPR) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_CPR), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_STATUS) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_STATUS), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_PROTOCOL_VERSION) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_PROTOCOL_VERSION), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GOTO) == 0) {
+        return parseGotoMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_STOP) == 0) {
+        return parseStopMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_TRACK_BUF_FREE_SPACE) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_TRACK_BUF_FREE_SPACE), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_TRACK_BUF_SIZE) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_TRACK_BUF_SIZE), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_BUF_CLEAR) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACK_BUF_CLEAR), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_BUF_ADD_POINT) == 0) {
+        return parseTrackPointMsg(MOUNT_MSG_CMD_TRACK_ADD_POINT, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACKING_BEGIN) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACKING_BEGIN), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACKING_STOP) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACKING_STOP), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_JOG) == 0) {
+        return parseJogMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_OFFSET) == 0) {
+        return parseTrackOffsetMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_RATE_OFFSET) == 0) {
+        return parseTrackRateOffsetMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_TIME_SHIFT) == 0) {
+        return parseTrackTimeShiftMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_BUF_NEXT) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACK_BUF_NEXT), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_BUF_SWAP) == 0) {
+        return parseTimeParamCmd(MOUNT_MSG_CMD_TRACK_BUF_SWAP, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACKING_BEGIN_AT) == 0) {
+        return parseTimeParamCmd(MOUNT_MSG_CMD_TRACKING_BEGIN_AT, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_STATS) == 0) {
+        return parseAxisParamCmd(MOUNT_MSG_CMD_GET_STATS, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_RESET_STATS) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_RESET_STATS), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_TRACE) == 0) {
+        return parseGetTraceMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_DIAG) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_DIAG), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRAJLIB_BEGIN) == 0) {
+        return parseNameParamCmd(MOUNT_MSG_CMD_TRAJLIB_BEGIN, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRAJLIB_POINT) == 0) {
+        return parseTrackPointMsg(MOUNT_MSG_CMD_TRAJLIB_POINT, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRAJLIB_END) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRAJLIB_END), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRAJLIB_LIST) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRAJLIB_LIST), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRAJLIB_REPLAY) == 0) {
+        return parseTrajlibReplayMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRAJLIB_CLEAR) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRAJLIB_CLEAR), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_CONFIG) == 0) {
+        return parseAxisParamCmd(MOUNT_MSG_CMD_GET_CONFIG, endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_SET_CONFIG) == 0) {
+        return parseSetConfigMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_GET_CHECKPOINT) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_CHECKPOINT), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_FAULT_CLEAR) == 0) {
+        return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_FAULT_CLEAR), endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_SET_ADDRESS) == 0) {
+        return parseSetAddressMsg(endFlag);
+    }
+    else if (strcmp(cmdBuffer, CMD_STR_TRACK_STREAM) == 0) {
+        return parseTrackStreamMsg(endFlag);
+    }
+    else {
+        if (!*endFlag)
+            receive_end();
+        DLOGW(TAG, "Unknown command received");
+        return makeMountMsg(MOUNT_MSG_CMD_ERR_UNKNOWN_CMD);
+    }
+
+}
+
+/**
+ * @brief Returns true for the commands accepted as broadcasts - time sync, stop and synchronized tracking start and stop
+ */
+inline bool isBroadcastCmd(cmd_t cmd) {
+    return cmd == MOUNT_MSG_CMD_TIME_SYNC || cmd == MOUNT_MSG_CMD_STOP || cmd == MOUNT_MSG_CMD_TRACKING_BEGIN_AT
+        || cmd == MOUNT_MSG_CMD_TRACKING_STOP;
+}
+
+/**
+ * @brief Reads the address of an addressed frame, after the `@`
+ * 
+ * @param broadcast Set to true for broadcast frames
+ * @return true The frame is for this device (or a broadcast), `replyAddress` is set accordingly
+ * @return false The frame is for another device, or the address is malformed
+ */
+bool receiveFrameAddress(bool *broadcast) {
+    char addrBuffer[5];
+    bool endFlag = false;
+    size_t addrLen = receive_space_block(addrBuffer, sizeof(addrBuffer), &endFlag);
+    if (addrLen == 0 || endFlag)
+        return false;
+
+    if (strcmp(addrBuffer, CMD_ADDR_BROADCAST) == 0) {
+        replyAddress = COMM_REPLY_SILENT;
+        *broadcast = true;
+        return true;
+    }
+    char *addrEnd;
+    long address = strtol(addrBuffer, &addrEnd, 10);
+    if (*addrEnd != 0 || commAddress == COMM_ADDRESS_NONE || address != commAddress)
+        return false;
+    replyAddress = commAddress;
+    return true;
+}
+
 MountMsg comm_getNext() {
-    size_t available = 0;
-    uart_get_buffered_data_len(COMM_UART_PORT, &available);
-    if (available > 2) {
+    if (transport->available(transport) > 2) {
         char currentByte;
+        bool broadcast = false;
+        // Unaddressed frames on a bus may be for another (point-to-point) device, errors would collide with its replies
+        replyAddress = commAddress == COMM_ADDRESS_NONE ? COMM_ADDRESS_NONE : COMM_REPLY_SILENT;
+
+        transport->read(transport, &currentByte, sizeof(currentByte));
+        if (currentByte == CMD_ADDR_START) {
+            if (!receiveFrameAddress(&broadcast)) {
+                skipFrame();
+                return makeMountMsg(MOUNT_MSG_CMD_NONE);
+            }
+            if (!waitForAvailable(1, UART_TIMEOUT_MS))
+                return makeMountMsg(MOUNT_MSG_CMD_NONE);
+            currentByte = receive_char();
+        }
+        else if (commAddress != COMM_ADDRESS_NONE && currentByte == CMD_START) {
+            skipFrame();
+            return makeMountMsg(MOUNT_MSG_CMD_NONE);
+        }
 
-        uart_read_bytes(COMM_UART_PORT, &currentByte, sizeof(currentByte), 0);
+        if (currentByte == '\n' || currentByte == '\r') {
+            return makeMountMsg(MOUNT_MSG_CMD_NONE); // empty line, or the rest of the last one
+        }
         if (currentByte != CMD_START) {
-            uart_flush_input(COMM_UART_PORT); // clear input buffer, so no data from the invalid command persist
+            skipFrame(); // drop the invalid line, the commands after it stay
             
             return makeMountMsg(MOUNT_MSG_CMD_ERR_INVALID_CMD);
         }
@@ -326,58 +939,12 @@ MountMsg comm_getNext() {
         char cmdBuffer[10];
         bool endFlag = false;
         receive_space_block(cmdBuffer, sizeof(cmdBuffer), &endFlag);
-
-        if (strcmp(cmdBuffer, CMD_STR_TIME_SYNC) == 0) {
-            return parseTimeSyncCmd(&endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_SET_POS) == 0) {
-            return parseSetPosCmd(&endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_POS) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_POS), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_TIME) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_TIME), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_CPR) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_CPR), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_STATUS) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_STATUS), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_PROTOCOL_VERSION) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_PROTOCOL_VERSION), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GOTO) == 0) {
-            return parseGotoMsg(&endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_STOP) == 0) {
-            return parseStopMsg(&endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_TRACK_BUF_FREE_SPACE) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_TRACK_BUF_FREE_SPACE), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_GET_TRACK_BUF_SIZE) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_GET_TRACK_BUF_SIZE), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_TRACK_BUF_CLEAR) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACK_BUF_CLEAR), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_TRACK_BUF_ADD_POINT) == 0) {
-            return parseTrackPointMsg(&endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_TRACKING_BEGIN) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACKING_BEGIN), &endFlag);
-        }
-        else if (strcmp(cmdBuffer, CMD_STR_TRACKING_STOP) == 0) {
-            return returnWithEFCheck(makeMountMsg(MOUNT_MSG_CMD_TRACKING_STOP), &endFlag);
-        }
-        else {
-            if (!endFlag)
-                receive_end();
-            ESP_LOGW(TAG, "Unknown command received");
-            return makeMountMsg(MOUNT_MSG_CMD_ERR_UNKNOWN_CMD);
+        MountMsg msg = parseCmd(cmdBuffer, &endFlag);
+        if (broadcast && msg.cmd > MOUNT_MSG_CMD_NONE && !isBroadcastCmd(msg.cmd)) {
+            DLOGW(TAG, "Command %i can't be broadcast, ignored", msg.cmd);
+            return makeMountMsg(MOUNT_MSG_CMD_NONE);
         }
+        return msg;
     }
     
     return makeMountMsg(MOUNT_MSG_CMD_NONE);
@@ -386,80 +953,80 @@ MountMsg comm_getNext() {
 void comm_sendTimeResponse(uint64_t currentTime) {
     char msg[30];
     snprintf(msg, sizeof(msg), "+%s %llu\n", CMD_STR_TIME_SYNC, currentTime);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendGetTimeResponse(uint64_t currentTime) {
     char msg[30];
     snprintf(msg, sizeof(msg), "+%s %llu\n", CMD_STR_GET_TIME, currentTime);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendSetPosResponse(step_t posAx1, step_t posAx2) {
-    char msg[30];
+    char msg[60];
     snprintf(msg, sizeof(msg), "+p %lli %lli\n", posAx1, posAx2);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendGetPosResponse(step_t ax1, step_t ax2) {
-    char msg[30];
+    char msg[60];
     snprintf(msg, sizeof(msg), "+%s %lli %lli\n", CMD_STR_GET_POS, ax1, ax2);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendError(int errCode, const char* msg) {
     char msgBuffer[200];
     snprintf(msgBuffer, sizeof(msgBuffer), "! %i %s\n", errCode, msg);
-    uart_write_bytes(COMM_UART_PORT, msgBuffer, strlen(msgBuffer));
+    sendLine(msgBuffer);
 }
 
 void comm_sendGotoResponse(step_t ax1, step_t ax2) {
     char msg[60];
     snprintf(msg, sizeof(msg), "+g %lli %lli\n", ax1, ax2);
 
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendStopResponse(bool instant) {
     char msg[20];
     snprintf(msg, sizeof(msg), "+s %hhi\n", instant);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendCprResponse(step_t ax1, step_t ax2) {
-    char msg[40];
+    char msg[60];
     snprintf(msg, sizeof(msg), "+gc %lli %lli\n", ax1, ax2);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
-void comm_sendStatusResponse(mount_status_t status) {
+void comm_sendStatusResponse(mount_status_t status, uint8_t fault) {
     char msg[20];
-    snprintf(msg, sizeof(msg), "+gs %i\n", status);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    snprintf(msg, sizeof(msg), "+gs %i %hhu\n", status, fault);
+    sendLine(msg);
 }
 
 void comm_sendProtocolVersionResponse() {
     char msg[20];
     snprintf(msg, sizeof(msg), "+gpv %i\n", UART_CTRL_PROTOCOL_VERSION);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendTrackBufferFreeSpaceResponse(uint32_t freeSpace) {
     char msg[20];
     snprintf(msg, sizeof(msg), "+%s %u\n", CMD_STR_GET_TRACK_BUF_FREE_SPACE, freeSpace);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendTrackBufferSizeResponse(uint32_t size) {
     char msg[20];
     snprintf(msg, sizeof(msg), "+%s %u\n", CMD_STR_GET_TRACK_BUF_SIZE, size);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void sendEmptyResponse(char* cmdStr) {
     char msg[10];
     snprintf(msg, sizeof(msg), "+%s\n", cmdStr);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendTrackBufferClearResponse() {
@@ -469,7 +1036,7 @@ void comm_sendTrackBufferClearResponse() {
 void comm_sendAddTrackPointResponse(uint8_t successCode) {
     char msg[20];
     snprintf(msg, sizeof(msg), "+%s %hu\n", CMD_STR_TRACK_BUF_ADD_POINT, successCode);
-    uart_write_bytes(COMM_UART_PORT, msg, strlen(msg));
+    sendLine(msg);
 }
 
 void comm_sendTrackingBeginResponse() {
@@ -478,4 +1045,189 @@ void comm_sendTrackingBeginResponse() {
 
 void comm_sendTrackingStopRespone() {
     sendEmptyResponse(CMD_STR_TRACKING_STOP);
+}
+
+void comm_sendTrackingBeginAtResponse(uint64_t time) {
+    char msg[30];
+    snprintf(msg, sizeof(msg), "+%s %llu\n", CMD_STR_TRACKING_BEGIN_AT, time);
+    sendLine(msg);
+}
+
+void comm_sendJogResponse() {
+    sendEmptyResponse(CMD_STR_JOG);
+}
+
+void comm_sendTrackOffsetResponse(step_t ax1, step_t ax2) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %lli %lli\n", CMD_STR_TRACK_OFFSET, ax1, ax2);
+    sendLine(msg);
+}
+
+void comm_sendTrackRateOffsetResponse(float r1, float r2) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %.3f %.3f\n", CMD_STR_TRACK_RATE_OFFSET, r1, r2);
+    sendLine(msg);
+}
+
+void comm_sendTrackTimeShiftResponse(int64_t timeShift) {
+    char msg[30];
+    snprintf(msg, sizeof(msg), "+%s %lli\n", CMD_STR_TRACK_TIME_SHIFT, timeShift);
+    sendLine(msg);
+}
+
+void comm_sendTrackBufferNextResponse(uint8_t bufferIdx) {
+    char msg[20];
+    snprintf(msg, sizeof(msg), "+%s %hhu\n", CMD_STR_TRACK_BUF_NEXT, bufferIdx);
+    sendLine(msg);
+}
+
+void comm_sendTrackBufferSwapResponse(uint64_t time) {
+    char msg[30];
+    snprintf(msg, sizeof(msg), "+%s %llu\n", CMD_STR_TRACK_BUF_SWAP, time);
+    sendLine(msg);
+}
+
+void comm_sendStatsResponse(uint8_t axis, const motor_stats_t *stats) {
+    char msg[300];
+    int len = snprintf(msg, sizeof(msg), "+%s %hhu %u %u %u", CMD_STR_GET_STATS, axis, 
+        stats->missedDeadlines, stats->multSwitches, stats->maxLateness);
+    for (int i = 0; i < MOTOR_STATS_BUCKET_COUNT; i++)
+        len += snprintf(msg + len, sizeof(msg) - len, " %u", stats->latenessHist[i]);
+    for (int i = 0; i < MOTOR_MODE_COUNT; i++)
+        len += snprintf(msg + len, sizeof(msg) - len, " %lli", stats->modeTime[i] / 1000);
+    snprintf(msg + len, sizeof(msg) - len, " %u %u %hu\n", stats->stalls, stats->driverErrors, stats->sgResult);
+    sendLine(msg);
+}
+
+void comm_sendResetStatsResponse() {
+    sendEmptyResponse(CMD_STR_RESET_STATS);
+}
+
+void comm_sendTraceEvent(uint32_t seq, const trace_event_t *event) {
+    char msg[120];
+    snprintf(msg, sizeof(msg), "+%s %u %lli %hhu %hhu %i %i %i %i\n", CMD_STR_TRACE_EVENT, seq, event->time, event->type, event->axis,
+        event->args[0], event->args[1], event->args[2], event->args[3]);
+    sendLine(msg);
+}
+
+void comm_sendTraceResponse(uint32_t next, uint32_t count) {
+    char msg[40];
+    snprintf(msg, sizeof(msg), "+%s %u %u\n", CMD_STR_GET_TRACE, next, count);
+    sendLine(msg);
+}
+
+void comm_sendDiagTask(const diag_task_t *task) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %s %hu %hu %u\n", CMD_STR_DIAG_TASK, task->name, task->load, task->maxLoad, task->stackFree);
+    sendLine(msg);
+}
+
+void comm_sendDiagQueue(const diag_queue_t *queue) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %s %u %u\n", CMD_STR_DIAG_QUEUE, queue->name, queue->count, queue->maxCount);
+    sendLine(msg);
+}
+
+void comm_sendDiagResponse(uint32_t freeHeap, uint32_t minFreeHeap, uint32_t logDropped, uint32_t taskCount, uint32_t trackWindowMisses) {
+    char msg[70];
+    snprintf(msg, sizeof(msg), "+%s %u %u %u %u %u\n", CMD_STR_GET_DIAG, freeHeap, minFreeHeap, logDropped, taskCount, trackWindowMisses);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibBeginResponse(const char *name) {
+    char msg[40];
+    snprintf(msg, sizeof(msg), "+%s %s\n", CMD_STR_TRAJLIB_BEGIN, name);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibPointResponse(uint8_t resultCode) {
+    char msg[20];
+    snprintf(msg, sizeof(msg), "+%s %hhu\n", CMD_STR_TRAJLIB_POINT, resultCode);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibEndResponse(uint32_t count) {
+    char msg[30];
+    snprintf(msg, sizeof(msg), "+%s %u\n", CMD_STR_TRAJLIB_END, count);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibEntry(uint32_t idx, const trajlib_entry_t *entry) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %u %.*s %u\n", CMD_STR_TRAJLIB_ENTRY, idx, TRAJLIB_NAME_LENGTH, entry->name, entry->count);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibListResponse(uint32_t count, uint32_t freePoints) {
+    char msg[40];
+    snprintf(msg, sizeof(msg), "+%s %u %u\n", CMD_STR_TRAJLIB_LIST, count, freePoints);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibReplayResponse(uint32_t count) {
+    char msg[30];
+    snprintf(msg, sizeof(msg), "+%s %u\n", CMD_STR_TRAJLIB_REPLAY, count);
+    sendLine(msg);
+}
+
+void comm_sendTrajlibClearResponse() {
+    sendEmptyResponse(CMD_STR_TRAJLIB_CLEAR);
+}
+
+void comm_sendConfigResponse(uint8_t axis, const persist_axis_config_t *config) {
+    char msg[160];
+    snprintf(msg, sizeof(msg), "+%s %hhu %lli %.3f %.3f %.3f %.3f %.3f %i %i %i %.3f %.3f\n", CMD_STR_GET_CONFIG, axis, config->cpr,
+        config->maxV, config->maxA, config->brakeA, config->aPosK, config->gotoMinV, config->minStepI,
+        config->irun, config->ihold, config->stealthV, config->stallV);
+    sendLine(msg);
+}
+
+void comm_sendSetConfigResponse(uint8_t axis, const char *name, double value) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %hhu %s %.3f\n", CMD_STR_SET_CONFIG, axis, name, value);
+    sendLine(msg);
+}
+
+void comm_sendCheckpointResponse(uint8_t source, const persist_checkpoint_t *checkpoint, mount_status_t statusCode) {
+    char msg[60];
+    snprintf(msg, sizeof(msg), "+%s %hhu %lli %lli %i\n", CMD_STR_GET_CHECKPOINT, source, checkpoint->ax1, checkpoint->ax2, statusCode);
+    sendLine(msg);
+}
+
+void comm_sendFaultClearResponse() {
+    char msg[10];
+    snprintf(msg, sizeof(msg), "+%s\n", CMD_STR_FAULT_CLEAR);
+    sendLine(msg);
+}
+
+void comm_sendSetAddressResponse(uint8_t address) {
+    char msg[20];
+    snprintf(msg, sizeof(msg), "+%s %hhu\n", CMD_STR_SET_ADDRESS, address);
+    sendLine(msg);
+}
+
+void comm_sendTrackStreamResponse(uint32_t credits) {
+    char msg[20];
+    snprintf(msg, sizeof(msg), "+%s %u\n", CMD_STR_TRACK_STREAM, credits);
+    sendLine(msg);
+}
+
+/**
+ * @brief Writes an unsolicited line, not a reply to any frame. It goes out with the device address, if it has one.
+ * 
+ */
+void sendUnsolicited(const char *line) {
+    sendLineTo(commAddress, line);
+}
+
+void comm_sendStreamCredits(uint32_t credits) {
+    char msg[20];
+    snprintf(msg, sizeof(msg), "%c%s %u\n", CMD_UNSOLICITED_START, CMD_STR_STREAM_CREDITS, credits);
+    sendUnsolicited(msg);
+}
+
+void comm_sendLowWatermarkAlert(uint32_t count, uint64_t timeToEmpty) {
+    char msg[40];
+    snprintf(msg, sizeof(msg), "%c%s %u %llu\n", CMD_UNSOLICITED_START, CMD_STR_LOW_WATERMARK, count, timeToEmpty);
+    sendUnsolicited(msg);
 }
\ No newline at end of file
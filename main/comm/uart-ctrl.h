@@ -1,16 +1,24 @@
 #ifndef __MOUNT_COMM
 #define __MOUNT_COMM
 
-#include <driver/uart.h>
-#include <driver/gpio.h>
 #include "../config.h"
+#include "../motors/motor-driver.h"
 #include "../settings.h"
+#include "../log/trace.h"
+#include "../diag/diag.h"
+#include "../trajlib/trajlib.h"
+#include "../persist/persist.h"
+#include "transport.h"
 
-#define COMM_UART_PORT UART_NUM_2
+#define COMM_UART_PORT 2
 #define COMM_BAUD_RATE 115200
-#define COMM_PIN_TX GPIO_NUM_26
-#define COMM_PIN_RX GPIO_NUM_27
 #define RX_TX_BUFFER_SIZE 1024
+/**
+ * @brief Device address on a multi-drop bus. With COMM_ADDRESS_NONE (default), the device takes unaddressed frames 
+ * only, as on a point-to-point link. See comm_getNext for the framing.
+ */
+#define COMM_ADDRESS_NONE 0
+#define COMM_ADDRESS_MAX 254
 
 #define MOUNT_MSG_CMD_ERR_UNKNOWN_CMD -3
 #define MOUNT_MSG_CMD_ERR_INVALID_CMD -2
@@ -31,6 +39,29 @@
 #define MOUNT_MSG_CMD_TRACK_ADD_POINT 13
 #define MOUNT_MSG_CMD_TRACKING_BEGIN 14
 #define MOUNT_MSG_CMD_TRACKING_STOP 15
+#define MOUNT_MSG_CMD_TRACK_BUF_NEXT 16
+#define MOUNT_MSG_CMD_TRACK_BUF_SWAP 17
+#define MOUNT_MSG_CMD_TRACKING_BEGIN_AT 18
+#define MOUNT_MSG_CMD_JOG 19
+#define MOUNT_MSG_CMD_TRACK_OFFSET 20
+#define MOUNT_MSG_CMD_TRACK_RATE_OFFSET 21
+#define MOUNT_MSG_CMD_TRACK_TIME_SHIFT 22
+#define MOUNT_MSG_CMD_GET_STATS 23
+#define MOUNT_MSG_CMD_RESET_STATS 24
+#define MOUNT_MSG_CMD_GET_TRACE 25
+#define MOUNT_MSG_CMD_GET_DIAG 26
+#define MOUNT_MSG_CMD_TRAJLIB_BEGIN 27
+#define MOUNT_MSG_CMD_TRAJLIB_POINT 28
+#define MOUNT_MSG_CMD_TRAJLIB_END 29
+#define MOUNT_MSG_CMD_TRAJLIB_LIST 30
+#define MOUNT_MSG_CMD_TRAJLIB_REPLAY 31
+#define MOUNT_MSG_CMD_TRAJLIB_CLEAR 32
+#define MOUNT_MSG_CMD_GET_CONFIG 33
+#define MOUNT_MSG_CMD_SET_CONFIG 34
+#define MOUNT_MSG_CMD_GET_CHECKPOINT 35
+#define MOUNT_MSG_CMD_FAULT_CLEAR 36
+#define MOUNT_MSG_CMD_SET_ADDRESS 37
+#define MOUNT_MSG_CMD_TRACK_STREAM 38
 
 #define MOUNT_ERR_CODE_INTERNAL 1
 #define MOUNT_ERR_CODE_INVALID_MSG 2
@@ -40,6 +71,9 @@
 #define MOUNT_STATUS_CODE_GOTO 1
 #define MOUNT_STATUS_CODE_TRACKING 2
 #define MOUNT_STATUS_CODE_BRAKING 3
+#define MOUNT_STATUS_CODE_ARMED 4
+#define MOUNT_STATUS_CODE_VELOCITY 5
+#define MOUNT_STATUS_CODE_FAULT 6
 
 #define UART_CTRL_PROTOCOL_VERSION 0
 
@@ -55,7 +89,97 @@ typedef struct MountMsg_Goto {
     step_t ax2;
 } MountMsg_Goto;
 
+/**
+ * @brief Target velocities of the axes (steps per second)
+ * 
+ */
+typedef struct MountMsg_Jog {
+    float v1;
+    float v2;
+} MountMsg_Jog;
+
+/**
+ * @brief Position offsets of the tracked trajectory (steps)
+ * 
+ */
+typedef struct MountMsg_TrackOffset {
+    step_t ax1;
+    step_t ax2;
+} MountMsg_TrackOffset;
+
+/**
+ * @brief Rate offsets of the tracked trajectory (steps per second)
+ * 
+ */
+typedef struct MountMsg_TrackRate {
+    float r1;
+    float r2;
+} MountMsg_TrackRate;
+
+/**
+ * @brief Range of the motion trace dump
+ * 
+ */
+typedef struct MountMsg_GetTrace {
+    /**
+     * @brief Sequence number of the first requested event
+     * 
+     */
+    uint32_t from;
+    /**
+     * @brief Maximum number of events to send
+     * 
+     */
+    uint32_t max;
+} MountMsg_GetTrace;
+
+/**
+ * @brief Trajectory replay from the trajectory library
+ * 
+ */
+typedef struct MountMsg_TrajlibReplay {
+    char name[TRAJLIB_NAME_LENGTH];
+    /**
+     * @brief Mount time the first point is moved to, the others keep their spacing. 0 keeps the stored times.
+     * 
+     */
+    uint64_t startTime;
+} MountMsg_TrajlibReplay;
+
+/**
+ * @brief Track streaming mode settings
+ * 
+ */
+typedef struct MountMsg_TrackStream {
+    bool enable;
+    /**
+     * @brief Number of points left for the tracking below which the low watermark alert is sent, 0 for no alerts
+     * 
+     */
+    uint32_t watermark;
+} MountMsg_TrackStream;
+
+/**
+ * @brief Axis configuration parameter change
+ * 
+ */
+typedef struct MountMsg_SetConfig {
+    uint8_t axis;
+    /**
+     * @brief Parameter name, see persist_setAxisParam
+     * 
+     */
+    char name[PERSIST_NAME_LENGTH];
+    double value;
+} MountMsg_SetConfig;
+
 typedef union MountMsg_data {
+    /**
+     * @brief Mount time in milliseconds
+     * 
+     * Associated with `MOUNT_MSG_CMD_TIME_SYNC`, `MOUNT_MSG_CMD_TRACK_BUF_SWAP` (swap time) 
+     * and `MOUNT_MSG_CMD_TRACKING_BEGIN_AT` (tracking start time) commands
+     */
     uint64_t time;
     MountMsg_SetPos setPos;
     MountMsg_Goto goTo;
@@ -66,6 +190,37 @@ typedef union MountMsg_data {
      */
     bool stopInstant;
     TrackPoint trackPoint;
+    MountMsg_Jog jog;
+    MountMsg_TrackOffset trackOffset;
+    MountMsg_TrackRate trackRate;
+    /**
+     * @brief Time shift of the tracked trajectory in milliseconds
+     * 
+     * Associated with `MOUNT_MSG_CMD_TRACK_TIME_SHIFT` command
+     */
+    int64_t timeShift;
+    /**
+     * @brief Axis number
+     * 
+     * Associated with `MOUNT_MSG_CMD_GET_STATS` and `MOUNT_MSG_CMD_GET_CONFIG` commands
+     */
+    uint8_t axis;
+    MountMsg_GetTrace getTrace;
+    /**
+     * @brief Trajectory name
+     * 
+     * Associated with `MOUNT_MSG_CMD_TRAJLIB_BEGIN` command
+     */
+    char name[TRAJLIB_NAME_LENGTH];
+    MountMsg_TrajlibReplay trajlibReplay;
+    MountMsg_SetConfig setConfig;
+    /**
+     * @brief Bus address of the device
+     * 
+     * Associated with `MOUNT_MSG_CMD_SET_ADDRESS` command
+     */
+    uint8_t address;
+    MountMsg_TrackStream trackStream;
 
 } MountMsg_data;
 
@@ -75,18 +230,41 @@ typedef struct MountMsg {
 } MountMsg;
 
 /**
- * @brief Initiates mount communication through a UART port. Other functions in this file can be then used 
- * for communication with the control pc (or some other device). For this communication, pins `COMM_PIN_TX` and `COMM_PIN_RX` are used
+ * @brief Initiates mount communication through the transport selected by the `MOUNT_COMM_TRANSPORT` choice (menuconfig), 
+ * by default the UART port on pins `COMM_PIN_TX` and `COMM_PIN_RX`. Other functions in this file can be then used 
+ * for communication with the control pc (or some other device). Panics if the transport can't be initialized.
  * 
  */
 void comm_init();
+/**
+ * @brief Initiates mount communication through the given transport, instead of comm_init
+ * 
+ * @param transport Initialized transport (see transport.h), must stay valid
+ */
+void comm_initTransport(comm_transport_t *transport);
 /**
  * @brief If there is any incoming data to read, reads it and parses it into `MountMsg` object, which is than returned.
  * 
  * If there is no incoming data, MountMsg object with attribute `cmd` set to `MOUNT_MSG_CMD_NONE` is returned.
+ * 
+ * On a multi-drop bus (several mounts on one RS-485 line), frames are prefixed by the device address, `@<address> +<cmd> ...`.
+ * Only the addressed device processes the frame, and its replies (all lines until the next frame) get the same prefix.
+ * `@* ` is a broadcast - processed by all the devices and never answered, only the time sync, stop and tracking start 
+ * at and stop commands can be broadcast. Devices with an address ignore unaddressed frames, devices without one
+ * (COMM_ADDRESS_NONE) take unaddressed frames and broadcasts.
  * @return MountMsg Mount message object containg command and its arguments.
  */
 MountMsg comm_getNext();
+/**
+ * @brief Returns the bus address of the device, COMM_ADDRESS_NONE if it has none
+ * 
+ */
+uint8_t comm_getAddress();
+/**
+ * @brief Sets the bus address, effective from the next frame. Doesn't store it (see persist_setAddress).
+ * 
+ */
+void comm_setAddress(uint8_t address);
 
 /**
  * @brief Sends error back through uart. This error has format of `"! {errCode} {msg}"`
@@ -125,8 +303,9 @@ void comm_sendCprResponse(step_t ax1, step_t ax2);
  * @brief Sends a response to the status request command
  * 
  * @param status Status of the mount (one of MOUNT_STATUS_CODE_* constants)
+ * @param fault Latched fault (MOTOR_FAULT_* bits), 0 if there is none
  */
-void comm_sendStatusResponse(mount_status_t status);
+void comm_sendStatusResponse(mount_status_t status, uint8_t fault);
 
 /**
  * @brief Sends a response to the protocol version request command
@@ -140,4 +319,145 @@ void comm_sendTrackBufferClearResponse();
 void comm_sendAddTrackPointResponse(uint8_t successCode);
 void comm_sendTrackingBeginResponse();
 void comm_sendTrackingStopRespone();
+/**
+ * @brief Sends a response to the scheduled tracking start command
+ * 
+ * @param time Mount time when the tracking starts
+ */
+void comm_sendTrackingBeginAtResponse(uint64_t time);
+/**
+ * @brief Sends a response to the velocity (jog) command
+ * 
+ */
+void comm_sendJogResponse();
+void comm_sendTrackOffsetResponse(step_t ax1, step_t ax2);
+void comm_sendTrackRateOffsetResponse(float r1, float r2);
+void comm_sendTrackTimeShiftResponse(int64_t timeShift);
+/**
+ * @brief Sends a response to the statistics request command. The response contains the missed deadlines, 
+ * multiplier switches, maximum step lateness (us), the lateness histogram, time spent in each motor mode (ms),
+ * and the driver stalls, errors and last StallGuard result.
+ * 
+ * @param axis Axis number
+ * @param stats Statistics of the axis motor
+ */
+void comm_sendStatsResponse(uint8_t axis, const motor_stats_t *stats);
+void comm_sendResetStatsResponse();
+/**
+ * @brief Sends a single motion trace event, as a part of the response to the trace dump command
+ * 
+ * @param seq Sequence number of the event
+ * @param event Event
+ */
+void comm_sendTraceEvent(uint32_t seq, const trace_event_t *event);
+/**
+ * @brief Sends the final line of the response to the trace dump command
+ * 
+ * @param next Sequence number to continue the dump from
+ * @param count Number of events sent
+ */
+void comm_sendTraceResponse(uint32_t next, uint32_t count);
+/**
+ * @brief Sends statistics of a single task, as a part of the response to the diagnostics command
+ * 
+ */
+void comm_sendDiagTask(const diag_task_t *task);
+/**
+ * @brief Sends statistics of a single queue, as a part of the response to the diagnostics command
+ * 
+ */
+void comm_sendDiagQueue(const diag_queue_t *queue);
+/**
+ * @brief Sends the final line of the response to the diagnostics command
+ * 
+ * @param freeHeap Free heap (bytes)
+ * @param minFreeHeap Minimum free heap since boot (bytes)
+ * @param logDropped Number of dropped log records
+ * @param taskCount Number of tasks sent
+ * @param trackWindowMisses Number of track points pulled while the prefetch window was empty
+ */
+void comm_sendDiagResponse(uint32_t freeHeap, uint32_t minFreeHeap, uint32_t logDropped, uint32_t taskCount, uint32_t trackWindowMisses);
+/**
+ * @brief Sends a response to the track buffer next command
+ * 
+ * @param bufferIdx Index of the track buffer prepared for upload
+ */
+void comm_sendTrackBufferNextResponse(uint8_t bufferIdx);
+/**
+ * @brief Sends a response to the track buffer swap command
+ * 
+ * @param time Scheduled swap time (0 if the swap happens on completion of the active buffer)
+ */
+void comm_sendTrackBufferSwapResponse(uint64_t time);
+void comm_sendTrajlibBeginResponse(const char *name);
+/**
+ * @brief Sends a response to the trajectory library point command
+ * 
+ * @param resultCode TRAJLIB_OK or TRAJLIB_ERR_* code
+ */
+void comm_sendTrajlibPointResponse(uint8_t resultCode);
+/**
+ * @brief Sends a response to the trajectory library end command
+ * 
+ * @param count Number of points of the stored trajectory
+ */
+void comm_sendTrajlibEndResponse(uint32_t count);
+/**
+ * @brief Sends a single stored trajectory, as a part of the response to the trajectory list command
+ * 
+ * @param idx Index of the trajectory
+ * @param entry Directory entry of the trajectory
+ */
+void comm_sendTrajlibEntry(uint32_t idx, const trajlib_entry_t *entry);
+/**
+ * @brief Sends the final line of the response to the trajectory list command
+ * 
+ * @param count Number of stored trajectories
+ * @param freePoints Number of points that can still be stored
+ */
+void comm_sendTrajlibListResponse(uint32_t count, uint32_t freePoints);
+/**
+ * @brief Sends a response to the trajectory replay command
+ * 
+ * @param count Number of points of the trajectory mapped to the track buffer
+ */
+void comm_sendTrajlibReplayResponse(uint32_t count);
+void comm_sendTrajlibClearResponse();
+/**
+ * @brief Sends a response to the configuration request command
+ * 
+ * @param axis Axis number
+ * @param config Configuration of the axis
+ */
+void comm_sendConfigResponse(uint8_t axis, const persist_axis_config_t *config);
+void comm_sendSetConfigResponse(uint8_t axis, const char *name, double value);
+/**
+ * @brief Sends a response to the checkpoint request command
+ * 
+ * @param source Where the position was restored from at boot (PERSIST_SOURCE_* constant)
+ * @param checkpoint The restored checkpoint
+ * @param statusCode Mount status when the checkpoint was taken (one of MOUNT_STATUS_CODE_* constants)
+ */
+void comm_sendCheckpointResponse(uint8_t source, const persist_checkpoint_t *checkpoint, mount_status_t statusCode);
+void comm_sendFaultClearResponse();
+void comm_sendSetAddressResponse(uint8_t address);
+/**
+ * @brief Sends the track streaming mode response
+ * 
+ * @param credits Track points the client may send right away (the initial credit grant), 0 if the mode was disabled
+ */
+void comm_sendTrackStreamResponse(uint32_t credits);
+/**
+ * @brief Sends an unsolicited credit grant of the track streaming mode, `*tc <credits>` - the client may send
+ * `credits` more track points
+ * 
+ */
+void comm_sendStreamCredits(uint32_t credits);
+/**
+ * @brief Sends an unsolicited low watermark alert of the track streaming mode, `*tlw <count> <timeToEmpty>`
+ * 
+ * @param count Points left for the tracking
+ * @param timeToEmpty Time until the last of them is reached (ms)
+ */
+void comm_sendLowWatermarkAlert(uint32_t count, uint64_t timeToEmpty);
 #endif
\ No newline at end of file
@@ -1,16 +1,9 @@
 #ifndef __ESP_MOUNT_CONFIG
 #define __ESP_MOUNT_CONFIG
 
-typedef int64_t step_t;
+#include <stdint.h>
+#include "board.h"
 
-/**
- * @brief Steps per full rotation for the first axis.
- */
-#define CPR_AX1 2304000
-/**
- * @brief Steps per full rotation for the second axis.
- * 
- */
-#define CPR_AX2 2304000
+typedef int64_t step_t;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#include "diag.h"
+#include <string.h>
+#include "../log/dlog.h"
+
+#define TAG "diag"
+
+hal_mutex_buffer_t diagMtxBuffer;
+hal_mutex_t diagMtx;
+diag_task_t diagTasks[DIAG_MAX_TASKS];
+uint32_t diagTaskCount = 0;
+diag_queue_t diagQueues[DIAG_MAX_QUEUES];
+uint32_t diagQueueCount = 0;
+uint32_t lastTotalRunTime = 0;
+
+void diag_init() {
+    diagMtx = hal_mutexCreateStatic(&diagMtxBuffer);
+}
+
+bool diag_addQueue(const char *name, hal_queue_t queue) {
+    if (diagQueueCount == DIAG_MAX_QUEUES)
+        return false;
+
+    diag_queue_t q = {
+        .name = name,
+        .queue = queue,
+        .count = 0,
+        .maxCount = 0
+    };
+    diagQueues[diagQueueCount++] = q;
+    return true;
+}
+
+diag_task_t *findTask(diag_task_t *tasks, uint32_t count, uint32_t id) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (tasks[i].id == id)
+            return &tasks[i];
+    }
+    return NULL;
+}
+
+void diag_sample() {
+    hal_task_info_t info[DIAG_MAX_TASKS];
+    uint32_t totalRunTime;
+    uint32_t count = hal_getTasks(info, DIAG_MAX_TASKS, &totalRunTime);
+
+    if (!hal_mutexTake(diagMtx, DIAG_MTX_TIMEOUT)) {
+        DLOGW(TAG, "Couldn't acquire diag mutex!");
+        return;
+    }
+
+    // Tasks are matched with the previous sample by their number, so the deleted ones disappear
+    diag_task_t previous[DIAG_MAX_TASKS];
+    uint32_t previousCount = diagTaskCount;
+    memcpy(previous, diagTasks, previousCount * sizeof(diag_task_t));
+    uint32_t period = totalRunTime - lastTotalRunTime;
+
+    for (uint32_t i = 0; i < count; i++) {
+        diag_task_t *task = &diagTasks[i];
+        diag_task_t *prev = findTask(previous, previousCount, info[i].id);
+        task->id = info[i].id;
+        strncpy(task->name, info[i].name, DIAG_TASK_NAME_LEN - 1);
+        task->name[DIAG_TASK_NAME_LEN - 1] = 0;
+        for (char *c = task->name; *c != 0; c++) {
+            if (*c == ' ')
+                *c = '_';
+        }
+        task->stackFree = info[i].stackFree;
+        task->lastRunTime = info[i].runTime;
+        task->load = 0;
+        task->maxLoad = 0;
+
+        if (prev != NULL && period > 0) {
+            uint64_t load = (uint64_t)(info[i].runTime - prev->lastRunTime) * 1000 / period;
+            task->load = load > 1000 ? 1000 : load;
+            task->maxLoad = prev->maxLoad > task->load ? prev->maxLoad : task->load;
+        }
+    }
+    diagTaskCount = count;
+    lastTotalRunTime = totalRunTime;
+
+    for (uint32_t i = 0; i < diagQueueCount; i++) {
+        diag_queue_t *q = &diagQueues[i];
+        q->count = hal_queueCount(q->queue);
+        if (q->count > q->maxCount)
+            q->maxCount = q->count;
+    }
+
+    hal_mutexGive(diagMtx);
+}
+
+uint32_t diag_getTasks(diag_task_t *tasks, uint32_t maxCount) {
+    if (!hal_mutexTake(diagMtx, DIAG_MTX_TIMEOUT))
+        return 0;
+
+    uint32_t count = diagTaskCount < maxCount ? diagTaskCount : maxCount;
+    memcpy(tasks, diagTasks, count * sizeof(diag_task_t));
+    hal_mutexGive(diagMtx);
+    return count;
+}
+
+uint32_t diag_getQueues(diag_queue_t *queues, uint32_t maxCount) {
+    if (!hal_mutexTake(diagMtx, DIAG_MTX_TIMEOUT))
+        return 0;
+
+    uint32_t count = diagQueueCount < maxCount ? diagQueueCount : maxCount;
+    memcpy(queues, diagQueues, count * sizeof(diag_queue_t));
+    hal_mutexGive(diagMtx);
+    return count;
+}
@@ -0,0 +1,94 @@
+#ifndef __MOUNT_DIAG
+#define __MOUNT_DIAG
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../hal/hal.h"
+
+/**
+ * @brief Runtime diagnostics - CPU load and stack headroom of the tasks, heap and queue depths. 
+ * `diag_sample` is called periodically (by the blink task each second), the results can be read any time.
+ */
+
+#define DIAG_MAX_TASKS 16
+#define DIAG_MAX_QUEUES 4
+#define DIAG_TASK_NAME_LEN 16
+#define DIAG_MTX_TIMEOUT 100 // ms
+
+typedef struct DiagTask {
+    uint32_t id;
+    /**
+     * @brief Task name, with spaces replaced by underscores
+     * 
+     */
+    char name[DIAG_TASK_NAME_LEN];
+    /**
+     * @brief CPU load during the last sample period, in per mille of one core
+     * 
+     */
+    uint16_t load;
+    /**
+     * @brief Maximum of `load` since boot
+     * 
+     */
+    uint16_t maxLoad;
+    /**
+     * @brief Minimum free stack since the task start (bytes)
+     * 
+     */
+    uint32_t stackFree;
+    /**
+     * @brief Run time counter at the last sample
+     * 
+     */
+    uint32_t lastRunTime;
+} diag_task_t;
+
+typedef struct DiagQueue {
+    const char *name;
+    hal_queue_t queue;
+    /**
+     * @brief Items waiting at the last sample
+     * 
+     */
+    uint32_t count;
+    /**
+     * @brief Maximum of the sampled `count` since boot
+     * 
+     */
+    uint32_t maxCount;
+} diag_queue_t;
+
+void diag_init();
+/**
+ * @brief Adds a queue whose depth should be monitored
+ * 
+ * @param name Name of the queue (pointer is stored, no spaces)
+ * @param queue Queue
+ * @return true Queue added
+ * @return false Too many queues
+ */
+bool diag_addQueue(const char *name, hal_queue_t queue);
+/**
+ * @brief Samples the task run times, stacks and queue depths. The CPU load is computed over the time since the previous call.
+ * 
+ */
+void diag_sample();
+/**
+ * @brief Copies the task statistics from the last sample
+ * 
+ * @param tasks Array for the tasks
+ * @param maxCount Length of `tasks`
+ * @return uint32_t Number of tasks copied
+ */
+uint32_t diag_getTasks(diag_task_t *tasks, uint32_t maxCount);
+/**
+ * @brief Copies the queue statistics from the last sample
+ * 
+ * @param queues Array for the queues
+ * @param maxCount Length of `queues`
+ * @return uint32_t Number of queues copied
+ */
+uint32_t diag_getQueues(diag_queue_t *queues, uint32_t maxCount);
+
+#endif
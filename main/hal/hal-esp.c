@@ -0,0 +1,320 @@
+#include "hal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <freertos/semphr.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_task_wdt.h>
+#include <esp_cpu.h>
+#include <esp_intr_alloc.h>
+#include <sdkconfig.h>
+#include <soc/soc.h>
+#include <soc/gpio_reg.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <driver/spi_master.h>
+#include <esp_partition.h>
+#include <nvs_flash.h>
+#include <nvs.h>
+
+#define HAL_STORAGE_NAMESPACE "mount"
+#define HAL_UART_RTS_THRESHOLD 100 // Bytes in the RX FIFO (128) at which RTS is deasserted
+#define HAL_GPIO_PULSE_CYCLES (HAL_GPIO_PULSE_NS * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ / 1000)
+
+nvs_handle_t storageHandle;
+bool storageOpen = false;
+
+int64_t hal_getTime() {
+    return esp_timer_get_time();
+}
+
+hal_tick_t hal_getTicks() {
+    return xTaskGetTickCount();
+}
+
+void hal_delay(uint32_t ms) {
+    TickType_t ticks = ms / portTICK_PERIOD_MS;
+    vTaskDelay(ticks > 0 ? ticks : 1);
+}
+
+void hal_delayUntil(hal_tick_t *lastWake, uint32_t periodMs) {
+    TickType_t lastTicks = *lastWake;
+    vTaskDelayUntil(&lastTicks, periodMs / portTICK_PERIOD_MS);
+    *lastWake = lastTicks;
+}
+
+void hal_disableIdleWatchdog(int core) {
+    TaskHandle_t idleTaskHandle = xTaskGetIdleTaskHandleForCPU(core);
+    esp_task_wdt_delete(idleTaskHandle);
+}
+
+int hal_getCoreId() {
+    return xPortGetCoreID();
+}
+
+uint32_t hal_getTasks(hal_task_info_t *tasks, uint32_t maxCount, uint32_t *totalRunTime) {
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    TaskStatus_t status[maxCount];
+    uint32_t count = uxTaskGetSystemState(status, maxCount, totalRunTime);
+    for (uint32_t i = 0; i < count; i++) {
+        tasks[i].id = status[i].xTaskNumber;
+        tasks[i].name = status[i].pcTaskName;
+        tasks[i].runTime = status[i].ulRunTimeCounter;
+        tasks[i].stackFree = status[i].usStackHighWaterMark; // StackType_t is a byte on ESP32
+    }
+    return count;
+#else
+    return 0;
+#endif
+}
+
+uint32_t hal_getFreeHeap() {
+    return esp_get_free_heap_size();
+}
+
+uint32_t hal_getMinFreeHeap() {
+    return esp_get_minimum_free_heap_size();
+}
+
+hal_reset_reason_t hal_getResetReason() {
+    switch (esp_reset_reason()) {
+    case ESP_RST_POWERON:
+        return HAL_RESET_POWER_ON;
+    case ESP_RST_SW:
+        return HAL_RESET_SOFTWARE;
+    case ESP_RST_PANIC:
+        return HAL_RESET_PANIC;
+    case ESP_RST_INT_WDT:
+    case ESP_RST_TASK_WDT:
+    case ESP_RST_WDT:
+        return HAL_RESET_WATCHDOG;
+    case ESP_RST_BROWNOUT:
+        return HAL_RESET_BROWNOUT;
+    default:
+        return HAL_RESET_OTHER;
+    }
+}
+
+hal_mutex_t hal_mutexCreate() {
+    return xSemaphoreCreateMutex();
+}
+
+hal_mutex_t hal_mutexCreateStatic(hal_mutex_buffer_t *buffer) {
+    return xSemaphoreCreateMutexStatic(buffer);
+}
+
+bool hal_mutexTake(hal_mutex_t mutex, uint32_t timeoutMs) {
+    return xSemaphoreTake(mutex, timeoutMs / portTICK_PERIOD_MS) == pdTRUE;
+}
+
+void hal_mutexGive(hal_mutex_t mutex) {
+    xSemaphoreGive(mutex);
+}
+
+hal_queue_t hal_queueCreate(uint32_t length, uint32_t itemSize) {
+    return xQueueCreate(length, itemSize);
+}
+
+hal_queue_t hal_queueCreateStatic(uint32_t length, uint32_t itemSize, uint8_t *storage, hal_queue_buffer_t *buffer) {
+    return xQueueCreateStatic(length, itemSize, storage, buffer);
+}
+
+bool hal_queueSend(hal_queue_t queue, const void *item) {
+    return xQueueSend(queue, item, 0) == pdPASS;
+}
+
+void hal_queueOverwrite(hal_queue_t queue, const void *item) {
+    xQueueOverwrite(queue, item);
+}
+
+bool hal_queueReceive(hal_queue_t queue, void *item) {
+    return xQueueReceive(queue, item, 0) == pdPASS;
+}
+
+uint32_t hal_queueCount(hal_queue_t queue) {
+    return uxQueueMessagesWaiting(queue);
+}
+
+void hal_gpioSetOutput(int pin) {
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+}
+
+void hal_gpioSetInput(int pin) {
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(pin, GPIO_FLOATING);
+}
+
+void hal_gpioSetLevel(int pin, uint32_t level) {
+    gpio_set_level(pin, level);
+}
+
+void hal_gpioPulse(hal_gpio_mask_t mask) {
+    uint32_t bank0 = mask;
+    uint32_t bank1 = mask >> 32;
+    uint32_t start = esp_cpu_get_ccount();
+    if (bank0 != 0)
+        REG_WRITE(GPIO_OUT_W1TS_REG, bank0);
+    if (bank1 != 0)
+        REG_WRITE(GPIO_OUT1_W1TS_REG, bank1);
+    while (esp_cpu_get_ccount() - start < HAL_GPIO_PULSE_CYCLES)
+        ;
+    if (bank0 != 0)
+        REG_WRITE(GPIO_OUT_W1TC_REG, bank0);
+    if (bank1 != 0)
+        REG_WRITE(GPIO_OUT1_W1TC_REG, bank1);
+}
+
+HAL_ISR_ATTR void hal_gpioClear(hal_gpio_mask_t mask) {
+    if ((uint32_t)mask != 0)
+        REG_WRITE(GPIO_OUT_W1TC_REG, (uint32_t)mask);
+    if ((uint32_t)(mask >> 32) != 0)
+        REG_WRITE(GPIO_OUT1_W1TC_REG, (uint32_t)(mask >> 32));
+}
+
+uint32_t hal_gpioGetLevel(int pin) {
+    return gpio_get_level(pin);
+}
+
+bool hal_gpioSetInterrupt(int pin, uint32_t level, hal_gpio_isr_t handler, void *arg) {
+    gpio_config_t config = {
+        .pin_bit_mask = 1ULL << pin,
+        .mode = GPIO_MODE_INPUT,
+        .pull_up_en = GPIO_PULLUP_ENABLE,
+        .pull_down_en = GPIO_PULLDOWN_DISABLE,
+        .intr_type = level ? GPIO_INTR_POSEDGE : GPIO_INTR_NEGEDGE
+    };
+    if (gpio_config(&config) != ESP_OK)
+        return false;
+    // The service dispatches in the IRAM, so the interrupt isn't delayed by flash writes. It's installed only once.
+    esp_err_t result = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+    if (result != ESP_OK && result != ESP_ERR_INVALID_STATE)
+        return false;
+    return gpio_isr_handler_add(pin, handler, arg) == ESP_OK;
+}
+
+bool hal_spiInit(int host, int sckPin, int mosiPin, int misoPin) {
+    spi_bus_config_t config = {
+        .sclk_io_num = sckPin,
+        .mosi_io_num = mosiPin,
+        .miso_io_num = misoPin,
+        .quadwp_io_num = -1,
+        .quadhd_io_num = -1,
+        .max_transfer_sz = 0
+    };
+    return spi_bus_initialize(host, &config, 0) == ESP_OK;
+}
+
+hal_spi_device_t hal_spiAddDevice(int host, int csPin, uint32_t clockHz, uint8_t mode) {
+    spi_device_interface_config_t config = {
+        .clock_speed_hz = clockHz,
+        .mode = mode,
+        .spics_io_num = csPin,
+        .queue_size = 1
+    };
+    spi_device_handle_t device;
+    if (spi_bus_add_device(host, &config, &device) != ESP_OK)
+        return NULL;
+    return device;
+}
+
+bool hal_spiTransfer(hal_spi_device_t device, const uint8_t *tx, uint8_t *rx, size_t len) {
+    spi_transaction_t transaction = {
+        .length = len * 8,
+        .tx_buffer = tx,
+        .rx_buffer = rx
+    };
+    return spi_device_polling_transmit(device, &transaction) == ESP_OK;
+}
+
+void hal_uartInit(int port, int baudRate, int txPin, int rxPin, size_t bufferSize) {
+    uart_config_t config = {
+        .baud_rate = baudRate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE
+    };
+
+    ESP_ERROR_CHECK(uart_param_config(port, &config));
+    ESP_ERROR_CHECK(uart_set_pin(port, txPin, rxPin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    ESP_ERROR_CHECK(uart_driver_install(port, bufferSize, bufferSize, 0, NULL, 0));
+}
+
+bool hal_uartSetHalfDuplex(int port, int dePin) {
+    // The driver enable is the RTS output in the RS-485 mode
+    return uart_set_pin(port, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, dePin, UART_PIN_NO_CHANGE) == ESP_OK
+        && uart_set_mode(port, UART_MODE_RS485_HALF_DUPLEX) == ESP_OK;
+}
+
+bool hal_uartSetFlowControl(int port, int rtsPin, int ctsPin) {
+    uart_hw_flowcontrol_t flowControl = UART_HW_FLOWCTRL_CTS_RTS;
+    if (ctsPin < 0)
+        flowControl = UART_HW_FLOWCTRL_RTS;
+    else if (rtsPin < 0)
+        flowControl = UART_HW_FLOWCTRL_CTS;
+    // The driver stops emptying the RX FIFO when its buffer is full, RTS then follows the FIFO threshold
+    return uart_set_pin(port, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, rtsPin, ctsPin) == ESP_OK
+        && uart_set_hw_flow_ctrl(port, flowControl, HAL_UART_RTS_THRESHOLD) == ESP_OK;
+}
+
+int hal_uartRead(int port, void *buffer, size_t len) {
+    return uart_read_bytes(port, buffer, len, 0);
+}
+
+int hal_uartWrite(int port, const void *buffer, size_t len) {
+    return uart_write_bytes(port, buffer, len);
+}
+
+size_t hal_uartAvailable(int port) {
+    size_t available = 0;
+    uart_get_buffered_data_len(port, &available);
+    return available;
+}
+
+void hal_uartFlushInput(int port) {
+    uart_flush_input(port);
+}
+
+hal_partition_t hal_partitionFind(const char *label) {
+    return esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+}
+
+uint32_t hal_partitionSize(hal_partition_t partition) {
+    return ((const esp_partition_t*)partition)->size;
+}
+
+bool hal_partitionErase(hal_partition_t partition, uint32_t offset, uint32_t size) {
+    return esp_partition_erase_range(partition, offset, size) == ESP_OK;
+}
+
+bool hal_partitionWrite(hal_partition_t partition, uint32_t offset, const void *data, size_t size) {
+    return esp_partition_write(partition, offset, data, size) == ESP_OK;
+}
+
+const void *hal_partitionMap(hal_partition_t partition) {
+    const void *ptr;
+    spi_flash_mmap_handle_t handle;
+    if (esp_partition_mmap(partition, 0, hal_partitionSize(partition), SPI_FLASH_MMAP_DATA, &ptr, &handle) != ESP_OK)
+        return NULL;
+    return ptr;
+}
+
+bool hal_storageInit() {
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+    storageOpen = err == ESP_OK && nvs_open(HAL_STORAGE_NAMESPACE, NVS_READWRITE, &storageHandle) == ESP_OK;
+    return storageOpen;
+}
+
+bool hal_storageRead(const char *key, void *data, size_t size) {
+    size_t length = size;
+    return storageOpen && nvs_get_blob(storageHandle, key, data, &length) == ESP_OK && length == size;
+}
+
+bool hal_storageWrite(const char *key, const void *data, size_t size) {
+    return storageOpen && nvs_set_blob(storageHandle, key, data, size) == ESP_OK && nvs_commit(storageHandle) == ESP_OK;
+}
@@ -0,0 +1,451 @@
+#ifndef __MOUNT_HAL
+#define __MOUNT_HAL
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief Hardware abstraction layer. Everything the firmware core (motors, settings, communication) needs 
+ * from the platform goes through these functions.
+ * 
+ * There are two backends:
+ *  - `hal-esp.c` - ESP-IDF (FreeRTOS, esp_timer, gpio and uart drivers), used in the firmware
+ *  - `host/sim/hal-sim.c` - POSIX simulation with a virtual clock, used by the host build
+ */
+
+/**
+ * @brief Mutex handle (SemaphoreHandle_t on ESP-IDF)
+ * 
+ */
+typedef void* hal_mutex_t;
+/**
+ * @brief Queue handle (QueueHandle_t on ESP-IDF)
+ * 
+ */
+typedef void* hal_queue_t;
+/**
+ * @brief Scheduler tick count, see hal_getTicks
+ * 
+ */
+typedef uint32_t hal_tick_t;
+/**
+ * @brief Flash partition handle (const esp_partition_t* on ESP-IDF)
+ * 
+ */
+typedef const void* hal_partition_t;
+/**
+ * @brief SPI device handle (spi_device_handle_t on ESP-IDF)
+ * 
+ */
+typedef void* hal_spi_device_t;
+/**
+ * @brief Set of GPIO pins, bit n is GPIO n (see HAL_GPIO_MASK)
+ * 
+ */
+typedef uint64_t hal_gpio_mask_t;
+#define HAL_GPIO_MASK(pin) ((hal_gpio_mask_t)1 << (pin))
+/**
+ * @brief GPIO interrupt handler, see hal_gpioSetInterrupt
+ * 
+ */
+typedef void (*hal_gpio_isr_t)(void *arg);
+
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#include <esp_attr.h>
+/**
+ * @brief Places a static variable into the external RAM (PSRAM), when enabled for static data. 
+ * Otherwise it stays in the internal DRAM.
+ * 
+ */
+#define HAL_EXT_RAM_ATTR EXT_RAM_ATTR
+/**
+ * @brief Places a static variable into the memory kept over resets (except power on), not initialized at boot
+ * 
+ */
+#define HAL_NOINIT_ATTR RTC_NOINIT_ATTR
+/**
+ * @brief Places an interrupt handler (and the functions it calls) into the IRAM, so it runs even while the flash 
+ * cache is disabled (flash and NVS writes)
+ * 
+ */
+#define HAL_ISR_ATTR IRAM_ATTR
+/**
+ * @brief Storage of a statically allocated mutex, see hal_mutexCreateStatic
+ * 
+ */
+typedef StaticSemaphore_t hal_mutex_buffer_t;
+/**
+ * @brief Storage of a statically allocated queue (without the items), see hal_queueCreateStatic
+ * 
+ */
+typedef StaticQueue_t hal_queue_buffer_t;
+#else
+#include <pthread.h>
+#define HAL_EXT_RAM_ATTR
+#define HAL_NOINIT_ATTR
+#define HAL_ISR_ATTR
+typedef pthread_mutex_t hal_mutex_buffer_t;
+typedef struct HalQueueBuffer {
+    uint32_t length;
+    uint32_t itemSize;
+    uint32_t head;
+    uint32_t count;
+    pthread_mutex_t mtx;
+    uint8_t *items;
+} hal_queue_buffer_t;
+#endif
+
+/**
+ * @brief Cause of the last reset, see hal_getResetReason
+ * 
+ */
+typedef enum HalResetReason {
+    HAL_RESET_POWER_ON,
+    HAL_RESET_SOFTWARE,
+    HAL_RESET_PANIC,
+    HAL_RESET_WATCHDOG,
+    HAL_RESET_BROWNOUT,
+    HAL_RESET_OTHER
+} hal_reset_reason_t;
+
+/**
+ * @brief Task information returned by hal_getTasks
+ * 
+ */
+typedef struct HalTaskInfo {
+    /**
+     * @brief Unique task number
+     * 
+     */
+    uint32_t id;
+    const char *name;
+    /**
+     * @brief Total time the task has been running, in the units of hal_getTasks `totalRunTime`
+     * 
+     */
+    uint32_t runTime;
+    /**
+     * @brief Minimum free stack since the task start (bytes)
+     * 
+     */
+    uint32_t stackFree;
+} hal_task_info_t;
+
+/**
+ * @brief Returns time since boot, in microseconds
+ * 
+ * @return int64_t Time
+ */
+int64_t hal_getTime();
+/**
+ * @brief Returns scheduler tick count. Meant to be used with hal_delayUntil.
+ * 
+ * @return hal_tick_t Tick count
+ */
+hal_tick_t hal_getTicks();
+/**
+ * @brief Blocks the calling task for (at least) the given time
+ * 
+ * @param ms Time in milliseconds
+ */
+void hal_delay(uint32_t ms);
+/**
+ * @brief Blocks the calling task until `periodMs` after `lastWake`, for periodic tasks. `lastWake` is updated.
+ * 
+ * @param lastWake Tick count of the last wake up, initialize it with hal_getTicks
+ * @param periodMs Period in milliseconds
+ */
+void hal_delayUntil(hal_tick_t *lastWake, uint32_t periodMs);
+/**
+ * @brief Removes the idle task of the core from the task watchdog. Needed on the core running the motor loop,
+ * which never yields.
+ * 
+ * @param core Core number
+ */
+void hal_disableIdleWatchdog(int core);
+/**
+ * @brief Returns number of the core the caller runs on
+ * 
+ */
+int hal_getCoreId();
+/**
+ * @brief Lists the tasks of the system, with their run time and stack usage. Requires FreeRTOS trace facility 
+ * and run time stats (see sdkconfig.defaults).
+ * 
+ * @param tasks Array for the tasks
+ * @param maxCount Length of `tasks`
+ * @param totalRunTime Run time counter value (time since boot in the run time units) is written here
+ * @return uint32_t Number of tasks written, 0 if there are more than `maxCount` tasks or the stats are not available
+ */
+uint32_t hal_getTasks(hal_task_info_t *tasks, uint32_t maxCount, uint32_t *totalRunTime);
+/**
+ * @brief Returns currently free heap (bytes)
+ * 
+ */
+uint32_t hal_getFreeHeap();
+/**
+ * @brief Returns minimum free heap since boot (bytes)
+ * 
+ */
+uint32_t hal_getMinFreeHeap();
+
+/**
+ * @brief Returns cause of the last reset
+ * 
+ */
+hal_reset_reason_t hal_getResetReason();
+
+hal_mutex_t hal_mutexCreate();
+/**
+ * @brief Creates a mutex in the given storage, without any heap allocation
+ * 
+ * @param buffer Mutex storage, must live as long as the mutex (use a static variable)
+ * @return hal_mutex_t Mutex
+ */
+hal_mutex_t hal_mutexCreateStatic(hal_mutex_buffer_t *buffer);
+/**
+ * @brief Takes a mutex
+ * 
+ * @param mutex Mutex
+ * @param timeoutMs Maximum waiting time, in milliseconds
+ * @return true Mutex taken
+ * @return false Timed out
+ */
+bool hal_mutexTake(hal_mutex_t mutex, uint32_t timeoutMs);
+void hal_mutexGive(hal_mutex_t mutex);
+
+hal_queue_t hal_queueCreate(uint32_t length, uint32_t itemSize);
+/**
+ * @brief Creates a queue in the given storage, without any heap allocation
+ * 
+ * @param length Maximum number of items
+ * @param itemSize Size of one item
+ * @param storage Item storage, `length * itemSize` bytes
+ * @param buffer Queue storage. Both `storage` and `buffer` must live as long as the queue.
+ * @return hal_queue_t Queue
+ */
+hal_queue_t hal_queueCreateStatic(uint32_t length, uint32_t itemSize, uint8_t *storage, hal_queue_buffer_t *buffer);
+/**
+ * @brief Appends an item to the queue, without blocking
+ * 
+ * @return true Item added
+ * @return false Queue is full
+ */
+bool hal_queueSend(hal_queue_t queue, const void *item);
+/**
+ * @brief Writes the item to a queue of length 1, replacing the previous item
+ * 
+ */
+void hal_queueOverwrite(hal_queue_t queue, const void *item);
+/**
+ * @brief Removes the oldest item from the queue, without blocking
+ * 
+ * @return true Item received
+ * @return false Queue is empty
+ */
+bool hal_queueReceive(hal_queue_t queue, void *item);
+/**
+ * @brief Returns number of items waiting in the queue
+ * 
+ */
+uint32_t hal_queueCount(hal_queue_t queue);
+
+/**
+ * @brief Configures the pin as an output
+ * 
+ * @param pin GPIO number
+ */
+void hal_gpioSetOutput(int pin);
+/**
+ * @brief Configures the pin as a floating input
+ * 
+ * @param pin GPIO number
+ */
+void hal_gpioSetInput(int pin);
+void hal_gpioSetLevel(int pin, uint32_t level);
+/**
+ * @brief Minimum length of the pulses of hal_gpioPulse (TMC2130 needs the step input high for about 100 ns)
+ * 
+ */
+#define HAL_GPIO_PULSE_NS 200
+/**
+ * @brief Pulses the output pins high and back low, all of them at once. On ESP32 it writes the W1TS and W1TC 
+ * registers directly (one write per GPIO bank), bypassing the checks of the gpio driver. The pulse is at least
+ * HAL_GPIO_PULSE_NS long.
+ * 
+ * Meant for the step pulses, the pins must already be outputs and low.
+ * 
+ * @param mask Pins to pulse
+ */
+void hal_gpioPulse(hal_gpio_mask_t mask);
+/**
+ * @brief Sets the output pins low, by a direct register write. Can be called from an interrupt handler.
+ * 
+ * @param mask Pins to set low
+ */
+void hal_gpioClear(hal_gpio_mask_t mask);
+/**
+ * @brief Returns the level of an input pin
+ * 
+ */
+uint32_t hal_gpioGetLevel(int pin);
+/**
+ * @brief Configures the pin as an input with the pull-up, calling the handler from an interrupt on each edge 
+ * to `level`. On ESP32 the interrupt runs on the core calling this function, and the handler must have HAL_ISR_ATTR.
+ * 
+ * @param pin GPIO number
+ * @param level Level the handler is called on the edge to (0 falling edge, 1 rising edge)
+ * @param handler Interrupt handler
+ * @param arg Argument of the handler
+ * @return true Success
+ * @return false The interrupt couldn't be set up
+ */
+bool hal_gpioSetInterrupt(int pin, uint32_t level, hal_gpio_isr_t handler, void *arg);
+
+/**
+ * @brief Initializes an SPI bus, without DMA
+ * 
+ * @param host SPI controller number (1 = HSPI, 2 = VSPI on ESP32)
+ * @param sckPin Clock pin
+ * @param mosiPin Data output pin
+ * @param misoPin Data input pin
+ * @return true Success
+ * @return false The bus couldn't be initialized
+ */
+bool hal_spiInit(int host, int sckPin, int mosiPin, int misoPin);
+/**
+ * @brief Adds a device to an initialized SPI bus
+ * 
+ * @param host SPI controller number, as given to hal_spiInit
+ * @param csPin Chip select pin of the device
+ * @param clockHz Clock frequency
+ * @param mode SPI mode (0-3)
+ * @return hal_spi_device_t Device, NULL on failure
+ */
+hal_spi_device_t hal_spiAddDevice(int host, int csPin, uint32_t clockHz, uint8_t mode);
+/**
+ * @brief Makes a full-duplex transfer, blocking until it's done (polling, no interrupts). Should be called from 
+ * one task only.
+ * 
+ * @param device Device
+ * @param tx Data sent
+ * @param rx Data received, `len` bytes
+ * @param len Length of the transfer (bytes)
+ * @return true Success
+ * @return false Transfer failed
+ */
+bool hal_spiTransfer(hal_spi_device_t device, const uint8_t *tx, uint8_t *rx, size_t len);
+
+/**
+ * @brief Initializes the persistent key-value storage (NVS on ESP-IDF). The storage is erased if it's corrupted 
+ * or from an incompatible version.
+ * 
+ * @return true Storage available
+ * @return false Storage couldn't be initialized, reads and writes will fail
+ */
+bool hal_storageInit();
+/**
+ * @brief Reads a value from the persistent storage
+ * 
+ * @param key Key, at most 15 characters
+ * @param data The value is written here
+ * @param size Size of the value
+ * @return true Read
+ * @return false The key doesn't exist, or its value has a different size
+ */
+bool hal_storageRead(const char *key, void *data, size_t size);
+/**
+ * @brief Writes a value to the persistent storage. Like other flash writes, it stalls the flash cache of both cores.
+ * 
+ * @param key Key, at most 15 characters
+ * @param data Value
+ * @param size Size of the value
+ * @return true Written and committed
+ * @return false Failed
+ */
+bool hal_storageWrite(const char *key, const void *data, size_t size);
+
+/**
+ * @brief Size of the flash erase unit (sector)
+ * 
+ */
+#define HAL_FLASH_SECTOR_SIZE 4096
+
+/**
+ * @brief Finds a data partition by its label
+ * 
+ * @return hal_partition_t Partition, NULL if not found
+ */
+hal_partition_t hal_partitionFind(const char *label);
+uint32_t hal_partitionSize(hal_partition_t partition);
+/**
+ * @brief Erases a part of the partition. Both `offset` and `size` must be multiples of HAL_FLASH_SECTOR_SIZE.
+ * 
+ * Note that on ESP32 the flash cache of both cores is disabled during erase and write, stalling the motor task.
+ * 
+ * @return true Erased
+ * @return false Failed
+ */
+bool hal_partitionErase(hal_partition_t partition, uint32_t offset, uint32_t size);
+/**
+ * @brief Writes data to an erased part of the partition
+ * 
+ * @return true Written
+ * @return false Failed
+ */
+bool hal_partitionWrite(hal_partition_t partition, uint32_t offset, const void *data, size_t size);
+/**
+ * @brief Maps the whole partition to the data address space, read only. The mapping is never released.
+ * 
+ * @return const void* Start of the partition, NULL on failure
+ */
+const void *hal_partitionMap(hal_partition_t partition);
+
+/**
+ * @brief Initializes the UART port. Panics on failure.
+ * 
+ * @param port UART port number
+ * @param baudRate Baud rate
+ * @param txPin TX pin
+ * @param rxPin RX pin
+ * @param bufferSize Size of RX and TX buffers
+ */
+void hal_uartInit(int port, int baudRate, int txPin, int rxPin, size_t bufferSize);
+/**
+ * @brief Switches the UART port to the RS-485 half-duplex mode - the driver enable pin is driven high only while
+ * transmitting, so several devices can share the line
+ * 
+ * @param port UART port number, already initialized
+ * @param dePin Driver enable pin of the transceiver
+ * @return true Success
+ * @return false The mode couldn't be set
+ */
+bool hal_uartSetHalfDuplex(int port, int dePin);
+/**
+ * @brief Enables the hardware flow control. RTS is deasserted while the receive buffer is full, so the host pauses
+ * instead of overrunning it, and data is sent only while CTS is asserted.
+ * 
+ * @param port UART port number, already initialized
+ * @param rtsPin RTS output pin, -1 for none
+ * @param ctsPin CTS input pin, -1 for none
+ * @return true Success
+ * @return false The flow control couldn't be set
+ */
+bool hal_uartSetFlowControl(int port, int rtsPin, int ctsPin);
+/**
+ * @brief Reads up to `len` bytes already received, without blocking
+ * 
+ * @return int Number of bytes read
+ */
+int hal_uartRead(int port, void *buffer, size_t len);
+int hal_uartWrite(int port, const void *buffer, size_t len);
+/**
+ * @brief Returns number of received bytes available for reading
+ * 
+ */
+size_t hal_uartAvailable(int port);
+void hal_uartFlushInput(int port);
+
+#endif
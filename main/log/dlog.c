@@ -0,0 +1,244 @@
+#include "dlog.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "../hal/hal.h"
+
+#define TAG "dlog"
+#define DLOG_LINE_LENGTH 200
+
+/**
+ * @brief Log record. `seq` tells the ring slot state: it equals the write position when the slot is free,
+ * and the write position + 1 when the record is ready for reading.
+ */
+typedef struct DlogRecord {
+    atomic_uint seq;
+    uint8_t level;
+    uint8_t argCount;
+    int64_t time;
+    const char *tag;
+    const char *format;
+    uint64_t args[DLOG_MAX_ARGS];
+} DlogRecord;
+
+_Static_assert(sizeof(DlogRecord) <= MEM_DLOG_RECORD_BYTES, "DlogRecord is larger than the memory map assumes");
+
+/**
+ * @brief Bounded multi-producer ring (Vyukov's queue). Writers only reserve a slot with a CAS on `writePos`, 
+ * so tasks preempting each other on the same core never block. There is a single reader (the drain task).
+ */
+typedef struct DlogRing {
+    DlogRecord records[DLOG_RING_SIZE];
+    atomic_uint writePos;
+    uint32_t readPos;
+    atomic_uint dropped;
+} DlogRing;
+
+DlogRing rings[DLOG_CORE_COUNT];
+esp_log_level_t dlog_level = ESP_LOG_INFO;
+uint32_t reportedDropped = 0;
+
+void dlog_init() {
+    for (int core = 0; core < DLOG_CORE_COUNT; core++) {
+        DlogRing *ring = &rings[core];
+        for (uint32_t i = 0; i < DLOG_RING_SIZE; i++)
+            atomic_init(&ring->records[i].seq, i);
+        atomic_init(&ring->writePos, 0);
+        atomic_init(&ring->dropped, 0);
+        ring->readPos = 0;
+    }
+    reportedDropped = 0;
+}
+
+void dlog_setLevel(esp_log_level_t level) {
+    dlog_level = level;
+}
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *format, uint8_t argCount, const uint64_t *args) {
+    DlogRing *ring = &rings[hal_getCoreId() % DLOG_CORE_COUNT];
+    int64_t time = hal_getTime();
+    uint32_t pos = atomic_load_explicit(&ring->writePos, memory_order_relaxed);
+    DlogRecord *record;
+
+    for (;;) {
+        record = &ring->records[pos & (DLOG_RING_SIZE - 1)];
+        uint32_t seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+        int32_t dif = (int32_t)(seq - pos);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->writePos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if (dif < 0) {
+            // The reader hasn't freed the slot yet - the ring is full
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else {
+            pos = atomic_load_explicit(&ring->writePos, memory_order_relaxed);
+        }
+    }
+
+    record->level = level;
+    record->argCount = argCount;
+    record->time = time;
+    record->tag = tag;
+    record->format = format;
+    memcpy(record->args, args, argCount * sizeof(uint64_t));
+    atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+}
+
+/**
+ * @brief Formats a single conversion (`spec`, e.g. "%5.2f") with a raw argument
+ */
+int formatArg(char *out, size_t len, const char *spec, char conversion, const char *lengthMod, uint64_t arg) {
+    switch (conversion) {
+        case 'd':
+        case 'i':
+            if (strcmp(lengthMod, "ll") == 0 || strcmp(lengthMod, "j") == 0)
+                return snprintf(out, len, spec, (long long)arg);
+            if (strcmp(lengthMod, "l") == 0 || strcmp(lengthMod, "z") == 0 || strcmp(lengthMod, "t") == 0)
+                return snprintf(out, len, spec, (long)arg);
+            return snprintf(out, len, spec, (int)arg);
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            if (strcmp(lengthMod, "ll") == 0 || strcmp(lengthMod, "j") == 0)
+                return snprintf(out, len, spec, (unsigned long long)arg);
+            if (strcmp(lengthMod, "l") == 0 || strcmp(lengthMod, "z") == 0 || strcmp(lengthMod, "t") == 0)
+                return snprintf(out, len, spec, (unsigned long)arg);
+            return snprintf(out, len, spec, (unsigned int)arg);
+
+        case 'c':
+            return snprintf(out, len, spec, (int)arg);
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            union { double d; uint64_t u; } conv = { .u = arg };
+            return snprintf(out, len, spec, conv.d);
+        }
+
+        case 's':
+            return snprintf(out, len, spec, (const char *)(uintptr_t)arg);
+
+        case 'p':
+            return snprintf(out, len, spec, (void *)(uintptr_t)arg);
+    }
+
+    return snprintf(out, len, "%s", spec);
+}
+
+/**
+ * @brief Formats the record message, the same way printf would have formatted it when the record was written
+ */
+void formatRecord(char *out, size_t len, const DlogRecord *record) {
+    const char *f = record->format;
+    size_t outLen = 0;
+    uint8_t argIdx = 0;
+
+    while (*f != 0 && outLen < len - 1) {
+        if (*f != '%') {
+            out[outLen++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[outLen++] = '%';
+            f += 2;
+            continue;
+        }
+
+        // Conversion specification: %[flags][width][.precision][length]conversion
+        char spec[16];
+        char lengthMod[3] = {0};
+        size_t specLen = 0;
+        spec[specLen++] = *f++;
+        while (*f != 0 && strchr("-+ #0123456789.", *f) != NULL && specLen < sizeof(spec) - 4)
+            spec[specLen++] = *f++;
+        for (size_t i = 0; *f != 0 && strchr("hljztL", *f) != NULL && i < 2; i++) {
+            lengthMod[i] = *f;
+            spec[specLen++] = *f++;
+        }
+        if (*f == 0)
+            break;
+        char conversion = *f++;
+        spec[specLen++] = conversion;
+        spec[specLen] = 0;
+
+        int written;
+        if (argIdx < record->argCount)
+            written = formatArg(out + outLen, len - outLen, spec, conversion, lengthMod, record->args[argIdx++]);
+        else
+            written = snprintf(out + outLen, len - outLen, "%s", spec);
+        if (written > 0)
+            outLen += written;
+        if (outLen >= len)
+            outLen = len - 1;
+    }
+    out[outLen] = 0;
+}
+
+char levelLetter(uint8_t level) {
+    switch (level) {
+        case ESP_LOG_ERROR:
+            return 'E';
+        case ESP_LOG_WARN:
+            return 'W';
+        case ESP_LOG_INFO:
+            return 'I';
+        case ESP_LOG_DEBUG:
+            return 'D';
+        default:
+            return 'V';
+    }
+}
+
+uint32_t dlog_drain() {
+    uint32_t count = 0;
+    char line[DLOG_LINE_LENGTH];
+
+    for (int core = 0; core < DLOG_CORE_COUNT; core++) {
+        DlogRing *ring = &rings[core];
+        for (;;) {
+            DlogRecord *record = &ring->records[ring->readPos & (DLOG_RING_SIZE - 1)];
+            if (atomic_load_explicit(&record->seq, memory_order_acquire) != ring->readPos + 1)
+                break;
+
+            formatRecord(line, sizeof(line), record);
+            esp_log_write(record->level, record->tag, "%c (%lli) %s: %s\n", 
+                levelLetter(record->level), record->time / 1000, record->tag, line);
+            atomic_store_explicit(&record->seq, ring->readPos + DLOG_RING_SIZE, memory_order_release);
+            ring->readPos++;
+            count++;
+        }
+    }
+
+    uint32_t dropped = dlog_getDropped();
+    if (dropped != reportedDropped) {
+        esp_log_write(ESP_LOG_WARN, TAG, "W (%lli) %s: %u records dropped\n", hal_getTime() / 1000, TAG, dropped - reportedDropped);
+        reportedDropped = dropped;
+    }
+    return count;
+}
+
+uint32_t dlog_getDropped() {
+    uint32_t dropped = 0;
+    for (int core = 0; core < DLOG_CORE_COUNT; core++)
+        dropped += atomic_load_explicit(&rings[core].dropped, memory_order_relaxed);
+    return dropped;
+}
+
+void dlog_task(void *args) {
+    hal_tick_t lastTicks = hal_getTicks();
+
+    for (;;) {
+        dlog_drain();
+        hal_delayUntil(&lastTicks, DLOG_DRAIN_P);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef __MOUNT_DLOG
+#define __MOUNT_DLOG
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <esp_log.h>
+#include "../memory-map.h"
+
+/**
+ * @brief Deferred logging. The DLOGx macros are drop-in replacements of ESP_LOGx for code running in time critical tasks - 
+ * instead of formatting the message, they only store a compact binary record (time, tag, format and raw arguments) 
+ * into a lock-free ring of the current core. The records are formatted and written out later by `dlog_task`,
+ * running at the lowest priority.
+ * 
+ * Limitations:
+ *  - tag, format and `%s` arguments are stored as pointers, so they must be string literals (or otherwise never change)
+ *  - at most DLOG_MAX_ARGS arguments, only integers, floats and strings
+ *  - when a ring is full, new records are dropped (and counted, see dlog_getDropped)
+ */
+
+#define DLOG_MAX_ARGS 6
+/**
+ * @brief Number of records in the ring of each core, must be a power of two
+ */
+#define DLOG_RING_SIZE MEM_DLOG_RING_SIZE
+#define DLOG_CORE_COUNT 2
+/**
+ * @brief Period (in milliseconds) of draining the rings in `dlog_task`
+ */
+#define DLOG_DRAIN_P 50
+
+/**
+ * @brief Records with higher level (more verbose) are discarded right away. Set by dlog_setLevel.
+ */
+extern esp_log_level_t dlog_level;
+
+void dlog_init();
+void dlog_setLevel(esp_log_level_t level);
+/**
+ * @brief Stores a log record. Use the DLOGx macros instead.
+ * 
+ * @param level Log level
+ * @param tag Tag (pointer is stored)
+ * @param format printf-like format (pointer is stored)
+ * @param argCount Number of arguments
+ * @param args Arguments converted by DLOG_ARG
+ */
+void dlog_write(esp_log_level_t level, const char *tag, const char *format, uint8_t argCount, const uint64_t *args);
+/**
+ * @brief Formats and outputs all stored records
+ * 
+ * @return uint32_t Number of records written out
+ */
+uint32_t dlog_drain();
+/**
+ * @brief Returns total number of records dropped because of a full ring
+ * 
+ */
+uint32_t dlog_getDropped();
+/**
+ * @brief Drain task, calls dlog_drain each DLOG_DRAIN_P. Should run with the lowest priority.
+ * 
+ */
+void dlog_task(void *args);
+
+static inline uint64_t dlog_argInt(int64_t value) {
+    return value;
+}
+
+static inline uint64_t dlog_argDouble(double value) {
+    union { double d; uint64_t u; } conv = { .d = value };
+    return conv.u;
+}
+
+static inline uint64_t dlog_argStr(const char *value) {
+    return (uintptr_t)value;
+}
+
+#define DLOG_ARG(x) _Generic((x), \
+    float: dlog_argDouble, \
+    double: dlog_argDouble, \
+    char*: dlog_argStr, \
+    const char*: dlog_argStr, \
+    default: dlog_argInt)(x)
+
+#define DLOG_NARGS(...) DLOG_NARGS_(_, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_, a1, a2, a3, a4, a5, a6, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+#define DLOG_ARGS_0()
+#define DLOG_ARGS_1(a) DLOG_ARG(a)
+#define DLOG_ARGS_2(a, ...) DLOG_ARG(a), DLOG_ARGS_1(__VA_ARGS__)
+#define DLOG_ARGS_3(a, ...) DLOG_ARG(a), DLOG_ARGS_2(__VA_ARGS__)
+#define DLOG_ARGS_4(a, ...) DLOG_ARG(a), DLOG_ARGS_3(__VA_ARGS__)
+#define DLOG_ARGS_5(a, ...) DLOG_ARG(a), DLOG_ARGS_4(__VA_ARGS__)
+#define DLOG_ARGS_6(a, ...) DLOG_ARG(a), DLOG_ARGS_5(__VA_ARGS__)
+
+#define DLOG_LEVEL(level, tag, format, ...) do { \
+        if (dlog_level >= level) { \
+            const uint64_t dlogArgs[DLOG_MAX_ARGS] = { DLOG_CAT(DLOG_ARGS_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__) }; \
+            dlog_write(level, tag, format, DLOG_NARGS(__VA_ARGS__), dlogArgs); \
+        } \
+    } while (0)
+
+#define DLOGE(tag, format, ...) DLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define DLOGV(tag, format, ...) DLOG_LEVEL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,53 @@
+#include "trace.h"
+#include <stdatomic.h>
+#include "../hal/hal.h"
+
+_Static_assert(sizeof(trace_event_t) <= MEM_TRACE_EVENT_BYTES, "trace_event_t is larger than the memory map assumes");
+
+trace_event_t traceEvents[TRACE_SIZE];
+/**
+ * @brief Sequence number of the next event. Events `nextSeq - TRACE_SIZE` to `nextSeq - 1` are in the buffer.
+ */
+atomic_uint nextSeq = 0;
+/**
+ * @brief Number of events whose writing has started. Differs from `nextSeq` only while an event is being written.
+ */
+atomic_uint startedSeq = 0;
+
+void trace_event(trace_event_type_t type, uint8_t axis, int32_t a0, int32_t a1, int32_t a2, int32_t a3) {
+    uint32_t seq = atomic_load_explicit(&nextSeq, memory_order_relaxed);
+    trace_event_t *event = &traceEvents[seq & (TRACE_SIZE - 1)];
+
+    // Invalidates the event previously stored in the slot for readers
+    atomic_store_explicit(&startedSeq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    event->time = hal_getTime();
+    event->type = type;
+    event->axis = axis;
+    event->args[0] = a0;
+    event->args[1] = a1;
+    event->args[2] = a2;
+    event->args[3] = a3;
+    atomic_store_explicit(&nextSeq, seq + 1, memory_order_release);
+}
+
+uint32_t trace_getOldest() {
+    uint32_t next = atomic_load_explicit(&nextSeq, memory_order_acquire);
+    return next > TRACE_SIZE ? next - TRACE_SIZE : 0;
+}
+
+uint32_t trace_getNext() {
+    return atomic_load_explicit(&nextSeq, memory_order_acquire);
+}
+
+bool trace_read(uint32_t seq, trace_event_t *event) {
+    uint32_t next = atomic_load_explicit(&nextSeq, memory_order_acquire);
+    if (seq >= next || next - seq > TRACE_SIZE)
+        return false;
+
+    *event = traceEvents[seq & (TRACE_SIZE - 1)];
+    atomic_thread_fence(memory_order_acquire);
+    // The slot is reused by event seq + TRACE_SIZE, check its writing hasn't started during the copy
+    uint32_t started = atomic_load_explicit(&startedSeq, memory_order_relaxed);
+    return started - seq <= TRACE_SIZE;
+}
@@ -0,0 +1,91 @@
+#ifndef __MOUNT_TRACE
+#define __MOUNT_TRACE
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../memory-map.h"
+
+/**
+ * @brief Motion event trace. A circular buffer of the decisions made by the motion stack, readable over the protocol 
+ * (`+gtr`) and convertible to a Chrome/Perfetto trace by tools/trace-to-chrome.py.
+ * 
+ * Events are written only by the motor task, the buffer has a single writer. Readers detect events overwritten 
+ * while being read, so no locking is needed.
+ */
+
+/**
+ * @brief Number of events kept, must be a power of two
+ */
+#define TRACE_SIZE MEM_TRACE_SIZE
+
+/**
+ * @brief Event types. Meaning of the arguments:
+ *  - TRACE_MODE: old mode, new mode (motor_mode_t)
+ *  - TRACE_SEGMENT: start position, target position, start time and target time (us, relative to the event time)
+ *  - TRACE_POINT_PULL: ax1, ax2, point time (ms, relative to the event time)
+ *  - TRACE_UNDERRUN: none, the tracking ran out of points
+ *  - TRACE_MULTIPLIER: old multiplier index, new multiplier index, position
+ *  - TRACE_COMMAND: MotorCmdType, `data.pos.ax1`, `data.pos.ax2` (positions of the position commands)
+ *  - TRACE_JOG: velocities of the axes (steps per second)
+ *  - TRACE_INTERCEPT: target position, plan duration (us), join time (us, relative to the event time)
+ *  - TRACE_DRIVER: StallGuard result (SG_RESULT), fault flags (bit 0 stall, 1 overtemperature, 2 short to ground), position
+ *  - TRACE_BRAKING: velocity at the start (steps per second), stop position, braking duration (us)
+ *  - TRACE_FAULT: fault input bits (MOTOR_FAULT_*), ax1, ax2 (positions the motors were stopped at)
+ * 
+ * Positions are truncated to 32 bits.
+ */
+typedef enum TraceEventType {
+    TRACE_MODE,
+    TRACE_SEGMENT,
+    TRACE_POINT_PULL,
+    TRACE_UNDERRUN,
+    TRACE_MULTIPLIER,
+    TRACE_COMMAND,
+    TRACE_JOG,
+    TRACE_INTERCEPT,
+    TRACE_DRIVER,
+    TRACE_BRAKING,
+    TRACE_FAULT
+} trace_event_type_t;
+
+typedef struct TraceEvent {
+    /**
+     * @brief Time of the event (in microseconds)
+     * 
+     */
+    int64_t time;
+    uint8_t type;
+    /**
+     * @brief Axis of the event (1 or 2), 0 for events of the whole mount
+     * 
+     */
+    uint8_t axis;
+    int32_t args[4];
+} trace_event_t;
+
+/**
+ * @brief Records an event. Must be called only from the motor task.
+ * 
+ */
+void trace_event(trace_event_type_t type, uint8_t axis, int32_t a0, int32_t a1, int32_t a2, int32_t a3);
+/**
+ * @brief Reads an event
+ * 
+ * @param seq Sequence number of the event, between trace_getOldest and trace_getNext
+ * @param event The event is written here
+ * @return true Success
+ * @return false The event doesn't exist (yet or anymore)
+ */
+bool trace_read(uint32_t seq, trace_event_t *event);
+/**
+ * @brief Returns the sequence number of the oldest event still in the buffer
+ * 
+ */
+uint32_t trace_getOldest();
+/**
+ * @brief Returns the sequence number the next event will get
+ * 
+ */
+uint32_t trace_getNext();
+
+#endif
@@ -17,50 +17,87 @@
 #include <esp_task_wdt.h>
 #include <esp_int_wdt.h>
 #include "settings.h"
+#include "hal/hal.h"
 #include "comm/comm-task.h"
+#include "comm/network.h"
 #include "motors/motor-task.h"
+#include "log/dlog.h"
+#include "diag/diag.h"
+#include "memory-map.h"
+#include "trajlib/trajlib.h"
+#include "persist/persist.h"
 
 #define DELAY_MS 1000
-#define LED_PIN GPIO_NUM_25
 #define CORE_MOTORS 1
+#define LOG_LEVEL ESP_LOG_INFO
 #define TAG "main"
 
-QueueHandle_t motorCmdQueue = NULL;
+MotorQueues motorQueues;
+
+// Statically allocated tasks and queues, see memory-map.h
+StackType_t dlogStack[MEM_STACK_DLOG];
+StackType_t blinkStack[MEM_STACK_BLINK];
+StackType_t commStack[MEM_STACK_COMM];
+StackType_t motorStack[MEM_STACK_MOTOR];
+StaticTask_t dlogTcb;
+StaticTask_t blinkTcb;
+StaticTask_t commTcb;
+StaticTask_t motorTcb;
+uint8_t motorCmdQueueStorage[MEM_MOTOR_CMD_QUEUE_LENGTH * sizeof(MotorCmd)];
+uint8_t jogQueueStorage[MEM_JOG_QUEUE_LENGTH * sizeof(JogCmd)];
+hal_queue_buffer_t motorCmdQueueBuffer;
+hal_queue_buffer_t jogQueueBuffer;
+
+_Static_assert(sizeof(StackType_t) == 1, "Stack sizes in memory-map.h are in bytes");
+_Static_assert(2 * sizeof(Motor) + sizeof(motorCmdQueueStorage) + sizeof(jogQueueStorage) 
+    + 2 * sizeof(hal_queue_buffer_t) + 6 * sizeof(hal_mutex_buffer_t) + 4 * sizeof(StaticTask_t) <= MEM_OBJECTS_BYTES,
+    "Objects are larger than the memory map assumes");
 
 void blink_task(void *args) {
-    gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
+    gpio_set_direction(BOARD_LED_PIN, GPIO_MODE_OUTPUT);
     
     uint32_t counter = 0;
     TickType_t lastTicks = xTaskGetTickCount();
 
     for (int i = 0; i < 3; ++i) {
-        gpio_set_level(LED_PIN, 1);
+        gpio_set_level(BOARD_LED_PIN, 1);
         vTaskDelay(100 / portTICK_PERIOD_MS);
-        gpio_set_level(LED_PIN, 0);
+        gpio_set_level(BOARD_LED_PIN, 0);
         vTaskDelay(100 / portTICK_PERIOD_MS);
     }
 
     //ESP_LOGI("blink", "Starting blink task");
     for(;;) {
         vTaskDelayUntil(&lastTicks, DELAY_MS / portTICK_PERIOD_MS);
-        gpio_set_level(LED_PIN, 1);
+        gpio_set_level(BOARD_LED_PIN, 1);
         vTaskDelayUntil(&lastTicks, 1);
-        gpio_set_level(LED_PIN, 0);
-        uint64_t time;
-        mount_getTime(&time);
+        gpio_set_level(BOARD_LED_PIN, 0);
+        diag_sample();
 
         counter++;
     }
 }
 
 void app_main() {
-    motorCmdQueue = xQueueCreate(10, sizeof(MotorCmd));
-    esp_log_level_set("*", ESP_LOG_VERBOSE);
+    motorQueues.cmdQueue = hal_queueCreateStatic(MEM_MOTOR_CMD_QUEUE_LENGTH, sizeof(MotorCmd), motorCmdQueueStorage, &motorCmdQueueBuffer);
+    motorQueues.jogQueue = hal_queueCreateStatic(MEM_JOG_QUEUE_LENGTH, sizeof(JogCmd), jogQueueStorage, &jogQueueBuffer);
+    esp_log_level_set("*", LOG_LEVEL);
+    dlog_init();
+    dlog_setLevel(LOG_LEVEL);
     ESP_LOGD("app_main", "hi");
     ESP_LOGD("app_main", "portTICK_PERIOD_MS: %i", portTICK_PERIOD_MS);
+    ESP_LOGI(TAG, "Board profile: %s", BOARD_NAME);
     mount_initSettings();
-    xTaskCreatePinnedToCore(blink_task, "blink", 2500, NULL, tskIDLE_PRIORITY, NULL, 0);
-    xTaskCreatePinnedToCore(comm_task, "commTask", 3000, motorCmdQueue, tskIDLE_PRIORITY, NULL, 0);
+    persist_init();
+    trajlib_init();
+    // The TCP transport needs the TCP/IP stack before comm_init, and the NVS (persist_init) for the WiFi
+    network_init();
+    diag_init();
+    diag_addQueue("motorCmd", motorQueues.cmdQueue);
+    diag_addQueue("jog", motorQueues.jogQueue);
+    xTaskCreateStaticPinnedToCore(dlog_task, "dlog", MEM_STACK_DLOG, NULL, tskIDLE_PRIORITY, dlogStack, &dlogTcb, 0);
+    xTaskCreateStaticPinnedToCore(blink_task, "blink", MEM_STACK_BLINK, NULL, tskIDLE_PRIORITY, blinkStack, &blinkTcb, 0);
+    xTaskCreateStaticPinnedToCore(comm_task, "commTask", MEM_STACK_COMM, &motorQueues, tskIDLE_PRIORITY, commStack, &commTcb, 0);
     vTaskDelay(10);
-    xTaskCreatePinnedToCore(motor_task, "motorTask", 5000, motorCmdQueue, 12, NULL, CORE_MOTORS);
+    xTaskCreateStaticPinnedToCore(motor_task, "motorTask", MEM_STACK_MOTOR, &motorQueues, 12, motorStack, &motorTcb, CORE_MOTORS);
 }
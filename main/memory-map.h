@@ -0,0 +1,93 @@
+#ifndef __MOUNT_MEMORY_MAP
+#define __MOUNT_MEMORY_MAP
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+/**
+ * @brief Compile-time memory map. All long-lived objects (task stacks and TCBs, queues, mutexes, motors and
+ * the buffers) are allocated statically, with the sizes defined here, so the boot can't fail on heap
+ * fragmentation and the whole footprint is known at link time.
+ *
+ * On ESP32 the static data live in the `dram0_0_seg` segment (0x2c200 bytes), shared with the static data
+ * of ESP-IDF itself. `MEM_STATIC_BUDGET` is the part of it left for the objects below - compare it with
+ * the footprint report printed after each firmware build. Note that the task stacks now come from this
+ * segment as well, so they compete with the track buffers for the space. The track store keeps the points
+ * in 16 bytes (StoredTrackPoint) to make up for it.
+ */
+
+// Task stacks (bytes)
+#define MEM_STACK_DLOG 3000
+#define MEM_STACK_BLINK 4000
+#define MEM_STACK_COMM 4096
+#define MEM_STACK_MOTOR 5000
+#define MEM_STACKS_TOTAL (MEM_STACK_DLOG + MEM_STACK_BLINK + MEM_STACK_COMM + MEM_STACK_MOTOR)
+
+// Queue lengths (items)
+#define MEM_MOTOR_CMD_QUEUE_LENGTH 10
+#define MEM_JOG_QUEUE_LENGTH 1
+
+// Buffers (items)
+/**
+ * @brief With PSRAM enabled for static data (see sdkconfig.psram), the track buffers live in the external RAM
+ * and are much larger. The tracking then reads them through the prefetch window in internal DRAM.
+ */
+#ifdef CONFIG_SPIRAM_ALLOW_BSS_SEG_EXTERNAL_MEMORY
+#define MEM_TRACK_STORE_EXTERNAL
+#define MEM_TRACK_BUFFER_SIZE 75000
+#else
+#define MEM_TRACK_BUFFER_SIZE 3600
+#endif
+#define MEM_TRACK_BUFFER_COUNT 2
+#define MEM_TRACK_WINDOW_SIZE 32
+#define MEM_TRACE_SIZE 512
+#define MEM_DLOG_RING_SIZE 64
+
+/**
+ * @brief Upper bounds of the item sizes (bytes). Checked by _Static_assert next to the definitions of the types.
+ *
+ */
+#define MEM_TRACK_POINT_BYTES 24
+#define MEM_STORED_POINT_BYTES 16
+#define MEM_TRACE_EVENT_BYTES 32
+#define MEM_DLOG_RECORD_BYTES 80
+/**
+ * @brief Upper bound of the small objects - motors, queues with their items, mutexes and TCBs
+ *
+ */
+#define MEM_OBJECTS_BYTES 4096
+
+#ifdef MEM_TRACK_STORE_EXTERNAL
+#define MEM_TRACK_STORE_BYTES 0
+#else
+#define MEM_TRACK_STORE_BYTES (MEM_TRACK_BUFFER_SIZE * MEM_TRACK_BUFFER_COUNT * MEM_STORED_POINT_BYTES)
+#endif
+
+#define MEM_STATIC_TOTAL (MEM_STACKS_TOTAL \
+    + MEM_TRACK_STORE_BYTES \
+    + MEM_TRACK_WINDOW_SIZE * MEM_TRACK_POINT_BYTES \
+    + MEM_TRACE_SIZE * MEM_TRACE_EVENT_BYTES \
+    + 2 * MEM_DLOG_RING_SIZE * MEM_DLOG_RECORD_BYTES \
+    + MEM_OBJECTS_BYTES)
+
+/**
+ * @brief Static data budget of the firmware objects: `dram0_0_seg` minus 16 kB reserved for ESP-IDF
+ *
+ */
+#define MEM_STATIC_BUDGET (0x2c200 - 16 * 1024)
+
+_Static_assert(MEM_STATIC_TOTAL <= MEM_STATIC_BUDGET, "Memory map doesn't fit into the static DRAM budget");
+
+#ifdef MEM_TRACK_STORE_EXTERNAL
+/**
+ * @brief Static data budget in the external RAM: 4 MB mapped PSRAM minus 512 kB left for the heap
+ *
+ */
+#define MEM_EXT_BUDGET (4 * 1024 * 1024 - 512 * 1024)
+
+_Static_assert(MEM_TRACK_BUFFER_SIZE * MEM_TRACK_BUFFER_COUNT * MEM_STORED_POINT_BYTES <= MEM_EXT_BUDGET,
+    "Track buffers don't fit into the external RAM budget");
+#endif
+
+#endif
@@ -1,71 +1,100 @@
 #include "motor-driver.h"
 #include <stdlib.h>
-#include <driver/gpio.h>
-#include <esp_timer.h>
-#include <esp_log.h>
+#include <string.h>
+#include "../hal/hal.h"
+#include "../log/dlog.h"
+#include "../log/trace.h"
 #include <math.h>
 
 #define TAG "motor-driver"
 #define PARAM_UPDATE_P 1000
 
-const uint8_t MULTIPLIERS[] = {1, 4, 8, 16};
-#define MULTIPLIERS_COUNT 4
-
-void makeStep(motor_t m) {
-    gpio_set_level(m->cfg.stepPin, 1);
-    gpio_set_level(m->cfg.stepPin, 0);
+/**
+ * @brief Multipliers of the standalone mode (16, 4, 2 and 1 microsteps, selected by the CFG pins)
+ */
+const uint8_t PIN_MULTIPLIERS[] = {1, 4, 8, 16};
+/**
+ * @brief Multipliers of the SPI mode (16 to 1 microsteps), any resolution can be set there
+ */
+const uint8_t SPI_MULTIPLIERS[] = {1, 2, 4, 8, 16};
+/**
+ * @brief CFG1 and CFG2 states selecting PIN_MULTIPLIERS (-1 open, 0 low, 1 high)
+ */
+const int8_t PIN_CFG_STATES[][2] = {{-1, -1}, {1, -1}, {-1, 0}, {0, 0}};
+const uint16_t STATS_BUCKET_BOUNDS[] = {10, 20, 50, 100, 200, 500, 1000};
+
+/**
+ * @brief Counts the step into the position. The pulse itself is made by the caller (hal_gpioPulse with `stepMask`),
+ * together with the steps of the other motors.
+ */
+inline void makeStep(motor_t m) {
     if (m->dir == 1)
-        m->pos += MULTIPLIERS[m->multIdx];
+        m->pos += m->mults[m->multIdx];
     else
-        m->pos -= MULTIPLIERS[m->multIdx];
+        m->pos -= m->mults[m->multIdx];
 }
 
 void updateDir(motor_t m, uint8_t dir) {
     m->dir = dir;
     if (dir == 0) {
-        gpio_set_level(m->cfg.dirPin, 0);
+        hal_gpioSetLevel(m->cfg.dirPin, 0);
     }
     else {
-        gpio_set_level(m->cfg.dirPin, 1);
+        hal_gpioSetLevel(m->cfg.dirPin, 1);
     }
 }
 
+/**
+ * @brief Sets a CFG pin of the standalone mode - -1 open (floating input), 0 low, 1 high. Pins keeping their state
+ * aren't touched, reconfiguring the direction goes through the slow gpio driver calls.
+ */
+void setCfgPin(int pin, int8_t state, int8_t oldState) {
+    if (state == oldState)
+        return;
+    if (state < 0) {
+        hal_gpioSetInput(pin);
+        return;
+    }
+    if (oldState < 0)
+        hal_gpioSetOutput(pin);
+    hal_gpioSetLevel(pin, state);
+}
+
+/**
+ * @brief Index of the multiplier in PIN_MULTIPLIERS, or -1 if the CFG pins can't select it
+ */
+int8_t pinMultiplierIdx(uint8_t mult) {
+    for (int8_t i = 0; i < (int8_t)sizeof(PIN_MULTIPLIERS); i++) {
+        if (PIN_MULTIPLIERS[i] == mult)
+            return i;
+    }
+    return -1;
+}
+
 void updateMultiplier(motor_t m, uint8_t multIdx) {
+    trace_event(TRACE_MULTIPLIER, m->cfg.id, m->multIdx, multIdx, m->pos, 0);
+    uint8_t oldMult = m->mults[m->multIdx];
     m->multIdx = multIdx;
-    switch (multIdx) {
-        case 0:
-            gpio_set_direction(m->cfg.cfg1Pin, GPIO_MODE_INPUT);
-            gpio_set_pull_mode(m->cfg.cfg1Pin, GPIO_FLOATING);
-            gpio_set_direction(m->cfg.cfg2Pin, GPIO_MODE_INPUT);
-            gpio_set_pull_mode(m->cfg.cfg2Pin, GPIO_FLOATING);
-            break;
-        
-        case 1:
-            gpio_set_direction(m->cfg.cfg1Pin, GPIO_MODE_OUTPUT);
-            gpio_set_direction(m->cfg.cfg2Pin, GPIO_MODE_INPUT);
-            gpio_set_pull_mode(m->cfg.cfg2Pin, GPIO_FLOATING);
-            gpio_set_level(m->cfg.cfg1Pin, 1);
-            break;
-
-        case 2:
-            gpio_set_direction(m->cfg.cfg1Pin, GPIO_MODE_INPUT);
-            gpio_set_pull_mode(m->cfg.cfg1Pin, GPIO_FLOATING);
-            gpio_set_direction(m->cfg.cfg2Pin, GPIO_MODE_OUTPUT);
-            gpio_set_level(m->cfg.cfg2Pin, 0);
-            break;
-
-        case 3:
-            gpio_set_direction(m->cfg.cfg1Pin, GPIO_MODE_OUTPUT);
-            gpio_set_direction(m->cfg.cfg2Pin, GPIO_MODE_OUTPUT);
-            gpio_set_level(m->cfg.cfg1Pin, 0);
-            gpio_set_level(m->cfg.cfg2Pin, 0);
-            break;
+    m->stats.multSwitches++;
+    if (m->cfg.driver != NULL) {
+        tmc_setMicrosteps(m->cfg.driver, MOTOR_MICROSTEPS / m->mults[multIdx]);
+        return;
+    }
+    const int8_t *oldState = PIN_CFG_STATES[pinMultiplierIdx(oldMult)];
+    const int8_t *state = PIN_CFG_STATES[pinMultiplierIdx(m->mults[multIdx])];
+    setCfgPin(m->cfg.cfg1Pin, state[0], oldState[0]);
+    setCfgPin(m->cfg.cfg2Pin, state[1], oldState[1]);
+}
+
+inline void setMode(motor_t m, motor_mode_t mode) {
+    if (m->mode != mode) {
+        trace_event(TRACE_MODE, m->cfg.id, m->mode, mode, 0, 0);
+        m->mode = mode;
     }
-    ESP_LOGD(TAG, "Switched to multiplier %i", multIdx);
 }
 
 inline float getStepI(motor_t m) {
-    return 1000000.0f/abs(m->v) * MULTIPLIERS[m->multIdx];
+    return 1000000.0f/abs(m->v) * m->mults[m->multIdx];
 }
 
 inline float stepIToV(float stepI, uint8_t dir) {
@@ -76,14 +105,25 @@ inline float getCorrectA(motor_t m, int64_t t) {
     return 2 * ((float)(m->tPos - m->tStartPos) / (m->tTime - m->tStartTime) * 1e6 - m->tStartV)/(m->tTime - m->tStartTime) * 1e6;
 }
 
-inline float getCorrectV(motor_t m, int64_t t) {
-    return (float)(m->tPos - m->pos) / ((float)(m->tTime - t) / 1e6);
+inline float getCorrectV(motor_t m, step_t pos, int64_t t) {
+    return (float)(m->tPos - pos) / ((float)(m->tTime - t) / 1e6);
+}
+
+/**
+ * @brief Returns the guiding offset of the tracked trajectory at time t (position offset plus integrated rate offset)
+ */
+inline step_t getTrackOffset(motor_t m, int64_t t) {
+    return m->oPos + (step_t)(m->oRate * (t - m->oRateStart) / 1e6f);
+}
+
+step_t motor_getTrackPos(motor_t m, int64_t t) {
+    return m->pos - getTrackOffset(m, t);
 }
 
 int64_t motor_getPosOffset(motor_t m, int64_t t) {
     step_t x0 = m->tStartPos;
     step_t x1 = m->tPos;
-    step_t x = m->pos;
+    step_t x = m->pos - getTrackOffset(m, t);
     int64_t tdt = m->tTime - m->tStartTime; // Tracking delta time
     int64_t sdt = t - m->tStartTime; // Start delta time
     float v0 = m->tStartV;
@@ -100,8 +140,34 @@ int64_t motor_getPosOffset(motor_t m, int64_t t) {
     return x - correctPos;
 }
 
-void accelV(motor_t m, float a, int64_t dt) {
-    m->v += a * dt / 1000000;
+/**
+ * @brief Adds the time since the last call to the time spent in the current mode
+ */
+inline void updateModeTime(motor_t m, int64_t t) {
+    m->stats.modeTime[m->mode] += t - m->stats.lastModeTime;
+    m->stats.lastModeTime = t;
+}
+
+/**
+ * @brief Records step lateness into the statistics
+ * 
+ * @param lateness Lateness in microseconds
+ * @param stepI Step interval the step was made with
+ */
+inline void recordStepLateness(motor_t m, int64_t lateness, float stepI) {
+    uint8_t bucket = 0;
+    while (bucket < MOTOR_STATS_BUCKET_COUNT - 1 && lateness >= STATS_BUCKET_BOUNDS[bucket])
+        bucket++;
+    m->stats.latenessHist[bucket]++;
+
+    if (lateness > m->stats.maxLateness)
+        m->stats.maxLateness = lateness;
+    if (lateness > stepI)
+        m->stats.missedDeadlines++;
+}
+
+void setV(motor_t m, float v) {
+    m->v = v;
     if (abs(m->v) > m->cfg.maxV) {
         m->v = abs(m->v) / m->v * m->cfg.maxV;
     }
@@ -110,30 +176,38 @@ void accelV(motor_t m, float a, int64_t dt) {
     }
 }
 
+void accelV(motor_t m, float a, int64_t dt) {
+    setV(m, m->v + a * dt / 1000000);
+}
+
 inline void trackMAdjust(motor_t m, int64_t t, int64_t dt) {
-    float correctV = getCorrectV(m, t);
+    // Position and velocity relative to the offset trajectory, so guiding corrections are blended in by the same 
+    // maxA-limited control as the tracking errors
+    step_t pos = m->pos - getTrackOffset(m, t);
+    float v = m->v - m->oRate;
+    float correctV = getCorrectV(m, pos, t);
 
     // Ideal speed (the average speed between startPos and endPos over endTime - startTime). 
     // Maybe it would be better to replace this with speed of future track point, but seems to work fine as it is
     float idealV = (float)(m->tPos - m->tStartPos) * 1e6 / (m->tTime - m->tStartTime) ;
     // Time (in microseconds) the motor needs to brake from current speed to idealV
-    int64_t brake_time = fabs(m->v - idealV) / m->cfg.maxA * 1e6;
+    int64_t brake_time = fabs(v - idealV) / m->cfg.maxA * 1e6;
     // Position the motor should have in the moment it stops braking to idealV
     step_t ideal_x_in_bt = m->tStartPos + idealV * (t - m->tStartTime + brake_time) / 1e6;
     // Distance the motor needs to brake before it reaches the target speed
-    step_t brake_dst = m->v * brake_time / 1e6 - 0.5e-12 * (m->v > 0 ? m->cfg.maxA : -m->cfg.maxA) * brake_time * brake_time;    
+    step_t brake_dst = v * brake_time / 1e6 - 0.5e-12 * (v > 0 ? m->cfg.maxA : -m->cfg.maxA) * brake_time * brake_time;    
     
-    if (m->v > idealV && brake_dst > (ideal_x_in_bt - m->pos)) // Braking, when the speed is too high (it would overrun the target position)
+    if (v > idealV && brake_dst > (ideal_x_in_bt - pos)) // Braking, when the speed is too high (it would overrun the target position)
         accelV(m, -m->cfg.maxA, dt);
-    else if (m->v < idealV && brake_dst < (ideal_x_in_bt - m->pos)) // Same as above, but for the opossite direction
+    else if (v < idealV && brake_dst < (ideal_x_in_bt - pos)) // Same as above, but for the opossite direction
         accelV(m, m->cfg.maxA, dt);
-    else if (m->v > correctV) // Speed up if speed is too low
+    else if (v > correctV) // Speed up if speed is too low
         accelV(m, -m->cfg.maxA, dt);
-    else if (m->v < correctV) // Speed down if speed is too high
+    else if (v < correctV) // Speed down if speed is too high
         accelV(m, m->cfg.maxA, dt);
 
     if (m->tTime < t)
-        m->mode = GOTO;
+        setMode(m, GOTO);
 }
 
 inline void gotoMAdjust(motor_t m, int64_t t, int64_t dt) {
@@ -141,7 +215,7 @@ inline void gotoMAdjust(motor_t m, int64_t t, int64_t dt) {
 
     if (abs(m->v) <= m->cfg.gotoMinV && posOffset == 0) {
         m->v = 0.0f;
-        m->mode = STOP;
+        setMode(m, STOP);
         return;
     }
 
@@ -172,66 +246,248 @@ inline void gotoMAdjust(motor_t m, int64_t t, int64_t dt) {
     }
 }
 
-void multiplierAdjust(motor_t m) {
-    float stepI = getStepI(m);
-    if (stepI < m->cfg.minStepI) {
-        if (m->multIdx == MULTIPLIERS_COUNT - 1) {
-            // Maximum multiplier reached, can do nothing
-            return;
+inline void interceptMAdjust(motor_t m, int64_t t) {
+    intercept_plan_t *p = &m->iPlan;
+    float dt = (t - m->iStartTime) / 1e6f;
+
+    if (dt < p->t1)
+        setV(m, p->v0 + p->a * dt);
+    else if (dt < p->t1 + p->tc)
+        setV(m, p->vc);
+    else if (dt < p->t1 + p->tc + p->t2)
+        setV(m, p->vc - p->a * (dt - p->t1 - p->tc));
+    else {
+        setV(m, p->v1);
+        int64_t planEndTime = m->iStartTime + motor_getInterceptDuration(p);
+        if (m->tTime > planEndTime && m->tTime > t) {
+            // Join the trajectory
+            m->tStartPos = p->targetPos;
+            m->tStartTime = planEndTime;
+            m->tStartV = m->v;
+            setMode(m, TRACKING);
         }
-        updateMultiplier(m, m->multIdx + 1);
     }
-    if (m->multIdx > 0 && stepI * MULTIPLIERS[m->multIdx - 1] / MULTIPLIERS[m->multIdx] > m->cfg.minStepI) {
-        updateMultiplier(m, m->multIdx - 1);
+}
+
+/**
+ * @brief Ramps the velocity down to zero with `brakeA`, from the velocity the braking started with. The motor stops
+ * (and holds the position) at the end of the ramp.
+ */
+inline void brakingMAdjust(motor_t m, int64_t t) {
+    float dt = (t - m->bStartTime) / 1e6f;
+    float brakeT = fabsf(m->bStartV) / m->cfg.brakeA;
+    if (dt >= brakeT) {
+        m->v = 0.0f;
+        setMode(m, STOP);
+        return;
     }
+    setV(m, m->bStartV > 0.0f ? m->bStartV - m->cfg.brakeA * dt : m->bStartV + m->cfg.brakeA * dt);
 }
 
-motor_t motor_create(motor_config_t cfg) {
-    motor_t motor = malloc(sizeof(Motor));
+inline void velocityMAdjust(motor_t m, int64_t t, int64_t dt) {
+    float targetV = t > m->jogDeadline ? 0.0f : m->jogV;
+    float dv = m->cfg.maxA * dt / 1e6f;
+
+    if (m->v < targetV - dv)
+        accelV(m, m->cfg.maxA, dt);
+    else if (m->v > targetV + dv)
+        accelV(m, -m->cfg.maxA, dt);
+    else
+        setV(m, targetV);
+
+    if (m->v == 0.0f && targetV == 0.0f)
+        setMode(m, STOP);
+}
+
+/**
+ * @brief Number of steps (with the current multiplier) to the next position aligned to `mult` in the current direction
+ */
+inline int32_t stepsToAligned(motor_t m, uint8_t mult) {
+    int32_t rem = ((m->pos % mult) + mult) % mult;
+    int32_t dst = m->dir == 1 ? (mult - rem) % mult : rem;
+    return dst / m->mults[m->multIdx];
+}
+
+/**
+ * @brief Schedules and applies the multiplier switches.
+ * 
+ * The next higher multiplier is scheduled when the step interval would drop under `minStepI` by the time the switch 
+ * can be made - the velocity is extrapolated with the current acceleration over the steps to the next aligned position, 
+ * so accelerating slews switch in time. The lower multiplier is scheduled only when it keeps the step interval above 
+ * `minStepI` by the `multHyst` band, so the motor doesn't chatter between the two around the boundary.
+ * 
+ * Switches up are applied at the next position aligned to the new multiplier, so the position stays on the grid
+ * of the new resolution and the driver microstep phase matches it. In the SPI mode the switch is only chosen here 
+ * and made by motor_applyMultiplier, out of the step loop. The driver counts the microsteps in 1/256 whatever 
+ * the resolution, so the switch doesn't need the aligned position there.
+ */
+void multiplierAdjust(motor_t m) {
+    float v = fabsf(m->v);
+    uint8_t mult = m->mults[m->multIdx];
+    uint8_t target = m->multIdx;
+
+    if (m->multIdx < m->multCount - 1 && v > 0.0f) {
+        uint8_t upMult = m->mults[m->multIdx + 1];
+        // In the SPI mode the switch waits for motor_applyMultiplier instead of the aligned position
+        float alignT = m->cfg.driver != NULL ? m->cfg.multLatency / 1e6f : stepsToAligned(m, upMult) * mult / v;
+        float a = m->v > 0.0f ? m->accel : -m->accel;
+        float aheadV = a > 0.0f ? v + a * alignT : v;
+        if (1e6f * mult / aheadV < m->cfg.minStepI)
+            target = m->multIdx + 1;
+    }
+    if (target == m->multIdx && m->multIdx > 0 
+            && 1e6f * m->mults[m->multIdx - 1] / v > m->cfg.minStepI * (1.0f + m->cfg.multHyst))
+        target = m->multIdx - 1;
+
+    if (m->cfg.driver != NULL) {
+        m->pendingMultIdx = target;
+        return;
+    }
+    // Lower multipliers divide the current one, so the position stays aligned. Positions already off the grid 
+    // (set by a position update) can't be aligned, the switch is made right away then.
+    if (target < m->multIdx || (target > m->multIdx && (m->pos % m->mults[target] == 0 || m->pos % mult != 0)))
+        updateMultiplier(m, target);
+}
+
+/**
+ * @brief Checks the configured multiplier table - ascending from 1, each dividing the next, and selectable 
+ * by the CFG pins in the standalone mode
+ */
+bool multipliersValid(const motor_config_t *cfg) {
+    if (cfg->multCount == 0 || cfg->multCount > MOTOR_MAX_MULTIPLIERS || cfg->mults[0] != 1)
+        return false;
+    for (uint8_t i = 0; i < cfg->multCount; i++) {
+        if (i > 0 && (cfg->mults[i] <= cfg->mults[i - 1] || cfg->mults[i] % cfg->mults[i - 1] != 0))
+            return false;
+        if (cfg->mults[i] > MOTOR_MICROSTEPS || (cfg->driver == NULL && pinMultiplierIdx(cfg->mults[i]) < 0))
+            return false;
+    }
+    return true;
+}
 
-    gpio_set_direction(cfg.stepPin, GPIO_MODE_OUTPUT);
-    gpio_set_direction(cfg.dirPin, GPIO_MODE_OUTPUT);
-    gpio_set_direction(cfg.cfg1Pin, GPIO_MODE_INPUT);
-    gpio_set_direction(cfg.cfg2Pin, GPIO_MODE_INPUT);
+motor_t motor_create(Motor *storage, motor_config_t cfg) {
+    motor_t motor = storage;
+
+    hal_gpioSetOutput(cfg.stepPin);
+    hal_gpioSetOutput(cfg.dirPin);
+    if (cfg.driver == NULL) {
+        hal_gpioSetInput(cfg.cfg1Pin);
+        hal_gpioSetInput(cfg.cfg2Pin);
+        motor->mults = PIN_MULTIPLIERS;
+        motor->multCount = sizeof(PIN_MULTIPLIERS);
+    }
+    else {
+        tmc_setMicrosteps(cfg.driver, MOTOR_MICROSTEPS);
+        motor->mults = SPI_MULTIPLIERS;
+        motor->multCount = sizeof(SPI_MULTIPLIERS);
+    }
+    if (cfg.mults != NULL) {
+        if (multipliersValid(&cfg)) {
+            motor->mults = cfg.mults;
+            motor->multCount = cfg.multCount;
+        }
+        else {
+            DLOGW(TAG, "Motor %hhu: multiplier table not supported by the driver mode, using the default", cfg.id);
+        }
+    }
 
     motor->cfg = cfg;
+    motor->stepMask = HAL_GPIO_MASK(cfg.stepPin);
+    motor->stepI = 0.0f;
     motor->dir = 0;
     motor->pos = 0;
     motor->mode = STOP;
     motor->v = 0.0f;
     motor->lastParamUpdateTime = 0;
     motor->multIdx = 0;
+    motor->pendingMultIdx = 0;
+    motor->accel = 0.0f;
+    motor->oPos = 0;
+    motor->oRate = 0.0f;
+    motor->oRateStart = 0;
+    motor_resetStats(motor, hal_getTime());
     return motor;
 }
 
-void motor_run(motor_t m) {
-    int64_t time = esp_timer_get_time();
-    bool paramsUpdated = false;
+inline void adjustMode(motor_t m, int64_t time, int64_t dt) {
+    float v0 = m->v;
+    if (m->mode == TRACKING)
+        trackMAdjust(m, time, dt);
+    else if (m->mode == GOTO)
+        gotoMAdjust(m, time, dt);
+    else if (m->mode == INTERCEPT)
+        interceptMAdjust(m, time);
+    else if (m->mode == VELOCITY)
+        velocityMAdjust(m, time, dt);
+    else if (m->mode == BRAKING)
+        brakingMAdjust(m, time);
+    if (dt > 0)
+        m->accel = (m->v - v0) * 1e6f / dt;
+    m->lastParamUpdateTime = time;
+}
+
+/**
+ * @brief First half of a motor pass - recalculates the motor parameters when due, and counts the step when it's due.
+ * 
+ * @return hal_gpio_mask_t Step pin of the motor when a step is due, 0 otherwise. The pulse must be made before finishStep.
+ */
+hal_gpio_mask_t prepareStep(motor_t m, int64_t time) {
     if (m->lastParamUpdateTime + PARAM_UPDATE_P < time) {
-        int64_t dt = time - m->lastParamUpdateTime;
-        if (m->mode == TRACKING)
-            trackMAdjust(m, time, dt);
-        else if (m->mode == GOTO)
-            gotoMAdjust(m, time, dt);
-        m->lastParamUpdateTime = time;
-        paramsUpdated = true;
+        updateModeTime(m, time);
+        adjustMode(m, time, time - m->lastParamUpdateTime);
+        return 0;
     }
 
-    if (!paramsUpdated && abs(m->v) > 0.0f && m->mode != STOP && time - m->lastStepTime > getStepI(m)) {
-        //ESP_LOGD(TAG, "pos: %lli", m->pos);
-        makeStep(m);
-        m->lastStepTime = time;
-
-        int64_t dt = time - m->lastParamUpdateTime;
-        if (m->mode == TRACKING)
-            trackMAdjust(m, time, dt);
-        else if (m->mode == GOTO)
-            gotoMAdjust(m, time, dt);
-        m->lastParamUpdateTime = time;
-        multiplierAdjust(m);
+    if (abs(m->v) == 0.0f || m->mode == STOP)
+        return 0;
+
+    m->stepI = getStepI(m);
+    if (time - m->lastStepTime <= m->stepI)
+        return 0;
+    makeStep(m);
+    return m->stepMask;
+}
+
+/**
+ * @brief Second half of a motor pass, after the step pulse - records the step timing and recalculates the parameters. 
+ * Direction and resolution changes are made here, so they never happen between counting a step and its pulse.
+ */
+void finishStep(motor_t m, int64_t time) {
+    // The step couldn't be due before the velocity it was made with was set
+    int64_t dueTime = m->lastStepTime + m->stepI;
+    if (dueTime < m->lastParamUpdateTime)
+        dueTime = m->lastParamUpdateTime;
+    recordStepLateness(m, time - dueTime, m->stepI);
+    m->lastStepTime = time;
+    updateModeTime(m, time);
+
+    adjustMode(m, time, time - m->lastParamUpdateTime);
+    multiplierAdjust(m);
+}
+
+void motor_run(motor_t m) {
+    int64_t time = hal_getTime();
+    hal_gpio_mask_t step = prepareStep(m, time);
+    if (step != 0) {
+        hal_gpioPulse(step);
+        finishStep(m, time);
     }
 }
 
+void motor_runAxes(motor_t m1, motor_t m2) {
+    int64_t time = hal_getTime();
+    hal_gpio_mask_t step1 = prepareStep(m1, time);
+    hal_gpio_mask_t step2 = prepareStep(m2, time);
+    if (step1 == 0 && step2 == 0)
+        return;
+
+    hal_gpioPulse(step1 | step2);
+    if (step1 != 0)
+        finishStep(m1, time);
+    if (step2 != 0)
+        finishStep(m2, time);
+}
+
 void motor_track(motor_t m, step_t startPos, step_t targetPos, int64_t startTime, int64_t targetTime) {
 
     m->tStartTime = startTime;
@@ -239,29 +495,158 @@ void motor_track(motor_t m, step_t startPos, step_t targetPos, int64_t startTime
     m->tPos = targetPos;
     m->tTime = targetTime;
     m->tStartV = m->v;
-    m->mode = TRACKING;
+    setMode(m, TRACKING);
+    trace_event(TRACE_SEGMENT, m->cfg.id, startPos, targetPos, startTime - hal_getTime(), targetTime - hal_getTime());
+}
+
+bool motor_planIntercept(motor_t m, step_t targetPos, float targetV, float a, intercept_plan_t *plan) {
+    float dx = targetPos - m->pos;
+    float v0 = m->v;
+    float v1 = targetV;
+    float bestT = INFINITY;
+
+    if (fabsf(v1) > m->cfg.maxV)
+        return false;
+
+    // s is the direction of the first phase acceleration. The peak velocity vp follows from
+    // dx = (vp^2 - v0^2) / 2sa + (vp^2 - v1^2) / 2sa
+    for (int s = -1; s <= 1; s += 2) {
+        float sa = s * a;
+        float vp2 = sa * dx + (v0 * v0 + v1 * v1) / 2;
+        if (vp2 < 0.0f)
+            continue;
+
+        float vc = s * sqrtf(vp2);
+        float tc = 0.0f;
+        if (fabsf(vc) > m->cfg.maxV) {
+            vc = s * m->cfg.maxV;
+            float rampDst = (vc * vc - v0 * v0) / (2 * sa) + (vc * vc - v1 * v1) / (2 * sa);
+            tc = (dx - rampDst) / vc;
+        }
+        float t1 = (vc - v0) / sa;
+        float t2 = (vc - v1) / sa;
+        if (t1 < 0.0f || t2 < 0.0f || tc < 0.0f || t1 + tc + t2 >= bestT)
+            continue;
+
+        bestT = t1 + tc + t2;
+        plan->targetPos = targetPos;
+        plan->v0 = v0;
+        plan->vc = vc;
+        plan->v1 = v1;
+        plan->a = sa;
+        plan->t1 = t1;
+        plan->tc = tc;
+        plan->t2 = t2;
+    }
+
+    return bestT != INFINITY;
+}
+
+int64_t motor_getInterceptDuration(const intercept_plan_t *plan) {
+    return (plan->t1 + plan->tc + plan->t2) * 1e6;
+}
+
+void motor_intercept(motor_t m, const intercept_plan_t *plan, int64_t startTime, step_t followPos, int64_t followTime) {
+    m->iPlan = *plan;
+    m->iStartTime = startTime;
+    m->tPos = followPos;
+    m->tTime = followTime;
+    setMode(m, INTERCEPT);
+    trace_event(TRACE_INTERCEPT, m->cfg.id, plan->targetPos, motor_getInterceptDuration(plan), followTime - hal_getTime(), 0);
+}
+
+void motor_setVelocity(motor_t m, float v, int64_t deadline) {
+    // NaN would get past the velocity limits, stop instead
+    if (isnan(v))
+        v = 0.0f;
+    m->jogV = fmaxf(-m->cfg.maxV, fminf(v, m->cfg.maxV));
+    m->jogDeadline = deadline;
+    setMode(m, VELOCITY);
+}
+
+void motor_setTrackPosOffset(motor_t m, step_t offset, int64_t t) {
+    m->oPos = offset;
+    m->oRateStart = t;
+}
+
+void motor_setTrackRateOffset(motor_t m, float rate, int64_t t) {
+    m->oPos = getTrackOffset(m, t);
+    m->oRateStart = t;
+    m->oRate = rate;
+}
+
+void motor_clearTrackOffsets(motor_t m) {
+    m->oPos = 0;
+    m->oRate = 0.0f;
+    m->oRateStart = 0;
+}
+
+void motor_shiftTrackTime(motor_t m, int64_t dt) {
+    m->tStartTime += dt;
+    m->tTime += dt;
 }
 
 void motor_goto(motor_t m, step_t targetPos) {
     m->tPos = targetPos;
-    m->mode = GOTO;
+    setMode(m, GOTO);
 }
 
 void motor_stop(motor_t m, bool instant) {
     if (instant) {
         m->v = 0.0f;
-        m->mode = STOP;
+        setMode(m, STOP);
     }
-    else {
-        motor_goto(m, m->pos); // TODO: make the motor to stop and stay stopped, not to return to original position.
-        m->mode = GOTO;
+    else if (m->v == 0.0f) {
+        setMode(m, STOP);
+    }
+    else if (m->mode != BRAKING) {
+        // Closed form ramp to zero, the motor stops after |v| / brakeA at v^2 / 2brakeA from here
+        int64_t t = hal_getTime();
+        m->bStartTime = t;
+        m->bStartV = m->v;
+        m->tPos = m->pos + m->v * fabsf(m->v) / (2 * m->cfg.brakeA);
+        m->tTime = t + fabsf(m->v) / m->cfg.brakeA * 1e6f;
+        setMode(m, BRAKING);
+        trace_event(TRACE_BRAKING, m->cfg.id, m->v, m->tPos, m->tTime - t, 0);
     }
 }
 
+void motor_resetStats(motor_t m, int64_t t) {
+    memset(&m->stats, 0, sizeof(motor_stats_t));
+    m->stats.lastModeTime = t;
+}
+
+bool motor_checkDriver(motor_t m) {
+    tmc2130_status_t status;
+    if (m->cfg.driver == NULL || !tmc_readStatus(m->cfg.driver, &status))
+        return false;
+
+    m->stats.sgResult = status.sgResult;
+    bool stall = status.stall && m->mode != STOP;
+    bool error = status.overtemp || status.shortToGround;
+    if (stall)
+        m->stats.stalls++;
+    if (error)
+        m->stats.driverErrors++;
+    if (!stall && !error)
+        return false;
+
+    uint8_t flags = (stall ? 1 : 0) | (status.overtemp ? 2 : 0) | (status.shortToGround ? 4 : 0);
+    trace_event(TRACE_DRIVER, m->cfg.id, status.sgResult, flags, m->pos, 0);
+    DLOGW(TAG, "Motor %hhu driver problem (flags %hhu), position may be lost", m->cfg.id, flags);
+    return true;
+}
+
+void motor_applyMultiplier(motor_t m) {
+    if (m->cfg.driver != NULL && m->pendingMultIdx != m->multIdx)
+        updateMultiplier(m, m->pendingMultIdx);
+}
+
 void motor_destroy(motor_t motor) {
-    gpio_set_direction(motor->cfg.stepPin, GPIO_MODE_INPUT);
-    gpio_set_direction(motor->cfg.dirPin, GPIO_MODE_INPUT);
-    gpio_set_direction(motor->cfg.cfg1Pin, GPIO_MODE_INPUT);
-    gpio_set_direction(motor->cfg.cfg2Pin, GPIO_MODE_INPUT);
-    free(motor);
+    hal_gpioSetInput(motor->cfg.stepPin);
+    hal_gpioSetInput(motor->cfg.dirPin);
+    if (motor->cfg.driver == NULL) {
+        hal_gpioSetInput(motor->cfg.cfg1Pin);
+        hal_gpioSetInput(motor->cfg.cfg2Pin);
+    }
 }
\ No newline at end of file
@@ -2,19 +2,45 @@
 #define __MOTOR_DRIVER
 #include "../settings.h"
 #include "../config.h"
+#include "tmc2130.h"
+#include "../hal/hal.h"
 
 typedef enum motor_mode {
     STOP,
     TRACKING,
     GOTO,
-    BRAKING
+    BRAKING,
+    INTERCEPT,
+    VELOCITY
 } motor_mode_t;
 
+/**
+ * @brief Number of motor modes (values of motor_mode_t)
+ */
+#define MOTOR_MODE_COUNT 6
+/**
+ * @brief Microsteps per full step with multiplier 1 - the position unit is 1/16 of a full step
+ */
+#define MOTOR_MICROSTEPS 16
+/**
+ * @brief Maximum length of a multiplier table
+ */
+#define MOTOR_MAX_MULTIPLIERS 5
+/**
+ * @brief Number of buckets of the step lateness histogram, see MotorStats
+ */
+#define MOTOR_STATS_BUCKET_COUNT 8
+
 /**
  * @brief Motor configuration. This structure is used for motor initialization by motor_create.
  * 
  */
 typedef struct MotorConfig {
+    /**
+     * @brief Motor number (axis), identifies the motor in the motion trace
+     * 
+     */
+    uint8_t id;
     /**
      * @brief STP pin number (for example GPIO_NUM_14)
      * 
@@ -35,6 +61,12 @@ typedef struct MotorConfig {
      * 
      */
     int cfg2Pin;
+    /**
+     * @brief Driver configured over SPI, or NULL in the standalone mode (resolution set by the CFG pins).
+     * With SPI the multipliers go by powers of two, the standalone mode can't set 8 microsteps.
+     * 
+     */
+    tmc2130_t *driver;
 
     /**
      * @brief Maximum motor acceleration (steps per second squared)
@@ -66,8 +98,119 @@ typedef struct MotorConfig {
      * switch to a lower step resolution (and therefore higher speed per step interval)
      */
     int32_t minStepI;
+    /**
+     * @brief Hysteresis of the switches to a lower multiplier, as a part of `minStepI`. The lower multiplier is used 
+     * once the step interval with it is above `minStepI * (1 + multHyst)`.
+     */
+    float multHyst;
+    /**
+     * @brief Longest delay (microseconds) of a multiplier switch in the SPI mode, until `motor_applyMultiplier`
+     * makes it. The switches up are planned that far ahead.
+     */
+    int32_t multLatency;
+    /**
+     * @brief Multiplier table (ascending from 1, each dividing the next, at most MOTOR_MAX_MULTIPLIERS), or NULL 
+     * for the default of the driver mode. The standalone mode can use 1, 4, 8 and 16 only.
+     * 
+     */
+    const uint8_t *mults;
+    uint8_t multCount;
 } motor_config_t;
 
+/**
+ * @brief Time-optimal move from the current position and velocity to a target position and velocity, 
+ * under an acceleration limit. It consists of an acceleration phase (`t1`), a cruise phase at `vc` (`tc`, 
+ * only when the maximum velocity is reached) and a deceleration phase (`t2`).
+ * 
+ * Calculated by motor_planIntercept and executed by motor_intercept.
+ */
+typedef struct InterceptPlan {
+    /**
+     * @brief Target position
+     * 
+     */
+    step_t targetPos;
+    /**
+     * @brief Velocity at the start of the move (steps per second)
+     * 
+     */
+    float v0;
+    /**
+     * @brief Velocity at the end of the acceleration phase
+     * 
+     */
+    float vc;
+    /**
+     * @brief Target velocity (reached at the end of the move)
+     * 
+     */
+    float v1;
+    /**
+     * @brief Acceleration in the first phase (steps per second squared, signed). The last phase uses `-a`.
+     * 
+     */
+    float a;
+    /**
+     * @brief Durations of the acceleration, cruise and deceleration phases (seconds)
+     * 
+     */
+    float t1, tc, t2;
+} intercept_plan_t;
+
+/**
+ * @brief Step timing statistics of a motor, collected by motor_run.
+ * 
+ * Lateness of a step is the time between the moment the step became due (given the current velocity) and the moment 
+ * it was made. Bucket upper bounds are 10, 20, 50, 100, 200, 500 and 1000 us, the last bucket holds the rest.
+ */
+typedef struct MotorStats {
+    /**
+     * @brief Histogram of step lateness
+     * 
+     */
+    uint32_t latenessHist[MOTOR_STATS_BUCKET_COUNT];
+    /**
+     * @brief Maximum step lateness (in microseconds)
+     * 
+     */
+    uint32_t maxLateness;
+    /**
+     * @brief Number of steps late by more than their own step interval (a whole step slot was lost)
+     * 
+     */
+    uint32_t missedDeadlines;
+    /**
+     * @brief Number of multiplier changes
+     * 
+     */
+    uint32_t multSwitches;
+    /**
+     * @brief Number of driver status reads reporting a stall while the motor moved (SPI mode only). A stall means lost steps.
+     * 
+     */
+    uint32_t stalls;
+    /**
+     * @brief Number of driver status reads reporting overtemperature or a short to ground (SPI mode only)
+     * 
+     */
+    uint32_t driverErrors;
+    /**
+     * @brief Last StallGuard load measurement (SPI mode only), lower means higher load
+     * 
+     */
+    uint16_t sgResult;
+    /**
+     * @brief Time spent in each mode (in microseconds), indexed by motor_mode_t
+     * 
+     */
+    int64_t modeTime[MOTOR_MODE_COUNT];
+    /**
+     * @brief Time `modeTime` was last updated
+     * 
+     */
+    int64_t lastModeTime;
+} motor_stats_t;
+
 /**
  * @brief Structure containing all the info about a stepper motor - its configuration, position, speed etc.
  * 
@@ -116,6 +259,16 @@ typedef struct Motor {
      * 
      */
     float v;
+    /**
+     * @brief Step interval the last step was made with (in microseconds)
+     * 
+     */
+    float stepI;
+    /**
+     * @brief STP pin as a GPIO mask, for hal_gpioPulse
+     * 
+     */
+    hal_gpio_mask_t stepMask;
     /**
      * @brief Direction of the motor, either 1 (forward) or 0 (backward)
      * 
@@ -130,10 +283,69 @@ typedef struct Motor {
      * @brief Multiplier index.
      * 
      * Number of the multiplier used for the steps. It works sort of like opposite of step resolution - the more, the smaller the resolution is.
-     * Each step's position change (default 1) is multiplied by MULTIPLIERS[multIdx]. (MULTIPLIERS is defined in motor-driver.c)
+     * Each step's position change (default 1) is multiplied by mults[multIdx].
      * 
      */
     uint8_t multIdx;
+    /**
+     * @brief Multiplier index chosen in the SPI mode, made by `motor_applyMultiplier` out of the step loop
+     * 
+     */
+    uint8_t pendingMultIdx;
+    /**
+     * @brief Multiplier table in use, `cfg.mults` or the default of the driver mode (defined in motor-driver.c)
+     * 
+     */
+    const uint8_t *mults;
+    uint8_t multCount;
+    /**
+     * @brief Acceleration of the last parameter update (steps per second squared), used to plan the multiplier switches
+     * 
+     */
+    float accel;
+    /**
+     * @brief Executed plan in INTERCEPT mode
+     * 
+     */
+    intercept_plan_t iPlan;
+    /**
+     * @brief Time when the INTERCEPT mode plan started (in microseconds)
+     * 
+     */
+    int64_t iStartTime;
+    /**
+     * @brief Target velocity in VELOCITY mode (steps per second)
+     * 
+     */
+    float jogV;
+    /**
+     * @brief Time (in microseconds) after which the VELOCITY mode ramps down to zero, unless the velocity gets updated
+     * 
+     */
+    int64_t jogDeadline;
+    /**
+     * @brief Time (in microseconds) and velocity the BRAKING mode started with. The stop position and time 
+     * are in `tPos` and `tTime`.
+     * 
+     */
+    int64_t bStartTime;
+    float bStartV;
+    /**
+     * @brief Position offset of the tracked trajectory (guiding correction)
+     * 
+     */
+    step_t oPos;
+    /**
+     * @brief Rate offset of the tracked trajectory (steps per second), integrated since `oRateStart`
+     * 
+     */
+    float oRate;
+    int64_t oRateStart;
+    /**
+     * @brief Step timing statistics
+     * 
+     */
+    motor_stats_t stats;
     /**
      * @brief Motor configuration
      * 
@@ -150,10 +362,11 @@ typedef Motor* motor_t;
 /**
  * @brief Initializes a new motor, sets its pin to correct states and makes it stopped.
  * 
+ * @param storage Motor storage, must live as long as the motor (use a static variable). Nothing is allocated.
  * @param config 
  * @return motor_t 
  */
-motor_t motor_create(motor_config_t config);
+motor_t motor_create(Motor *storage, motor_config_t config);
 /**
  * @brief Initiates motor tracking. During tracking, the motor will try to interpolate between startPos and endPos, with speed linearly 
  * increasing/decreasing based on the speed on the start of tracking.
@@ -168,6 +381,94 @@ motor_t motor_create(motor_config_t config);
  */
 void motor_track(motor_t motor, step_t startPos, step_t targetPos, int64_t startTime, int64_t targetTime);
 
+/**
+ * @brief Calculates the fastest move from the current motor state to `targetPos`, arriving with velocity `targetV`.
+ * 
+ * The move is computed in closed form (bang-bang acceleration, with a cruise phase when `maxV` would be exceeded).
+ * 
+ * @param motor Motor
+ * @param targetPos Target position
+ * @param targetV Velocity at the target position (steps per second)
+ * @param a Acceleration limit used for the move
+ * @param plan Resulting plan
+ * @return true The plan was found
+ * @return false The target can't be reached (e.g. `targetV` is over `maxV`)
+ */
+bool motor_planIntercept(motor_t motor, step_t targetPos, float targetV, float a, intercept_plan_t *plan);
+
+/**
+ * @brief Returns total duration of the plan, in microseconds
+ * 
+ * @param plan Plan
+ * @return int64_t Duration
+ */
+int64_t motor_getInterceptDuration(const intercept_plan_t *plan);
+
+/**
+ * @brief Initiates motor INTERCEPT mode. The motor follows the plan from motor_planIntercept, and when it ends, 
+ * it continues in TRACKING mode from the plan's target to `followPos`.
+ * 
+ * @param motor Motor
+ * @param plan Plan calculated by motor_planIntercept
+ * @param startTime Time of the plan start (should be the time the plan was calculated at)
+ * @param followPos Tracking target position after the plan ends
+ * @param followTime Time when `followPos` should be reached. If it's not after the plan end, 
+ *  the motor just keeps the plan's target velocity.
+ */
+void motor_intercept(motor_t motor, const intercept_plan_t *plan, int64_t startTime, step_t followPos, int64_t followTime);
+
+/**
+ * @brief Initiates motor VELOCITY mode (or updates its target velocity). The motor ramps to the velocity with `maxA`
+ * and keeps it until `deadline`, then ramps down to zero and stops.
+ * 
+ * @param motor Motor
+ * @param v Target velocity (steps per second), clamped to ±maxV
+ * @param deadline Time (in microseconds) when the velocity expires. Should be renewed by calling this function again.
+ */
+void motor_setVelocity(motor_t motor, float v, int64_t deadline);
+
+/**
+ * @brief Returns the position of the motor on the tracked trajectory, without the guiding offset. Track segments
+ * continuing from the current position start here.
+ * 
+ * @param motor Motor
+ * @param t Current time (in microseconds)
+ */
+step_t motor_getTrackPos(motor_t motor, int64_t t);
+
+/**
+ * @brief Sets the position offset added to the tracked trajectory. The motor ramps to the offset trajectory with `maxA`.
+ * 
+ * @param motor Motor
+ * @param offset Offset (in steps). Replaces the previous offset, including the part accumulated by the rate offset.
+ * @param t Current time (in microseconds)
+ */
+void motor_setTrackPosOffset(motor_t motor, step_t offset, int64_t t);
+
+/**
+ * @brief Sets the rate offset added to the tracked trajectory. The offset accumulated by the previous rate is kept.
+ * 
+ * @param motor Motor
+ * @param rate Rate offset (steps per second)
+ * @param t Current time (in microseconds)
+ */
+void motor_setTrackRateOffset(motor_t motor, float rate, int64_t t);
+
+/**
+ * @brief Clears the position and rate offsets of the tracked trajectory.
+ * 
+ * @param motor Motor
+ */
+void motor_clearTrackOffsets(motor_t motor);
+
+/**
+ * @brief Shifts the currently tracked segment in time.
+ * 
+ * @param motor Motor
+ * @param dt Time shift (in microseconds), positive values delay the trajectory
+ */
+void motor_shiftTrackTime(motor_t motor, int64_t dt);
+
 /**
  * @brief Initiates motor GOTO mode. In this mode, the motor will accelerate until the maximum speed is reached, 
  * or gets near enough to its target position to start decelerating. 
@@ -183,9 +484,18 @@ void motor_goto(motor_t motor, step_t targetPos);
  * @param motor Motor
  */
 void motor_run(motor_t motor);
+/**
+ * @brief Runs two motors like motor_run, at the same time point. Steps due on both motors in the same pass 
+ * are pulsed together, by a single hal_gpioPulse.
+ * 
+ * @param m1 First motor
+ * @param m2 Second motor
+ */
+void motor_runAxes(motor_t m1, motor_t m2);
 
 /**
- * @brief Stops the motor
+ * @brief Stops the motor. Without `instant`, the motor brakes (BRAKING mode) with `brakeA` to zero velocity 
+ * in the shortest time and distance, and holds the position it stopped at.
  * 
  * @param motor Motor
  * @param instant True if the motor should not brake and just stop immediately. 
@@ -194,7 +504,34 @@ void motor_run(motor_t motor);
 void motor_stop(motor_t motor, bool instant);
 
 /**
- * @brief Frees all resources allocated by the motor.
+ * @brief Clears the motor statistics
+ * 
+ * @param motor Motor
+ * @param t Current time (in microseconds), start of the new mode time measurement
+ */
+void motor_resetStats(motor_t motor, int64_t t);
+
+/**
+ * @brief Reads the driver status (SPI mode only) and records stalls and driver errors into the statistics 
+ * and the motion trace. Takes two SPI datagrams, meant to be called periodically from the motor task update.
+ * 
+ * @param motor Motor
+ * @return true A stall or a driver error was detected
+ * @return false No problem, or the motor is in the standalone mode
+ */
+bool motor_checkDriver(motor_t motor);
+
+/**
+ * @brief Makes the multiplier switch chosen by the step loop (SPI mode only). The resolution is written to the driver
+ * by a blocking SPI transaction, so it's kept out of the step loop - meant to be called from the motor task update,
+ * at most `multLatency` apart.
+ * 
+ * @param motor Motor
+ */
+void motor_applyMultiplier(motor_t motor);
+
+/**
+ * @brief Releases the motor pins (sets them as inputs). The motor storage is left to the caller.
  * 
  * @param motor Motor
  */
@@ -1,182 +1,761 @@
 #include "motor-task.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include <esp_log.h>
+#include "../log/dlog.h"
+#include "../log/trace.h"
 #include "../settings.h"
-#include <esp_timer.h>
+#include "../hal/hal.h"
+#include "../persist/persist.h"
 #include "motor-driver.h"
 #include <math.h>
-#include <esp_task_wdt.h>
-#include <esp_int_wdt.h>
+#include <stdatomic.h>
 #define TAG "motor-task"
 
 //#define MEASURE_CYCLE_T
 
 bool tracking = false;
+/**
+ * @brief True when the motors are pre-positioned (or moving to the start) and waiting for `armedStartEspTime`
+ */
+bool trackingArmed = false;
+int64_t armedStartEspTime;
+/**
+ * @brief Trajectory time of the armed start
+ */
+uint64_t armedStartTime;
+/**
+ * @brief True while the trajectory intercept is being searched for (CMD_TRACK_BEGIN), see continueIntercept
+ */
+bool interceptSearch = false;
+/**
+ * @brief Offsets of the end points of the first segments not ruled out for the intercept, per axis
+ */
+uint32_t interceptFrom[2];
+/**
+ * @brief Time shift of the tracked trajectory (in milliseconds). Track point with time T is reached at mount time T + trackTimeShift.
+ */
+int64_t trackTimeShift = 0;
+/**
+ * @brief Tracking was running, armed or searching for the intercept at the last update. The offsets and the time shift are cleared once it ends.
+ */
+bool trackingActive = false;
+Motor motors[2];
+/**
+ * @brief Drivers configured over SPI (MOTOR_DRIVER_SPI)
+ */
+tmc2130_t tmcDrivers[2];
 motor_t m1;
 motor_t m2;
 TrackPoint currentTrackPoint;
-QueueHandle_t motorCmdQueue;
+hal_queue_t motorCmdQueue;
+hal_queue_t jogQueue;
+int64_t tLastUpdate;
+int64_t tLastJogPoll;
+/**
+ * @brief Statistics of the motors, as published for motor_getStats. Protected by `statsMtx`.
+ */
+motor_stats_t statsSnapshot[2];
+hal_mutex_buffer_t statsMtxBuffer;
+hal_mutex_t statsMtx;
+#ifdef MOTOR_MULTIPLIERS
+const uint8_t motorMultipliers[] = MOTOR_MULTIPLIERS;
+#endif
+/**
+ * @brief Latched fault, MOTOR_FAULT_* bits set by faultIsr. Cleared only by CMD_FAULT_CLEAR.
+ */
+atomic_uint faultFlags = 0;
+/**
+ * @brief Fault the motor loop has already stopped the motors for
+ */
+uint32_t handledFault = 0;
+/**
+ * @brief Step pins of both motors, cut by faultIsr
+ */
+hal_gpio_mask_t stepPins = 0;
+#ifdef MEASURE_CYCLE_T
+int64_t maxExecT = 0;
+#endif
 
-void beginTracking(uint64_t time) {
-    bool trackPointAcquired = mount_pullTrackPoint(&currentTrackPoint);
+/**
+ * @brief Converts trajectory time (time of the track points) to ESP timer time, including the tracking time shift
+ */
+inline bool trackTimeToEspTime(uint64_t trackTime, int64_t *espTime) {
+    return mount_timeToEspTime(trackTime + trackTimeShift, espTime);
+}
 
-    if (!trackPointAcquired) {
-        ESP_LOGW(TAG, "Requested tracking start, but no tracking point found");
+/**
+ * @brief Pulls the next track point from the track buffer, recording it in the motion trace
+ */
+bool pullTrackPoint(TrackPoint *trackPoint) {
+    if (!mount_pullTrackPoint(trackPoint))
+        return false;
+
+    int64_t espTime;
+    trackTimeToEspTime(trackPoint->time, &espTime);
+    trace_event(TRACE_POINT_PULL, 0, trackPoint->ax1, trackPoint->ax2, (espTime - hal_getTime()) / 1000, 0);
+    return true;
+}
+
+inline step_t trackPointAxis(const TrackPoint *tp, uint8_t axis) {
+    return axis == 1 ? tp->ax1 : tp->ax2;
+}
+
+/**
+ * @brief Position on the axis between two track points at the given time (linear interpolation)
+ */
+inline step_t interpolateAxis(const TrackPoint *a, const TrackPoint *b, uint8_t axis, uint64_t time) {
+    step_t x0 = trackPointAxis(a, axis);
+    return x0 + (float)(trackPointAxis(b, axis) - x0) * (int64_t)(time - a->time) / (b->time - a->time);
+}
+
+/**
+ * @brief Checks whether the motor can join the segment a-b at `joinTime` with matched position and velocity.
+ */
+bool interceptFeasible(motor_t m, uint8_t axis, const TrackPoint *a, const TrackPoint *b, uint64_t time, uint64_t joinTime, intercept_plan_t *plan) {
+    float segmentV = (float)(trackPointAxis(b, axis) - trackPointAxis(a, axis)) * 1000 / (b->time - a->time);
+    step_t joinPos = interpolateAxis(a, b, axis, joinTime);
+    if (!motor_planIntercept(m, joinPos, segmentV, m->cfg.maxA * MOTOR_INTERCEPT_A_K, plan))
+        return false;
+    return motor_getInterceptDuration(plan) <= (int64_t)(joinTime - time) * 1000;
+}
+
+typedef enum InterceptScan {
+    INTERCEPT_FOUND,
+    INTERCEPT_SEARCHING,
+    INTERCEPT_NONE
+} InterceptScan;
+
+/**
+ * @brief Searches the next MOTOR_INTERCEPT_SCAN_CHUNK segments for the first one the motor can join at its end
+ * 
+ * @param m Motor
+ * @param axis Axis of the motor (1 or 2)
+ * @param time Current trajectory time
+ * @param from Offset of the end point of the first segment to test, moved to the segment found or to where the search 
+ * continues
+ * @return InterceptScan INTERCEPT_FOUND when the segment ending at `from` can be joined, INTERCEPT_NONE when 
+ * the trajectory can't be reached within the lookahead
+ */
+InterceptScan scanIntercept(motor_t m, uint8_t axis, uint64_t time, uint32_t *from) {
+    TrackPoint a, b;
+    intercept_plan_t plan;
+    uint32_t end = *from + MOTOR_INTERCEPT_SCAN_CHUNK;
+    if (end > MOTOR_INTERCEPT_LOOKAHEAD)
+        end = MOTOR_INTERCEPT_LOOKAHEAD;
+    if (!mount_peekTrackPoint(*from - 1, &a))
+        return INTERCEPT_NONE;
+
+    for (; *from < end; (*from)++, a = b) {
+        if (!mount_peekTrackPoint(*from, &b))
+            return INTERCEPT_NONE;
+        if (b.time > time && b.time > a.time && interceptFeasible(m, axis, &a, &b, time, b.time, &plan))
+            return INTERCEPT_FOUND;
+    }
+    return end < MOTOR_INTERCEPT_LOOKAHEAD ? INTERCEPT_SEARCHING : INTERCEPT_NONE;
+}
+
+/**
+ * @brief Finds the earliest time the motor can join the segment ending at the offset, by bisection with millisecond 
+ * resolution. The segment must be reachable at its end (scanIntercept).
+ * 
+ * @param joinTime The earliest join time is written here
+ * @param plan Plan of the move to the join point
+ */
+void findJoinTime(motor_t m, uint8_t axis, uint64_t time, uint32_t offset, uint64_t *joinTime, intercept_plan_t *plan) {
+    TrackPoint a, b;
+    mount_peekTrackPoint(offset - 1, &a);
+    mount_peekTrackPoint(offset, &b);
+    uint64_t lo = a.time > time ? a.time : time;
+    uint64_t hi = b.time;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (interceptFeasible(m, axis, &a, &b, time, mid, plan))
+            hi = mid;
+        else
+            lo = mid;
+    }
+    interceptFeasible(m, axis, &a, &b, time, hi, plan);
+    *joinTime = hi;
+}
+
+/**
+ * @brief Starts the trajectory intercept search, continued by continueIntercept in the following updates
+ */
+void beginTracking() {
+    tracking = false;
+    trackingArmed = false;
+    interceptSearch = true;
+    interceptFrom[0] = 1;
+    interceptFrom[1] = 1;
+}
+
+/**
+ * @brief Continues the intercept search, and starts the tracking by joining the trajectory at the earliest reachable 
+ * point once both axes have one.
+ * 
+ * The segments are tested one by one (at most MOTOR_INTERCEPT_LOOKAHEAD points ahead), MOTOR_INTERCEPT_SCAN_CHUNK
+ * per axis in one update, so the search doesn't hold up the steps. Each update tests the motors in their current state
+ * from the first segment not ruled out yet, the join time inside it is then found by bisection. Each motor gets 
+ * a time-optimal move to its own intercept point, from which it follows the trajectory to the later of the two 
+ * intercepts. Regular segment tracking continues from there. When no intercept is found, the motors go to the first 
+ * track point instead.
+ * 
+ * @param time Current trajectory time
+ */
+void continueIntercept(uint64_t time) {
+    InterceptScan scan1 = scanIntercept(m1, 1, time, &interceptFrom[0]);
+    InterceptScan scan2 = scanIntercept(m2, 2, time, &interceptFrom[1]);
+    if ((scan1 == INTERCEPT_SEARCHING || scan2 == INTERCEPT_SEARCHING) && scan1 != INTERCEPT_NONE && scan2 != INTERCEPT_NONE)
+        return;
+
+    int64_t espTime = hal_getTime();
+    uint64_t join1, join2;
+    intercept_plan_t plan1, plan2;
+    interceptSearch = false;
+
+    if (scan1 == INTERCEPT_NONE || scan2 == INTERCEPT_NONE) {
+        bool trackPointAcquired = pullTrackPoint(&currentTrackPoint);
+
+        if (!trackPointAcquired) {
+            DLOGW(TAG, "Requested tracking start, but no tracking point found");
+            motor_stop(m1, false);
+            motor_stop(m2, false);
+            tracking = false;
+        }
+        else {
+            DLOGW(TAG, "No trajectory intercept found, going to the first track point");
+            motor_goto(m1, currentTrackPoint.ax1);
+            motor_goto(m2, currentTrackPoint.ax2);
+            tracking = true;
+        }
+        return;
+    }
+
+    findJoinTime(m1, 1, time, interceptFrom[0], &join1, &plan1);
+    findJoinTime(m2, 2, time, interceptFrom[1], &join2, &plan2);
+    // Tracking continues from the trajectory position at the later intercept, older points aren't needed
+    uint64_t joinTime = join1 > join2 ? join1 : join2;
+    TrackPoint nextTrackPoint;
+    pullTrackPoint(&currentTrackPoint);
+    while (mount_peekTrackPoint(0, &nextTrackPoint) && nextTrackPoint.time <= joinTime)
+        pullTrackPoint(&currentTrackPoint);
+
+    if (currentTrackPoint.time < joinTime && mount_peekTrackPoint(0, &nextTrackPoint)) {
+        currentTrackPoint.ax1 = interpolateAxis(&currentTrackPoint, &nextTrackPoint, 1, joinTime);
+        currentTrackPoint.ax2 = interpolateAxis(&currentTrackPoint, &nextTrackPoint, 2, joinTime);
+        currentTrackPoint.time = joinTime;
+    }
+
+    int64_t joinEspTime;
+    trackTimeToEspTime(joinTime, &joinEspTime);
+    motor_intercept(m1, &plan1, espTime, currentTrackPoint.ax1, joinEspTime);
+    motor_intercept(m2, &plan2, espTime, currentTrackPoint.ax2, joinEspTime);
+    tracking = true;
+    DLOGD(TAG, "Intercepting trajectory at %llu", joinTime);
+}
+
+/**
+ * @brief Pre-positions the motors to the trajectory position at `startTime` and arms the tracking start.
+ * 
+ * Points older than `startTime` are dropped. The tracking itself is started by `startArmedTracking` from the motor loop,
+ * so the start isn't delayed by the update period.
+ * 
+ * @param startTime Mount time when the tracking should start
+ */
+void armTracking(uint64_t startTime) {
+    TrackPoint nextTrackPoint;
+    // The start time is converted first, a failure mustn't lose the pulled point
+    if (!mount_timeToEspTime(startTime, &armedStartEspTime) || !pullTrackPoint(&currentTrackPoint)) {
+        DLOGW(TAG, "Requested tracking start at %llu, but no tracking point found", startTime);
         motor_stop(m1, false);
         motor_stop(m2, false);
         tracking = false;
+        trackingArmed = false;
+        interceptSearch = false;
+        return;
     }
-    else {
-        motor_goto(m1, currentTrackPoint.ax1);
-        motor_goto(m2, currentTrackPoint.ax2);
-        tracking = true;
+
+    uint64_t trackStartTime = startTime - trackTimeShift;
+    while (mount_peekTrackPoint(0, &nextTrackPoint) && nextTrackPoint.time <= trackStartTime)
+        pullTrackPoint(&currentTrackPoint);
+
+    if (currentTrackPoint.time < trackStartTime && mount_peekTrackPoint(0, &nextTrackPoint)) {
+        // Interpolate the position at the start time, it becomes the start of the first tracked segment
+        float k = (float)(trackStartTime - currentTrackPoint.time) / (nextTrackPoint.time - currentTrackPoint.time);
+        currentTrackPoint.ax1 += (nextTrackPoint.ax1 - currentTrackPoint.ax1) * k;
+        currentTrackPoint.ax2 += (nextTrackPoint.ax2 - currentTrackPoint.ax2) * k;
+        currentTrackPoint.time = trackStartTime;
     }
+
+    motor_goto(m1, currentTrackPoint.ax1);
+    motor_goto(m2, currentTrackPoint.ax2);
+    armedStartTime = trackStartTime;
+    trackingArmed = true;
+    tracking = false;
+    interceptSearch = false;
 }
 
-inline int64_t timeToESPTime(uint64_t time, int64_t currentESPTime, uint64_t currentTime) {
-    return currentESPTime + (time - currentTime) * 1000;
+/**
+ * @brief Starts the armed tracking. Called from the motor loop as soon as `armedStartEspTime` is reached.
+ * 
+ * @param espTime Current ESP timer time
+ */
+void startArmedTracking(int64_t espTime) {
+    trackingArmed = false;
+    tracking = true;
 
+    if (currentTrackPoint.time > armedStartTime) {
+        // The trajectory starts after the requested time, hold the position until its first point
+        int64_t trackEspTime;
+        trackTimeToEspTime(currentTrackPoint.time, &trackEspTime);
+        motor_track(m1, motor_getTrackPos(m1, espTime), currentTrackPoint.ax1, espTime, trackEspTime);
+        motor_track(m2, motor_getTrackPos(m2, espTime), currentTrackPoint.ax2, espTime, trackEspTime);
+        return;
+    }
+
+    TrackPoint newTrackPoint;
+    int64_t newTrackEspTime;
+    if (!pullTrackPoint(&newTrackPoint) || !trackTimeToEspTime(newTrackPoint.time, &newTrackEspTime)) {
+        tracking = false;
+        return; // Motors are already at the last point
+    }
+
+    motor_track(m1, currentTrackPoint.ax1, newTrackPoint.ax1, espTime, newTrackEspTime);
+    motor_track(m2, currentTrackPoint.ax2, newTrackPoint.ax2, espTime, newTrackEspTime);
+    currentTrackPoint = newTrackPoint;
+}
+
+/**
+ * @brief Retargets the tracking to the first point of a freshly swapped track buffer. Points already in the past are skipped,
+ * the motors continue from their current position.
+ */
+void joinSwappedBuffer(uint64_t time) {
+    int64_t espTime = hal_getTime();
+    TrackPoint newTrackPoint;
+    bool trackPointAcquired;
+    do {
+        trackPointAcquired = pullTrackPoint(&newTrackPoint);
+    } while (trackPointAcquired && newTrackPoint.time <= time);
+
+    if (!trackPointAcquired) {
+        DLOGW(TAG, "Swapped to a track buffer without future points");
+        motor_stop(m1, false);
+        motor_stop(m2, false);
+        tracking = false;
+        return;
+    }
+
+    int64_t newTrackEspTime;
+    trackTimeToEspTime(newTrackPoint.time, &newTrackEspTime);
+    motor_track(m1, motor_getTrackPos(m1, espTime), newTrackPoint.ax1, espTime, newTrackEspTime);
+    motor_track(m2, motor_getTrackPos(m2, espTime), newTrackPoint.ax2, espTime, newTrackEspTime);
+    currentTrackPoint = newTrackPoint;
+}
+
+/**
+ * @brief Clears the guiding offsets and the time shift. They belong to one tracked pass, and mustn't carry over to the next.
+ */
+void clearTrackOffsets() {
+    motor_clearTrackOffsets(m1);
+    motor_clearTrackOffsets(m2);
+    trackTimeShift = 0;
+    mount_setTrackTimeShift(0);
 }
 
 void updateTracking(uint64_t time) {
-    int64_t espTime = esp_timer_get_time();
-    if (currentTrackPoint.time < time) {
+    uint64_t trackTime = time - trackTimeShift;
+    if (currentTrackPoint.time < trackTime) {
         TrackPoint newTrackPoint;
-        bool trackPointAcquired = mount_pullTrackPoint(&newTrackPoint);
+        bool trackPointAcquired = pullTrackPoint(&newTrackPoint);
         if (!trackPointAcquired) {
+            trace_event(TRACE_UNDERRUN, 0, 0, 0, 0, 0);
             motor_goto(m1, currentTrackPoint.ax1);
             motor_goto(m2, currentTrackPoint.ax2);
             tracking = false;
             return;
         }
 
-        int64_t currentTrackEspTime = timeToESPTime(currentTrackPoint.time, espTime, time);
-        int64_t newTrackEspTime = timeToESPTime(newTrackPoint.time, espTime, time);
+        int64_t currentTrackEspTime, newTrackEspTime;
+        trackTimeToEspTime(currentTrackPoint.time, &currentTrackEspTime);
+        trackTimeToEspTime(newTrackPoint.time, &newTrackEspTime);
         motor_track(m1, currentTrackPoint.ax1, newTrackPoint.ax1, currentTrackEspTime, newTrackEspTime);
         motor_track(m2, currentTrackPoint.ax2, newTrackPoint.ax2, currentTrackEspTime, newTrackEspTime);
         currentTrackPoint = newTrackPoint;
     }
 }
 
+/**
+ * @brief Copies the motor and driver parameters of the axis from the persistent configuration to the motor config
+ * and the SPI driver config
+ */
+bool loadAxisConfig(motor_config_t *cfg, tmc2130_config_t *driverCfg) {
+    persist_axis_config_t axisConfig;
+    if (!persist_getAxisConfig(cfg->id, &axisConfig)) {
+        DLOGW(TAG, "Couldn't read configuration of axis %u", cfg->id);
+        return false;
+    }
+    cfg->maxA = axisConfig.maxA;
+    cfg->maxV = axisConfig.maxV;
+    cfg->brakeA = axisConfig.brakeA;
+    cfg->aPosK = axisConfig.aPosK;
+    cfg->gotoMinV = axisConfig.gotoMinV;
+    cfg->minStepI = axisConfig.minStepI;
+    cfg->multHyst = MOTOR_MULT_HYSTERESIS;
+    cfg->multLatency = MOTOR_TSK_UPADTE_P;
+#ifdef MOTOR_MULTIPLIERS
+    cfg->mults = motorMultipliers;
+    cfg->multCount = sizeof(motorMultipliers);
+#endif
+
+    // The driver velocities are in 1/256 microsteps
+    driverCfg->irun = axisConfig.irun;
+    driverCfg->ihold = axisConfig.ihold;
+    driverCfg->stealthV = axisConfig.stealthV * (256 / MOTOR_MICROSTEPS);
+    driverCfg->stallV = axisConfig.stallV * (256 / MOTOR_MICROSTEPS);
+    driverCfg->sgt = MOTOR_TMC_SGT;
+    return true;
+}
+
+void applyAxisConfig(motor_t m) {
+    tmc2130_config_t driverCfg;
+    if (loadAxisConfig(&m->cfg, &driverCfg) && m->cfg.driver != NULL)
+        tmc_configure(m->cfg.driver, &driverCfg);
+}
+
+#ifdef MOTOR_DRIVER_SPI
+/**
+ * @brief Initializes the SPI driver of a motor
+ * 
+ * @return tmc2130_t* The driver, NULL if it doesn't respond (the motor then runs in the standalone mode)
+ */
+tmc2130_t *initDriver(tmc2130_t *driver, int csPin, const tmc2130_config_t *driverCfg) {
+    hal_spi_device_t spi = hal_spiAddDevice(MOTOR_SPI_HOST, csPin, TMC_SPI_CLOCK_HZ, TMC_SPI_MODE);
+    return tmc_init(driver, spi, MOTOR_MICROSTEPS, driverCfg) ? driver : NULL;
+}
+#endif
+
+/**
+ * @brief Interrupt of the fault inputs. Ends a step pulse in progress and latches the fault, the motor loop
+ * stops the motors on its next pass.
+ * 
+ * @param arg MOTOR_FAULT_* bit of the input
+ */
+HAL_ISR_ATTR void faultIsr(void *arg) {
+    hal_gpioClear(stepPins);
+    atomic_fetch_or(&faultFlags, (uint32_t)(uintptr_t)arg);
+}
+
+uint8_t motor_getFault() {
+    return atomic_load(&faultFlags);
+}
+
+uint8_t motor_getFaultInputs() {
+    uint8_t active = 0;
+    if (BOARD_ESTOP_PIN >= 0 && hal_gpioGetLevel(BOARD_ESTOP_PIN) == BOARD_FAULT_ACTIVE_LEVEL)
+        active |= MOTOR_FAULT_ESTOP;
+    if (BOARD_LIMIT_PIN >= 0 && hal_gpioGetLevel(BOARD_LIMIT_PIN) == BOARD_FAULT_ACTIVE_LEVEL)
+        active |= MOTOR_FAULT_LIMIT;
+    return active;
+}
+
+/**
+ * @brief Sets up the fault input interrupts, on the motor core. Inputs already active latch the fault right away.
+ */
+void initFaultInputs() {
+    if (BOARD_ESTOP_PIN >= 0 && !hal_gpioSetInterrupt(BOARD_ESTOP_PIN, BOARD_FAULT_ACTIVE_LEVEL, faultIsr, (void*)MOTOR_FAULT_ESTOP))
+        DLOGE(TAG, "Couldn't set up the emergency stop input");
+    if (BOARD_LIMIT_PIN >= 0 && !hal_gpioSetInterrupt(BOARD_LIMIT_PIN, BOARD_FAULT_ACTIVE_LEVEL, faultIsr, (void*)MOTOR_FAULT_LIMIT))
+        DLOGE(TAG, "Couldn't set up the limit switch input");
+    atomic_fetch_or(&faultFlags, motor_getFaultInputs());
+}
+
+/**
+ * @brief Stops the motors for a newly latched fault, and publishes the fault status without waiting for the update
+ */
+void handleFault(uint32_t fault) {
+    motor_stop(m1, true);
+    motor_stop(m2, true);
+    tracking = false;
+    trackingArmed = false;
+    interceptSearch = false;
+    handledFault = fault;
+    mount_setState(MOUNT_STATUS_FAULT, m1->pos, m2->pos);
+    trace_event(TRACE_FAULT, 0, fault, m1->pos, m2->pos, 0);
+    DLOGE(TAG, "Fault latched (inputs %u), motors stopped", fault);
+}
+
+/**
+ * @brief Clears the latched fault. Inputs still active (or triggered meanwhile) latch it again.
+ */
+void clearFault() {
+    atomic_store(&faultFlags, 0);
+    atomic_fetch_or(&faultFlags, motor_getFaultInputs());
+    handledFault = 0;
+    uint32_t fault = atomic_load(&faultFlags);
+    if (fault == 0)
+        DLOGI(TAG, "Fault cleared");
+    else
+        DLOGW(TAG, "Fault inputs %u still active, fault not cleared", fault);
+}
+
+/**
+ * @brief Returns true for the commands starting a motion, which are ignored while a fault is latched
+ */
+inline bool isMotionCmd(MotorCmdType type) {
+    return type == CMD_GOTO || type == CMD_TRACK_BEGIN || type == CMD_TRACK_BEGIN_AT;
+}
+
 void processQueue(uint64_t time) {
     MotorCmd cmd;
-    if (xQueueReceive(motorCmdQueue, &cmd, 0) == pdPASS) {
-        if (cmd.type == CMD_POSITION_UPDATE) {
+    if (hal_queueReceive(motorCmdQueue, &cmd)) {
+        trace_event(TRACE_COMMAND, 0, cmd.type, cmd.data.pos.ax1, cmd.data.pos.ax2, 0);
+        if (handledFault != 0 && isMotionCmd(cmd.type)) {
+            DLOGW(TAG, "Fault latched, command %i ignored", cmd.type);
+        }
+        else if (cmd.type == CMD_POSITION_UPDATE) {
             m1->pos = cmd.data.pos.ax1;
             m2->pos = cmd.data.pos.ax2;
-            ESP_LOGD(TAG, "Position updated");
+            DLOGD(TAG, "Position updated");
         }
         else if (cmd.type == CMD_GOTO) {
             motor_goto(m1, cmd.data.pos.ax1);
             motor_goto(m2, cmd.data.pos.ax2);
             tracking = false;
+            trackingArmed = false;
+            interceptSearch = false;
         }
         else if (cmd.type == CMD_STOP) {
             motor_stop(m1, cmd.data.instantStop);
             motor_stop(m2, cmd.data.instantStop);
             tracking = false;
+            trackingArmed = false;
+            interceptSearch = false;
         }
         else if (cmd.type == CMD_TRACK_BEGIN) {
-            beginTracking(time);
+            beginTracking();
         }
         else if (cmd.type == CMD_TRACK_STOP) {
             motor_stop(m1, false);
             motor_stop(m2, false);
             tracking = false;
+            trackingArmed = false;
+            interceptSearch = false;
+        }
+        else if (cmd.type == CMD_TRACK_BEGIN_AT) {
+            armTracking(cmd.data.time);
+        }
+        else if (cmd.type == CMD_TRACK_OFFSET) {
+            int64_t espTime = hal_getTime();
+            motor_setTrackPosOffset(m1, cmd.data.pos.ax1, espTime);
+            motor_setTrackPosOffset(m2, cmd.data.pos.ax2, espTime);
+        }
+        else if (cmd.type == CMD_TRACK_RATE_OFFSET) {
+            int64_t espTime = hal_getTime();
+            motor_setTrackRateOffset(m1, cmd.data.rate.r1, espTime);
+            motor_setTrackRateOffset(m2, cmd.data.rate.r2, espTime);
+        }
+        else if (cmd.type == CMD_TRACK_TIME_SHIFT) {
+            int64_t delta = cmd.data.timeShift - trackTimeShift;
+            motor_shiftTrackTime(m1, delta * 1000);
+            motor_shiftTrackTime(m2, delta * 1000);
+            armedStartEspTime += delta * 1000;
+            trackTimeShift = cmd.data.timeShift;
+            mount_setTrackTimeShift(trackTimeShift);
+        }
+        else if (cmd.type == CMD_RESET_STATS) {
+            int64_t espTime = hal_getTime();
+            motor_resetStats(m1, espTime);
+            motor_resetStats(m2, espTime);
+            DLOGD(TAG, "Statistics reset");
+        }
+        else if (cmd.type == CMD_CONFIG_UPDATE) {
+            applyAxisConfig(m1);
+            applyAxisConfig(m2);
+            DLOGD(TAG, "Configuration updated");
+        }
+        else if (cmd.type == CMD_FAULT_CLEAR) {
+            clearFault();
         }
     }
 }
 
+void processJogQueue(int64_t espTime) {
+    JogCmd jog;
+    if (hal_queueReceive(jogQueue, &jog)) {
+        trace_event(TRACE_JOG, 0, jog.v1, jog.v2, 0, 0);
+        if (handledFault != 0)
+            return;
+        motor_setVelocity(m1, jog.v1, espTime + MOTOR_JOG_TIMEOUT);
+        motor_setVelocity(m2, jog.v2, espTime + MOTOR_JOG_TIMEOUT);
+        tracking = false;
+        trackingArmed = false;
+        interceptSearch = false;
+    }
+}
+
 void updateState() {
     MountStatus status;
-    if (tracking)
+    if (handledFault != 0)
+        status = MOUNT_STATUS_FAULT;
+    else if (tracking || interceptSearch)
         status = MOUNT_STATUS_TRACKING;
+    else if (trackingArmed)
+        status = MOUNT_STATUS_ARMED;
     else if (m1->mode == GOTO || m2->mode == GOTO)
         status = MOUNT_STATUS_GOTO;
     else if (m1->mode == BRAKING || m2->mode == BRAKING)
         status = MOUNT_STATUS_BRAKING;
+    else if (m1->mode == VELOCITY || m2->mode == VELOCITY)
+        status = MOUNT_STATUS_VELOCITY;
     else
         status = MOUNT_STATUS_STOPPED;
     
     mount_setState(status, m1->pos, m2->pos);
 }
 
-void motor_task(void *args) {
-    motorCmdQueue = args;
+/**
+ * @brief Copies the motor statistics for motor_getStats. Skipped when the reader holds the mutex, 
+ * the motor loop mustn't wait.
+ */
+void publishStats() {
+    if (hal_mutexTake(statsMtx, 0)) {
+        statsSnapshot[0] = m1->stats;
+        statsSnapshot[1] = m2->stats;
+        hal_mutexGive(statsMtx);
+    }
+}
 
-    TaskHandle_t idleTaskHandle = xTaskGetIdleTaskHandleForCPU(1);
-    esp_task_wdt_delete(idleTaskHandle);
+bool motor_getStats(uint8_t axis, motor_stats_t *stats) {
+    if (axis < 1 || axis > 2 || statsMtx == NULL)
+        return false;
+    if (!hal_mutexTake(statsMtx, MOTOR_STATS_MTX_TIMEOUT))
+        return false;
+    *stats = statsSnapshot[axis - 1];
+    hal_mutexGive(statsMtx);
+    return true;
+}
+
+void motor_taskInit(MotorQueues *queues) {
+    motorCmdQueue = queues->cmdQueue;
+    jogQueue = queues->jogQueue;
 
     motor_config_t m1Cfg = {
+        .id = 1,
         .stepPin = MOTOR_DEC_STEP_PIN,
         .dirPin = MOTOR_DEC_DIR_PIN,
         .cfg1Pin = MOTOR_DEC_CFG1_PIN,
         .cfg2Pin = MOTOR_DEC_CFG2_PIN,
-        .maxA = MOTOR_MAX_A,
-        .maxV = MOTOR_MAX_V,
-        .brakeA = MOTOR_BRAKE_A,
-        .aPosK = MOTOR_A_POS_K,
-        .gotoMinV = MOTOR_GOTO_MIN_V,
-        .minStepI = MOTOR_MIN_STEP_I_MICROS
     };
-    m1 = motor_create(m1Cfg);
+    tmc2130_config_t d1Cfg;
+    loadAxisConfig(&m1Cfg, &d1Cfg);
 
     motor_config_t m2Cfg = {
+        .id = 2,
         .stepPin = MOTOR_RA_STEP_PIN,
         .dirPin = MOTOR_RA_DIR_PIN,
         .cfg1Pin = MOTOR_RA_CFG1_PIN,
         .cfg2Pin = MOTOR_RA_CFG2_PIN,
-        .maxA = MOTOR_MAX_A,
-        .maxV = MOTOR_MAX_V,
-        .brakeA = MOTOR_BRAKE_A,
-        .aPosK = MOTOR_A_POS_K,
-        .gotoMinV = MOTOR_GOTO_MIN_V,
-        .minStepI = MOTOR_MIN_STEP_I_MICROS
     };
-    m2 = motor_create(m2Cfg);
-
-    ESP_LOGI(TAG, "Motor task started");
-    int64_t tLastUpdate = esp_timer_get_time();
-    
+    tmc2130_config_t d2Cfg;
+    loadAxisConfig(&m2Cfg, &d2Cfg);
 
-#ifdef MEASURE_CYCLE_T
-    int64_t maxExecT = 0;
+#ifdef MOTOR_DRIVER_SPI
+    if (hal_spiInit(MOTOR_SPI_HOST, MOTOR_SPI_SCK_PIN, MOTOR_SPI_MOSI_PIN, MOTOR_SPI_MISO_PIN)) {
+        m1Cfg.driver = initDriver(&tmcDrivers[0], MOTOR_DEC_CS_PIN, &d1Cfg);
+        m2Cfg.driver = initDriver(&tmcDrivers[1], MOTOR_RA_CS_PIN, &d2Cfg);
+    }
+    else {
+        DLOGE(TAG, "Couldn't initialize the driver SPI bus");
+    }
 #endif
-    for(;;) {
+    m1 = motor_create(&motors[0], m1Cfg);
+    m2 = motor_create(&motors[1], m2Cfg);
+    mount_getPos(&m1->pos, &m2->pos);
+    stepPins = m1->stepMask | m2->stepMask;
+    initFaultInputs();
+
+    tLastUpdate = hal_getTime();
+    tLastJogPoll = tLastUpdate;
+    statsMtx = hal_mutexCreateStatic(&statsMtxBuffer);
+}
+
+void motor_taskRun() {
 #ifdef MEASURE_CYCLE_T
-        int64_t t1 = esp_timer_get_time();
+    int64_t t1 = hal_getTime();
 #endif
-        motor_run(m1);
-        motor_run(m2);
-        int64_t t2 = esp_timer_get_time();
+    // The step output stays frozen while a fault is latched
+    uint32_t fault = atomic_load(&faultFlags);
+    if (fault != handledFault && fault != 0)
+        handleFault(fault);
+    if (fault == 0)
+        motor_runAxes(m1, m2);
+    int64_t t2 = hal_getTime();
 #ifdef MEASURE_CYCLE_T
-        if (maxExecT < t2 - t1)
-            maxExecT = t2 - t1;
+    if (maxExecT < t2 - t1)
+        maxExecT = t2 - t1;
 #endif
-        if (t2 > tLastUpdate + MOTOR_TSK_UPADTE_P) {
-            #ifdef MEASURE_CYCLE_T
-                int64_t update_t1 = esp_timer_get_time();
-            #endif
-            tLastUpdate = t2;
-            uint64_t time;
-            mount_getTime(&time);
-            mount_setPos(m1->pos, m2->pos);
-            processQueue(time);
-
-            if (tracking) {
-                updateTracking(time);
-            }
-            updateState();
+    if (trackingArmed && t2 >= armedStartEspTime) {
+        startArmedTracking(t2);
+    }
+    if (t2 > tLastJogPoll + MOTOR_JOG_POLL_P) {
+        tLastJogPoll = t2;
+        processJogQueue(t2);
+    }
+    if (t2 > tLastUpdate + MOTOR_TSK_UPADTE_P) {
+        #ifdef MEASURE_CYCLE_T
+            int64_t update_t1 = hal_getTime();
+        #endif
+        tLastUpdate = t2;
+        uint64_t time;
+        mount_getTime(&time);
+        mount_setPos(m1->pos, m2->pos);
+        processQueue(time);
+
+        // The timed buffer swap happens even when not tracking, so the next start uses the new buffer
+        if (mount_updateTrackBufferSwap(time)) {
+            // The swapped buffer is a new pass. An armed start keeps them, it was positioned with them.
+            if (!trackingArmed)
+                clearTrackOffsets();
+            if (tracking)
+                joinSwappedBuffer(time);
+            else if (interceptSearch)
+                beginTracking(); // The search starts over in the new buffer
+        }
+        else if (tracking) {
+            updateTracking(time);
+        }
+        else if (interceptSearch) {
+            continueIntercept(time - trackTimeShift);
+        }
+        if (trackingActive && !tracking && !trackingArmed && !interceptSearch)
+            clearTrackOffsets();
+        trackingActive = tracking || trackingArmed || interceptSearch;
+        motor_applyMultiplier(m1);
+        motor_applyMultiplier(m2);
+        motor_checkDriver(m1);
+        motor_checkDriver(m2);
+        updateState();
+        publishStats();
 #ifdef MEASURE_CYCLE_T
-            int64_t update_t2 = esp_timer_get_time();
-            uint64_t posOffset = motor_getPosOffset(m1, t2);
-            ESP_LOGD(TAG, "M max exec t: %lli micros, update t: %lli micros, posOffset: %lli, mode: %i, v: %f, p: %lli, tpos: %lli", 
-                maxExecT, update_t2 - update_t1, posOffset, m1->mode, m1->v, m1->pos, m1->tPos);
-            maxExecT = 0;
+        int64_t update_t2 = hal_getTime();
+        uint64_t posOffset = motor_getPosOffset(m1, t2);
+        ESP_LOGD(TAG, "M max exec t: %lli micros, update t: %lli micros, posOffset: %lli, mode: %i, v: %f, p: %lli, tpos: %lli", 
+            maxExecT, update_t2 - update_t1, posOffset, m1->mode, m1->v, m1->pos, m1->tPos);
+        maxExecT = 0;
 #endif
-        }
+    }
+}
+
+motor_t motor_getAxis(uint8_t axis) {
+    return axis == 1 ? m1 : m2;
+}
+
+void motor_task(void *args) {
+    hal_disableIdleWatchdog(1);
+    motor_taskInit(args);
+    DLOGI(TAG, "Motor task started");
+
+    for(;;) {
+        motor_taskRun();
     }
 
     motor_destroy(m1);
-}
\ No newline at end of file
+}
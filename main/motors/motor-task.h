@@ -1,33 +1,102 @@
 #ifndef __MOTOR_TASK
 #define __MOTOR_TASK
 
-#include <driver/gpio.h>
-#include <freertos/FreeRTOS.h>
-#include <freertos/queue.h>
 #include "../config.h"
-#define MOTOR_DEC_STEP_PIN GPIO_NUM_21
-#define MOTOR_DEC_DIR_PIN GPIO_NUM_19
-#define MOTOR_DEC_CFG1_PIN GPIO_NUM_23
-#define MOTOR_DEC_CFG2_PIN GPIO_NUM_22
+#include "../hal/hal.h"
+#include "motor-driver.h"
 #define MOTOR_MIN_STEP_I_MICROS 350
 #define MOTOR_MAX_V 16000.0f
 #define MOTOR_MAX_A 2500.0f
 #define MOTOR_A_POS_K 50.0f
 #define MOTOR_BRAKE_A 2500
 #define MOTOR_GOTO_MIN_V 100.0f
+/**
+ * @brief Hysteresis of the switches to a lower multiplier, as a part of MOTOR_MIN_STEP_I_MICROS
+ */
+#define MOTOR_MULT_HYSTERESIS 0.25f
+/**
+ * @brief Define to override the multiplier table of the driver mode (see motor_config_t)
+ */
+//#define MOTOR_MULTIPLIERS { 1, 4, 16 }
 #define MOTOR_TSK_UPADTE_P 30000
+/**
+ * @brief Part of maxA used for planning the trajectory intercept, the rest is left for tracking corrections
+ */
+#define MOTOR_INTERCEPT_A_K 0.8f
+/**
+ * @brief Maximum number of track points searched for the trajectory intercept
+ */
+#define MOTOR_INTERCEPT_LOOKAHEAD 600
+/**
+ * @brief Number of track segments searched for the intercept per axis in one update, bounds the time the search takes
+ * from the step output. The whole lookahead is searched in MOTOR_INTERCEPT_LOOKAHEAD / MOTOR_INTERCEPT_SCAN_CHUNK updates.
+ */
+#define MOTOR_INTERCEPT_SCAN_CHUNK 50
+/**
+ * @brief Time (in microseconds) after the last velocity command, after which the motors ramp down to zero
+ */
+#define MOTOR_JOG_TIMEOUT 250000
+/**
+ * @brief Period (in microseconds) of checking for new velocity commands
+ */
+#define MOTOR_JOG_POLL_P 1000
+/**
+ * @brief Maximum waiting time (in milliseconds) for the statistics mutex in motor_getStats
+ */
+#define MOTOR_STATS_MTX_TIMEOUT 100
 
-#define MOTOR_RA_STEP_PIN GPIO_NUM_2
-#define MOTOR_RA_DIR_PIN GPIO_NUM_32
-#define MOTOR_RA_CFG1_PIN GPIO_NUM_18
-#define MOTOR_RA_CFG2_PIN GPIO_NUM_33
+/**
+ * @brief Fault input bits, see motor_getFault
+ */
+#define MOTOR_FAULT_ESTOP 1
+#define MOTOR_FAULT_LIMIT 2
+/**
+ * @brief Specified worst-case latency (in microseconds) from the fault input edge to the frozen step output. On ESP32 
+ * it is the interrupt latency (IRAM handler, a few microseconds) plus one motor loop pass. A step pulse already being 
+ * issued when the interrupt comes is cut short, at most one more step per axis can follow in the same pass.
+ * Measured in the simulation by host/bench/estop-bench.c.
+ */
+#define MOTOR_FAULT_MAX_LATENCY 50
+/**
+ * @brief Default driver currents (SPI mode), in 1/32 of the current set by the sense resistors
+ */
+#define MOTOR_TMC_IRUN 20
+#define MOTOR_TMC_IHOLD 10
+/**
+ * @brief Default velocity (steps per second) up to which the driver uses the quiet stealthChop (SPI mode).
+ * Tracking stays below it, gotos run in spreadCycle.
+ */
+#define MOTOR_TMC_STEALTH_V 2000.0f
+/**
+ * @brief Default velocity (steps per second) from which StallGuard detects stalls (SPI mode). It works 
+ * in spreadCycle only, so it must be above MOTOR_TMC_STEALTH_V.
+ */
+#define MOTOR_TMC_STALL_V 4000.0f
+#define MOTOR_TMC_SGT 8
 
 typedef enum MotorCmdType {
     CMD_POSITION_UPDATE,
     CMD_GOTO,
     CMD_STOP,
     CMD_TRACK_BEGIN,
-    CMD_TRACK_STOP
+    CMD_TRACK_STOP,
+    CMD_TRACK_BEGIN_AT,
+    /**
+     * @brief The offsets and the time shift apply to the current pass. They can be set before the tracking starts,
+     * and are cleared when it ends or the track buffers are swapped.
+     */
+    CMD_TRACK_OFFSET,
+    CMD_TRACK_RATE_OFFSET,
+    CMD_TRACK_TIME_SHIFT,
+    CMD_RESET_STATS,
+    /**
+     * @brief Reloads the motor parameters from the persistent configuration (persist_getAxisConfig)
+     */
+    CMD_CONFIG_UPDATE,
+    /**
+     * @brief Clears the latched fault, unless a fault input is still active
+     */
+    CMD_FAULT_CLEAR
 } MotorCmdType;
 
 typedef struct MotorPosData {
@@ -35,15 +104,115 @@ typedef struct MotorPosData {
     step_t ax2;
 } MotorPosData;
 
+/**
+ * @brief Rate offsets of the axes (steps per second)
+ * 
+ */
+typedef struct MotorRateData {
+    float r1;
+    float r2;
+} MotorRateData;
+
 typedef union MotorCmdData {
+    /**
+     * @brief Positions, used by CMD_POSITION_UPDATE, CMD_GOTO and CMD_TRACK_OFFSET (offsets)
+     */
     MotorPosData pos;
+    MotorRateData rate;
+    /**
+     * @brief Trajectory time shift (in milliseconds), used by CMD_TRACK_TIME_SHIFT
+     */
+    int64_t timeShift;
     bool instantStop;
+    /**
+     * @brief Mount time (in milliseconds), used by CMD_TRACK_BEGIN_AT
+     */
+    uint64_t time;
 } MotorCmdData;
 typedef struct MotorCmd {
     MotorCmdType type;
     MotorCmdData data;
 } MotorCmd; 
 
+/**
+ * @brief Velocity command. Sent through the jog queue, which holds only the latest command (see xQueueOverwrite),
+ * so it can be updated at high rate without going through the command queue.
+ * 
+ */
+typedef struct JogCmd {
+    /**
+     * @brief Target velocities of the axes, in steps per second
+     * 
+     */
+    float v1;
+    float v2;
+} JogCmd;
+
+/**
+ * @brief Queues connecting the comm task with the motor task. Passed to both tasks as the argument.
+ * 
+ */
+typedef struct MotorQueues {
+    /**
+     * @brief Queue of MotorCmd
+     * 
+     */
+    hal_queue_t cmdQueue;
+    /**
+     * @brief Queue of JogCmd with length 1
+     * 
+     */
+    hal_queue_t jogQueue;
+} MotorQueues;
+
+/**
+ * @brief Creates the motors, with the parameters from the persistent configuration and the position
+ * restored by persist_init. Called at the start of motor_task.
+ * 
+ * @param queues Queues the motor task receives commands from
+ */
+void motor_taskInit(MotorQueues *queues);
+/**
+ * @brief Runs one iteration of the motor loop - runs the motors and, once per MOTOR_TSK_UPADTE_P, 
+ * processes commands and updates the tracking.
+ * 
+ */
+void motor_taskRun();
+/**
+ * @brief Returns the motor of the axis, for diagnostics. Only valid after motor_taskInit.
+ * 
+ * @param axis Axis number (1 or 2)
+ * @return motor_t Motor
+ */
+motor_t motor_getAxis(uint8_t axis);
+/**
+ * @brief Copies the latest statistics of the axis motor. The statistics are published by the motor task 
+ * once per MOTOR_TSK_UPADTE_P, so they may be that old.
+ * 
+ * @param axis Axis number (1 or 2)
+ * @param stats The statistics are written here
+ * @return true Success
+ * @return false Invalid axis, or the statistics mutex couldn't be acquired
+ */
+bool motor_getStats(uint8_t axis, motor_stats_t *stats);
+/**
+ * @brief Returns the latched fault. The fault is latched by the interrupt of the emergency stop and limit switch inputs 
+ * (BOARD_ESTOP_PIN, BOARD_LIMIT_PIN), which also cuts the step output. The motor task then stops the motors instantly,
+ * and ignores motion commands until the fault is cleared. Can be called from any task.
+ * 
+ * @return uint8_t MOTOR_FAULT_* bits of the inputs that triggered, 0 if there is no fault
+ */
+uint8_t motor_getFault();
+/**
+ * @brief Reads the fault inputs, returns the MOTOR_FAULT_* bits of the active ones
+ * 
+ */
+uint8_t motor_getFaultInputs();
+/**
+ * @brief Motor task. Runs motor_taskRun in an endless loop, should have a core for itself.
+ * 
+ * @param args Pointer to MotorQueues
+ */
 void motor_task(void* args);
 
 #endif
\ No newline at end of file
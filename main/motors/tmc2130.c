@@ -0,0 +1,112 @@
+#include "tmc2130.h"
+#include "../log/dlog.h"
+
+#define TAG "tmc2130"
+#define TMC_WRITE 0x80
+#define TMC_TSTEP_MAX 0xfffff
+
+#define TMC_GCONF_EN_PWM_MODE (1 << 2)
+/**
+ * @brief CHOPCONF without the resolution: spreadCycle, toff 3, hstrt 4, hend 1, tbl 2, step interpolation to 256 microsteps
+ */
+#define TMC_CHOPCONF_BASE 0x100100c3
+#define TMC_CHOPCONF_MRES_SHIFT 24
+#define TMC_CHOPCONF_MRES_MASK (0xf << TMC_CHOPCONF_MRES_SHIFT)
+/**
+ * @brief PWMCONF with automatic current scaling: pwm_ampl 200, pwm_grad 1, pwm_freq 2/683 fCLK
+ */
+#define TMC_PWMCONF 0x000401c8
+#define TMC_IHOLDDELAY 6
+#define TMC_TPOWERDOWN 10
+
+bool sendDatagram(tmc2130_t *tmc, uint8_t addr, uint32_t value, uint32_t *reply) {
+    uint8_t tx[5] = { addr, value >> 24, value >> 16, value >> 8, value };
+    uint8_t rx[5];
+    if (!hal_spiTransfer(tmc->spi, tx, rx, sizeof(tx)))
+        return false;
+    tmc->spiStatus = rx[0];
+    if (reply != NULL)
+        *reply = (uint32_t)rx[1] << 24 | (uint32_t)rx[2] << 16 | (uint32_t)rx[3] << 8 | rx[4];
+    return true;
+}
+
+bool tmc_writeRegister(tmc2130_t *tmc, uint8_t addr, uint32_t value) {
+    return sendDatagram(tmc, addr | TMC_WRITE, value, NULL);
+}
+
+bool tmc_readRegister(tmc2130_t *tmc, uint8_t addr, uint32_t *value) {
+    // The reply carries the register requested by the previous datagram
+    return sendDatagram(tmc, addr, 0, NULL) && sendDatagram(tmc, addr, 0, value);
+}
+
+/**
+ * @brief Converts velocity (1/256 microsteps per second) to TSTEP, the time between 1/256 microsteps in clock cycles
+ */
+inline uint32_t velocityToTstep(float v) {
+    if (v <= TMC_CLOCK_HZ / (float)TMC_TSTEP_MAX)
+        return TMC_TSTEP_MAX;
+    return TMC_CLOCK_HZ / v;
+}
+
+bool tmc_init(tmc2130_t *tmc, hal_spi_device_t spi, uint16_t microsteps, const tmc2130_config_t *config) {
+    tmc->spi = spi;
+    tmc->chopconf = TMC_CHOPCONF_BASE;
+
+    uint32_t ioin;
+    if (spi == NULL || !tmc_readRegister(tmc, TMC_REG_IOIN, &ioin) || ioin >> 24 != TMC_VERSION) {
+        DLOGE(TAG, "TMC2130 not responding");
+        return false;
+    }
+
+    bool success = tmc_writeRegister(tmc, TMC_REG_GSTAT, 0x7); // Clear the reset and error flags
+    success &= tmc_writeRegister(tmc, TMC_REG_TPOWERDOWN, TMC_TPOWERDOWN);
+    success &= tmc_writeRegister(tmc, TMC_REG_PWMCONF, TMC_PWMCONF);
+    success &= tmc_setMicrosteps(tmc, microsteps);
+    success &= tmc_configure(tmc, config);
+    return success;
+}
+
+bool tmc_configure(tmc2130_t *tmc, const tmc2130_config_t *config) {
+    uint32_t iholdIrun = (config->ihold & 0x1f) | (config->irun & 0x1f) << 8 | TMC_IHOLDDELAY << 16;
+    uint32_t coolconf = ((uint32_t)config->sgt & 0x7f) << 16;
+
+    bool success = tmc_writeRegister(tmc, TMC_REG_IHOLD_IRUN, iholdIrun);
+    success &= tmc_writeRegister(tmc, TMC_REG_COOLCONF, coolconf);
+    // TCOOLTHRS 0 keeps StallGuard off at all velocities
+    success &= tmc_writeRegister(tmc, TMC_REG_TCOOLTHRS, config->stallV > 0.0f ? velocityToTstep(config->stallV) : 0);
+    if (config->stealthV > 0.0f) {
+        success &= tmc_writeRegister(tmc, TMC_REG_TPWMTHRS, velocityToTstep(config->stealthV));
+        success &= tmc_writeRegister(tmc, TMC_REG_GCONF, TMC_GCONF_EN_PWM_MODE);
+    }
+    else {
+        success &= tmc_writeRegister(tmc, TMC_REG_GCONF, 0);
+    }
+    return success;
+}
+
+bool tmc_setMicrosteps(tmc2130_t *tmc, uint16_t microsteps) {
+    // MRES 0 is 256 microsteps, each next value halves the resolution, 8 is full step
+    uint32_t mres = 8;
+    while (mres > 0 && microsteps > 1) {
+        microsteps >>= 1;
+        mres--;
+    }
+    tmc->chopconf = (tmc->chopconf & ~TMC_CHOPCONF_MRES_MASK) | mres << TMC_CHOPCONF_MRES_SHIFT;
+    return tmc_writeRegister(tmc, TMC_REG_CHOPCONF, tmc->chopconf);
+}
+
+bool tmc_readStatus(tmc2130_t *tmc, tmc2130_status_t *status) {
+    uint32_t drvStatus;
+    if (!tmc_readRegister(tmc, TMC_REG_DRV_STATUS, &drvStatus))
+        return false;
+
+    status->sgResult = drvStatus & 0x3ff;
+    status->csActual = (drvStatus >> 16) & 0x1f;
+    status->stall = drvStatus & (1 << 24);
+    status->overtemp = drvStatus & (1 << 25);
+    status->overtempWarning = drvStatus & (1 << 26);
+    status->shortToGround = drvStatus & (3 << 27);
+    status->openLoad = drvStatus & (3 << 29);
+    status->standstill = drvStatus & (1u << 31);
+    return true;
+}
@@ -0,0 +1,143 @@
+#ifndef __MOTOR_TMC2130
+#define __MOTOR_TMC2130
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../hal/hal.h"
+
+/**
+ * @brief TMC2130 configuration over SPI. With the driver in SPI mode (the CFG pins are the SPI bus then),
+ * the microstep resolution, currents and chopper thresholds are set by register writes, and the StallGuard
+ * and error flags can be read back.
+ *
+ * The step input is always interpolated to 256 microsteps (CHOPCONF.intpol), whatever the resolution is.
+ */
+
+#define TMC_SPI_CLOCK_HZ 2000000
+#define TMC_SPI_MODE 3
+/**
+ * @brief Internal clock of the driver (typical value), TSTEP and the thresholds are counted in its cycles
+ */
+#define TMC_CLOCK_HZ 12000000
+#define TMC_VERSION 0x11
+
+#define TMC_REG_GCONF 0x00
+#define TMC_REG_GSTAT 0x01
+#define TMC_REG_IOIN 0x04
+#define TMC_REG_IHOLD_IRUN 0x10
+#define TMC_REG_TPOWERDOWN 0x11
+#define TMC_REG_TPWMTHRS 0x13
+#define TMC_REG_TCOOLTHRS 0x14
+#define TMC_REG_CHOPCONF 0x6c
+#define TMC_REG_COOLCONF 0x6d
+#define TMC_REG_DRV_STATUS 0x6f
+#define TMC_REG_PWMCONF 0x70
+
+/**
+ * @brief Driver configuration, applied by tmc_configure
+ *
+ */
+typedef struct Tmc2130Config {
+    /**
+     * @brief Run current (0-31, in 1/32 of the current set by the sense resistors)
+     *
+     */
+    uint8_t irun;
+    /**
+     * @brief Standstill current (0-31)
+     *
+     */
+    uint8_t ihold;
+    /**
+     * @brief Velocity (in 1/256 microsteps per second) up to which the quiet stealthChop is used, spreadCycle above it.
+     * 0 disables stealthChop.
+     *
+     */
+    float stealthV;
+    /**
+     * @brief Velocity (in 1/256 microsteps per second) from which StallGuard reports stalls. StallGuard doesn't work
+     * in stealthChop, so it should be above `stealthV`. 0 disables StallGuard.
+     *
+     */
+    float stallV;
+    /**
+     * @brief StallGuard threshold (-64 to 63), higher values are less sensitive
+     *
+     */
+    int8_t sgt;
+} tmc2130_config_t;
+
+/**
+ * @brief DRV_STATUS flags
+ *
+ */
+typedef struct Tmc2130Status {
+    /**
+     * @brief StallGuard load measurement, lower means higher load (0 at stall)
+     *
+     */
+    uint16_t sgResult;
+    /**
+     * @brief Actual current scale (0-31)
+     *
+     */
+    uint8_t csActual;
+    bool stall;
+    bool overtemp;
+    bool overtempWarning;
+    /**
+     * @brief Short to ground on a coil
+     *
+     */
+    bool shortToGround;
+    bool openLoad;
+    bool standstill;
+} tmc2130_status_t;
+
+typedef struct Tmc2130 {
+    hal_spi_device_t spi;
+    /**
+     * @brief Last written CHOPCONF, the resolution changes keep the rest of it
+     *
+     */
+    uint32_t chopconf;
+    /**
+     * @brief Status byte of the last SPI datagram
+     *
+     */
+    uint8_t spiStatus;
+} tmc2130_t;
+
+/**
+ * @brief Initializes the driver and checks it responds
+ *
+ * @param tmc Driver storage, must live as long as the driver (use a static variable)
+ * @param spi SPI device of the driver (hal_spiAddDevice with TMC_SPI_CLOCK_HZ and TMC_SPI_MODE)
+ * @param microsteps Initial microstep resolution
+ * @param config Configuration
+ * @return true Driver found and configured
+ * @return false The driver didn't report TMC_VERSION
+ */
+bool tmc_init(tmc2130_t *tmc, hal_spi_device_t spi, uint16_t microsteps, const tmc2130_config_t *config);
+/**
+ * @brief Sets currents, chopper mode thresholds and StallGuard threshold
+ *
+ */
+bool tmc_configure(tmc2130_t *tmc, const tmc2130_config_t *config);
+/**
+ * @brief Sets the microstep resolution. Takes one SPI datagram, so it can be called from the motor loop.
+ *
+ * @param microsteps Microsteps per full step, a power of two from 1 to 256
+ */
+bool tmc_setMicrosteps(tmc2130_t *tmc, uint16_t microsteps);
+/**
+ * @brief Reads DRV_STATUS (two SPI datagrams)
+ *
+ * @return true Success
+ * @return false SPI transfer failed
+ */
+bool tmc_readStatus(tmc2130_t *tmc, tmc2130_status_t *status);
+bool tmc_writeRegister(tmc2130_t *tmc, uint8_t addr, uint32_t value);
+bool tmc_readRegister(tmc2130_t *tmc, uint8_t addr, uint32_t *value);
+
+#endif
@@ -0,0 +1,303 @@
+#include "persist.h"
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include "../hal/hal.h"
+#include "../log/dlog.h"
+#include "../motors/motor-task.h"
+
+#define TAG "persist"
+#define PERSIST_CHECKPOINT_MAGIC 0x4b504843 // "CHPK"
+/**
+ * @brief Minimum of the float parameters that must be positive
+ */
+#define PARAM_POSITIVE FLT_MIN
+/**
+ * @brief Maximum of cpr, a full revolution of steps stays within the 32-bit positions of the track store
+ */
+#define PARAM_MAX_CPR 1073741824.0
+/**
+ * @brief Maximum of minStepI (microseconds)
+ */
+#define PARAM_MAX_STEP_I 1000000.0
+/**
+ * @brief Maximum velocity (steps per second) and acceleration (steps per second squared), well above what the step 
+ * output can do
+ */
+#define PARAM_MAX_V 200000.0
+#define PARAM_MAX_A 1000000.0
+
+typedef struct PersistConfig {
+    uint32_t version;
+    persist_axis_config_t axes[2];
+} PersistConfig;
+
+/**
+ * @brief Checkpoint with the integrity check, as kept in the RTC memory and in the storage
+ *
+ */
+typedef struct StoredCheckpoint {
+    uint32_t magic;
+    persist_checkpoint_t checkpoint;
+    uint32_t checksum;
+} StoredCheckpoint;
+
+typedef enum ParamType {
+    PARAM_STEP,
+    PARAM_FLOAT,
+    PARAM_INT32
+} ParamType;
+
+typedef struct ParamDef {
+    const char *name;
+    size_t offset;
+    ParamType type;
+    /**
+     * @brief Minimum value
+     */
+    double min;
+    /**
+     * @brief Maximum value
+     */
+    double max;
+} ParamDef;
+
+/**
+ * @brief The driver velocities can be 0, it turns the stealthChop and StallGuard thresholds off
+ */
+const ParamDef persistParams[] = {
+    { "cpr", offsetof(persist_axis_config_t, cpr), PARAM_STEP, 1, PARAM_MAX_CPR },
+    { "maxV", offsetof(persist_axis_config_t, maxV), PARAM_FLOAT, PARAM_POSITIVE, PARAM_MAX_V },
+    { "maxA", offsetof(persist_axis_config_t, maxA), PARAM_FLOAT, PARAM_POSITIVE, PARAM_MAX_A },
+    { "brakeA", offsetof(persist_axis_config_t, brakeA), PARAM_FLOAT, PARAM_POSITIVE, PARAM_MAX_A },
+    { "aPosK", offsetof(persist_axis_config_t, aPosK), PARAM_FLOAT, PARAM_POSITIVE, FLT_MAX },
+    { "gotoMinV", offsetof(persist_axis_config_t, gotoMinV), PARAM_FLOAT, PARAM_POSITIVE, PARAM_MAX_V },
+    { "minStepI", offsetof(persist_axis_config_t, minStepI), PARAM_INT32, 1, PARAM_MAX_STEP_I },
+    { "irun", offsetof(persist_axis_config_t, irun), PARAM_INT32, 1, 31 },
+    { "ihold", offsetof(persist_axis_config_t, ihold), PARAM_INT32, 1, 31 },
+    { "stealthV", offsetof(persist_axis_config_t, stealthV), PARAM_FLOAT, 0, PARAM_MAX_V },
+    { "stallV", offsetof(persist_axis_config_t, stallV), PARAM_FLOAT, 0, PARAM_MAX_V }
+};
+
+/**
+ * @brief Current configuration, protected by `configMtx`. Holds the defaults until persist_init loads the stored one.
+ */
+PersistConfig persistConfig = {
+    .version = PERSIST_CONFIG_VERSION,
+    .axes = {
+        { CPR_AX1, MOTOR_MAX_V, MOTOR_MAX_A, MOTOR_BRAKE_A, MOTOR_A_POS_K, MOTOR_GOTO_MIN_V, MOTOR_MIN_STEP_I_MICROS,
+            MOTOR_TMC_IRUN, MOTOR_TMC_IHOLD, MOTOR_TMC_STEALTH_V, MOTOR_TMC_STALL_V },
+        { CPR_AX2, MOTOR_MAX_V, MOTOR_MAX_A, MOTOR_BRAKE_A, MOTOR_A_POS_K, MOTOR_GOTO_MIN_V, MOTOR_MIN_STEP_I_MICROS,
+            MOTOR_TMC_IRUN, MOTOR_TMC_IHOLD, MOTOR_TMC_STEALTH_V, MOTOR_TMC_STALL_V }
+    }
+};
+hal_mutex_buffer_t configMtxBuffer;
+hal_mutex_t configMtx = NULL;
+bool storageAvailable = false;
+
+/**
+ * @brief Checkpoint kept over resets, not initialized at boot (validated by the magic and the checksum)
+ */
+HAL_NOINIT_ATTR StoredCheckpoint rtcCheckpoint;
+/**
+ * @brief Last checkpoint written to the storage
+ */
+persist_checkpoint_t storedCheckpoint;
+persist_checkpoint_t restoredCheckpoint;
+uint8_t restoredSource = PERSIST_SOURCE_NONE;
+uint8_t storedAddress = 0;
+
+/**
+ * @brief FNV-1a hash of the checkpoint
+ */
+uint32_t checkpointChecksum(const persist_checkpoint_t *checkpoint) {
+    const uint8_t *data = (const uint8_t*)checkpoint;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(persist_checkpoint_t); i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+inline bool checkpointValid(const StoredCheckpoint *stored) {
+    return stored->magic == PERSIST_CHECKPOINT_MAGIC && stored->checksum == checkpointChecksum(&stored->checkpoint);
+}
+
+inline bool checkpointEqual(const persist_checkpoint_t *a, const persist_checkpoint_t *b) {
+    return a->ax1 == b->ax1 && a->ax2 == b->ax2 && a->status == b->status;
+}
+
+void storeCheckpoint(StoredCheckpoint *stored, const persist_checkpoint_t *checkpoint) {
+    stored->magic = PERSIST_CHECKPOINT_MAGIC;
+    stored->checkpoint = *checkpoint;
+    stored->checksum = checkpointChecksum(checkpoint);
+}
+
+/**
+ * @brief Restores the position from the RTC memory checkpoint (kept over all resets except power loss),
+ * or from the storage
+ */
+void restoreCheckpoint() {
+    StoredCheckpoint stored;
+    hal_reset_reason_t resetReason = hal_getResetReason();
+    memset(&restoredCheckpoint, 0, sizeof(restoredCheckpoint));
+
+    if (resetReason != HAL_RESET_POWER_ON && resetReason != HAL_RESET_BROWNOUT && checkpointValid(&rtcCheckpoint)) {
+        restoredCheckpoint = rtcCheckpoint.checkpoint;
+        restoredSource = PERSIST_SOURCE_RTC;
+    }
+    else if (storageAvailable && hal_storageRead(PERSIST_CHECKPOINT_KEY, &stored, sizeof(stored)) && checkpointValid(&stored)) {
+        restoredCheckpoint = stored.checkpoint;
+        restoredSource = PERSIST_SOURCE_STORAGE;
+    }
+    else {
+        restoredSource = PERSIST_SOURCE_NONE;
+        DLOGI(TAG, "No checkpoint to restore (reset reason %i)", resetReason);
+        return;
+    }
+
+    mount_setPos(restoredCheckpoint.ax1, restoredCheckpoint.ax2);
+    storedCheckpoint = restoredCheckpoint;
+    storedCheckpoint.status = MOUNT_STATUS_STOPPED;
+    DLOGI(TAG, "Position restored from %s: %lli %lli (status %i, reset reason %i)",
+        restoredSource == PERSIST_SOURCE_RTC ? "RTC memory" : "storage",
+        restoredCheckpoint.ax1, restoredCheckpoint.ax2, restoredCheckpoint.status, resetReason);
+    if (restoredCheckpoint.status != MOUNT_STATUS_STOPPED)
+        DLOGW(TAG, "The mount was moving when the checkpoint was taken, the position may be off");
+}
+
+inline double paramValue(const persist_axis_config_t *config, const ParamDef *param) {
+    const uint8_t *field = (const uint8_t*)config + param->offset;
+    if (param->type == PARAM_STEP)
+        return *(const step_t*)field;
+    else if (param->type == PARAM_FLOAT)
+        return *(const float*)field;
+    else
+        return *(const int32_t*)field;
+}
+
+/**
+ * @brief Checks the parameters of a stored configuration against the limits, it may come from a version that didn't
+ * check them
+ */
+bool configValid(const PersistConfig *config) {
+    for (size_t axis = 0; axis < 2; axis++) {
+        for (size_t i = 0; i < sizeof(persistParams) / sizeof(ParamDef); i++) {
+            double value = paramValue(&config->axes[axis], &persistParams[i]);
+            if (!isfinite(value) || value < persistParams[i].min || value > persistParams[i].max)
+                return false;
+        }
+    }
+    return true;
+}
+
+bool persist_init() {
+    configMtx = hal_mutexCreateStatic(&configMtxBuffer);
+    storageAvailable = hal_storageInit();
+    if (!storageAvailable)
+        DLOGW(TAG, "Persistent storage not available, using the default configuration");
+
+    PersistConfig stored;
+    if (storageAvailable && hal_storageRead(PERSIST_CONFIG_KEY, &stored, sizeof(stored))) {
+        if (stored.version != PERSIST_CONFIG_VERSION)
+            DLOGW(TAG, "Stored configuration has version %u, using the defaults", stored.version);
+        else if (!configValid(&stored))
+            DLOGW(TAG, "Stored configuration is out of the limits, using the defaults");
+        else
+            persistConfig = stored;
+    }
+
+    if (storageAvailable && !hal_storageRead(PERSIST_ADDRESS_KEY, &storedAddress, sizeof(storedAddress)))
+        storedAddress = 0;
+
+    restoreCheckpoint();
+    return storageAvailable;
+}
+
+bool persist_getAxisConfig(uint8_t axis, persist_axis_config_t *config) {
+    if (axis < 1 || axis > 2)
+        return false;
+    if (configMtx == NULL) {
+        *config = persistConfig.axes[axis - 1];
+        return true;
+    }
+    if (!hal_mutexTake(configMtx, PERSIST_MTX_TIMEOUT))
+        return false;
+    *config = persistConfig.axes[axis - 1];
+    hal_mutexGive(configMtx);
+    return true;
+}
+
+uint8_t persist_setAxisParam(uint8_t axis, const char *name, double value) {
+    if (axis < 1 || axis > 2)
+        return PERSIST_ERR_AXIS;
+
+    const ParamDef *param = NULL;
+    for (size_t i = 0; i < sizeof(persistParams) / sizeof(ParamDef); i++) {
+        if (strcmp(persistParams[i].name, name) == 0)
+            param = &persistParams[i];
+    }
+    if (param == NULL)
+        return PERSIST_ERR_PARAM;
+    if (!isfinite(value) || value < param->min || value > param->max)
+        return PERSIST_ERR_VALUE;
+
+    if (!hal_mutexTake(configMtx, PERSIST_MTX_TIMEOUT))
+        return PERSIST_ERR_STORAGE;
+    uint8_t *field = (uint8_t*)&persistConfig.axes[axis - 1] + param->offset;
+    if (param->type == PARAM_STEP)
+        *(step_t*)field = value;
+    else if (param->type == PARAM_FLOAT)
+        *(float*)field = value;
+    else
+        *(int32_t*)field = value;
+    PersistConfig config = persistConfig;
+    hal_mutexGive(configMtx);
+
+    if (!storageAvailable || !hal_storageWrite(PERSIST_CONFIG_KEY, &config, sizeof(config))) {
+        DLOGW(TAG, "Couldn't store the configuration, %s of axis %u is set until reset", param->name, axis);
+        return PERSIST_ERR_STORAGE;
+    }
+    DLOGI(TAG, "Axis %u: %s set to %f", axis, param->name, value);
+    return PERSIST_OK;
+}
+
+void persist_checkpoint() {
+    persist_checkpoint_t checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint)); // Zeroes the padding, it's covered by the checksum
+    if (!mount_getPos(&checkpoint.ax1, &checkpoint.ax2))
+        return;
+    checkpoint.status = mount_getStatus();
+    storeCheckpoint(&rtcCheckpoint, &checkpoint);
+
+    // Storage writes freeze the step output (flash cache), the moving mount has only the RTC checkpoint
+    bool moving = checkpoint.status != MOUNT_STATUS_STOPPED && checkpoint.status != MOUNT_STATUS_FAULT;
+    if (!storageAvailable || moving || checkpointEqual(&checkpoint, &storedCheckpoint))
+        return;
+
+    StoredCheckpoint stored;
+    storeCheckpoint(&stored, &checkpoint);
+    if (!hal_storageWrite(PERSIST_CHECKPOINT_KEY, &stored, sizeof(stored)))
+        DLOGW(TAG, "Couldn't store the checkpoint");
+    storedCheckpoint = checkpoint;
+}
+
+uint8_t persist_getRestored(persist_checkpoint_t *checkpoint) {
+    *checkpoint = restoredCheckpoint;
+    return restoredSource;
+}
+
+uint8_t persist_getAddress() {
+    return storedAddress;
+}
+
+bool persist_setAddress(uint8_t address) {
+    if (!storageAvailable || !hal_storageWrite(PERSIST_ADDRESS_KEY, &address, sizeof(address))) {
+        DLOGW(TAG, "Couldn't store the address %hhu", address);
+        return false;
+    }
+    storedAddress = address;
+    return true;
+}
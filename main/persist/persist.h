@@ -0,0 +1,151 @@
+#ifndef __MOUNT_PERSIST
+#define __MOUNT_PERSIST
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../config.h"
+#include "../settings.h"
+
+/**
+ * @brief Persistent state - runtime axis configuration and the position checkpoint, kept in the persistent storage
+ * (NVS) over resets.
+ *
+ * The checkpoint (position and status of the mount) is taken by the communication task each cycle. It's kept in the
+ * memory surviving resets (RTC memory on ESP32), which covers watchdog, panic and software resets without any flash
+ * writes. For power loss and brown-outs it's also written to the storage whenever the mount stops, never during
+ * motion - storage writes stall the flash cache of both cores, and with it the step output. A power loss during motion
+ * thus restores the position where the mount last stopped. At boot, the position is restored from the newest available
+ * checkpoint. The motion itself is never resumed, the mount starts stopped.
+ */
+
+#define PERSIST_CONFIG_KEY "config"
+#define PERSIST_CHECKPOINT_KEY "checkpoint"
+#define PERSIST_ADDRESS_KEY "address"
+/**
+ * @brief Version of the stored configuration, stored configuration of other versions is replaced by the defaults
+ */
+#define PERSIST_CONFIG_VERSION 2
+/**
+ * @brief Maximum waiting time (in milliseconds) for the configuration mutex
+ */
+#define PERSIST_MTX_TIMEOUT 100
+/**
+ * @brief Maximum length of a parameter name, including the terminating 0
+ */
+#define PERSIST_NAME_LENGTH 12
+
+#define PERSIST_OK 0
+#define PERSIST_ERR_AXIS 1
+#define PERSIST_ERR_PARAM 2
+#define PERSIST_ERR_VALUE 3
+#define PERSIST_ERR_STORAGE 4
+
+#define PERSIST_SOURCE_NONE 0
+#define PERSIST_SOURCE_RTC 1
+#define PERSIST_SOURCE_STORAGE 2
+
+/**
+ * @brief Runtime configuration of an axis. The defaults are `CPR_AX*` (board.h) and `MOTOR_*` (motor-task.h),
+ * see motor_config_t for the meaning of the motor parameters.
+ *
+ */
+typedef struct PersistAxisConfig {
+    /**
+     * @brief Steps per full rotation
+     *
+     */
+    step_t cpr;
+    float maxV;
+    float maxA;
+    float brakeA;
+    float aPosK;
+    float gotoMinV;
+    int32_t minStepI;
+    /**
+     * @brief Driver run and standstill currents (1-31), SPI driver mode only
+     *
+     */
+    int32_t irun;
+    int32_t ihold;
+    /**
+     * @brief Velocity (steps per second) up to which the driver uses stealthChop, SPI driver mode only
+     *
+     */
+    float stealthV;
+    /**
+     * @brief Velocity (steps per second) from which the driver detects stalls, SPI driver mode only
+     *
+     */
+    float stallV;
+} persist_axis_config_t;
+
+/**
+ * @brief Position checkpoint
+ *
+ */
+typedef struct PersistCheckpoint {
+    step_t ax1;
+    step_t ax2;
+    /**
+     * @brief Mount status when the checkpoint was taken
+     *
+     */
+    MountStatus status;
+} persist_checkpoint_t;
+
+/**
+ * @brief Loads the configuration and restores the position from the last checkpoint. Must be called after
+ * mount_initSettings and before the motor task starts.
+ *
+ * @return true Storage available
+ * @return false Storage not available, the defaults are used and nothing is persisted
+ */
+bool persist_init();
+/**
+ * @brief Returns current configuration of an axis
+ *
+ * @param axis Axis number (1 or 2)
+ * @param config The configuration is written here
+ * @return true Success
+ * @return false Invalid axis, or the mutex couldn't be acquired
+ */
+bool persist_getAxisConfig(uint8_t axis, persist_axis_config_t *config);
+/**
+ * @brief Sets and stores a configuration parameter. The motor task must be told to reload the configuration
+ * (CMD_CONFIG_UPDATE).
+ *
+ * @param axis Axis number (1 or 2)
+ * @param name Parameter name (`cpr`, `maxV`, `maxA`, `brakeA`, `aPosK`, `gotoMinV`, `minStepI`, `irun`, `ihold`,
+ * `stealthV` or `stallV`)
+ * @param value New value, must be finite, positive and within the parameter's maximum (31 for the currents, 200000 
+ * steps per second for the velocities, see persistParams). `stealthV` and `stallV` can be 0, which turns the 
+ * stealthChop and StallGuard thresholds off.
+ * @return uint8_t PERSIST_OK or PERSIST_ERR_* code
+ */
+uint8_t persist_setAxisParam(uint8_t axis, const char *name, double value);
+/**
+ * @brief Takes the position checkpoint. Called periodically by the communication task.
+ *
+ */
+void persist_checkpoint();
+/**
+ * @brief Returns the checkpoint the position was restored from at boot
+ *
+ * @param checkpoint The checkpoint is written here (zeroes if there was none)
+ * @return uint8_t Source of the checkpoint, PERSIST_SOURCE_* constant
+ */
+uint8_t persist_getRestored(persist_checkpoint_t *checkpoint);
+/**
+ * @brief Returns the stored bus address of the device (see comm_getNext), 0 if it has none
+ *
+ */
+uint8_t persist_getAddress();
+/**
+ * @brief Stores the bus address of the device
+ *
+ * @return true Stored
+ * @return false Storage not available or the write failed
+ */
+bool persist_setAddress(uint8_t address);
+
+#endif
@@ -1,33 +1,112 @@
 #include "settings.h"
-#include "freertos/FreeRTOS.h"
-#include <freertos/semphr.h>
-#include <esp_timer.h>
-#include <esp_log.h>
+#include "hal/hal.h"
+#include "log/dlog.h"
+#include "memory-map.h"
 
 #define TAG "settings"
-#define MAX_TIME_SEMAPHORE_DELAY 1000 // ticks
-#define TRACK_BUFFER_SIZE 6000
+#define MAX_TIME_SEMAPHORE_DELAY 1000 // ms
+#define TRACK_BUFFER_SIZE MEM_TRACK_BUFFER_SIZE
+#define TRACK_BUFFER_COUNT MEM_TRACK_BUFFER_COUNT
+#define TRACK_WINDOW_SIZE MEM_TRACK_WINDOW_SIZE
+/**
+ * @brief Maximum number of points moved to the prefetch window by one mount_prefetchTrackPoints call, 
+ * limits the time tbMutex is held
+ */
+#define TRACK_PREFETCH_CHUNK 16
 
-SemaphoreHandle_t timeMutex;
-SemaphoreHandle_t stateMtx;
-SemaphoreHandle_t tbMutex;
+_Static_assert(sizeof(TrackPoint) <= MEM_TRACK_POINT_BYTES, "TrackPoint is larger than the memory map assumes");
+
+/**
+ * @brief Track point as kept in the track store. The positions are stored in 32 bits (mount_pushTrackPoint rejects
+ * points out of the range), so a point takes 16 bytes instead of 24.
+ */
+typedef struct StoredTrackPoint {
+    int32_t ax1;
+    int32_t ax2;
+    uint64_t time;
+} StoredTrackPoint;
+
+_Static_assert(sizeof(StoredTrackPoint) <= MEM_STORED_POINT_BYTES, "StoredTrackPoint is larger than the memory map assumes");
+
+hal_mutex_buffer_t timeMutexBuffer;
+hal_mutex_buffer_t stateMtxBuffer;
+hal_mutex_buffer_t tbMutexBuffer;
+hal_mutex_t timeMutex;
+hal_mutex_t stateMtx;
+hal_mutex_t tbMutex;
 
 struct MountSettings {
     uint64_t timeOffset;
+    int64_t trackTimeShift;
     step_t posAx1;
     step_t posAx2;
     MountStatus status;
 } settings;
 
-TrackPoint trackBuffer[TRACK_BUFFER_SIZE];
-uint32_t tbTailIdx = 0;
-uint32_t tbHeadIdx = 0;
+/**
+ * @brief Ring buffer of track points. There are `TRACK_BUFFER_COUNT` of them, so the next pass can be uploaded
+ * while the current one is being tracked. The points are kept in `trackStore`, possibly in the external RAM,
+ * or the buffer is mapped to a trajectory stored in flash (mount_mapTrackBuffer).
+ * 
+ */
+typedef struct TrackBuffer {
+    StoredTrackPoint *points;
+    /**
+     * @brief Mapped points, read instead of `points`. NULL unless the buffer is mapped.
+     */
+    const TrackPoint *mapped;
+    /**
+     * @brief Added to the times of the mapped points (in milliseconds), rebases a stored trajectory
+     */
+    int64_t mappedTimeShift;
+    /**
+     * @brief Ring size, TRACK_BUFFER_SIZE unless the buffer is mapped
+     */
+    uint32_t size;
+    uint32_t tailIdx;
+    uint32_t headIdx;
+} TrackBuffer;
+
+HAL_EXT_RAM_ATTR StoredTrackPoint trackStore[TRACK_BUFFER_COUNT][TRACK_BUFFER_SIZE];
+TrackBuffer trackBuffers[TRACK_BUFFER_COUNT];
+/**
+ * @brief Prefetch window - the next points of the active buffer, moved to the internal DRAM ahead of the tracking 
+ * by mount_prefetchTrackPoints, so the motor core doesn't have to read the (slow) external RAM. The points in the window 
+ * are already removed from the active buffer.
+ */
+TrackPoint trackWindow[TRACK_WINDOW_SIZE];
+uint32_t twTail = 0;
+uint32_t twCount = 0;
+/**
+ * @brief Number of points pulled directly from the track buffer, because the window was empty
+ */
+uint32_t twMisses = 0;
+/**
+ * @brief Index of the buffer the tracking pulls points from
+ */
+uint8_t tbActive = 0;
+/**
+ * @brief Index of the buffer new points are pushed to. Same as `tbActive` unless the next buffer was prepared.
+ */
+uint8_t tbStaging = 0;
+bool tbSwapPending = false;
+/**
+ * @brief Mount time of the scheduled buffer swap, or MOUNT_TRACK_SWAP_ON_COMPLETION
+ */
+uint64_t tbSwapTime = 0;
 
 void mount_initSettings() {
-    timeMutex = xSemaphoreCreateMutex();
-    stateMtx = xSemaphoreCreateMutex();
-    tbMutex = xSemaphoreCreateMutex();
+    timeMutex = hal_mutexCreateStatic(&timeMutexBuffer);
+    stateMtx = hal_mutexCreateStatic(&stateMtxBuffer);
+    tbMutex = hal_mutexCreateStatic(&tbMutexBuffer);
+    for (int i = 0; i < TRACK_BUFFER_COUNT; i++) {
+        trackBuffers[i].points = trackStore[i];
+        trackBuffers[i].mapped = NULL;
+        trackBuffers[i].mappedTimeShift = 0;
+        trackBuffers[i].size = TRACK_BUFFER_SIZE;
+    }
     settings.timeOffset = 0;
+    settings.trackTimeShift = 0;
     settings.posAx1 = 0;
     settings.posAx2 = 0;
 }
@@ -35,43 +114,83 @@ void mount_initSettings() {
 bool mount_getTime(uint64_t *time) {
     uint64_t localTimeOffset;
 
-    if (xSemaphoreTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY) == pdTRUE) {
+    if (hal_mutexTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY)) {
         localTimeOffset = settings.timeOffset;
-        xSemaphoreGive(timeMutex);
+        hal_mutexGive(timeMutex);
     }
     else {
-        ESP_LOGW(TAG, "Couldn't acquire time mutex!");
+        DLOGW(TAG, "Couldn't acquire time mutex!");
         return false;
     }
 
-    *time = esp_timer_get_time() / 1000 + localTimeOffset;
+    *time = hal_getTime() / 1000 + localTimeOffset;
     return true;
 }
 
 bool mount_setTime(uint64_t realTime) {
-    int64_t espTime = esp_timer_get_time() / 1000;
+    int64_t espTime = hal_getTime() / 1000;
     uint64_t localTimeOffset = realTime - espTime;
-    if (xSemaphoreTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY) == pdTRUE) {
+    if (hal_mutexTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY)) {
         settings.timeOffset = localTimeOffset;
-        xSemaphoreGive(timeMutex);
+        hal_mutexGive(timeMutex);
     }
     else {
-        ESP_LOGW(TAG, "Couldn't acquire time mutex!");
+        DLOGW(TAG, "Couldn't acquire time mutex!");
         return false;
     }
 
     return true;
 }
 
+bool mount_timeToEspTime(uint64_t time, int64_t *espTime) {
+    uint64_t localTimeOffset;
+
+    if (hal_mutexTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        localTimeOffset = settings.timeOffset;
+        hal_mutexGive(timeMutex);
+    }
+    else {
+        DLOGW(TAG, "Couldn't acquire time mutex!");
+        return false;
+    }
+
+    *espTime = (int64_t)(time - localTimeOffset) * 1000;
+    return true;
+}
+
+bool mount_getTrackTimeShift(int64_t *shift) {
+    if (hal_mutexTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        *shift = settings.trackTimeShift;
+        hal_mutexGive(timeMutex);
+        return true;
+    }
+    else {
+        DLOGW(TAG, "Couldn't acquire time mutex!");
+        return false;
+    }
+}
+
+bool mount_setTrackTimeShift(int64_t shift) {
+    if (hal_mutexTake(timeMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        settings.trackTimeShift = shift;
+        hal_mutexGive(timeMutex);
+        return true;
+    }
+    else {
+        DLOGW(TAG, "Couldn't acquire time mutex!");
+        return false;
+    }
+}
+
 bool mount_setPos(step_t ax1, step_t ax2) {
-    if (xSemaphoreTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY) == pdTRUE) {
+    if (hal_mutexTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY)) {
         settings.posAx1 = ax1;
         settings.posAx2 = ax2;
-        xSemaphoreGive(stateMtx);
+        hal_mutexGive(stateMtx);
         return true;
     }
     else {
-        ESP_LOGW(TAG, "Couldn't acquire pos mutex!");
+        DLOGW(TAG, "Couldn't acquire pos mutex!");
         return false;
     }
 
@@ -79,88 +198,280 @@ bool mount_setPos(step_t ax1, step_t ax2) {
 }
 
 bool mount_getPos(step_t *ax1, step_t *ax2) {
-    if (xSemaphoreTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY) == pdTRUE) {
+    if (hal_mutexTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY)) {
         *ax1 = settings.posAx1;
         *ax2 = settings.posAx2;
-        xSemaphoreGive(stateMtx);
+        hal_mutexGive(stateMtx);
         return true;
     }
     else {
-        ESP_LOGW(TAG, "Couldn't acquire pos mutex!");
+        DLOGW(TAG, "Couldn't acquire pos mutex!");
         return false;
     }
 
     return true;
 }
 
+/**
+ * @brief Clears the track buffer, including the prefetch window if the buffer is active. Expects tbMutex to be taken.
+ * 
+ */
+void clearBuffer(TrackBuffer *tb) {
+    tb->mapped = NULL;
+    tb->mappedTimeShift = 0;
+    tb->size = TRACK_BUFFER_SIZE;
+    tb->tailIdx = 0;
+    tb->headIdx = 0;
+    if (tb == &trackBuffers[tbActive]) {
+        twTail = 0;
+        twCount = 0;
+    }
+}
+
+inline bool isMapped(const TrackBuffer *tb) {
+    return tb->mapped != NULL;
+}
+
+/**
+ * @brief Reads the point at the ring index
+ */
+inline TrackPoint bufferPoint(const TrackBuffer *tb, uint32_t idx) {
+    if (tb->mapped != NULL) {
+        TrackPoint tp = tb->mapped[idx];
+        tp.time += tb->mappedTimeShift;
+        return tp;
+    }
+    TrackPoint tp = { tb->points[idx].ax1, tb->points[idx].ax2, tb->points[idx].time };
+    return tp;
+}
+
+inline uint32_t bufferCount(const TrackBuffer *tb) {
+    return (tb->headIdx + tb->size - tb->tailIdx) % tb->size;
+}
+
+/**
+ * @brief Number of points the ring holds - one slot stays empty, to tell a full ring from an empty one
+ */
+inline uint32_t bufferCapacity(const TrackBuffer *tb) {
+    return tb->size - 1;
+}
+
+/**
+ * @brief Makes the staging buffer active. The previously active buffer is cleared. Expects tbMutex to be taken.
+ * 
+ */
+void swapBuffers() {
+    clearBuffer(&trackBuffers[tbActive]);
+    tbActive = tbStaging;
+    tbSwapPending = false;
+    DLOGD(TAG, "Switched to track buffer %hhu", tbActive);
+}
+
 uint8_t mount_pushTrackPoint(TrackPoint tp) {
-    if (xSemaphoreTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY) == pdTRUE) {
-        if (tbTailIdx == tbHeadIdx + 1 || (tbTailIdx == 0 && tbHeadIdx == TRACK_BUFFER_SIZE - 1)) {
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        TrackBuffer *tb = &trackBuffers[tbStaging];
+        if (isMapped(tb) || bufferCount(tb) >= bufferCapacity(tb)) {
+            hal_mutexGive(tbMutex);
             return MOUNT_BUFFER_FULL;
         }
+        if (tp.ax1 < INT32_MIN || tp.ax1 > INT32_MAX || tp.ax2 < INT32_MIN || tp.ax2 > INT32_MAX) {
+            hal_mutexGive(tbMutex);
+            return MOUNT_BUFFER_RANGE;
+        }
 
-        trackBuffer[tbHeadIdx] = tp;
-        tbHeadIdx++;
-        if (tbHeadIdx == TRACK_BUFFER_SIZE)
-            tbHeadIdx = 0;
-        xSemaphoreGive(tbMutex);
+        StoredTrackPoint *stored = &tb->points[tb->headIdx];
+        stored->ax1 = tp.ax1;
+        stored->ax2 = tp.ax2;
+        stored->time = tp.time;
+        tb->headIdx++;
+        if (tb->headIdx == tb->size)
+            tb->headIdx = 0;
+        hal_mutexGive(tbMutex);
         return MOUNT_BUFFER_OK;
     }
     return MOUNT_MTX_ACQ_FAIL;
 }
 
 bool mount_pullTrackPoint(TrackPoint *trackPoint) {
-    if (xSemaphoreTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY) == pdTRUE) {
-        if (tbTailIdx != tbHeadIdx) {
-            *trackPoint = trackBuffer[tbTailIdx];
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        TrackBuffer *tb = &trackBuffers[tbActive];
+        if (twCount == 0 && tb->tailIdx == tb->headIdx && tbSwapPending && tbSwapTime == MOUNT_TRACK_SWAP_ON_COMPLETION) {
+            swapBuffers();
+            tb = &trackBuffers[tbActive];
+        }
+
+        if (twCount > 0) {
+            *trackPoint = trackWindow[twTail];
+            twTail = (twTail + 1) % TRACK_WINDOW_SIZE;
+            twCount--;
+            hal_mutexGive(tbMutex);
+            return true;
+        }
+        if (tb->tailIdx != tb->headIdx) {
+            // The window ran dry, read the buffer directly
+            twMisses++;
+            *trackPoint = bufferPoint(tb, tb->tailIdx);
             
-            if (++tbTailIdx == TRACK_BUFFER_SIZE)
-                tbTailIdx = 0;
-            xSemaphoreGive(tbMutex);
+            if (++tb->tailIdx == tb->size)
+                tb->tailIdx = 0;
+            hal_mutexGive(tbMutex);
             return true;
         }
         
-        xSemaphoreGive(tbMutex);
+        hal_mutexGive(tbMutex);
         return false;
     }
     else
         return false;
 }
 
+bool mount_peekTrackPoint(uint32_t offset, TrackPoint *trackPoint) {
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        TrackBuffer *tb = &trackBuffers[tbActive];
+        bool found = true;
+        if (offset < twCount)
+            *trackPoint = trackWindow[(twTail + offset) % TRACK_WINDOW_SIZE];
+        else if (offset - twCount < bufferCount(tb))
+            *trackPoint = bufferPoint(tb, (tb->tailIdx + offset - twCount) % tb->size);
+        else
+            found = false;
+
+        hal_mutexGive(tbMutex);
+        return found;
+    }
+    return false;
+}
+
+uint32_t mount_prefetchTrackPoints() {
+    uint32_t moved = 0;
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        TrackBuffer *tb = &trackBuffers[tbActive];
+        while (moved < TRACK_PREFETCH_CHUNK && twCount < TRACK_WINDOW_SIZE && tb->tailIdx != tb->headIdx) {
+            trackWindow[(twTail + twCount) % TRACK_WINDOW_SIZE] = bufferPoint(tb, tb->tailIdx);
+            twCount++;
+            if (++tb->tailIdx == tb->size)
+                tb->tailIdx = 0;
+            moved++;
+        }
+        hal_mutexGive(tbMutex);
+    }
+    return moved;
+}
+
+uint32_t mount_getTrackWindowMisses() {
+    return twMisses;
+}
+
 uint32_t mount_getTrackBufferSize() {
-    return TRACK_BUFFER_SIZE;
+    return TRACK_BUFFER_SIZE - 1;
 }
 
 uint32_t mount_getTrackBufferFreeSpace() {
-    xSemaphoreTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY);
-    uint32_t result;
-    if (tbTailIdx <= tbHeadIdx)
-        result = TRACK_BUFFER_SIZE - tbHeadIdx + tbTailIdx;
-    else 
-        result = tbTailIdx - tbHeadIdx;
+    if (!hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        DLOGW(TAG, "Couldn't acquire track buffer mutex!");
+        return 0;
+    }
+    TrackBuffer *tb = &trackBuffers[tbStaging];
+    uint32_t result = isMapped(tb) ? 0 : bufferCapacity(tb) - bufferCount(tb);
     
-    xSemaphoreGive(tbMutex);
+    hal_mutexGive(tbMutex);
     return result;
 }
 
+bool mount_getTrackBufferLevel(uint32_t *count, uint64_t *lastTime) {
+    if (!hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY))
+        return false;
+    TrackBuffer *tb = &trackBuffers[tbActive];
+    uint32_t buffered = bufferCount(tb);
+    *count = twCount + buffered;
+    if (buffered > 0)
+        *lastTime = bufferPoint(tb, (tb->headIdx + tb->size - 1) % tb->size).time;
+    else if (twCount > 0)
+        *lastTime = trackWindow[(twTail + twCount - 1) % TRACK_WINDOW_SIZE].time;
+    else
+        *lastTime = 0;
+    hal_mutexGive(tbMutex);
+    return true;
+}
+
 void mount_clearTrackBuffer() {
-    xSemaphoreTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY);
-    tbTailIdx = 0;
-    tbHeadIdx = 0;
-    xSemaphoreGive(tbMutex);
+    hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY);
+    clearBuffer(&trackBuffers[tbStaging]);
+    if (tbStaging != tbActive)
+        tbSwapPending = false;
+    hal_mutexGive(tbMutex);
+}
+
+bool mount_mapTrackBuffer(const TrackPoint *points, uint32_t count, uint64_t startTime) {
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        TrackBuffer *tb = &trackBuffers[tbStaging];
+        clearBuffer(tb);
+        tb->mapped = points;
+        if (startTime != 0 && count > 0)
+            tb->mappedTimeShift = (int64_t)(startTime - points[0].time);
+        tb->size = count + 1;
+        tb->headIdx = count;
+        hal_mutexGive(tbMutex);
+        return true;
+    }
+    return false;
+}
+
+void mount_releaseMappedTrackBuffers() {
+    hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY);
+    for (int i = 0; i < TRACK_BUFFER_COUNT; i++) {
+        if (isMapped(&trackBuffers[i]))
+            clearBuffer(&trackBuffers[i]);
+    }
+    hal_mutexGive(tbMutex);
+}
+
+uint8_t mount_prepareNextTrackBuffer() {
+    hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY);
+    tbStaging = (tbActive + 1) % TRACK_BUFFER_COUNT;
+    clearBuffer(&trackBuffers[tbStaging]);
+    tbSwapPending = false;
+    uint8_t staging = tbStaging;
+    hal_mutexGive(tbMutex);
+    return staging;
+}
+
+bool mount_scheduleTrackBufferSwap(uint64_t time) {
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        bool prepared = tbStaging != tbActive;
+        if (prepared) {
+            tbSwapTime = time;
+            tbSwapPending = true;
+        }
+        hal_mutexGive(tbMutex);
+        return prepared;
+    }
+    return false;
+}
+
+bool mount_updateTrackBufferSwap(uint64_t time) {
+    bool swapped = false;
+    if (hal_mutexTake(tbMutex, MAX_TIME_SEMAPHORE_DELAY)) {
+        if (tbSwapPending && tbSwapTime != MOUNT_TRACK_SWAP_ON_COMPLETION && tbSwapTime <= time) {
+            swapBuffers();
+            swapped = true;
+        }
+        hal_mutexGive(tbMutex);
+    }
+    return swapped;
 }
 
 MountStatus mount_getStatus() {
-    xSemaphoreTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY);
+    hal_mutexTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY);
     MountStatus status = settings.status;
-    xSemaphoreGive(stateMtx);
+    hal_mutexGive(stateMtx);
     return status;
 }
 
 void mount_setState(MountStatus status, step_t posAx1, step_t posAx2) {
-    xSemaphoreTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY); // TODO: fix these mutexes to operate differently when the acqusition fails.
+    hal_mutexTake(stateMtx, MAX_TIME_SEMAPHORE_DELAY); // TODO: fix these mutexes to operate differently when the acqusition fails.
     settings.status = status;
     settings.posAx1 = posAx1;
     settings.posAx2 = posAx2;
-    xSemaphoreGive(stateMtx);
+    hal_mutexGive(stateMtx);
 }
\ No newline at end of file
@@ -8,12 +8,27 @@
 #define MOUNT_BUFFER_OK 0
 #define MOUNT_BUFFER_FULL 1
 #define MOUNT_MTX_ACQ_FAIL 2
+/**
+ * @brief The point's position doesn't fit into the track store (32 bits per axis)
+ */
+#define MOUNT_BUFFER_RANGE 3
+
+/**
+ * @brief Swap time meaning the track buffers should be swapped once the active one runs out of points.
+ */
+#define MOUNT_TRACK_SWAP_ON_COMPLETION 0
 
 typedef enum MountStatus {
     MOUNT_STATUS_STOPPED,
     MOUNT_STATUS_GOTO,
     MOUNT_STATUS_TRACKING,
-    MOUNT_STATUS_BRAKING
+    MOUNT_STATUS_BRAKING,
+    MOUNT_STATUS_ARMED,
+    MOUNT_STATUS_VELOCITY,
+    /**
+     * @brief Stopped by the emergency stop or limit switch input, until the fault is cleared (motor_clearFault)
+     */
+    MOUNT_STATUS_FAULT
 } MountStatus;
 
 typedef struct TrackPoint {
@@ -26,16 +41,119 @@ void mount_initSettings();
 
 bool mount_getTime(uint64_t *time);
 bool mount_setTime(uint64_t time);
+/**
+ * @brief Converts mount time to the ESP timer time, without rounding to milliseconds.
+ * 
+ * @param time Mount time (milliseconds)
+ * @param espTime ESP timer time (microseconds) corresponding to `time`
+ * @return true Success
+ * @return false Couldn't acquire time mutex
+ */
+bool mount_timeToEspTime(uint64_t time, int64_t *espTime);
+/**
+ * @brief Time shift of the tracked trajectory (in milliseconds), published by the motor task. Track point with time T
+ * is reached at mount time T + shift.
+ * 
+ * @param shift The time shift is written here
+ * @return true Success
+ * @return false Couldn't acquire time mutex
+ */
+bool mount_getTrackTimeShift(int64_t *shift);
+bool mount_setTrackTimeShift(int64_t shift);
 
 bool mount_getPos(step_t* ax1, step_t *ax2);
 bool mount_setPos(step_t ax1, step_t ax2);
 
 uint8_t mount_pushTrackPoint(TrackPoint trackPoint);
 bool mount_pullTrackPoint(TrackPoint *trackPoint);
+/**
+ * @brief Reads a point from the active track buffer without removing it.
+ * 
+ * @param offset Position of the point in the buffer, 0 is the point `mount_pullTrackPoint` would return next
+ * @param trackPoint The point is written here
+ * @return true Success
+ * @return false The buffer doesn't contain that many points, or the mutex couldn't be acquired
+ */
+bool mount_peekTrackPoint(uint32_t offset, TrackPoint *trackPoint);
+/**
+ * @brief Moves the next points of the active track buffer to the prefetch window in internal DRAM, from which 
+ * `mount_pullTrackPoint` and `mount_peekTrackPoint` read. Called periodically by the communication task, 
+ * so the tracking doesn't read the track buffers (possibly in the external RAM) itself.
+ * 
+ * @return uint32_t Number of points moved
+ */
+uint32_t mount_prefetchTrackPoints();
+/**
+ * @brief Returns number of points pulled while the prefetch window was empty (read from the track buffer directly)
+ * 
+ */
+uint32_t mount_getTrackWindowMisses();
+/**
+ * @brief Returns the number of points a track buffer holds
+ * 
+ */
 uint32_t mount_getTrackBufferSize();
+/**
+ * @brief Returns the number of points `mount_pushTrackPoint` accepts before the buffer is full
+ * 
+ * @return uint32_t Free space, 0 if the mutex couldn't be acquired
+ */
 uint32_t mount_getTrackBufferFreeSpace();
+/**
+ * @brief Returns the points left for the tracking - in the prefetch window and the active track buffer
+ * 
+ * @param count Number of points left
+ * @param lastTime Time of the last one, 0 if there are none
+ * @return true Success
+ * @return false The mutex couldn't be acquired
+ */
+bool mount_getTrackBufferLevel(uint32_t *count, uint64_t *lastTime);
 void mount_clearTrackBuffer();
 
+/**
+ * @brief Selects the inactive track buffer as the target of `mount_pushTrackPoint`, and clears it.
+ * 
+ * The active buffer keeps being used by the tracking until the swap scheduled by `mount_scheduleTrackBufferSwap`.
+ * Free space, size and clear then also refer to the prepared buffer.
+ * 
+ * @return uint8_t Index of the prepared buffer
+ */
+uint8_t mount_prepareNextTrackBuffer();
+/**
+ * @brief Maps the staging track buffer (the target of `mount_pushTrackPoint`) to read only points, typically
+ * a trajectory in the memory mapped flash (see trajlib). The points are tracked from there, without copying.
+ * Pushing to the buffer fails until it is cleared.
+ * 
+ * @param points Points, must stay valid until the buffer is cleared
+ * @param count Number of points
+ * @param startTime Mount time the first point is moved to, the others keep their spacing. 0 keeps the stored times.
+ * @return true Mapped
+ * @return false The mutex couldn't be acquired
+ */
+bool mount_mapTrackBuffer(const TrackPoint *points, uint32_t count, uint64_t startTime);
+/**
+ * @brief Clears all track buffers mapped by `mount_mapTrackBuffer`. Needed before the mapped points are overwritten.
+ * 
+ */
+void mount_releaseMappedTrackBuffers();
+/**
+ * @brief Schedules the handover from the active track buffer to the prepared one.
+ * 
+ * @param time Mount time of the swap, or MOUNT_TRACK_SWAP_ON_COMPLETION to swap when the active buffer runs out.
+ * @return true Swap scheduled
+ * @return false No buffer was prepared by `mount_prepareNextTrackBuffer`, or the mutex couldn't be acquired
+ */
+bool mount_scheduleTrackBufferSwap(uint64_t time);
+/**
+ * @brief Performs the scheduled timed buffer swap if its time has come. Called periodically by the motor task, whether
+ * tracking or not, before pulling points.
+ * 
+ * @param time Current mount time
+ * @return true The buffers were swapped, following points come from the new buffer
+ * @return false No swap happened
+ */
+bool mount_updateTrackBufferSwap(uint64_t time);
+
 MountStatus mount_getStatus();
 void mount_setState(MountStatus status, step_t posAx1, step_t posAx2);
 #endif
\ No newline at end of file
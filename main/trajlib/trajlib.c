@@ -0,0 +1,160 @@
+#include "trajlib.h"
+#include <string.h>
+#include "../hal/hal.h"
+#include "../log/dlog.h"
+
+#define TAG "trajlib"
+#define TRAJLIB_DIR_SIZE HAL_FLASH_SECTOR_SIZE
+#define TRAJLIB_MAX_ENTRIES (TRAJLIB_DIR_SIZE / sizeof(trajlib_entry_t))
+
+_Static_assert(sizeof(trajlib_entry_t) == 32, "Directory entries must keep their flash layout");
+_Static_assert(HAL_FLASH_SECTOR_SIZE % 8 == 0, "Trajectories must start aligned for the mapped TrackPoint access");
+
+hal_partition_t tlPartition = NULL;
+const uint8_t *tlMapped = NULL;
+uint32_t tlPartitionSize = 0;
+uint32_t tlEntryCount = 0;
+/**
+ * @brief Start of the free space (bytes, sector aligned)
+ */
+uint32_t tlFreeOffset = TRAJLIB_DIR_SIZE;
+
+bool tlWriting = false;
+trajlib_entry_t tlWriteEntry;
+/**
+ * @brief End of the area erased for the trajectory being written
+ */
+uint32_t tlErasedEnd;
+
+inline const trajlib_entry_t *entryAt(uint32_t idx) {
+    return (const trajlib_entry_t*)tlMapped + idx;
+}
+
+inline uint32_t alignToSector(uint32_t offset) {
+    return (offset + HAL_FLASH_SECTOR_SIZE - 1) / HAL_FLASH_SECTOR_SIZE * HAL_FLASH_SECTOR_SIZE;
+}
+
+bool trajlib_init() {
+    tlPartition = hal_partitionFind(TRAJLIB_PARTITION);
+    if (tlPartition == NULL) {
+        DLOGW(TAG, "No trajectory library partition");
+        return false;
+    }
+    tlMapped = hal_partitionMap(tlPartition);
+    if (tlMapped == NULL) {
+        DLOGE(TAG, "Couldn't map the trajectory library");
+        tlPartition = NULL;
+        return false;
+    }
+    tlPartitionSize = hal_partitionSize(tlPartition);
+
+    tlEntryCount = 0;
+    tlFreeOffset = TRAJLIB_DIR_SIZE;
+    while (tlEntryCount < TRAJLIB_MAX_ENTRIES && entryAt(tlEntryCount)->magic == TRAJLIB_MAGIC) {
+        const trajlib_entry_t *entry = entryAt(tlEntryCount);
+        uint32_t end = alignToSector(entry->offset + entry->count * sizeof(TrackPoint));
+        if (end > tlFreeOffset)
+            tlFreeOffset = end;
+        tlEntryCount++;
+    }
+    DLOGI(TAG, "Trajectory library: %u trajectories, %u free points", tlEntryCount, trajlib_getFreePoints());
+    return true;
+}
+
+uint8_t trajlib_begin(const char *name) {
+    if (tlPartition == NULL)
+        return TRAJLIB_ERR_NO_PARTITION;
+    uint32_t count;
+    if (trajlib_find(name, &count) != NULL)
+        return TRAJLIB_ERR_EXISTS;
+    if (tlEntryCount == TRAJLIB_MAX_ENTRIES || tlFreeOffset >= tlPartitionSize)
+        return TRAJLIB_ERR_FULL;
+
+    memset(&tlWriteEntry, 0xff, sizeof(tlWriteEntry));
+    tlWriteEntry.magic = TRAJLIB_MAGIC;
+    memset(tlWriteEntry.name, 0, TRAJLIB_NAME_LENGTH);
+    strncpy(tlWriteEntry.name, name, TRAJLIB_NAME_LENGTH - 1);
+    tlWriteEntry.offset = tlFreeOffset;
+    tlWriteEntry.count = 0;
+    tlErasedEnd = tlFreeOffset;
+    tlWriting = true;
+    return TRAJLIB_OK;
+}
+
+uint8_t trajlib_append(TrackPoint point) {
+    if (!tlWriting)
+        return TRAJLIB_ERR_NOT_WRITING;
+
+    uint32_t offset = tlWriteEntry.offset + tlWriteEntry.count * sizeof(TrackPoint);
+    if (offset + sizeof(TrackPoint) > tlPartitionSize)
+        return TRAJLIB_ERR_FULL;
+    while (tlErasedEnd < offset + sizeof(TrackPoint)) {
+        if (!hal_partitionErase(tlPartition, tlErasedEnd, HAL_FLASH_SECTOR_SIZE))
+            return TRAJLIB_ERR_FLASH;
+        tlErasedEnd += HAL_FLASH_SECTOR_SIZE;
+    }
+    if (!hal_partitionWrite(tlPartition, offset, &point, sizeof(TrackPoint)))
+        return TRAJLIB_ERR_FLASH;
+
+    tlWriteEntry.count++;
+    return TRAJLIB_OK;
+}
+
+uint8_t trajlib_end(uint32_t *count) {
+    if (!tlWriting)
+        return TRAJLIB_ERR_NOT_WRITING;
+    if (tlWriteEntry.count == 0)
+        return TRAJLIB_ERR_EMPTY;
+
+    tlWriting = false;
+    if (!hal_partitionWrite(tlPartition, tlEntryCount * sizeof(trajlib_entry_t), &tlWriteEntry, sizeof(trajlib_entry_t)))
+        return TRAJLIB_ERR_FLASH;
+
+    tlEntryCount++;
+    tlFreeOffset = alignToSector(tlWriteEntry.offset + tlWriteEntry.count * sizeof(TrackPoint));
+    *count = tlWriteEntry.count;
+    // The name is in the mapped flash, erased by trajlib_clear, and dlog keeps only the pointer
+    DLOGI(TAG, "Stored trajectory %u (%u points)", tlEntryCount - 1, tlWriteEntry.count);
+    return TRAJLIB_OK;
+}
+
+uint8_t trajlib_clear() {
+    if (tlPartition == NULL)
+        return TRAJLIB_ERR_NO_PARTITION;
+
+    tlWriting = false;
+    if (!hal_partitionErase(tlPartition, 0, TRAJLIB_DIR_SIZE))
+        return TRAJLIB_ERR_FLASH;
+    tlEntryCount = 0;
+    tlFreeOffset = TRAJLIB_DIR_SIZE;
+    DLOGI(TAG, "Trajectory library cleared");
+    return TRAJLIB_OK;
+}
+
+uint32_t trajlib_getCount() {
+    return tlEntryCount;
+}
+
+bool trajlib_getEntry(uint32_t idx, trajlib_entry_t *entry) {
+    if (idx >= tlEntryCount)
+        return false;
+    *entry = *entryAt(idx);
+    return true;
+}
+
+uint32_t trajlib_getFreePoints() {
+    if (tlPartition == NULL || tlFreeOffset >= tlPartitionSize)
+        return 0;
+    return (tlPartitionSize - tlFreeOffset) / sizeof(TrackPoint);
+}
+
+const TrackPoint *trajlib_find(const char *name, uint32_t *count) {
+    for (uint32_t i = 0; i < tlEntryCount; i++) {
+        const trajlib_entry_t *entry = entryAt(i);
+        if (strncmp(entry->name, name, TRAJLIB_NAME_LENGTH) == 0) {
+            *count = entry->count;
+            return (const TrackPoint*)(tlMapped + entry->offset);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,123 @@
+#ifndef __MOUNT_TRAJLIB
+#define __MOUNT_TRAJLIB
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../settings.h"
+
+/**
+ * @brief Trajectory library. Named trajectories are written once to the `trajlib` flash partition and replayed
+ * from there - the partition is memory mapped, so the tracking reads the points straight from the flash
+ * (see mount_mapTrackBuffer), without uploading or copying them.
+ *
+ * Layout of the partition: the first sector holds the directory (an array of trajlib_entry_t, ended by the first
+ * erased entry), the trajectories follow, each starting at a sector boundary. An entry is written only after all
+ * points of its trajectory, so an interrupted upload leaves no trace. Trajectories can't be deleted one by one,
+ * only the whole library is cleared.
+ *
+ * The functions are not thread safe, they are meant to be called from the communication task only. Writing stalls
+ * the flash cache of both cores, so it must not be done while the mount moves.
+ */
+
+#define TRAJLIB_PARTITION "trajlib"
+/**
+ * @brief Maximum length of a trajectory name, including the terminating 0
+ */
+#define TRAJLIB_NAME_LENGTH 16
+#define TRAJLIB_MAGIC 0x4a415254 // "TRAJ"
+
+#define TRAJLIB_OK 0
+#define TRAJLIB_ERR_NO_PARTITION 1
+#define TRAJLIB_ERR_EXISTS 2
+#define TRAJLIB_ERR_FULL 3
+#define TRAJLIB_ERR_NOT_WRITING 4
+#define TRAJLIB_ERR_EMPTY 5
+#define TRAJLIB_ERR_FLASH 6
+
+/**
+ * @brief Directory entry of a stored trajectory
+ *
+ */
+typedef struct TrajlibEntry {
+    /**
+     * @brief TRAJLIB_MAGIC for valid entries, erased flash (0xffffffff) after the last one
+     *
+     */
+    uint32_t magic;
+    char name[TRAJLIB_NAME_LENGTH];
+    /**
+     * @brief Offset of the first point from the partition start (bytes)
+     *
+     */
+    uint32_t offset;
+    /**
+     * @brief Number of points
+     *
+     */
+    uint32_t count;
+    uint32_t reserved;
+} trajlib_entry_t;
+
+/**
+ * @brief Finds and maps the partition and reads the directory
+ *
+ * @return true Library available
+ * @return false There is no trajectory library partition
+ */
+bool trajlib_init();
+/**
+ * @brief Starts writing a new trajectory. A previous unfinished trajectory is discarded.
+ *
+ * @param name Name of the trajectory, shorter than TRAJLIB_NAME_LENGTH
+ * @return uint8_t TRAJLIB_OK or TRAJLIB_ERR_* code
+ */
+uint8_t trajlib_begin(const char *name);
+/**
+ * @brief Appends a point to the trajectory being written
+ *
+ * @return uint8_t TRAJLIB_OK or TRAJLIB_ERR_* code
+ */
+uint8_t trajlib_append(TrackPoint point);
+/**
+ * @brief Finishes the trajectory being written, making it available for replay
+ *
+ * @param count Number of points of the trajectory is written here
+ * @return uint8_t TRAJLIB_OK or TRAJLIB_ERR_* code
+ */
+uint8_t trajlib_end(uint32_t *count);
+/**
+ * @brief Removes all trajectories. Any track buffer mapped to the library must be released first
+ * (mount_releaseMappedTrackBuffers).
+ *
+ * @return uint8_t TRAJLIB_OK or TRAJLIB_ERR_* code
+ */
+uint8_t trajlib_clear();
+/**
+ * @brief Returns number of stored trajectories
+ *
+ */
+uint32_t trajlib_getCount();
+/**
+ * @brief Reads the directory entry of a stored trajectory
+ *
+ * @param idx Index of the trajectory, less than trajlib_getCount()
+ * @param entry The entry is written here
+ * @return true Success
+ * @return false No such trajectory
+ */
+bool trajlib_getEntry(uint32_t idx, trajlib_entry_t *entry);
+/**
+ * @brief Returns number of points that can still be stored (in one trajectory)
+ *
+ */
+uint32_t trajlib_getFreePoints();
+/**
+ * @brief Finds a stored trajectory
+ *
+ * @param name Trajectory name
+ * @param count Number of points is written here
+ * @return const TrackPoint* Points of the trajectory, in the memory mapped flash. NULL if not found.
+ */
+const TrackPoint *trajlib_find(const char *name, uint32_t *count);
+
+#endif
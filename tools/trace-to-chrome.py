@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Converts the motion trace of the mount to the Chrome trace format (chrome://tracing, ui.perfetto.dev).
+
+The trace is either read from the mount (--port, needs pyserial), or from a file with the raw dump -
+lines "+gtre <seq> <time> <type> <axis> <a0> <a1> <a2> <a3>" as sent in response to "+gtr".
+
+    tools/trace-to-chrome.py --port /dev/ttyUSB0 -o pass.json
+    tools/trace-to-chrome.py dump.txt -o pass.json
+"""
+import argparse
+import json
+import sys
+
+MODES = ["STOP", "TRACKING", "GOTO", "BRAKING", "INTERCEPT", "VELOCITY"]
+COMMANDS = ["POSITION_UPDATE", "GOTO", "STOP", "TRACK_BEGIN", "TRACK_STOP", "TRACK_BEGIN_AT",
+            "TRACK_OFFSET", "TRACK_RATE_OFFSET", "TRACK_TIME_SHIFT", "RESET_STATS", "CONFIG_UPDATE", "FAULT_CLEAR"]
+
+TRACE_MODE = 0
+TRACE_SEGMENT = 1
+TRACE_POINT_PULL = 2
+TRACE_UNDERRUN = 3
+TRACE_MULTIPLIER = 4
+TRACE_COMMAND = 5
+TRACE_JOG = 6
+TRACE_INTERCEPT = 7
+TRACE_DRIVER = 8
+TRACE_BRAKING = 9
+TRACE_FAULT = 10
+DRIVER_FLAGS = ["stall", "overtemperature", "short to ground"]
+
+TID_MOUNT = 0
+TID_SEGMENTS = 10
+DUMP_CHUNK = 64
+
+
+def parse_event(line):
+    parts = line.split()
+    if len(parts) != 9 or parts[0] != "+gtre":
+        return None
+    seq, time, etype, axis, a0, a1, a2, a3 = (int(p) for p in parts[1:])
+    return {"seq": seq, "time": time, "type": etype, "axis": axis, "args": [a0, a1, a2, a3]}
+
+
+def read_port(port, baud):
+    import serial
+
+    events = []
+    seq = 0
+    with serial.Serial(port, baud, timeout=2) as ser:
+        while True:
+            ser.write(f"+gtr {seq} {DUMP_CHUNK}\n".encode())
+            while True:
+                line = ser.readline().decode(errors="replace").strip()
+                if not line:
+                    raise RuntimeError("Mount didn't respond to the trace dump command")
+                if line.startswith("+gtre "):
+                    events.append(parse_event(line))
+                elif line.startswith("+gtr "):
+                    _, next_seq, count = line.split()
+                    seq = int(next_seq)
+                    break
+            if int(count) == 0:
+                return events
+
+
+def read_file(path):
+    with open(path) if path != "-" else sys.stdin as f:
+        return [e for e in (parse_event(line) for line in f) if e is not None]
+
+
+def name_of(names, idx):
+    return names[idx] if 0 <= idx < len(names) else str(idx)
+
+
+def convert(events):
+    events = sorted({e["seq"]: e for e in events}.values(), key=lambda e: e["seq"])
+    out = [
+        {"ph": "M", "pid": 1, "name": "process_name", "args": {"name": "esp-mount"}},
+        {"ph": "M", "pid": 1, "tid": TID_MOUNT, "name": "thread_name", "args": {"name": "Mount"}},
+    ]
+    for axis in (1, 2):
+        out.append({"ph": "M", "pid": 1, "tid": axis, "name": "thread_name", "args": {"name": f"Axis {axis} mode"}})
+        out.append({"ph": "M", "pid": 1, "tid": TID_SEGMENTS + axis, "name": "thread_name",
+                    "args": {"name": f"Axis {axis} segments"}})
+
+    if not events:
+        return out
+    end_time = events[-1]["time"]
+    mode_start = {}
+    prev_seq = None
+
+    for e in events:
+        t = e["time"]
+        axis = e["axis"]
+        a = e["args"]
+        if prev_seq is not None and e["seq"] != prev_seq + 1:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MOUNT, "ts": t, "s": "g",
+                        "name": f"trace gap ({e['seq'] - prev_seq - 1} events lost)"})
+        prev_seq = e["seq"]
+
+        if e["type"] == TRACE_MODE:
+            start = mode_start.get(axis)
+            if start is not None:
+                out.append({"ph": "X", "pid": 1, "tid": axis, "ts": start[0], "dur": t - start[0],
+                            "name": name_of(MODES, start[1])})
+            mode_start[axis] = (t, a[1])
+        elif e["type"] == TRACE_SEGMENT:
+            out.append({"ph": "X", "pid": 1, "tid": TID_SEGMENTS + axis, "ts": t + a[2], "dur": a[3] - a[2],
+                        "name": "segment", "args": {"startPos": a[0], "targetPos": a[1]}})
+        elif e["type"] == TRACE_INTERCEPT:
+            out.append({"ph": "X", "pid": 1, "tid": TID_SEGMENTS + axis, "ts": t, "dur": a[1],
+                        "name": "intercept", "args": {"targetPos": a[0], "joinIn": a[2]}})
+        elif e["type"] == TRACE_BRAKING:
+            out.append({"ph": "X", "pid": 1, "tid": TID_SEGMENTS + axis, "ts": t, "dur": a[2],
+                        "name": "braking", "args": {"v": a[0], "stopPos": a[1]}})
+        elif e["type"] == TRACE_MULTIPLIER:
+            out.append({"ph": "C", "pid": 1, "ts": t, "name": f"multiplier axis {axis}", "args": {"index": a[1]}})
+        elif e["type"] == TRACE_POINT_PULL:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MOUNT, "ts": t, "s": "t", "name": "point pull",
+                        "args": {"ax1": a[0], "ax2": a[1], "dueIn": a[2]}})
+        elif e["type"] == TRACE_UNDERRUN:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MOUNT, "ts": t, "s": "g", "name": "track buffer underrun"})
+        elif e["type"] == TRACE_COMMAND:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MOUNT, "ts": t, "s": "t",
+                        "name": "cmd " + name_of(COMMANDS, a[0]), "args": {"ax1": a[1], "ax2": a[2]}})
+        elif e["type"] == TRACE_JOG:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MOUNT, "ts": t, "s": "t", "name": "jog",
+                        "args": {"v1": a[0], "v2": a[1]}})
+        elif e["type"] == TRACE_FAULT:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MOUNT, "ts": t, "s": "g", "name": "fault",
+                        "args": {"inputs": a[0], "ax1": a[1], "ax2": a[2]}})
+        elif e["type"] == TRACE_DRIVER:
+            flags = [name for bit, name in enumerate(DRIVER_FLAGS) if a[1] & (1 << bit)]
+            out.append({"ph": "i", "pid": 1, "tid": axis, "ts": t, "s": "t", "name": "driver " + ", ".join(flags),
+                        "args": {"sgResult": a[0], "pos": a[2]}})
+
+    for axis, (start, mode) in mode_start.items():
+        out.append({"ph": "X", "pid": 1, "tid": axis, "ts": start, "dur": end_time - start, "name": name_of(MODES, mode)})
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", nargs="?", help="File with the raw trace dump ('-' for stdin)")
+    parser.add_argument("--port", help="Read the trace from the mount on this serial port")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("-o", "--output", default="-", help="Output file (default stdout)")
+    args = parser.parse_args()
+
+    if args.port:
+        events = read_port(args.port, args.baud)
+    elif args.dump:
+        events = read_file(args.dump)
+    else:
+        parser.error("Either a dump file or --port is required")
+
+    trace = {"traceEvents": convert(events), "displayTimeUnit": "ms"}
+    if args.output == "-":
+        json.dump(trace, sys.stdout)
+    else:
+        with open(args.output, "w") as f:
+            json.dump(trace, f)
+
+
+if __name__ == "__main__":
+    main()